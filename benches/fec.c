@@ -0,0 +1,163 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+/*
+ * Times the GF(256) arithmetic under the erasure code, and encoding and
+ * decoding messages of the sizes multipart sends: a few parts with a
+ * little parity, up to the widest with the most.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "fec.h"
+#include "gf256.h"
+
+#define LENGTH 258 /* a part of the widest frame and its length */
+#define MUL_ADD_BYTES (64 * 1024 * 1024)
+
+static uint8_t shards[FEC_MAX_SHARDS][LENGTH];
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+bench_field(void)
+{
+	static uint8_t dest[4096], src[4096];
+	unsigned int i, n = MUL_ADD_BYTES / sizeof dest;
+	volatile uint8_t sink = 0;
+	uint64_t start, ns;
+
+	for (i = 0; i < sizeof src; ++i)
+		src[i] = rand();
+
+	start = now_ns();
+	for (i = 0; i < 16 * 1024 * 1024; ++i)
+		sink ^= gf256_mul(i, i >> 8);
+	ns = now_ns() - start;
+	printf("gf256_mul       %8.2f ns each\n", ns / (16.0 * 1024 * 1024));
+
+	start = now_ns();
+	for (i = 1; i < 16 * 1024 * 1024; ++i)
+		sink ^= gf256_inv(i | 1);
+	ns = now_ns() - start;
+	printf("gf256_inv       %8.2f ns each\n", ns / (16.0 * 1024 * 1024));
+
+	start = now_ns();
+	for (i = 0; i < n; ++i)
+		gf256_mul_add(dest, src, i | 2, sizeof dest);
+	ns = now_ns() - start;
+	printf("gf256_mul_add   %8.1f MB/s\n", MUL_ADD_BYTES * 1e3 / ns);
+
+	(void) sink;
+}
+
+static void
+bench_code(unsigned int n_data, unsigned int n_parity)
+{
+	uint8_t *data[FEC_MAX_SHARDS], *parity[FEC_MAX_SHARDS];
+	const uint8_t *kept[FEC_MAX_SHARDS];
+	unsigned int parity_index[FEC_MAX_SHARDS], rounds, i, r;
+	int present[FEC_MAX_SHARDS];
+	uint64_t start, encode_ns, decode_ns = 0;
+
+	for (i = 0; i < n_data; ++i)
+	{
+		data[i] = shards[i];
+		memset(data[i], i, LENGTH);
+	}
+
+	for (i = 0; i < n_parity; ++i)
+		parity[i] = shards[n_data + i];
+
+	/* about as much work for each size */
+	rounds = 1 + 200000 / (n_data * n_parity);
+
+	start = now_ns();
+	for (r = 0; r < rounds; ++r)
+		fec_encode((const uint8_t * const *) data, n_data, parity,
+			n_parity, LENGTH);
+	encode_ns = now_ns() - start;
+
+	/* the worst case: as many data shards lost as there is parity */
+	for (i = 0; i < n_parity; ++i)
+	{
+		parity_index[i] = i;
+		kept[i] = parity[i];
+	}
+
+	for (r = 0; r < rounds; ++r)
+	{
+		for (i = 0; i < n_data; ++i)
+			present[i] = i >= n_parity;
+
+		start = now_ns();
+		if (fec_decode(data, present, n_data, kept, parity_index,
+				n_parity, LENGTH))
+		{
+			fprintf(stderr, "Failed to decode %u + %u\n", n_data,
+				n_parity);
+			exit(1);
+		}
+		decode_ns += now_ns() - start;
+	}
+
+	printf("%3u + %3u parts  encode %9.1f us  decode %9.1f us\n", n_data,
+		n_parity, encode_ns / 1e3 / rounds, decode_ns / 1e3 / rounds);
+}
+
+int
+main(void)
+{
+	static const unsigned int sizes[][2] = {
+		{ 4, 1 }, { 16, 2 }, { 32, 4 }, { 64, 8 }, { 128, 16 },
+		{ 240, 16 }, { 128, 128 }
+	};
+	unsigned int s;
+
+	srand(1);
+	gf256_init();
+	bench_field();
+
+	for (s = 0; s < sizeof sizes / sizeof sizes[0]; ++s)
+		bench_code(sizes[s][0], sizes[s][1]);
+
+	return 0;
+}
@@ -0,0 +1,199 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+/*
+ * Times a keyring of a million identities: building it, saving it in the
+ * indexed format, mapping it back, and looking call signs up in the
+ * mapping, both ones it has and ones it does not.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "keyring.h"
+
+#define DEFAULT_COUNT 1000000
+
+static uint64_t
+now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+report(const char *what, uint64_t start, unsigned int n)
+{
+	uint64_t ns = now_ns() - start;
+
+	printf("%-10s %8.1f ms %8.1f ns each\n", what, ns / 1e6,
+		(double) ns / n);
+}
+
+/* a call sign for each n, four letters and an SSID after the prefix */
+static void
+callsign(char *buf, char prefix, unsigned int n)
+{
+	int i;
+
+	buf[0] = prefix;
+	for (i = 1; i <= 4; ++i)
+	{
+		buf[i] = 'A' + n % 26;
+		n /= 26;
+	}
+
+	buf[5] = '\0';
+	if (n % 16)
+		sprintf(buf + 5, "-%u", n % 16);
+}
+
+int
+main(int argc, char **argv)
+{
+	char path[] = "/tmp/windbag-bench-XXXXXX";
+	unsigned char pubkey[crypto_sign_PUBLICKEYBYTES];
+	struct keyring *built = NULL, *mapped = NULL;
+	char (*calls)[AX25_ADDR_MAX] = NULL;
+	unsigned int count = DEFAULT_COUNT, *order = NULL, i, found = 0;
+	uint64_t start;
+	int fd, rc = 1;
+
+	if (argc > 1)
+		count = strtoul(argv[1], NULL, 10);
+
+	if (count == 0 || count > 26 * 26 * 26 * 26 * 16)
+	{
+		fprintf(stderr, "Usage: %s [count, up to 7311616]\n", argv[0]);
+		return 1;
+	}
+
+	fd = mkstemp(path);
+	if (fd < 0)
+	{
+		perror(path);
+		return 1;
+	}
+
+	close(fd);
+
+	calls = malloc((size_t) count * sizeof *calls);
+	order = malloc((size_t) count * sizeof *order);
+	built = keyring_new();
+	mapped = keyring_new();
+	if (!calls || !order || !built || !mapped)
+		goto end;
+
+	/* looked up in no particular order, as stations are heard */
+	srand(1);
+	for (i = 0; i < count; ++i)
+	{
+		callsign(calls[i], 'K', i);
+		order[i] = i;
+	}
+
+	for (i = count; i-- > 1;)
+	{
+		unsigned int j = (((unsigned int) rand() << 15) ^ rand()) % (i + 1);
+		unsigned int t = order[i];
+
+		order[i] = order[j];
+		order[j] = t;
+	}
+
+	printf("%u identities\n", count);
+
+	start = now_ns();
+	for (i = 0; i < count; ++i)
+	{
+		memcpy(pubkey, &i, sizeof i);
+		memset(pubkey + sizeof i, 0x5A, sizeof pubkey - sizeof i);
+		if (keyring_add_pubkey(built, calls[i], pubkey))
+		{
+			fprintf(stderr, "Failed to add %s\n", calls[i]);
+			goto end;
+		}
+	}
+	report("build", start, count);
+
+	start = now_ns();
+	if (keyring_save_as(built, path, KEYRING_INDEXED))
+	{
+		fprintf(stderr, "Failed to save %s\n", path);
+		goto end;
+	}
+	report("save", start, count);
+
+	start = now_ns();
+	if (keyring_load(mapped, path))
+	{
+		fprintf(stderr, "Failed to load %s\n", path);
+		goto end;
+	}
+	report("map", start, count);
+
+	start = now_ns();
+	for (i = 0; i < count; ++i)
+		found += keyring_search(mapped, calls[order[i]]) != NULL;
+	report("hit", start, count);
+
+	/* the same call signs under another prefix, which it has none of */
+	for (i = 0; i < count; ++i)
+		calls[i][0] = 'W';
+
+	start = now_ns();
+	for (i = 0; i < count; ++i)
+		found += keyring_search(mapped, calls[order[i]]) != NULL;
+	report("miss", start, count);
+
+	if (found != count || mapped->length != count)
+	{
+		fprintf(stderr, "Found %u of %u identities\n", found, count);
+		goto end;
+	}
+
+	rc = 0;
+
+end:
+	if (mapped)
+		keyring_free(mapped);
+	if (built)
+		keyring_free(built);
+	free(order);
+	free(calls);
+	unlink(path);
+	return rc;
+}
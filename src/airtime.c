@@ -0,0 +1,336 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "airtime.h"
+#include "util.h"
+
+#define FLAG_BITS 8
+#define FCS_LENGTH 2
+#define STUFF_RUN 5 /* ones in a row before a zero is stuffed */
+
+/* a stuffed bit per this many bits, on average, for data that looks random */
+#define STUFF_PERIOD 62
+
+static uint16_t
+fcs(const uint8_t *data, unsigned int length)
+{
+	uint16_t crc = 0xFFFF;
+	unsigned int i, bit;
+
+	for (i = 0; i < length; ++i)
+	{
+		crc ^= data[i];
+		for (bit = 0; bit < 8; ++bit)
+			crc = crc & 1 ? (crc >> 1) ^ 0x8408 : crc >> 1;
+	}
+
+	return crc ^ 0xFFFF;
+}
+
+/* the zeros HDLC inserts into `length` octets, sent low bit first */
+static unsigned int
+stuffed_bits(const uint8_t *data, unsigned int length, unsigned int *ones)
+{
+	unsigned int i, bit, stuffed = 0;
+
+	for (i = 0; i < length; ++i)
+	{
+		for (bit = 0; bit < 8; ++bit)
+		{
+			if (!(data[i] >> bit & 1))
+			{
+				*ones = 0;
+				continue;
+			}
+
+			if (++*ones == STUFF_RUN)
+			{
+				++stuffed;
+				*ones = 0;
+			}
+		}
+	}
+
+	return stuffed;
+}
+
+static unsigned long
+bits_us(unsigned long bits, unsigned int baud)
+{
+	if (baud == 0)
+		return 0;
+
+	return (bits * 1000000 + baud - 1) / baud;
+}
+
+/*
+ * The time to send one frame between its flags, including the FCS and
+ * every bit stuffed into it.
+ */
+unsigned long
+airtime_frame_us(unsigned int baud, const uint8_t *data, unsigned int length)
+{
+	uint8_t check[FCS_LENGTH];
+	unsigned int ones = 0, stuffed;
+	uint16_t crc = fcs(data, length);
+
+	check[0] = crc & 0xFF;
+	check[1] = crc >> 8;
+
+	stuffed = stuffed_bits(data, length, &ones);
+	stuffed += stuffed_bits(check, FCS_LENGTH, &ones);
+
+	return bits_us((length + FCS_LENGTH) * 8UL + stuffed + 2 * FLAG_BITS,
+		baud);
+}
+
+/* the same for a frame whose contents are not known yet */
+unsigned long
+airtime_estimate_us(unsigned int baud, unsigned int length)
+{
+	unsigned long bits = (length + FCS_LENGTH) * 8UL;
+
+	return bits_us(bits + bits / STUFF_PERIOD + 2 * FLAG_BITS, baud);
+}
+
+/* how long the channel is held to send frames taking `frames_us` in one go */
+unsigned long
+airtime_transmission_ms(const struct airtime_params *params,
+	unsigned long frames_us)
+{
+	return params->txdelay_ms + (frames_us + 999) / 1000
+		+ params->txtail_ms;
+}
+
+static struct meter_bucket *
+bucket_at(struct channel_meter *meter, uint64_t now)
+{
+	uint64_t start = now - now % METER_BUCKET_MS;
+	struct meter_bucket *bucket;
+
+	bucket = meter->buckets + (now / METER_BUCKET_MS) % METER_BUCKETS;
+	if (bucket->start != start)
+	{
+		memset(bucket, 0, sizeof *bucket);
+		bucket->start = start;
+	}
+
+	return bucket;
+}
+
+static void
+heard(struct channel_meter *meter, const struct ax25_frame *frame,
+	uint64_t now)
+{
+	const struct airtime_params *params = &meter->params;
+	struct ax25_header header;
+	unsigned long us, ms;
+
+	us = airtime_frame_us(params->baud, frame->data, frame->length);
+
+	/* a frame right after another was likely sent in the same go */
+	if (meter->last_heard && now - meter->last_heard
+		< (us + 999) / 1000 + params->txdelay_ms)
+		ms = (us + 999) / 1000;
+	else
+		ms = airtime_transmission_ms(params, us);
+
+	meter->last_heard = now;
+	bucket_at(meter, now)->heard_us += ms * 1000;
+	meter->stats.heard_ms += ms;
+	++meter->stats.frames_heard;
+
+	if (meter->links && ax25_decode_addresses(frame, &header, NULL) > 0)
+		link_table_occupy(meter->links, header.src_addr, ms);
+}
+
+static struct ax25_frame *
+meter_read(void *arg)
+{
+	struct channel_meter *meter = arg;
+	struct ax25_frame *frame;
+
+	frame = meter->lower->read_frame(meter->lower->tnc);
+	if (!frame)
+		return NULL;
+
+	pthread_mutex_lock(&meter->lock);
+	heard(meter, frame, monotonic_ms());
+	pthread_mutex_unlock(&meter->lock);
+
+	return frame;
+}
+
+static ssize_t
+meter_write(void *arg, const struct ax25_frame *frame)
+{
+	struct channel_meter *meter = arg;
+	const struct airtime_params *params = &meter->params;
+	unsigned long us, ms;
+	uint64_t now;
+	ssize_t rc;
+
+	rc = meter->lower->write_frame(meter->lower->tnc, frame);
+	if (rc < 0)
+		return rc;
+
+	us = airtime_frame_us(params->baud, frame->data, frame->length);
+
+	pthread_mutex_lock(&meter->lock);
+
+	/* written while our last is still going out, it follows in the same go */
+	now = monotonic_ms();
+	if (now < meter->keyed_until)
+	{
+		ms = (us + 999) / 1000;
+		meter->keyed_until += ms;
+	}
+	else
+	{
+		ms = airtime_transmission_ms(params, us);
+		meter->keyed_until = now + ms - params->txtail_ms;
+	}
+
+	bucket_at(meter, now)->sent_us += ms * 1000;
+	meter->stats.sent_ms += ms;
+	++meter->stats.frames_sent;
+	pthread_mutex_unlock(&meter->lock);
+
+	return rc;
+}
+
+struct channel_meter *
+channel_meter_new(const struct ax25_io *lower,
+	const struct airtime_params *params, struct link_table *links)
+{
+	struct channel_meter *meter;
+
+	meter = calloc(1, sizeof (struct channel_meter));
+	if (!meter)
+		return NULL;
+
+	if (pthread_mutex_init(&meter->lock, NULL))
+	{
+		free(meter);
+		return NULL;
+	}
+
+	meter->lower = lower;
+	meter->params = *params;
+	meter->links = links;
+
+	meter->io.read_frame = meter_read;
+	meter->io.write_frame = meter_write;
+	meter->io.tnc = meter;
+	meter->io.other_frame = lower->other_frame;
+	meter->io.other_arg = lower->other_arg;
+	return meter;
+}
+
+void
+channel_meter_free(struct channel_meter *meter)
+{
+	pthread_mutex_destroy(&meter->lock);
+	free(meter);
+}
+
+/*
+ * The share of the last `window_ms` (at most the meter's span) the channel
+ * was in use, and in `sent`, if given, the share we used ourselves.
+ */
+double
+channel_meter_utilization(struct channel_meter *meter, unsigned int window_ms,
+	double *sent)
+{
+	uint64_t now = monotonic_ms(), since;
+	unsigned long heard_us = 0, sent_us = 0;
+	unsigned int i;
+
+	if (window_ms > METER_BUCKET_MS * METER_BUCKETS)
+		window_ms = METER_BUCKET_MS * METER_BUCKETS;
+
+	since = now > window_ms ? now - window_ms : 0;
+
+	pthread_mutex_lock(&meter->lock);
+
+	for (i = 0; i < METER_BUCKETS; ++i)
+	{
+		const struct meter_bucket *bucket = meter->buckets + i;
+
+		if (bucket->start + METER_BUCKET_MS <= since
+			|| bucket->start > now)
+			continue;
+
+		heard_us += bucket->heard_us;
+		sent_us += bucket->sent_us;
+	}
+
+	pthread_mutex_unlock(&meter->lock);
+
+	if (window_ms == 0)
+		return 0;
+
+	if (sent)
+		*sent = sent_us / (window_ms * 1000.0);
+
+	return (heard_us + sent_us) / (window_ms * 1000.0);
+}
+
+void
+channel_meter_print(struct channel_meter *meter, FILE *f)
+{
+	static const unsigned int WINDOWS[] = { 60000, 300000 };
+	struct channel_meter_stats stats;
+	unsigned int i;
+
+	pthread_mutex_lock(&meter->lock);
+	stats = meter->stats;
+	pthread_mutex_unlock(&meter->lock);
+
+	fprintf(f, "Airtime heard: %lu frames, %lu.%lus\n",
+		stats.frames_heard, (unsigned long) (stats.heard_ms / 1000),
+		(unsigned long) (stats.heard_ms % 1000) / 100);
+	fprintf(f, "Airtime sent: %lu frames, %lu.%lus\n",
+		stats.frames_sent, (unsigned long) (stats.sent_ms / 1000),
+		(unsigned long) (stats.sent_ms % 1000) / 100);
+
+	for (i = 0; i < sizeof WINDOWS / sizeof WINDOWS[0]; ++i)
+	{
+		double sent, used;
+
+		used = channel_meter_utilization(meter, WINDOWS[i], &sent);
+		fprintf(f, "Channel use over %u min: %.1f%% (%.1f%% ours)\n",
+			WINDOWS[i] / 60000, used * 100, sent * 100);
+	}
+}
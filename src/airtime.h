@@ -0,0 +1,116 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef WB_AIRTIME_H
+#define WB_AIRTIME_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ax25.h"
+#include "linkq.h"
+
+#define DEFAULT_TXDELAY_MS 300
+#define DEFAULT_TXTAIL_MS 20
+
+#define METER_BUCKET_MS 5000
+#define METER_BUCKETS 60 /* five minutes */
+
+/* what it takes to put frames on the air */
+struct airtime_params
+{
+	unsigned int baud;
+	unsigned int txdelay_ms; /* keyed up before the first frame */
+	unsigned int txtail_ms; /* and held after the last */
+};
+
+unsigned long
+airtime_frame_us(unsigned int baud, const uint8_t *data, unsigned int length);
+
+unsigned long
+airtime_estimate_us(unsigned int baud, unsigned int length);
+
+unsigned long
+airtime_transmission_ms(const struct airtime_params *params,
+	unsigned long frames_us);
+
+struct meter_bucket
+{
+	uint64_t start;
+	unsigned long heard_us;
+	unsigned long sent_us;
+};
+
+struct channel_meter_stats
+{
+	unsigned long frames_heard;
+	unsigned long frames_sent;
+	uint64_t heard_ms;
+	uint64_t sent_ms;
+};
+
+/*
+ * How busy the channel is, from the frames that pass through its io in
+ * either direction, over the last few minutes in buckets of a few seconds.
+ * The time a frame holds the channel is worked out from its bits, with the
+ * keying delays of a transmission counted once for frames sent back to
+ * back. The airtime of frames heard is also charged to their senders in
+ * the link table, if there is one.
+ */
+struct channel_meter
+{
+	pthread_mutex_t lock;
+	struct ax25_io io; /* reads and writes through the meter */
+	const struct ax25_io *lower;
+	struct airtime_params params;
+	struct link_table *links;
+	struct meter_bucket buckets[METER_BUCKETS];
+	uint64_t last_heard;
+	uint64_t keyed_until; /* the end of our own frames on the air */
+	struct channel_meter_stats stats;
+};
+
+struct channel_meter *
+channel_meter_new(const struct ax25_io *lower,
+	const struct airtime_params *params, struct link_table *links);
+
+void
+channel_meter_free(struct channel_meter *meter);
+
+double
+channel_meter_utilization(struct channel_meter *meter, unsigned int window_ms,
+	double *sent);
+
+void
+channel_meter_print(struct channel_meter *meter, FILE *f);
+
+#endif
@@ -39,6 +39,7 @@
 #define FRAME_TYPE_MASK 0x03
 #define SSID_MASK 0x1E
 #define SSID_SHIFT 1
+#define CR_MASK 0x80
 
 #define FRAME_TYPE_UI 0x03
 
@@ -87,46 +88,78 @@ addr_decode(const uint8_t *src, char *dest)
 	}
 }
 
+int
+ax25_decode_addresses(const struct ax25_frame *frame,
+	struct ax25_header *header, int *cr)
+{
+	int addr_len, i;
+
+	if (frame->length < AX25_FRAME_MIN)
+		return -1;
+
+	addr_len = addrlen(frame);
+	if (addr_len < 14 || addr_len % AX25_ADDR_SIZE != 0
+		|| addr_len / AX25_ADDR_SIZE > AX25_MAX_ADDRS
+		|| addr_len >= (int) frame->length)
+		return -1;
+
+	addr_decode(frame->data, header->dest_addr);
+	addr_decode(frame->data + AX25_ADDR_SIZE, header->src_addr);
+
+	for (i = 2; i < addr_len / AX25_ADDR_SIZE; ++i)
+		addr_decode(frame->data + (i * AX25_ADDR_SIZE), header->digi_path[i-2]);
+
+	for (; i < AX25_MAX_ADDRS; ++i)
+		header->digi_path[i-2][0] = '\0';
+
+	if (cr)
+	{
+		int dest_c = frame->data[6] & CR_MASK;
+		int src_c = frame->data[AX25_ADDR_SIZE + 6] & CR_MASK;
+
+		if (dest_c && !src_c)
+			*cr = AX25_COMMAND;
+		else if (src_c && !dest_c)
+			*cr = AX25_RESPONSE;
+		else
+			*cr = AX25_NO_CR;
+	}
+
+	return addr_len;
+}
+
 struct ax25_packet *
 ax25_read_packet(const struct ax25_io *io)
 {
 	struct ax25_frame *frame;
 	struct ax25_packet *packet;
 	struct ax25_header *header;
-	int addr_len, control_code, pid, i;
+	int addr_len, control_code, pid;
 
 	frame = io->read_frame(io->tnc);
 	if (!frame)
 		return NULL;
 
-	if (frame->length < AX25_FRAME_MIN)
-		return NULL;
-
-	addr_len = addrlen(frame);
-	if (addr_len < 14 || addr_len % AX25_ADDR_SIZE != 0)
-		return NULL;
-
-	control_code = frame->data[addr_len];
-	if ((control_code & FRAME_TYPE_MASK) != FRAME_TYPE_UI)
-		return NULL;
-
-	pid = frame->data[addr_len + 1];
-	if (pid != AX25_PID_NO_L3)
-		return NULL;
-
 	packet = malloc(sizeof (struct ax25_packet));
 	if (!packet)
 		return NULL;
 
 	header = &packet->header;
-	addr_decode(frame->data, header->dest_addr);
-	addr_decode(frame->data + AX25_ADDR_SIZE, header->src_addr);
+	addr_len = ax25_decode_addresses(frame, header, NULL);
+	if (addr_len < 0)
+		goto fail;
 
-	for (i = 2; i < addr_len / AX25_ADDR_SIZE; ++i)
-		addr_decode(frame->data + (i * AX25_ADDR_SIZE), header->digi_path[i-2]);
-
-	for (; i < AX25_MAX_ADDRS; ++i)
-		header->digi_path[i-2][0] = '\0';
+	/* S and U frames of a connected link may end at the control field */
+	control_code = frame->data[addr_len];
+	pid = addr_len + 2 <= (int) frame->length
+		? frame->data[addr_len + 1] : -1;
+	if ((control_code & FRAME_TYPE_MASK) != FRAME_TYPE_UI
+		|| pid != AX25_PID_NO_L3)
+	{
+		if (io->other_frame)
+			io->other_frame(io->other_arg, frame);
+		goto fail;
+	}
 
 	header->control = control_code;
 	header->pid = pid;
@@ -135,6 +168,10 @@ ax25_read_packet(const struct ax25_io *io)
 	memcpy(packet->payload, frame->data + addr_len + 2, packet->payload_length);
 
 	return packet;
+
+fail:
+	free(packet);
+	return NULL;
 }
 
 static void
@@ -163,27 +200,41 @@ addr_encode(const char *src, uint8_t *dest)
 		*(p++) = *(src++) << 1;
 }
 
-ssize_t
-ax25_write_packet(const struct ax25_io *io, const struct ax25_packet *packet)
+unsigned int
+ax25_encode_addresses(const struct ax25_header *header, uint8_t *dest, int cr)
 {
-	struct ax25_frame frame;
-	const struct ax25_header *header = &packet->header;
-	unsigned int i;
+	unsigned int i, length;
+
+	addr_encode(header->dest_addr, dest);
+	addr_encode(header->src_addr, dest + AX25_ADDR_SIZE);
+	length = AX25_ADDR_SIZE * 2;
 
-	addr_encode(header->dest_addr, frame.data);
-	addr_encode(header->src_addr, frame.data + AX25_ADDR_SIZE);
-	frame.length = AX25_ADDR_SIZE * 2;
-	
 	for (i = 0; i < AX25_MAX_ADDRS - 2; ++i)
 	{
 		if (header->digi_path[i][0] == '\0')
 			break;
 
-		addr_encode(header->digi_path[i], frame.data + frame.length);
-		frame.length += AX25_ADDR_SIZE;
+		addr_encode(header->digi_path[i], dest + length);
+		length += AX25_ADDR_SIZE;
 	}
 
-	frame.data[frame.length - 1] |= ADDR_END_MASK;
+	dest[length - 1] |= ADDR_END_MASK;
+
+	if (cr == AX25_COMMAND)
+		dest[6] |= CR_MASK;
+	else if (cr == AX25_RESPONSE)
+		dest[AX25_ADDR_SIZE + 6] |= CR_MASK;
+
+	return length;
+}
+
+ssize_t
+ax25_write_packet(const struct ax25_io *io, const struct ax25_packet *packet)
+{
+	struct ax25_frame frame;
+
+	frame.length = ax25_encode_addresses(&packet->header, frame.data,
+					AX25_NO_CR);
 
 	frame.data[frame.length++] = FRAME_TYPE_UI; /* control field */
 	frame.data[frame.length++] = AX25_PID_NO_L3; /* PID field */
@@ -192,4 +243,4 @@ ax25_write_packet(const struct ax25_io *io, const struct ax25_packet *packet)
 	frame.length += packet->payload_length;
 
 	return io->write_frame(io->tnc, &frame);
-}
\ No newline at end of file
+}
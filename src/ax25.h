@@ -47,6 +47,11 @@
 
 #define AX25_PID_NO_L3 0xF0
 
+/* the command/response bits of AX.25 v2 addresses, or neither for v1 */
+#define AX25_NO_CR 0
+#define AX25_COMMAND 1
+#define AX25_RESPONSE 2
+
 struct ax25_frame
 {
 	unsigned int length;
@@ -71,14 +76,26 @@ struct ax25_packet
 
 typedef struct ax25_frame *(*ax25_frame_reader)(void *tnc);
 typedef ssize_t (*ax25_frame_writer)(void *tnc, const struct ax25_frame *frame);
+typedef void (*ax25_frame_handler)(void *arg, const struct ax25_frame *frame);
 
 struct ax25_io
 {
 	ax25_frame_reader read_frame;
 	ax25_frame_writer write_frame;
 	void *tnc;
+
+	/* if set, given the frames that are not UI frames, e.g. for a link */
+	ax25_frame_handler other_frame;
+	void *other_arg;
 };
 
+int
+ax25_decode_addresses(const struct ax25_frame *frame,
+	struct ax25_header *header, int *cr);
+
+unsigned int
+ax25_encode_addresses(const struct ax25_header *header, uint8_t *dest, int cr);
+
 struct ax25_packet *
 ax25_read_packet(const struct ax25_io *io);
 
@@ -0,0 +1,917 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ax25link.h"
+#include "callsign.h"
+#include "util.h"
+
+#define PF 0x10
+
+#define S_RR 0x01
+#define S_RNR 0x05
+#define S_REJ 0x09
+#define S_SREJ 0x0D
+
+#define U_SABME 0x6F
+#define U_SABM 0x2F
+#define U_DISC 0x43
+#define U_DM 0x0F
+#define U_UA 0x63
+#define U_FRMR 0x87
+
+#define T1_BACKOFF_MAX 3 /* T1 doubles with each retry, up to eight times */
+
+static unsigned int
+seq(const struct ax25_link *link, unsigned int n)
+{
+	return n & (link->modulus - 1);
+}
+
+static unsigned int
+distance(const struct ax25_link *link, unsigned int from, unsigned int to)
+{
+	return (to - from) & (link->modulus - 1);
+}
+
+static unsigned int
+window(const struct ax25_link *link)
+{
+	if (link->params.window >= link->modulus)
+		return link->modulus - 1;
+
+	return link->params.window;
+}
+
+static void
+write_frame(struct ax25_link *link, int cr, const uint8_t *control,
+	unsigned int control_length, const struct ax25_segment *info)
+{
+	struct ax25_frame frame;
+
+	frame.length = ax25_encode_addresses(&link->header, frame.data, cr);
+	memcpy(frame.data + frame.length, control, control_length);
+	frame.length += control_length;
+
+	if (info)
+	{
+		frame.data[frame.length++] = AX25_PID_NO_L3;
+		memcpy(frame.data + frame.length, info->data, info->length);
+		frame.length += info->length;
+	}
+
+	link->io->write_frame(link->io->tnc, &frame);
+}
+
+static void
+send_u(struct ax25_link *link, uint8_t type, int cr, int pf)
+{
+	uint8_t control = type | (pf ? PF : 0);
+	write_frame(link, cr, &control, 1, NULL);
+}
+
+static void
+send_s(struct ax25_link *link, uint8_t type, int cr, int pf)
+{
+	uint8_t control[2];
+
+	if (link->modulus == 8)
+	{
+		control[0] = type | (link->vr << 5) | (pf ? PF : 0);
+		write_frame(link, cr, control, 1, NULL);
+	}
+	else
+	{
+		control[0] = type;
+		control[1] = (link->vr << 1) | (pf ? 1 : 0);
+		write_frame(link, cr, control, 2, NULL);
+	}
+
+	link->ack_pending = 0;
+	link->t2 = 0;
+}
+
+static void
+send_i(struct ax25_link *link, unsigned int ns)
+{
+	uint8_t control[2];
+
+	if (link->modulus == 8)
+	{
+		control[0] = (link->vr << 5) | (ns << 1);
+		write_frame(link, AX25_COMMAND, control, 1, &link->sent[ns]);
+	}
+	else
+	{
+		control[0] = ns << 1;
+		control[1] = link->vr << 1;
+		write_frame(link, AX25_COMMAND, control, 2, &link->sent[ns]);
+	}
+
+	link->ack_pending = 0;
+	link->t2 = 0;
+	++link->stats.frames_sent;
+}
+
+static void
+set_state(struct ax25_link *link, enum ax25_link_state state, int error)
+{
+	if (link->state == state && !error)
+		return;
+
+	link->state = state;
+	if (link->on_state)
+		link->on_state(link->arg, state, error);
+}
+
+static void
+start_t1(struct ax25_link *link, uint64_t now)
+{
+	unsigned int shift = link->rc < T1_BACKOFF_MAX ? link->rc : T1_BACKOFF_MAX;
+	link->t1 = now + (link->params.t1_ms << shift);
+}
+
+static void
+start_t3(struct ax25_link *link, uint64_t now)
+{
+	link->t3 = now + link->params.t3_ms;
+}
+
+static void
+reset(struct ax25_link *link)
+{
+	link->vs = link->va = link->vr = link->top = 0;
+	link->rc = 0;
+	link->peer_busy = 0;
+	link->reject_sent = 0;
+	link->ack_pending = 0;
+	link->t1 = link->t2 = link->t3 = 0;
+	memset(link->held_valid, 0, sizeof link->held_valid);
+	memset(link->srej_sent, 0, sizeof link->srej_sent);
+}
+
+static void
+establish(struct ax25_link *link, uint64_t now)
+{
+	reset(link);
+	send_u(link, link->modulus == 128 ? U_SABME : U_SABM, AX25_COMMAND, 1);
+	start_t1(link, now);
+	link->state = AX25_LINK_CONNECTING;
+}
+
+/* the peer confused us, so start over; unacknowledged frames are lost */
+static void
+reestablish(struct ax25_link *link, uint64_t now)
+{
+	establish(link, now);
+	set_state(link, AX25_LINK_CONNECTING, ECONNRESET);
+}
+
+static void
+disconnected(struct ax25_link *link, int error)
+{
+	reset(link);
+	link->queue_count = 0;
+	set_state(link, AX25_LINK_DISCONNECTED, error);
+}
+
+static void
+enquire(struct ax25_link *link, uint64_t now)
+{
+	send_s(link, S_RR, AX25_COMMAND, 1);
+	start_t1(link, now);
+	link->t3 = 0;
+	link->state = AX25_LINK_TIMER_RECOVERY;
+}
+
+static void
+pump(struct ax25_link *link, uint64_t now)
+{
+	if (link->state != AX25_LINK_CONNECTED || link->peer_busy)
+		return;
+
+	while (distance(link, link->va, link->vs) < window(link))
+	{
+		if (link->vs == link->top)
+		{
+			if (link->queue_count == 0)
+				break;
+
+			link->sent[link->vs] = link->queue[link->queue_head];
+			link->queue_head = (link->queue_head + 1) % AX25_LINK_QUEUE;
+			--link->queue_count;
+			link->top = seq(link, link->top + 1);
+		}
+		else
+		{
+			++link->stats.frames_resent;
+		}
+
+		send_i(link, link->vs);
+		link->vs = seq(link, link->vs + 1);
+
+		if (!link->t1)
+		{
+			start_t1(link, now);
+			link->t3 = 0;
+		}
+	}
+}
+
+static int
+valid_nr(const struct ax25_link *link, unsigned int nr)
+{
+	return distance(link, link->va, nr) <= distance(link, link->va, link->top);
+}
+
+static void
+acknowledge(struct ax25_link *link, unsigned int nr, uint64_t now)
+{
+	if (nr == link->va)
+		return;
+
+	/* the peer may have some of what we were about to send again */
+	if (distance(link, link->va, nr) > distance(link, link->va, link->vs))
+		link->vs = nr;
+
+	link->va = nr;
+	if (link->state != AX25_LINK_CONNECTED)
+		return;
+
+	link->rc = 0;
+	if (link->va == link->top)
+	{
+		link->t1 = 0;
+		start_t3(link, now);
+	}
+	else
+	{
+		start_t1(link, now);
+	}
+}
+
+/* the peer answered our poll, so we know exactly where it stands */
+static void
+recover(struct ax25_link *link, unsigned int nr, uint64_t now)
+{
+	link->va = nr;
+	link->vs = nr;
+	link->rc = 0;
+	link->t1 = 0;
+	link->state = AX25_LINK_CONNECTED;
+
+	if (link->peer_busy)
+		start_t1(link, now);
+	else if (link->va == link->top)
+		start_t3(link, now);
+}
+
+static void
+deliver(struct ax25_link *link, const uint8_t *data, unsigned int length)
+{
+	++link->stats.frames_received;
+	if (link->on_data)
+		link->on_data(link->arg, data, length);
+}
+
+static void
+request_missing(struct ax25_link *link)
+{
+	if (link->srej_sent[link->vr])
+		return;
+
+	send_s(link, S_SREJ, AX25_RESPONSE, 0);
+	link->srej_sent[link->vr] = 1;
+	++link->stats.rejects_sent;
+}
+
+static void
+receive_i(struct ax25_link *link, unsigned int ns, int p,
+	const uint8_t *info, unsigned int length, uint64_t now)
+{
+	unsigned int i;
+
+	if (length > AX25_INFO_MAX)
+		length = AX25_INFO_MAX;
+
+	if (ns == link->vr)
+	{
+		deliver(link, info, length);
+		link->srej_sent[ns] = 0;
+		link->vr = seq(link, link->vr + 1);
+		link->reject_sent = 0;
+
+		while (link->held_valid[link->vr])
+		{
+			struct ax25_segment *held = &link->held[link->vr];
+
+			deliver(link, held->data, held->length);
+			link->held_valid[link->vr] = 0;
+			link->srej_sent[link->vr] = 0;
+			link->vr = seq(link, link->vr + 1);
+		}
+
+		for (i = 1; i < window(link); ++i)
+		{
+			if (link->held_valid[seq(link, link->vr + i)])
+			{
+				request_missing(link);
+				break;
+			}
+		}
+
+		if (p)
+		{
+			send_s(link, S_RR, AX25_RESPONSE, 1);
+		}
+		else if (!link->ack_pending)
+		{
+			link->ack_pending = 1;
+			link->t2 = now + link->params.t2_ms;
+		}
+	}
+	else if (distance(link, link->vr, ns) < window(link))
+	{
+		++link->stats.frames_out_of_sequence;
+
+		if (link->params.srej)
+		{
+			link->held[ns].length = length;
+			memcpy(link->held[ns].data, info, length);
+			link->held_valid[ns] = 1;
+			request_missing(link);
+
+			if (p)
+				send_s(link, S_RR, AX25_RESPONSE, 1);
+		}
+		else if (!link->reject_sent)
+		{
+			send_s(link, S_REJ, AX25_RESPONSE, p);
+			link->reject_sent = 1;
+			++link->stats.rejects_sent;
+		}
+		else if (p)
+		{
+			send_s(link, S_RR, AX25_RESPONSE, 1);
+		}
+	}
+	else if (p)
+	{
+		send_s(link, S_RR, AX25_RESPONSE, 1);
+	}
+	else
+	{
+		/* a copy of something we have; tell the peer where we are */
+		link->ack_pending = 1;
+		if (!link->t2)
+			link->t2 = now + link->params.t2_ms;
+	}
+}
+
+static void
+receive_s(struct ax25_link *link, uint8_t type, unsigned int nr, int pf,
+	int cr, uint64_t now)
+{
+	if (cr == AX25_COMMAND && pf)
+		send_s(link, S_RR, AX25_RESPONSE, 1);
+
+	if (type == S_RR || type == S_RNR)
+		link->peer_busy = type == S_RNR;
+
+	if (link->state == AX25_LINK_TIMER_RECOVERY && cr != AX25_COMMAND && pf)
+	{
+		recover(link, nr, now);
+		return;
+	}
+
+	switch (type)
+	{
+	case S_RR:
+	case S_RNR:
+		acknowledge(link, nr, now);
+		if (link->peer_busy && !link->t1)
+			start_t1(link, now);
+		break;
+
+	case S_REJ:
+		acknowledge(link, nr, now);
+		link->vs = link->va;
+		break;
+
+	case S_SREJ:
+		/* only a final SREJ acknowledges what comes before N(R) */
+		if (pf)
+			acknowledge(link, nr, now);
+
+		if (nr != link->top)
+		{
+			++link->stats.frames_resent;
+			send_i(link, nr);
+			if (!link->t1)
+				start_t1(link, now);
+		}
+		break;
+	}
+}
+
+static void
+receive_u(struct ax25_link *link, uint8_t type, int pf, uint64_t now)
+{
+	int linked = link->state == AX25_LINK_CONNECTED
+		|| link->state == AX25_LINK_TIMER_RECOVERY;
+
+	switch (type)
+	{
+	case U_SABM:
+	case U_SABME:
+		if (link->state == AX25_LINK_DISCONNECTING
+			|| (link->state == AX25_LINK_DISCONNECTED
+				&& !link->listening))
+		{
+			send_u(link, U_DM, AX25_RESPONSE, pf);
+			break;
+		}
+
+		link->modulus = type == U_SABME ? 128 : 8;
+		reset(link);
+		send_u(link, U_UA, AX25_RESPONSE, pf);
+		start_t3(link, now);
+		set_state(link, AX25_LINK_CONNECTED, linked ? ECONNRESET : 0);
+		break;
+
+	case U_DISC:
+		if (linked)
+		{
+			send_u(link, U_UA, AX25_RESPONSE, pf);
+			disconnected(link, 0);
+		}
+		else if (link->state == AX25_LINK_DISCONNECTING)
+		{
+			send_u(link, U_UA, AX25_RESPONSE, pf);
+		}
+		else
+		{
+			send_u(link, U_DM, AX25_RESPONSE, pf);
+		}
+		break;
+
+	case U_UA:
+		if (link->state == AX25_LINK_CONNECTING)
+		{
+			reset(link);
+			start_t3(link, now);
+			set_state(link, AX25_LINK_CONNECTED, 0);
+		}
+		else if (link->state == AX25_LINK_DISCONNECTING)
+		{
+			disconnected(link, 0);
+		}
+		break;
+
+	case U_DM:
+		if (link->state == AX25_LINK_CONNECTING)
+		{
+			/* a v2.0 station refuses SABME, so try it the old way */
+			if (link->modulus == 128 && !link->fell_back)
+			{
+				link->fell_back = 1;
+				link->modulus = 8;
+				establish(link, now);
+			}
+			else
+			{
+				disconnected(link, ECONNREFUSED);
+			}
+		}
+		else if (link->state == AX25_LINK_DISCONNECTING)
+		{
+			disconnected(link, 0);
+		}
+		else if (linked)
+		{
+			disconnected(link, ECONNRESET);
+		}
+		break;
+
+	case U_FRMR:
+		if (linked)
+			reestablish(link, now);
+		break;
+
+	default:
+		break;
+	}
+}
+
+void
+ax25_link_defaults(struct ax25_link_params *params, int extended)
+{
+	params->extended = extended;
+	params->srej = extended;
+	params->window = extended ? 32 : 4;
+	params->paclen = AX25_INFO_MAX;
+	params->retries = 10;
+	params->t1_ms = 10000;
+	params->t2_ms = 1000;
+	params->t3_ms = 180000;
+}
+
+struct ax25_link *
+ax25_link_new(const struct ax25_io *io, const struct ax25_header *header,
+	const struct ax25_link_params *params)
+{
+	struct ax25_link *link = calloc(1, sizeof (struct ax25_link));
+	if (!link)
+		return NULL;
+
+	if (pthread_mutex_init(&link->lock, NULL))
+	{
+		free(link);
+		return NULL;
+	}
+
+	link->io = io;
+	link->header = *header;
+	link->params = *params;
+	if (link->params.paclen == 0 || link->params.paclen > AX25_INFO_MAX)
+		link->params.paclen = AX25_INFO_MAX;
+
+	if (link->params.window == 0)
+		link->params.window = 1;
+
+	link->modulus = params->extended ? 128 : 8;
+	link->state = AX25_LINK_DISCONNECTED;
+	return link;
+}
+
+void
+ax25_link_free(struct ax25_link *link)
+{
+	pthread_mutex_destroy(&link->lock);
+	free(link);
+}
+
+void
+ax25_link_listen(struct ax25_link *link, int listening)
+{
+	pthread_mutex_lock(&link->lock);
+	link->listening = listening;
+	pthread_mutex_unlock(&link->lock);
+}
+
+int
+ax25_link_connect(struct ax25_link *link, uint64_t now)
+{
+	int rc = 0;
+
+	pthread_mutex_lock(&link->lock);
+
+	if (link->state != AX25_LINK_DISCONNECTED)
+	{
+		rc = EISCONN;
+		goto end;
+	}
+
+	link->modulus = link->params.extended ? 128 : 8;
+	link->fell_back = 0;
+	link->queue_count = 0;
+	establish(link, now);
+	set_state(link, AX25_LINK_CONNECTING, 0);
+
+end:
+	pthread_mutex_unlock(&link->lock);
+	return rc;
+}
+
+int
+ax25_link_disconnect(struct ax25_link *link, uint64_t now)
+{
+	int rc = 0;
+
+	pthread_mutex_lock(&link->lock);
+
+	if (link->state == AX25_LINK_DISCONNECTED)
+	{
+		rc = ENOTCONN;
+		goto end;
+	}
+
+	reset(link);
+	link->queue_count = 0;
+	send_u(link, U_DISC, AX25_COMMAND, 1);
+	start_t1(link, now);
+	set_state(link, AX25_LINK_DISCONNECTING, 0);
+
+end:
+	pthread_mutex_unlock(&link->lock);
+	return rc;
+}
+
+int
+ax25_link_send(struct ax25_link *link, const uint8_t *data,
+	unsigned int length, uint64_t now)
+{
+	unsigned int segments, tail, n;
+	int rc = 0;
+
+	pthread_mutex_lock(&link->lock);
+
+	if (link->state == AX25_LINK_DISCONNECTED
+		|| link->state == AX25_LINK_DISCONNECTING)
+	{
+		rc = ENOTCONN;
+		goto end;
+	}
+
+	segments = (length + link->params.paclen - 1) / link->params.paclen;
+	if (link->queue_count + segments > AX25_LINK_QUEUE)
+	{
+		rc = EAGAIN;
+		goto end;
+	}
+
+	while (length > 0)
+	{
+		n = length < link->params.paclen ? length : link->params.paclen;
+		tail = (link->queue_head + link->queue_count) % AX25_LINK_QUEUE;
+
+		link->queue[tail].length = n;
+		memcpy(link->queue[tail].data, data, n);
+		++link->queue_count;
+
+		data += n;
+		length -= n;
+	}
+
+	pump(link, now);
+
+end:
+	pthread_mutex_unlock(&link->lock);
+	return rc;
+}
+
+void
+ax25_link_receive(struct ax25_link *link, const struct ax25_frame *frame,
+	uint64_t now)
+{
+	struct ax25_header header;
+	unsigned int nr, ns, control_length;
+	int addr_len, cr, pf;
+	uint8_t c;
+
+	addr_len = ax25_decode_addresses(frame, &header, &cr);
+	if (addr_len < 0)
+		return;
+
+	if (callsign_pack(header.src_addr) != callsign_pack(link->header.dest_addr)
+		|| callsign_pack(header.dest_addr)
+			!= callsign_pack(link->header.src_addr))
+		return;
+
+	pthread_mutex_lock(&link->lock);
+
+	c = frame->data[addr_len];
+	if ((c & 0x03) == 0x03)
+	{
+		receive_u(link, c & ~PF, c & PF, now);
+		goto end;
+	}
+
+	if (link->state != AX25_LINK_CONNECTED
+		&& link->state != AX25_LINK_TIMER_RECOVERY)
+	{
+		/* ask a station that thinks we are connected to go away */
+		if (link->state == AX25_LINK_DISCONNECTED && cr == AX25_COMMAND)
+			send_u(link, U_DM, AX25_RESPONSE, 1);
+
+		goto end;
+	}
+
+	control_length = link->modulus == 8 ? 1 : 2;
+	if (frame->length < addr_len + control_length)
+		goto end;
+
+	if (link->modulus == 8)
+	{
+		nr = c >> 5;
+		ns = (c >> 1) & 0x07;
+		pf = c & PF;
+	}
+	else
+	{
+		nr = frame->data[addr_len + 1] >> 1;
+		ns = c >> 1;
+		pf = frame->data[addr_len + 1] & 0x01;
+	}
+
+	if (!valid_nr(link, nr))
+	{
+		reestablish(link, now);
+		goto end;
+	}
+
+	if ((c & 0x01) == 0)
+	{
+		if (cr == AX25_RESPONSE
+			|| frame->length < addr_len + control_length + 1)
+			goto end;
+
+		acknowledge(link, nr, now);
+		receive_i(link, ns, pf,
+			frame->data + addr_len + control_length + 1,
+			frame->length - (addr_len + control_length + 1), now);
+	}
+	else
+	{
+		receive_s(link, link->modulus == 8 ? c & 0x0F : c, nr, pf,
+			cr, now);
+	}
+
+	pump(link, now);
+
+end:
+	pthread_mutex_unlock(&link->lock);
+}
+
+void
+ax25_link_frame_handler(void *arg, const struct ax25_frame *frame)
+{
+	ax25_link_receive(arg, frame, monotonic_ms());
+}
+
+void
+ax25_link_tick(struct ax25_link *link, uint64_t now)
+{
+	pthread_mutex_lock(&link->lock);
+
+	if (link->t2 && now >= link->t2)
+	{
+		if (link->ack_pending)
+			send_s(link, S_RR, AX25_RESPONSE, 0);
+
+		link->t2 = 0;
+	}
+
+	if (link->t1 && now >= link->t1)
+	{
+		link->t1 = 0;
+		++link->stats.timeouts;
+
+		switch (link->state)
+		{
+		case AX25_LINK_CONNECTING:
+		case AX25_LINK_DISCONNECTING:
+			if (++link->rc >= link->params.retries)
+			{
+				send_u(link, U_DM, AX25_RESPONSE, 0);
+				disconnected(link, ETIMEDOUT);
+				break;
+			}
+
+			if (link->state == AX25_LINK_DISCONNECTING)
+				send_u(link, U_DISC, AX25_COMMAND, 1);
+			else
+				send_u(link, link->modulus == 128 ? U_SABME : U_SABM,
+					AX25_COMMAND, 1);
+
+			start_t1(link, now);
+			break;
+
+		case AX25_LINK_CONNECTED:
+			link->rc = 1;
+			enquire(link, now);
+			break;
+
+		case AX25_LINK_TIMER_RECOVERY:
+			if (link->rc >= link->params.retries)
+			{
+				send_u(link, U_DM, AX25_RESPONSE, 0);
+				disconnected(link, ETIMEDOUT);
+				break;
+			}
+
+			++link->rc;
+			enquire(link, now);
+			break;
+
+		default:
+			break;
+		}
+	}
+
+	if (link->t3 && now >= link->t3)
+	{
+		link->t3 = 0;
+		if (link->state == AX25_LINK_CONNECTED)
+		{
+			link->rc = 0;
+			enquire(link, now);
+		}
+	}
+
+	pump(link, now);
+	pthread_mutex_unlock(&link->lock);
+}
+
+long
+ax25_link_timeout(struct ax25_link *link, uint64_t now)
+{
+	uint64_t next = 0;
+	uint64_t timers[3];
+	unsigned int i;
+
+	pthread_mutex_lock(&link->lock);
+	timers[0] = link->t1;
+	timers[1] = link->t2;
+	timers[2] = link->t3;
+	pthread_mutex_unlock(&link->lock);
+
+	for (i = 0; i < 3; ++i)
+	{
+		if (timers[i] && (!next || timers[i] < next))
+			next = timers[i];
+	}
+
+	if (!next)
+		return -1;
+
+	return next > now ? (long) (next - now) : 0;
+}
+
+enum ax25_link_state
+ax25_link_get_state(struct ax25_link *link)
+{
+	enum ax25_link_state state;
+
+	pthread_mutex_lock(&link->lock);
+	state = link->state;
+	pthread_mutex_unlock(&link->lock);
+	return state;
+}
+
+/* how many segments are queued or sent but not yet acknowledged */
+unsigned int
+ax25_link_unacked(struct ax25_link *link)
+{
+	unsigned int n;
+
+	pthread_mutex_lock(&link->lock);
+	n = link->queue_count + distance(link, link->va, link->top);
+	pthread_mutex_unlock(&link->lock);
+	return n;
+}
+
+const char *
+ax25_link_state_name(enum ax25_link_state state)
+{
+	switch (state)
+	{
+	case AX25_LINK_DISCONNECTED:
+		return "disconnected";
+
+	case AX25_LINK_CONNECTING:
+		return "connecting";
+
+	case AX25_LINK_CONNECTED:
+		return "connected";
+
+	case AX25_LINK_TIMER_RECOVERY:
+		return "timer recovery";
+
+	case AX25_LINK_DISCONNECTING:
+		return "disconnecting";
+	}
+
+	return "unknown";
+}
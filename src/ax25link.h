@@ -0,0 +1,172 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef WB_AX25LINK_H
+#define WB_AX25LINK_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "ax25.h"
+
+#define AX25_LINK_QUEUE 64 /* segments waiting for room in the window */
+
+enum ax25_link_state
+{
+	AX25_LINK_DISCONNECTED,
+	AX25_LINK_CONNECTING,
+	AX25_LINK_CONNECTED,
+	AX25_LINK_TIMER_RECOVERY,
+	AX25_LINK_DISCONNECTING
+};
+
+struct ax25_link_params
+{
+	int extended; /* modulo 128 rather than modulo 8 */
+	int srej; /* ask for single missing frames instead of going back */
+	unsigned int window; /* k */
+	unsigned int paclen; /* N1 */
+	unsigned int retries; /* N2 */
+	uint64_t t1_ms; /* waiting for an acknowledgement */
+	uint64_t t2_ms; /* delaying our acknowledgements */
+	uint64_t t3_ms; /* checking an idle link */
+};
+
+struct ax25_link_stats
+{
+	unsigned long frames_sent;
+	unsigned long frames_resent;
+	unsigned long frames_received;
+	unsigned long frames_out_of_sequence;
+	unsigned long rejects_sent;
+	unsigned long timeouts;
+};
+
+typedef void (*ax25_link_data_handler)(void *arg, const uint8_t *data,
+	unsigned int length);
+
+typedef void (*ax25_link_state_handler)(void *arg, enum ax25_link_state state,
+	int error);
+
+struct ax25_segment
+{
+	unsigned int length;
+	uint8_t data[AX25_INFO_MAX];
+};
+
+/*
+ * One end of an AX.25 v2.2 connected-mode link to a single peer. The link
+ * never reads by itself: feed it the frames that ax25_read_packet passes on
+ * through other_frame, and call ax25_link_tick for its timers. Times are
+ * milliseconds of some monotonic clock, so a simulated channel can drive it
+ * with its own. The handlers are called with the lock held and must not call
+ * back into the link.
+ */
+struct ax25_link
+{
+	pthread_mutex_t lock;
+	const struct ax25_io *io;
+	struct ax25_header header;
+	struct ax25_link_params params;
+	enum ax25_link_state state;
+	int listening;
+	int fell_back;
+
+	unsigned int modulus;
+	unsigned int vs, va, vr;
+	unsigned int top; /* the N(S) after the newest frame we have sent */
+	unsigned int rc;
+	int peer_busy;
+	int reject_sent;
+	int ack_pending;
+	uint64_t t1, t2, t3; /* expiry times, or 0 if stopped */
+
+	struct ax25_segment sent[128];
+	struct ax25_segment held[128];
+	uint8_t held_valid[128];
+	uint8_t srej_sent[128];
+
+	struct ax25_segment queue[AX25_LINK_QUEUE];
+	unsigned int queue_head, queue_count;
+
+	ax25_link_data_handler on_data;
+	ax25_link_state_handler on_state;
+	void *arg;
+
+	struct ax25_link_stats stats;
+};
+
+void
+ax25_link_defaults(struct ax25_link_params *params, int extended);
+
+struct ax25_link *
+ax25_link_new(const struct ax25_io *io, const struct ax25_header *header,
+	const struct ax25_link_params *params);
+
+void
+ax25_link_free(struct ax25_link *link);
+
+void
+ax25_link_listen(struct ax25_link *link, int listening);
+
+int
+ax25_link_connect(struct ax25_link *link, uint64_t now);
+
+int
+ax25_link_disconnect(struct ax25_link *link, uint64_t now);
+
+int
+ax25_link_send(struct ax25_link *link, const uint8_t *data,
+	unsigned int length, uint64_t now);
+
+void
+ax25_link_receive(struct ax25_link *link, const struct ax25_frame *frame,
+	uint64_t now);
+
+void
+ax25_link_frame_handler(void *arg, const struct ax25_frame *frame);
+
+void
+ax25_link_tick(struct ax25_link *link, uint64_t now);
+
+long
+ax25_link_timeout(struct ax25_link *link, uint64_t now);
+
+enum ax25_link_state
+ax25_link_get_state(struct ax25_link *link);
+
+unsigned int
+ax25_link_unacked(struct ax25_link *link);
+
+const char *
+ax25_link_state_name(enum ax25_link_state state);
+
+#endif
@@ -170,4 +170,44 @@ fail:
 		bigbuffer_free(buffers[index]);
 	free(buffers);
 	return NULL;
-}
\ No newline at end of file
+}
+
+/* like bigbuffer_split, but for binary data, with no regard for UTF-8 */
+struct bigbuffer **
+bigbuffer_chunk(const struct bigbuffer *src, unsigned int max_length, unsigned int *n_buffers)
+{
+	unsigned int i, n;
+	struct bigbuffer **buffers;
+
+	n = src->length / max_length + (src->length % max_length != 0);
+	if (n == 0)
+		n = 1;
+
+	buffers = malloc(n * sizeof src);
+	if (!buffers)
+		return NULL;
+
+	for (i = 0; i < n; ++i)
+	{
+		unsigned int offset = i * max_length;
+		unsigned int length = src->length - offset;
+
+		if (length > max_length)
+			length = max_length;
+
+		buffers[i] = bigbuffer_new(length + 1);
+		if (!buffers[i])
+		{
+			while (i)
+				bigbuffer_free(buffers[--i]);
+			free(buffers);
+			return NULL;
+		}
+
+		memcpy(buffers[i]->data, src->data + offset, length);
+		buffers[i]->length = length;
+	}
+
+	*n_buffers = n;
+	return buffers;
+}
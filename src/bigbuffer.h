@@ -62,4 +62,7 @@ bigbuffer_truncate(const struct bigbuffer *b, unsigned int max_length);
 struct bigbuffer **
 bigbuffer_split(const struct bigbuffer *src, unsigned int max_length, unsigned int *n_buffers);
 
+struct bigbuffer **
+bigbuffer_chunk(const struct bigbuffer *src, unsigned int max_length, unsigned int *n_buffers);
+
 #endif
@@ -0,0 +1,201 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <stdlib.h>
+#include <time.h>
+
+#include "budget.h"
+#include "callsign.h"
+
+#define PROBE_LENGTH 8
+#define BURST_SECONDS 2
+#define RESERVE_FRACTION 0.25
+
+static double
+now_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void
+refill(struct bucket *bucket, double rate, double now)
+{
+	bucket->tokens += (now - bucket->last) * rate;
+	if (bucket->tokens > rate * BURST_SECONDS)
+		bucket->tokens = rate * BURST_SECONDS;
+
+	bucket->last = now;
+}
+
+struct budget *
+budget_new(unsigned int capacity, unsigned int rate, unsigned int source_rate)
+{
+	struct budget *budget;
+	unsigned int size = PROBE_LENGTH;
+
+	while (size < capacity)
+		size <<= 1;
+
+	budget = calloc(1, sizeof (struct budget));
+	if (!budget)
+		return NULL;
+
+	budget->slots = calloc(size, sizeof (struct budget_slot));
+	budget->trusted_slots = calloc(size, sizeof (struct budget_slot));
+	if (!budget->slots || !budget->trusted_slots)
+	{
+		free(budget->slots);
+		free(budget->trusted_slots);
+		free(budget);
+		return NULL;
+	}
+
+	budget->mask = size - 1;
+	budget->rate = rate ? rate : DEFAULT_VERIFY_RATE;
+	budget->source_rate = source_rate ? source_rate
+		: DEFAULT_VERIFY_SOURCE_RATE;
+
+	budget->global.tokens = budget->rate * BURST_SECONDS;
+	budget->global.last = now_seconds();
+	return budget;
+}
+
+void
+budget_free(struct budget *budget)
+{
+	free(budget->slots);
+	free(budget->trusted_slots);
+	free(budget);
+}
+
+/*
+ * Looks for the source's slot in a table. If it is not there, `victim` is
+ * left at the slot to give it: an empty one, or whoever has been quiet the
+ * longest.
+ */
+static struct budget_slot *
+probe(struct budget_slot *slots, unsigned int mask, uint64_t packed,
+	struct budget_slot **victim)
+{
+	unsigned int i, home = callsign_hash(packed);
+
+	*victim = NULL;
+	for (i = 0; i < PROBE_LENGTH; ++i)
+	{
+		struct budget_slot *slot = slots + ((home + i) & mask);
+
+		if (slot->source == packed)
+			return slot;
+
+		if (!*victim || slot->source == 0
+			|| ((*victim)->source != 0
+				&& slot->bucket.last < (*victim)->bucket.last))
+			*victim = slot;
+	}
+
+	return NULL;
+}
+
+struct budget_slot *
+budget_claim(struct budget *budget, const char *source)
+{
+	struct budget_slot *slot, *victim;
+	uint64_t packed = callsign_pack(source);
+	double now = now_seconds();
+
+	slot = probe(budget->trusted_slots, budget->mask, packed, &victim);
+	if (!slot)
+		slot = probe(budget->slots, budget->mask, packed, &victim);
+
+	if (slot)
+	{
+		refill(&slot->bucket, budget->source_rate, now);
+		return slot;
+	}
+
+	/* only ever at the expense of another untrusted source */
+	victim->source = packed;
+	victim->trusted = 0;
+	victim->bucket.tokens = budget->source_rate * BURST_SECONDS;
+	victim->bucket.last = now;
+	return victim;
+}
+
+int
+budget_spend(struct budget *budget, struct budget_slot *slot)
+{
+	double floor = 0;
+
+	if (slot->bucket.tokens < 1)
+	{
+		++budget->stats.throttled_source;
+		return 0;
+	}
+
+	refill(&budget->global, budget->rate, now_seconds());
+	if (!slot->trusted)
+		floor = budget->rate * BURST_SECONDS * RESERVE_FRACTION;
+
+	if (budget->global.tokens - 1 < floor)
+	{
+		++budget->stats.throttled_global;
+		return 0;
+	}
+
+	slot->bucket.tokens -= 1;
+	budget->global.tokens -= 1;
+	++budget->stats.verifications;
+	return 1;
+}
+
+/*
+ * Moves a source into the trusted table once one of its signatures
+ * verifies. It stays there after a signature that does not, which anyone
+ * could send in its name, until other trusted sources need the room.
+ */
+void
+budget_settle(struct budget *budget, struct budget_slot *slot, int verified)
+{
+	struct budget_slot *victim;
+
+	if (!verified || slot->trusted)
+		return;
+
+	if (probe(budget->trusted_slots, budget->mask, slot->source, &victim))
+		return;
+
+	*victim = *slot;
+	victim->trusted = 1;
+	slot->source = 0;
+}
@@ -0,0 +1,93 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef WB_BUDGET_H
+#define WB_BUDGET_H
+
+#include <stdint.h>
+
+#define DEFAULT_VERIFY_RATE 2000
+#define DEFAULT_VERIFY_SOURCE_RATE 200
+
+struct bucket
+{
+	double tokens;
+	double last; /* seconds, monotonic */
+};
+
+struct budget_slot
+{
+	uint64_t source;
+	int trusted; /* a signature from this source has verified */
+	struct bucket bucket;
+};
+
+struct budget_stats
+{
+	unsigned long verifications;
+	unsigned long throttled_source;
+	unsigned long throttled_global;
+};
+
+/*
+ * Token buckets limiting how many signature verifications are done per
+ * second, both overall and for each source. Sources whose signatures have
+ * verified may dip into a reserve of the global bucket that other sources
+ * cannot touch. They are kept in a table of their own, so that a flood of
+ * made-up sources cannot push them out.
+ */
+struct budget
+{
+	unsigned int mask;
+	double rate;
+	double source_rate;
+	struct bucket global;
+	struct budget_slot *slots;
+	struct budget_slot *trusted_slots;
+	struct budget_stats stats;
+};
+
+struct budget *
+budget_new(unsigned int capacity, unsigned int rate, unsigned int source_rate);
+
+void
+budget_free(struct budget *budget);
+
+struct budget_slot *
+budget_claim(struct budget *budget, const char *source);
+
+int
+budget_spend(struct budget *budget, struct budget_slot *slot);
+
+void
+budget_settle(struct budget *budget, struct budget_slot *slot, int verified);
+
+#endif
@@ -106,3 +106,38 @@ sanitize_callsign(char *callsign)
 		++p;
 	}
 }
+
+uint64_t
+callsign_pack(const char *callsign)
+{
+	uint64_t packed = 0;
+	unsigned int ssid = 0;
+	int i;
+
+	for (i = 0; i < AX25_CALL_MAX; ++i)
+	{
+		int c = ' ';
+
+		if (*callsign && *callsign != '-')
+			c = *(callsign++);
+
+		packed = (packed << 8) | (uint8_t) c;
+	}
+
+	if (*callsign == '-')
+		sscanf(callsign, "-%u", &ssid);
+
+	return (packed << 4) | (ssid & CALLSIGN_SSID_MASK);
+}
+
+uint32_t
+callsign_hash(uint64_t packed)
+{
+	/* 64-bit finalizer from MurmurHash3 */
+	packed ^= packed >> 33;
+	packed *= 0xFF51AFD7ED558CCDULL;
+	packed ^= packed >> 33;
+	packed *= 0xC4CEB9FE1A85EC53ULL;
+	packed ^= packed >> 33;
+	return (uint32_t) packed;
+}
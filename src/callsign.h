@@ -32,6 +32,10 @@
 #ifndef WB_CALLSIGN_H
 #define WB_CALLSIGN_H
 
+#include <stdint.h>
+
+#define CALLSIGN_SSID_MASK 0x0F
+
 enum callsign_error
 {
 	NO_ERROR,
@@ -49,4 +53,10 @@ callsign_strerror(int error);
 void
 sanitize_callsign(char *callsign);
 
+uint64_t
+callsign_pack(const char *callsign);
+
+uint32_t
+callsign_hash(uint64_t packed);
+
 #endif
@@ -30,172 +30,615 @@
  */
 
 #include <errno.h>
+#include <poll.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "airtime.h"
 #include "bigbuffer.h"
+#include "budget.h"
+#include "callsign.h"
 #include "chat.h"
+#include "compress.h"
+#include "csma.h"
+#include "fec.h"
+#include "history.h"
+#include "jsonout.h"
 #include "keygen.h"
 #include "keyring.h"
+#include "keywatch.h"
 #include "kiss.h"
+#include "linkq.h"
+#include "os.h"
+#include "reassembly.h"
+#include "repair.h"
+#include "server.h"
+#include "sigcache.h"
+#include "txqueue.h"
 #include "util.h"
 #include "windbag.h"
 
+#define REPAIR_TICK_MS 1000
+#define CATCH_UP_BATCH 65536 /* octets of history sent to a client at once */
+
+/* when to warn that a channel is near saturation */
+#define CHANNEL_BUSY 0.6
+#define CHANNEL_BUSY_WINDOW 60000
+
 struct chat_config
 {
 	struct windbag_config *config;
+	struct io io;
+	KISS_TNC tnc;
+	struct ax25_io kiss_aio;
 	struct ax25_io *aio;
+	struct channel_meter *meter;
+	struct csma *csma;
+
+	/* the keyring is reloaded when it changes on disk */
+	struct keywatch *keywatch;
+	struct keywatch_reader key_reader; /* the reader's */
+	struct ax25_io read_aio; /* offline while waiting for a frame */
+
+	/* with JSON output, what is not a packet goes to stderr */
+	struct jsonout *json;
+	FILE *console;
+
+	/* the daemon's clients, which hear what it hears */
+	struct server *server;
+
+	struct history *history;
+
+	/* one way into the transmit queue for each kind of traffic */
+	struct tx_queue *tx;
+	struct tx_port message_port; /* the writer's */
+	struct tx_port request_port; /* the writer's */
+	struct tx_port answer_port; /* the reader's */
+
+	/* shared by the reader, and the writer when it asks for repairs */
+	pthread_mutex_t lock;
+	struct reassembly *reassembly;
 };
 
+static void
+print_packet(const struct windbag_packet *packet)
+{
+	printf("\n%s", packet->header.src_addr);
+
+	if (packet->signature_status != NO_SIGNATURE)
+	{
+		const char *status;
+		char temp[9 + AX25_ADDR_MAX];
+
+		switch (packet->signature_status)
+		{
+		case GOOD_SIGNATURE:
+			status = "verified";
+			break;
+
+		case ALTERNATE_SIGNATURE:
+			sprintf(temp, "verified %s", packet->verified_callsign);
+			status = temp;
+			break;
+
+		case UNKNOWN_SIGNATURE:
+		case DEFERRED_SIGNATURE:
+			status = "unverified";
+			break;
+
+		case BAD_SIGNATURE:
+			status = "BAD SIGNATURE!";
+			break;
+
+		case THROTTLED_SIGNATURE:
+			status = "unverified, throttled";
+			break;
+
+		default:
+			status = "unknown signature status";
+			break;
+		}
+
+		printf(" (%s)", status);
+	}
+
+	if (packet->multipart_final)
+		printf(" (%u parts)", packet->multipart_final + 1);
+
+	printf(": %s\n", packet->payload->data);
+}
+
+static void
+show_packet(struct chat_config *cc, const struct windbag_packet *packet)
+{
+	if (cc->history && history_append(cc->history, packet) == ENOSPC)
+		fprintf(stderr, "No space left to keep history\n");
+
+	if (cc->server)
+		server_publish(cc->server, packet);
+	else if (cc->json)
+		jsonout_packet(cc->json, packet);
+	else
+		print_packet(packet);
+}
+
+static void
+handle_control(struct chat_config *cc, const struct windbag_packet *packet)
+{
+	const struct windbag_config *config = cc->config;
+	struct repair *repair = config->repair_state;
+
+	if (packet->payload->length == 0
+		|| packet->payload->data[0] != WINDBAG_CONTROL_NACK || !repair)
+		return;
+
+	if (callsign_pack(packet->header.dest_addr)
+		== callsign_pack(config->my_call))
+	{
+		repair_answer(repair, &cc->answer_port.io, packet);
+		if (tx_queue_submit(&cc->answer_port))
+			fprintf(stderr, "Transmit queue full; repair dropped\n");
+		return;
+	}
+
+	pthread_mutex_lock(&cc->lock);
+	repair_overheard(repair, cc->reassembly, packet);
+	pthread_mutex_unlock(&cc->lock);
+}
+
+static void
+handle_packet(struct chat_config *cc, struct windbag_packet *packet,
+	struct windbag_packet *message)
+{
+	struct windbag_config *config = cc->config;
+	int rc;
+
+	link_table_heard(config->link_table, &packet->header);
+
+	if (packet->control)
+	{
+		handle_control(cc, packet);
+		return;
+	}
+
+	if (!packet->multipart_final)
+	{
+		show_packet(cc, packet);
+		return;
+	}
+
+	pthread_mutex_lock(&cc->lock);
+	rc = reassembly_add(cc->reassembly, packet, message);
+	pthread_mutex_unlock(&cc->lock);
+	if (rc <= 0)
+		return;
+
+	if (windbag_finish_message(config, message))
+		return;
+
+	show_packet(cc, message);
+}
+
+/* a reader waiting on the radio holds no keyring, however long it waits */
+static struct ax25_frame *
+read_offline(void *arg)
+{
+	struct chat_config *cc = arg;
+	struct ax25_frame *frame;
+
+	keywatch_offline(&cc->key_reader);
+	frame = cc->aio->read_frame(cc->aio->tnc);
+	keywatch_online(&cc->key_reader);
+	return frame;
+}
+
 static void *
 chat_read(void *input)
 {
 	struct chat_config *cc = (struct chat_config *) input;
-	struct ax25_io *aio = cc->aio;
+	struct ax25_io *aio = &cc->read_aio;
 	struct windbag_config *config = cc->config;
-	struct windbag_packet packet;
-	int rc;
+	struct windbag_packet packet, message;
+	int rc, state;
 
 	rc = windbag_packet_init(&packet);
 	if (rc)
 		return NULL;
 
+	rc = windbag_packet_init(&message);
+	if (rc)
+		goto end;
+
 	for (;;)
 	{
 		if (!windbag_read_packet(&packet, config, aio))
 			continue;
 
-		printf("\n%s", packet.header.src_addr);
+		/* the reader is stopped while waiting, never holding a lock */
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+		handle_packet(cc, &packet, &message);
+		pthread_setcancelstate(state, NULL);
+	}
 
-		if (packet.signature_status != NO_SIGNATURE)
-		{
-			const char *status;
-			char temp[9 + AX25_ADDR_MAX];
+	windbag_packet_cleanup(&message);
+end:
+	windbag_packet_cleanup(&packet);
+	return NULL;
+}
 
-			switch (packet.signature_status)
-			{
-			case GOOD_SIGNATURE:
-				status = "verified";
-				break;
+static void
+print_stats(const struct chat_config *cc)
+{
+	const struct windbag_config *config = cc->config;
+	const struct budget_stats *stats = &config->budget->stats;
 
-			case ALTERNATE_SIGNATURE:
-				sprintf(temp, "verified %s",
-					packet.verified_callsign);
-				status = temp;
-				break;
+	fprintf(cc->console, "Signature verifications: %lu\n", stats->verifications);
+	fprintf(cc->console, "Throttled by source limit: %lu\n", stats->throttled_source);
+	fprintf(cc->console, "Throttled by global limit: %lu\n", stats->throttled_global);
+	fprintf(cc->console, "Messages rebuilt from parity: %lu\n",
+		cc->reassembly->stats.recovered);
 
-			case UNKNOWN_SIGNATURE:
-				status = "unverified";
-				break;
+	if (config->fec_estimator)
+		fprintf(cc->console, "Estimated packet loss: %.1f%%\n",
+			fec_loss(config->fec_estimator) * 100);
 
-			case BAD_SIGNATURE:
-				status = "BAD SIGNATURE!";
-				break;
+	if (config->repair_state)
+	{
+		const struct repair_stats *repair =
+			&config->repair_state->stats;
 
-			default:
-				status = "unknown signature status";
-				break;
-			}
+		fprintf(cc->console, "Repair requests sent: %lu\n", repair->requests_sent);
+		fprintf(cc->console, "Repair requests answered: %lu\n",
+			repair->requests_heard);
+		fprintf(cc->console, "Repair requests held back: %lu\n",
+			repair->requests_suppressed);
+		fprintf(cc->console, "Packets resent: %lu\n", repair->packets_resent);
+		fprintf(cc->console, "Resends held back: %lu\n", repair->resends_held);
+	}
 
-			printf(" (%s)", status);
-		}
+	tx_queue_print_stats(cc->tx, cc->console);
+	channel_meter_print(cc->meter, cc->console);
+
+	if (cc->csma)
+	{
+		struct csma_stats csma;
 
-		if (packet.multipart_final)
-			printf(" (%u/%u)", packet.multipart_index + 1,
-				packet.multipart_final + 1);
+		pthread_mutex_lock(&cc->csma->lock);
+		csma = cc->csma->stats;
+		pthread_mutex_unlock(&cc->csma->lock);
 
-		printf(": %s\n", packet.payload->data);
+		fprintf(cc->console, "Frames heard: %lu\n", csma.frames_heard);
+		fprintf(cc->console, "Frames sent: %lu\n", csma.frames_sent);
+		fprintf(cc->console, "Frames deferred for a busy channel: %lu\n",
+			csma.deferred);
+		fprintf(cc->console, "Slots waited: %lu\n", csma.slots_waited);
 	}
 
-	windbag_packet_cleanup(&packet);
-	return NULL;
+	if (cc->keywatch)
+	{
+		fprintf(cc->console, "Keyring reloads: %lu\n", cc->keywatch->reloads);
+		fprintf(cc->console, "Keyring reloads failed: %lu\n",
+			cc->keywatch->failures);
+	}
+}
+
+static void
+request_repairs(struct chat_config *cc)
+{
+	const struct windbag_config *config = cc->config;
+	struct ax25_header header;
+	uint8_t buf[WINDBAG_CONTROL_MAX];
+	unsigned int length;
+
+	strcpy(header.src_addr, config->my_call);
+	memcpy(header.digi_path, config->digi_path, sizeof header.digi_path);
+
+	pthread_mutex_lock(&cc->lock);
+	length = repair_request(config->repair_state, cc->reassembly,
+				time(NULL), &header, buf, sizeof buf);
+	pthread_mutex_unlock(&cc->lock);
+
+	if (length == 0)
+		return;
+
+	if (windbag_send_control(&cc->request_port.io, &header, buf, length) < 0)
+		tx_port_discard(&cc->request_port);
+	else if (tx_queue_submit(&cc->request_port))
+		fprintf(stderr, "Transmit queue full; repair request dropped\n");
+}
+
+static int
+send_pending(struct chat_config *cc, const struct ax25_header *header,
+	struct bigbuffer *pending)
+{
+	unsigned long airtime;
+	double busy;
+	int written;
+
+	if (pending->length == 0)
+		return 0;
+
+	written = windbag_send_message(cc->config, &cc->message_port.io,
+					header, pending);
+	pending->length = 0;
+	if (written < 0)
+	{
+		tx_port_discard(&cc->message_port);
+		fprintf(stderr, "Error writing to TNC\n");
+		return 1;
+	}
+
+	airtime = tx_port_airtime_ms(&cc->message_port);
+
+	/* a full queue is worth a warning, but not the end of the chat */
+	if (tx_queue_submit(&cc->message_port))
+	{
+		fprintf(stderr, "Transmit queue full; message dropped\n");
+		return 0;
+	}
+
+	fprintf(cc->console, "Queued %d bytes, about %lu.%lus on the air\n", written,
+		airtime / 1000, (airtime % 1000) / 100);
+
+	busy = channel_meter_utilization(cc->meter, CHANNEL_BUSY_WINDOW, NULL);
+	if (busy >= CHANNEL_BUSY)
+		fprintf(cc->console, "The channel has been %.0f%% busy lately\n", busy * 100);
+
+	return 0;
+}
+
+/*
+ * Like Nagle's algorithm: a line is held for up to coalesce_ms in case more
+ * follow, and consecutive lines go out as one message, so a paste costs one
+ * header and one signature instead of one per line.
+ */
+static int
+queue_line(struct chat_config *cc, const struct ax25_header *header,
+	struct bigbuffer *pending, const char *line, unsigned int length,
+	uint64_t *deadline)
+{
+	const struct windbag_config *config = cc->config;
+	int rc;
+
+	if (length == 0)
+		return 0;
+
+	if (pending->length > 0
+		&& pending->length + 1 + length > config->coalesce_bytes)
+	{
+		rc = send_pending(cc, header, pending);
+		if (rc)
+			return rc;
+	}
+
+	if (pending->length == 0)
+		*deadline = monotonic_ms() + config->coalesce_ms;
+	else if (bigbuffer_append(pending, (uint8_t *) "\n", 1))
+		return 1;
+
+	if (bigbuffer_append(pending, (const uint8_t *) line, length))
+		return 1;
+
+	if (config->coalesce_ms == 0
+		|| pending->length >= config->coalesce_bytes)
+		return send_pending(cc, header, pending);
+
+	return 0;
 }
 
 static int
 chat_write(struct chat_config *cc)
 {
 	struct windbag_config *config = cc->config;
-	struct ax25_io *aio = cc->aio;
 	struct ax25_header header;
-	struct bigbuffer *message;
-	char buf[513];
+	struct bigbuffer *pending, *partial;
+	struct pollfd pfd;
+	uint64_t deadline = 0;
+	char buf[512];
 	int rc = 0, done = 0;
 
-	buf[0] = '\0';
-
 	strcpy(header.dest_addr, "CQ");
 	strcpy(header.src_addr, config->my_call);
 	memcpy(header.digi_path, config->digi_path, sizeof header.digi_path);
 
-	message = bigbuffer_new(sizeof buf);
-	if (!message)
+	pending = bigbuffer_new(sizeof buf);
+	if (!pending)
 		return 1;
 
-	while (!done)
+	partial = bigbuffer_new(sizeof buf);
+	if (!partial)
 	{
-		size_t count;
-		char *next = buf, *line_end = NULL;
+		bigbuffer_free(pending);
+		return 1;
+	}
+
+	pfd.fd = STDIN_FILENO;
+	pfd.events = POLLIN;
 
-		printf("> ");
+	fprintf(cc->console, "> ");
+	fflush(cc->console);
 
-		fgets(buf, sizeof buf, stdin);
-		count = strlen(buf);
+	while (!done)
+	{
+		ssize_t count;
+		char *next = buf, *line_end;
+		int timeout = -1;
 
-		while ((line_end = strchr(next, '\n')) != NULL)
+		if (pending->length > 0)
 		{
-			unsigned int line_length = line_end - next;
-			int written;
+			uint64_t now = monotonic_ms();
 
-			*line_end = '\0';
+			timeout = deadline > now ? deadline - now : 0;
+		}
+
+		if (config->repair_state
+			&& (timeout < 0 || timeout > REPAIR_TICK_MS))
+			timeout = REPAIR_TICK_MS;
+
+		count = poll(&pfd, 1, timeout);
+		if (count < 0 && errno == EINTR)
+			continue;
+
+		if (config->repair_state)
+			request_repairs(cc);
 
-			if (strcmp(next, "/exit") == 0)
+		if (count == 0)
+		{
+			if (pending->length > 0 && monotonic_ms() >= deadline)
 			{
-				done = 1;
-				break;
+				rc = send_pending(cc, &header, pending);
+				if (rc)
+					break;
 			}
 
-			bigbuffer_append(message, (uint8_t *) next, line_length);
-			if (message->length > 0)
+			continue;
+		}
+
+		count = read(STDIN_FILENO, buf, sizeof buf);
+		if (count < 0 && errno == EINTR)
+			continue;
+
+		if (count <= 0)
+		{
+			rc = send_pending(cc, &header, pending);
+			break;
+		}
+
+		while ((line_end = memchr(next, '\n', buf + count - next)))
+		{
+			const char *line = next;
+			unsigned int line_length = line_end - next;
+
+			next = line_end + 1;
+
+			/* a line split across reads is completed from partial */
+			if (partial->length > 0)
 			{
-				written = windbag_send_message(config, aio,
-							&header, message);
-				if (written < 0)
+				if (bigbuffer_append(partial, (uint8_t *) line,
+							line_length))
 				{
-					fprintf(stderr, "Error writing to TNC\n");
-					done = 1;
-					rc = 1;
+					rc = done = 1;
 					break;
 				}
 
-				printf("Wrote %d bytes\n", written);
+				line = (char *) partial->data;
+				line_length = partial->length;
+			}
 
-				message->length = 0;
+			if (line_length == 5 && memcmp(line, "/exit", 5) == 0)
+			{
+				rc = send_pending(cc, &header, pending);
+				done = 1;
+				break;
 			}
 
-			next = line_end + 1;
+			if (line_length == 6 && memcmp(line, "/stats", 6) == 0)
+				print_stats(cc);
+			else if (line_length == 6
+				&& memcmp(line, "/links", 6) == 0)
+				link_table_print(cc->config->link_table,
+						cc->console);
+			else if (queue_line(cc, &header, pending, line,
+						line_length, &deadline))
+				rc = done = 1;
+
+			partial->length = 0;
+			if (done)
+				break;
 		}
 
-		bigbuffer_append(message, (uint8_t *) next, count - (next - buf));
+		if (done)
+			break;
+
+		if (bigbuffer_append(partial, (uint8_t *) next,
+					buf + count - next))
+		{
+			rc = 1;
+			break;
+		}
+
+		fprintf(cc->console, "> ");
+		fflush(cc->console);
 	}
 
-	bigbuffer_free(message);
+	bigbuffer_free(partial);
+	bigbuffer_free(pending);
 	return rc;
 }
 
-int
-chat(struct windbag_config *config, int argc, char **argv)
+static int
+start_tx(struct chat_config *cc, const struct ax25_io *aio)
 {
-	struct io io;
-	struct ax25_io aio;
-	KISS_TNC tnc;
-	struct chat_config cc;
-	pthread_t read_thread;
+	const struct windbag_config *config = cc->config;
+	struct airtime_params air;
+	unsigned int airtime[TX_CLASSES];
+
+	config_airtime(config, &air);
+	config_airtime_shares(config, airtime);
+	cc->tx = tx_queue_new(aio, &air, airtime);
+	if (!cc->tx)
+		return 1;
+
+	tx_port_init(&cc->message_port, cc->tx, TX_INTERACTIVE);
+	tx_port_init(&cc->request_port, cc->tx, TX_CONTROL);
+	tx_port_init(&cc->answer_port, cc->tx, TX_CONTROL);
+	return 0;
+}
+
+
+static void
+station_close(struct chat_config *cc)
+{
+	struct windbag_config *config = cc->config;
+
+	if (cc->server)
+		server_free(cc->server);
+	if (cc->history)
+		history_close(cc->history);
+	if (cc->json)
+		jsonout_free(cc->json);
+	if (cc->keywatch)
+		keywatch_free(cc->keywatch);
+	if (cc->tx)
+		tx_queue_free(cc->tx);
+	if (cc->csma)
+		csma_free(cc->csma);
+	if (cc->meter)
+		channel_meter_free(cc->meter);
+	if (config->link_table)
+		link_table_free(config->link_table);
+	if (config->repair_state)
+		repair_free(config->repair_state);
+	if (config->fec_estimator)
+		fec_estimator_free(config->fec_estimator);
+	if (config->dictionary)
+		dictionary_free(config->dictionary);
+	if (cc->reassembly)
+		reassembly_free(cc->reassembly);
+	if (config->budget)
+		budget_free(config->budget);
+	if (config->sig_cache)
+		sig_cache_free(config->sig_cache);
+	if (config->keyring)
+		keyring_free(config->keyring);
+	pthread_mutex_destroy(&cc->lock);
+}
+
+/* sets up everything between the TNC and the user; undo with station_close */
+static int
+station_open(struct chat_config *cc, struct windbag_config *config)
+{
+	struct airtime_params air;
 	int rc;
 
-	UNUSED(argc);
-	UNUSED(argv);
+	memset(cc, 0, sizeof *cc);
+	cc->config = config;
+	cc->console = stdout;
+	pthread_mutex_init(&cc->lock, NULL);
 
 	if (config->my_call[0] == '\0')
 	{
@@ -221,20 +664,39 @@ chat(struct windbag_config *config, int argc, char **argv)
 		rc = keyring_load(config->keyring, config->keyring_path);
 		if (rc == -1)
 		{
-			keyring_free(config->keyring);
 			fprintf(stderr, "Keyring file %s is corrupt.\n",
 				config->keyring_path);
 			return rc;
 		}
 		else if (rc && rc != ENOENT)
 		{
-			keyring_free(config->keyring);
 			fprintf(stderr, "Error opening keyring %s: %s\n",
 				config->keyring_path, strerror(rc));
 			return rc;
 		}
 	}
 
+	if (config->dictionary_path[0] != '\0')
+	{
+		config->dictionary = dictionary_load(config->dictionary_path);
+		if (!config->dictionary)
+		{
+			fprintf(stderr, "Error loading dictionary %s: %s\n",
+				config->dictionary_path, strerror(errno));
+			return 1;
+		}
+	}
+
+	config->sig_cache = sig_cache_new(256, SIG_CACHE_TTL,
+				SIG_CACHE_NO_MATCH_TTL);
+	config->budget = budget_new(256, config->verify_rate,
+				config->verify_source_rate);
+	if (!config->sig_cache || !config->budget)
+	{
+		fprintf(stderr, "Failed to set up signature verification.\n");
+		return 1;
+	}
+
 	if (config->sign_messages)
 	{
 		rc = load_keypair(config);
@@ -242,29 +704,422 @@ chat(struct windbag_config *config, int argc, char **argv)
 			return rc;
 	}
 
-	if (!kiss_init_serial(&tnc, &io, config->tty, config->tty_speed))
+	if (!kiss_init_serial(&cc->tnc, &cc->io, config->tty,
+			config->tty_speed))
+	{
+		rc = errno;
+		fprintf(stderr, "Failed to set up TNC: %s\n", strerror(rc));
+		return rc;
+	}
+
+	cc->kiss_aio.read_frame = (ax25_frame_reader) kiss_read_frame;
+	cc->kiss_aio.write_frame = (ax25_frame_writer) kiss_write_frame;
+	cc->kiss_aio.tnc = (void *) &cc->tnc;
+	cc->kiss_aio.other_frame = NULL;
+
+	cc->aio = &cc->kiss_aio;
+	cc->reassembly = reassembly_new(REASSEMBLY_TIMEOUT,
+				REASSEMBLY_MAX_BYTES,
+				REASSEMBLY_MAX_SENDER_BYTES,
+				REASSEMBLY_MAX_SLOTS);
+	if (!cc->reassembly)
+	{
+		fprintf(stderr, "Failed to set up message reassembly.\n");
+		return 1;
+	}
+
+	config->link_table = link_table_new(LINK_TABLE_STATIONS);
+	if (!config->link_table)
+	{
+		fprintf(stderr, "Failed to set up the link quality table.\n");
+		return 1;
+	}
+
+	cc->reassembly->links = config->link_table;
+
+	config_airtime(config, &air);
+	cc->meter = channel_meter_new(&cc->kiss_aio, &air, config->link_table);
+	if (!cc->meter)
+	{
+		fprintf(stderr, "Failed to set up the channel meter.\n");
+		return 1;
+	}
+
+	cc->aio = &cc->meter->io;
+
+	if (config->csma)
+	{
+		cc->csma = csma_new(cc->aio, config->persist,
+				config->slot_time_ms, &air);
+		if (!cc->csma)
+		{
+			fprintf(stderr, "Failed to set up channel access.\n");
+			return 1;
+		}
+
+		/* so the TNC does not defer a second time */
+		kiss_set_persistence(&cc->tnc, 255);
+		kiss_set_slot_time(&cc->tnc, 0);
+		cc->aio = &cc->csma->io;
+	}
+
+	if (config->fec)
+	{
+		config->fec_estimator = fec_estimator_new(
+			config->fec_max_parity);
+		if (!config->fec_estimator)
+		{
+			fprintf(stderr, "Failed to set up error correction.\n");
+			return 1;
+		}
+
+		cc->reassembly->fec = config->fec_estimator;
+	}
+
+	if (config->repair)
 	{
-		fprintf(stderr, "Failed to set up TNC: %s\n", strerror(errno));
-		return errno;
+		config->repair_state = repair_new(REPAIR_CACHE_PACKETS,
+						REPAIR_CACHE_TTL);
+		if (!config->repair_state)
+		{
+			fprintf(stderr, "Failed to set up message repair.\n");
+			return 1;
+		}
 	}
 
-	aio.read_frame = (ax25_frame_reader) kiss_read_frame;
-	aio.write_frame = (ax25_frame_writer) kiss_write_frame;
-	aio.tnc = (void *) &tnc;
+	cc->read_aio = *cc->aio;
+	cc->read_aio.read_frame = read_offline;
+	cc->read_aio.tnc = cc;
 
-	cc.config = config;
-	cc.aio = &aio;
+	if (start_tx(cc, cc->aio))
+	{
+		fprintf(stderr, "Failed to set up the transmit queue.\n");
+		return 1;
+	}
+
+	if (config->keyring_path[0] != '\0')
+	{
+		cc->keywatch = keywatch_new(&config->keyring,
+					config->keyring_path);
+		if (cc->keywatch)
+			keywatch_register(cc->keywatch, &cc->key_reader);
+		else
+			fprintf(stderr, "Failed to watch the keyring; "
+				"changes to it take a restart.\n");
+	}
+
+	if (config->history)
+	{
+		char dir[MAX_FILE_PATH];
+
+		if (config->history_path[0] != '\0')
+			strcpy(dir, config->history_path);
+		else
+			history_default_path(dir, sizeof dir);
+
+		/* chat goes on without it; the messages are still shown */
+		cc->history = history_open(dir,
+			(uint64_t) config->history_size * 1024,
+			config->history_days);
+		if (!cc->history)
+			fprintf(stderr, "Not keeping history in %s: %s\n", dir,
+				strerror(errno));
+	}
+
+	return 0;
+}
+
+/* stops the reader, once what was queued has gone out */
+static void
+stop_reader(struct chat_config *cc, pthread_t read_thread)
+{
+	tx_queue_drain(cc->tx);
+	pthread_cancel(read_thread);
+	pthread_join(read_thread, NULL);
+}
+
+int
+chat(struct windbag_config *config, int argc, char **argv)
+{
+	struct chat_config cc;
+	pthread_t read_thread;
+	int rc;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	rc = station_open(&cc, config);
+	if (rc)
+		goto end;
+
+	if (config->output == OUTPUT_JSON)
+	{
+		cc.json = jsonout_new(STDOUT_FILENO, JSONOUT_FLUSH_BYTES,
+				JSONOUT_IDLE_MS);
+		if (!cc.json)
+		{
+			fprintf(stderr, "Failed to set up JSON output.\n");
+			rc = 1;
+			goto end;
+		}
+
+		cc.console = stderr;
+	}
 
 	rc = pthread_create(&read_thread, NULL, chat_read, &cc);
 	if (rc)
 	{
 		fprintf(stderr, "Error starting read thread\n");
-		return rc;
+		goto end;
 	}
 
 	rc = chat_write(&cc);
-	pthread_cancel(read_thread);
-	keyring_free(config->keyring);
 
+	/* what was typed before leaving should still go out */
+	stop_reader(&cc, read_thread);
+
+end:
+	station_close(&cc);
+	return rc;
+}
+
+/* a client's catch-up, sent a batch at a time as it takes each */
+struct catch_up
+{
+	struct history_cursor *cursor;
+	struct bigbuffer *buf;
+	int failed;
+};
+
+static int
+catch_up_message(void *arg, const struct windbag_packet *packet,
+	uint64_t time_ms)
+{
+	struct catch_up *up = arg;
+	struct timespec when;
+
+	when.tv_sec = time_ms / 1000;
+	when.tv_nsec = (time_ms % 1000) * 1000000;
+
+	if (jsonout_format(up->buf, packet, &when))
+	{
+		up->failed = 1;
+		return 1;
+	}
+
+	return up->buf->length >= CATCH_UP_BATCH;
+}
+
+static void
+reply_error(struct chat_config *cc, struct server_client *client,
+	const char *error)
+{
+	char buf[128];
+
+	snprintf(buf, sizeof buf, "{\"error\":\"%s\"}\n", error);
+	server_reply(cc->server, client, (const uint8_t *) buf, strlen(buf));
+}
+
+/* the next batch of a client's catch-up, once it has taken the last */
+static void
+catch_up_more(void *arg, struct server_client *client)
+{
+	struct chat_config *cc = arg;
+	struct catch_up *up = client->pending;
+	int more;
+
+	if (client->dead)
+		goto done;
+
+	up->buf->length = 0;
+	more = history_cursor_next(up->cursor, catch_up_message, up);
+
+	if (up->buf->length && server_reply(cc->server, client,
+			up->buf->data, up->buf->length))
+		goto done;
+
+	if (up->failed)
+		reply_error(cc, client, strerror(ENOMEM));
+	else if (more)
+		return;
+
+done:
+	history_cursor_close(up->cursor);
+	bigbuffer_free(up->buf);
+	free(up);
+	client->pending = NULL;
+}
+
+/*
+ * /since <time>: what was heard since then, for a client catching up. It
+ * is only looked up here; the server asks for it a batch at a time.
+ */
+static void
+catch_up(struct chat_config *cc, struct server_client *client,
+	const char *since)
+{
+	struct history_query query;
+	struct catch_up *up;
+	int rc;
+
+	if (!cc->history)
+	{
+		reply_error(cc, client, "history is off");
+		return;
+	}
+
+	if (client->pending)
+	{
+		reply_error(cc, client, "already catching up");
+		return;
+	}
+
+	memset(&query, 0, sizeof query);
+	query.until_ms = UINT64_MAX;
+	if (history_parse_time(since, &query.since_ms))
+	{
+		reply_error(cc, client, "bad time");
+		return;
+	}
+
+	up = calloc(1, sizeof (struct catch_up));
+	if (!up)
+		return;
+
+	up->buf = bigbuffer_new(CATCH_UP_BATCH + AX25_INFO_MAX * 8);
+	if (!up->buf)
+	{
+		free(up);
+		return;
+	}
+
+	rc = history_cursor_open(cc->history->dir, &query, &up->cursor);
+	if (rc)
+	{
+		reply_error(cc, client, strerror(rc));
+		bigbuffer_free(up->buf);
+		free(up);
+		return;
+	}
+
+	client->pending = up;
+}
+
+/* a line from a daemon client, sent just as if typed into chat */
+static void
+submit_line(void *arg, struct server_client *client, const char *line,
+	unsigned int length)
+{
+	struct chat_config *cc = arg;
+	const struct windbag_config *config = cc->config;
+	struct ax25_header header;
+	struct bigbuffer *message;
+
+	message = bigbuffer_new(length + 1);
+	if (!message)
+		return;
+
+	if (bigbuffer_append(message, (const uint8_t *) line, length))
+		goto end;
+
+	if (line[0] == '/')
+	{
+		bigbuffer_terminate(message);
+		if (length > 7 && memcmp(line, "/since ", 7) == 0)
+			catch_up(cc, client, (char *) message->data + 7);
+		else
+			reply_error(cc, client, "unknown command");
+
+		goto end;
+	}
+
+	strcpy(header.dest_addr, "CQ");
+	strcpy(header.src_addr, config->my_call);
+	memcpy(header.digi_path, config->digi_path, sizeof header.digi_path);
+
+	send_pending(cc, &header, message);
+
+end:
+	bigbuffer_free(message);
+}
+
+int
+windbag_daemon(struct windbag_config *config, int argc, char **argv)
+{
+	struct chat_config cc;
+	char path[MAX_FILE_PATH];
+	pthread_t read_thread;
+	sigset_t signals;
+	int rc;
+
+	if (argc > 1)
+	{
+		fprintf(stderr, "Usage: windbag daemon [socket]\n");
+		return -1;
+	}
+
+	if (argc == 1)
+	{
+		strncpy(path, argv[0], sizeof path - 1);
+		path[sizeof path - 1] = '\0';
+	}
+	else
+	{
+		default_config_dir_path(path, sizeof path);
+		strncat(path, FILE_SEPARATOR, sizeof path - strlen(path) - 1);
+		strncat(path, SERVER_SOCKET_NAME,
+			sizeof path - strlen(path) - 1);
+	}
+
+	/* taken by this thread alone, before there are others */
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	sigaddset(&signals, SIGHUP);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	rc = station_open(&cc, config);
+	if (rc)
+		goto end;
+
+	/* there is no terminal to chat on, so notices are logged */
+	cc.console = stderr;
+
+	cc.server = server_new(path, submit_line, catch_up_more, &cc);
+	if (!cc.server)
+	{
+		rc = errno;
+		fprintf(stderr, "Error listening on %s: %s\n", path,
+			strerror(rc));
+		goto end;
+	}
+
+	rc = pthread_create(&read_thread, NULL, chat_read, &cc);
+	if (rc)
+	{
+		fprintf(stderr, "Error starting read thread\n");
+		goto end;
+	}
+
+	fprintf(stderr, "Listening on %s\n", path);
+
+	for (;;)
+	{
+		struct timespec tick;
+
+		tick.tv_sec = REPAIR_TICK_MS / 1000;
+		tick.tv_nsec = (REPAIR_TICK_MS % 1000) * 1000000L;
+		if (sigtimedwait(&signals, NULL, &tick) > 0)
+			break;
+
+		if (config->repair_state)
+			request_repairs(&cc);
+	}
+
+	/* the reader publishes to the clients, so it stops first */
+	stop_reader(&cc, read_thread);
+
+end:
+	station_close(&cc);
 	return rc;
 }
@@ -38,4 +38,7 @@
 int
 chat(struct windbag_config *config, int argc, char **argv);
 
+int
+windbag_daemon(struct windbag_config *config, int argc, char **argv);
+
 #endif
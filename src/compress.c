@@ -0,0 +1,780 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sodium.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compress.h"
+#include "util.h"
+
+/*
+ * A small LZ77 codec whose window starts out holding a dictionary of
+ * strings common in chat traffic, so even short messages find matches.
+ *
+ * A compressed message is the dictionary ID followed by a series of tokens:
+ *
+ *   0LLLLLLL <L + 1 literal bytes>
+ *   1LLLLOOO OOOOOOOO [extra length]
+ *
+ * A match copies (L + 3) bytes from (O + 1) bytes back in the window. When
+ * L is 15, another octet follows and is added to the length.
+ */
+
+#define HASH_BITS 12
+#define HASH_SIZE (1 << HASH_BITS)
+#define MIN_MATCH 3
+#define SHORT_MATCH_MAX (MIN_MATCH + 14)
+#define MAX_MATCH (SHORT_MATCH_MAX + 1 + 255)
+#define MAX_OFFSET 2048
+#define MAX_LITERALS 128
+#define MAX_CHAIN 32
+#define MAX_OUTPUT (512 * 1024)
+
+#define NO_POSITION 0xFFFFFFFF
+
+static const char BUILTIN[] =
+	"Please Thank you for the information. antenna repeater frequency "
+	"simplex offset tone band conditions propagation contest field day "
+	"battery solar power supply transceiver handheld mobile base station "
+	"license club meeting net control check in check out emergency traffic "
+	"weather packet digipeater APRS KISS TNC windbag message received copy "
+	"readable signal report strength noise QRM QSB QSY QRZ? QRT QTH QSL "
+	"QSO 73 CQ CQ de over. Roger that say again standing by talk to you "
+	"later see you tomorrow this morning this afternoon this evening today "
+	"right now don't can't didn't won't that's it's I'm I'll I've there "
+	"their they them then than what when where which while would could "
+	"should about after again because good have here just know like look "
+	"make more much need never nice only other people really some "
+	"something still sure thanks think time very want well were will work "
+	"yeah yes your going to at the on the in the to the of the for the "
+	"with the from the and the is the that the it is I am ";
+
+static struct dictionary builtin;
+static pthread_once_t builtin_once = PTHREAD_ONCE_INIT;
+
+static unsigned int
+hash3(const uint8_t *p)
+{
+	uint32_t v = p[0] | (p[1] << 8) | ((uint32_t) p[2] << 16);
+	return (v * 2654435761U) >> (32 - HASH_BITS);
+}
+
+static int
+index_dictionary(struct dictionary *dict)
+{
+	unsigned int i;
+
+	dict->head = malloc(HASH_SIZE * sizeof (uint32_t));
+	if (!dict->head)
+		return ENOMEM;
+
+	memset(dict->head, 0xFF, HASH_SIZE * sizeof (uint32_t));
+	for (i = 0; i + MIN_MATCH <= dict->length; ++i)
+	{
+		unsigned int h = hash3(dict->data + i);
+
+		dict->prev[i] = dict->head[h];
+		dict->head[h] = i;
+	}
+
+	for (; i < dict->length; ++i)
+		dict->prev[i] = NO_POSITION;
+
+	return 0;
+}
+
+static void
+init_builtin(void)
+{
+	builtin.id = BUILTIN_DICTIONARY_ID;
+	builtin.length = sizeof BUILTIN - 1;
+	memcpy(builtin.data, BUILTIN, builtin.length);
+
+	if (index_dictionary(&builtin))
+		builtin.length = 0;
+}
+
+const struct dictionary *
+builtin_dictionary(void)
+{
+	pthread_once(&builtin_once, init_builtin);
+	return builtin.length ? &builtin : NULL;
+}
+
+struct dictionary *
+dictionary_new(const uint8_t *data, unsigned int length)
+{
+	struct dictionary *dict;
+	unsigned char hash[crypto_generichash_BYTES_MIN];
+
+	if (length > DICTIONARY_MAX)
+		return NULL;
+
+	dict = malloc(sizeof (struct dictionary));
+	if (!dict)
+		return NULL;
+
+	dict->length = length;
+	memcpy(dict->data, data, length);
+
+	/* the ID only has to tell dictionaries apart; 0 is the built-in one */
+	crypto_generichash(hash, sizeof hash, data, length, NULL, 0);
+	dict->id = hash[0] ? hash[0] : 1;
+
+	if (index_dictionary(dict))
+	{
+		free(dict);
+		return NULL;
+	}
+
+	return dict;
+}
+
+struct dictionary *
+dictionary_load(const char *path)
+{
+	uint8_t buf[DICTIONARY_MAX + 1];
+	size_t length;
+	FILE *f;
+
+	f = fopen(path, "rb");
+	if (!f)
+		return NULL;
+
+	length = fread(buf, 1, sizeof buf, f);
+	fclose(f);
+
+	if (length == 0 || length > DICTIONARY_MAX)
+	{
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return dictionary_new(buf, length);
+}
+
+void
+dictionary_free(struct dictionary *dict)
+{
+	free(dict->head);
+	free(dict);
+}
+
+static int
+flush_literals(struct bigbuffer *out, const uint8_t *start, unsigned int n)
+{
+	while (n)
+	{
+		unsigned int run = n > MAX_LITERALS ? MAX_LITERALS : n;
+		uint8_t c = run - 1;
+
+		if (bigbuffer_append(out, &c, 1)
+			|| bigbuffer_append(out, start, run))
+			return -1;
+
+		start += run;
+		n -= run;
+	}
+
+	return 0;
+}
+
+static int
+emit_match(struct bigbuffer *out, unsigned int length, unsigned int offset)
+{
+	uint8_t token[3];
+	unsigned int n = 2, l = length - MIN_MATCH;
+
+	--offset;
+	if (l > 15)
+		l = 15;
+
+	token[0] = 0x80 | (l << 3) | (offset >> 8);
+	token[1] = offset & 0xFF;
+	if (l == 15)
+		token[n++] = length - SHORT_MATCH_MAX - 1;
+
+	return bigbuffer_append(out, token, n);
+}
+
+struct bigbuffer *
+compress_message(const struct dictionary *dict, const uint8_t *src,
+		unsigned int length)
+{
+	struct bigbuffer *out;
+	uint8_t *window;
+	uint32_t *head, *prev;
+	unsigned int total, pos, literal_start;
+
+	total = dict->length + length;
+	window = malloc(total);
+	head = malloc(HASH_SIZE * sizeof (uint32_t));
+	prev = malloc(total * sizeof (uint32_t));
+	out = bigbuffer_new(length + 1);
+	if (!window || !head || !prev || !out)
+		goto fail;
+
+	memcpy(window, dict->data, dict->length);
+	memcpy(window + dict->length, src, length);
+	memcpy(head, dict->head, HASH_SIZE * sizeof (uint32_t));
+	memcpy(prev, dict->prev, dict->length * sizeof (uint32_t));
+
+	out->data[0] = dict->id;
+	out->length = 1;
+
+	pos = literal_start = dict->length;
+	while (pos < total)
+	{
+		unsigned int best_length = 0, best_offset = 0, step, i;
+
+		if (pos + MIN_MATCH <= total)
+		{
+			unsigned int h = hash3(window + pos);
+			uint32_t candidate = head[h];
+			unsigned int chain = 0, max = total - pos;
+
+			if (max > MAX_MATCH)
+				max = MAX_MATCH;
+
+			for (; candidate != NO_POSITION
+				     && pos - candidate <= MAX_OFFSET
+				     && chain < MAX_CHAIN;
+			     candidate = prev[candidate], ++chain)
+			{
+				unsigned int n = 0;
+
+				while (n < max && window[candidate + n]
+					== window[pos + n])
+					++n;
+
+				if (n > best_length)
+				{
+					best_length = n;
+					best_offset = pos - candidate;
+					if (n == max)
+						break;
+				}
+			}
+		}
+
+		if (best_length < MIN_MATCH)
+		{
+			best_length = 0;
+			step = 1;
+		}
+		else
+		{
+			if (flush_literals(out, window + literal_start,
+						pos - literal_start)
+				|| emit_match(out, best_length, best_offset))
+				goto fail;
+
+			step = best_length;
+		}
+
+		for (i = 0; i < step; ++i, ++pos)
+		{
+			if (pos + MIN_MATCH <= total)
+			{
+				unsigned int h = hash3(window + pos);
+
+				prev[pos] = head[h];
+				head[h] = pos;
+			}
+			else
+			{
+				prev[pos] = NO_POSITION;
+			}
+		}
+
+		if (best_length)
+			literal_start = pos;
+
+		/* not worth it; the caller sends the message as it is */
+		if (out->length >= length)
+			goto fail;
+	}
+
+	if (flush_literals(out, window + literal_start, pos - literal_start)
+		|| out->length >= length)
+		goto fail;
+
+	free(window);
+	free(head);
+	free(prev);
+	return out;
+
+fail:
+	free(window);
+	free(head);
+	free(prev);
+	if (out)
+		bigbuffer_free(out);
+	return NULL;
+}
+
+int
+decompress_message(const struct dictionary *custom, const uint8_t *src,
+		unsigned int length, struct bigbuffer *dest)
+{
+	const struct dictionary *dict;
+	const uint8_t *end = src + length;
+	struct bigbuffer *window;
+	int rc = 0;
+
+	if (length == 0)
+		return EINVAL;
+
+	if (*src == BUILTIN_DICTIONARY_ID)
+		dict = builtin_dictionary();
+	else if (custom && *src == custom->id)
+		dict = custom;
+	else
+		return ENOENT;
+
+	if (!dict)
+		return ENOMEM;
+
+	window = bigbuffer_new(dict->length + length * 4 + 1);
+	if (!window)
+		return ENOMEM;
+
+	memcpy(window->data, dict->data, dict->length);
+	window->length = dict->length;
+
+	++src;
+	while (src < end)
+	{
+		unsigned int c = *(src++);
+
+		if (c & 0x80)
+		{
+			unsigned int n, offset, i;
+
+			if (end - src < 1)
+				goto corrupt;
+
+			n = ((c >> 3) & 0x0F) + MIN_MATCH;
+			offset = (((c & 0x07) << 8) | *(src++)) + 1;
+			if (n == SHORT_MATCH_MAX + 1)
+			{
+				if (end - src < 1)
+					goto corrupt;
+
+				n += *(src++);
+			}
+
+			if (offset > window->length
+				|| window->length - dict->length + n > MAX_OUTPUT)
+				goto corrupt;
+
+			/* overlapping copies are how runs are encoded */
+			for (i = 0; i < n; ++i)
+			{
+				uint8_t b = window->data[window->length - offset];
+
+				if (bigbuffer_append(window, &b, 1))
+				{
+					rc = ENOMEM;
+					goto end;
+				}
+			}
+		}
+		else
+		{
+			unsigned int n = c + 1;
+
+			if ((unsigned int) (end - src) < n
+				|| window->length - dict->length + n > MAX_OUTPUT)
+				goto corrupt;
+
+			if (bigbuffer_append(window, src, n))
+			{
+				rc = ENOMEM;
+				goto end;
+			}
+
+			src += n;
+		}
+	}
+
+	dest->length = 0;
+	if (bigbuffer_append(dest, window->data + dict->length,
+				window->length - dict->length))
+		rc = ENOMEM;
+	else
+		bigbuffer_terminate(dest);
+
+	goto end;
+
+corrupt:
+	rc = EINVAL;
+end:
+	bigbuffer_free(window);
+	return rc;
+}
+
+#define MAX_PHRASE_WORDS 3
+#define MAX_PHRASE 64
+
+struct phrase
+{
+	char *text;
+	unsigned int length;
+	unsigned long count;
+	unsigned long score;
+};
+
+struct phrase_table
+{
+	struct phrase *entries;
+	unsigned long mask;
+	unsigned long used;
+};
+
+static unsigned long
+hash_string(const char *s, unsigned int length)
+{
+	unsigned long h = 14695981039346656037UL;
+	unsigned int i;
+
+	for (i = 0; i < length; ++i)
+		h = (h ^ (uint8_t) s[i]) * 1099511628211UL;
+
+	return h;
+}
+
+static int
+grow_phrases(struct phrase_table *t)
+{
+	struct phrase *old = t->entries;
+	unsigned long old_size = old ? t->mask + 1 : 0, i;
+	unsigned long size = old ? old_size * 2 : 4096;
+
+	t->entries = calloc(size, sizeof (struct phrase));
+	if (!t->entries)
+	{
+		t->entries = old;
+		return ENOMEM;
+	}
+
+	t->mask = size - 1;
+	for (i = 0; i < old_size; ++i)
+	{
+		unsigned long j;
+
+		if (!old[i].text)
+			continue;
+
+		j = hash_string(old[i].text, old[i].length) & t->mask;
+		while (t->entries[j].text)
+			j = (j + 1) & t->mask;
+
+		t->entries[j] = old[i];
+	}
+
+	free(old);
+	return 0;
+}
+
+static int
+count_phrase(struct phrase_table *t, const char *s, unsigned int length)
+{
+	unsigned long i;
+
+	if ((t->used + 1) * 2 > t->mask + 1 && grow_phrases(t))
+		return ENOMEM;
+
+	i = hash_string(s, length) & t->mask;
+	for (; t->entries[i].text; i = (i + 1) & t->mask)
+	{
+		struct phrase *p = &t->entries[i];
+
+		if (p->length == length && memcmp(p->text, s, length) == 0)
+		{
+			++p->count;
+			return 0;
+		}
+	}
+
+	t->entries[i].text = malloc(length + 1);
+	if (!t->entries[i].text)
+		return ENOMEM;
+
+	memcpy(t->entries[i].text, s, length);
+	t->entries[i].text[length] = '\0';
+	t->entries[i].length = length;
+	t->entries[i].count = 1;
+	++t->used;
+	return 0;
+}
+
+/* counts every run of up to MAX_PHRASE_WORDS words, each with its space */
+static int
+count_line(struct phrase_table *t, const char *line)
+{
+	const char *starts[MAX_PHRASE_WORDS];
+	unsigned int n = 0, i;
+	const char *p = line;
+
+	for (;;)
+	{
+		const char *end;
+
+		while (*p == ' ' || *p == '\t')
+			++p;
+
+		if (*p == '\0' || *p == '\n' || *p == '\r')
+			break;
+
+		end = p;
+		while (*end && *end != ' ' && *end != '\t' && *end != '\n'
+			&& *end != '\r')
+			++end;
+
+		if (n == MAX_PHRASE_WORDS)
+		{
+			memmove(starts, starts + 1,
+				(MAX_PHRASE_WORDS - 1) * sizeof *starts);
+			--n;
+		}
+		starts[n++] = p;
+
+		/* include the separator, since it will usually be there */
+		if (*end == ' ')
+			++end;
+
+		for (i = 0; i < n; ++i)
+		{
+			unsigned int length = end - starts[i];
+			int rc;
+
+			if (length < MIN_MATCH || length > MAX_PHRASE)
+				continue;
+
+			rc = count_phrase(t, starts[i], length);
+			if (rc)
+				return rc;
+		}
+
+		p = end;
+	}
+
+	return 0;
+}
+
+static int
+contains(const uint8_t *data, unsigned int length, const struct phrase *p)
+{
+	unsigned int i;
+
+	for (i = 0; i + p->length <= length; ++i)
+		if (memcmp(data + i, p->text, p->length) == 0)
+			return 1;
+
+	return 0;
+}
+
+static int
+compare_score(const void *a, const void *b)
+{
+	const struct phrase *pa = a, *pb = b;
+
+	if (pa->score != pb->score)
+		return pa->score < pb->score ? 1 : -1;
+
+	return strcmp(pa->text, pb->text);
+}
+
+static void
+report_ratio(const struct dictionary *dict, FILE *corpus)
+{
+	char line[512];
+	unsigned long original = 0, compressed = 0;
+
+	rewind(corpus);
+	while (fgets(line, sizeof line, corpus))
+	{
+		unsigned int length = strcspn(line, "\r\n");
+		struct bigbuffer *out;
+
+		if (length == 0)
+			continue;
+
+		original += length;
+		out = compress_message(dict, (uint8_t *) line, length);
+		if (out)
+		{
+			compressed += out->length;
+			bigbuffer_free(out);
+		}
+		else
+		{
+			compressed += length;
+		}
+	}
+
+	if (original)
+	{
+		printf("Dictionary %u: %lu bytes of messages to %lu (%.1f%%)\n",
+			dict->id, original, compressed,
+			100.0 * compressed / original);
+	}
+}
+
+int
+train_dictionary(struct windbag_config *config, int argc, char **argv)
+{
+	struct phrase_table t = { NULL, 0, 0 };
+	struct dictionary *dict = NULL;
+	uint8_t data[DICTIONARY_MAX];
+	unsigned int length = 0;
+	unsigned long i, n = 0;
+	char line[512];
+	FILE *corpus, *out;
+	int rc = 0;
+
+	UNUSED(config);
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: train-dictionary <corpus> <output>\n");
+		return 1;
+	}
+
+	corpus = fopen(argv[0], "r");
+	if (!corpus)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", argv[0],
+			strerror(errno));
+		return 1;
+	}
+
+	rc = grow_phrases(&t);
+	while (!rc && fgets(line, sizeof line, corpus))
+		rc = count_line(&t, line);
+
+	if (rc)
+	{
+		fprintf(stderr, "Error reading corpus: %s\n", strerror(rc));
+		goto end;
+	}
+
+	/* a phrase is worth what it saves: its length less a match token */
+	for (i = 0; i <= t.mask; ++i)
+	{
+		if (!t.entries[i].text)
+			continue;
+
+		if (t.entries[i].count < 2)
+		{
+			free(t.entries[i].text);
+			t.entries[i].text = NULL;
+			continue;
+		}
+
+		t.entries[n] = t.entries[i];
+		if (n != i)
+			t.entries[i].text = NULL;
+		t.entries[n].score = (t.entries[n].count - 1)
+			* (t.entries[n].length - 2);
+		++n;
+	}
+
+	qsort(t.entries, n, sizeof (struct phrase), compare_score);
+
+	/*
+	 * Choose greedily from the most valuable down, then lay the choices
+	 * out backward so the best land nearest the message, where matches
+	 * against them are cheapest to find.
+	 */
+	for (i = 0; i < n && length < DICTIONARY_MAX; ++i)
+	{
+		struct phrase *p = &t.entries[i];
+
+		if (length + p->length > DICTIONARY_MAX)
+			continue;
+
+		if (contains(data + DICTIONARY_MAX - length, length, p))
+			continue;
+
+		length += p->length;
+		memcpy(data + DICTIONARY_MAX - length, p->text, p->length);
+	}
+
+	if (length == 0)
+	{
+		fprintf(stderr, "Corpus has no repeated phrases to learn.\n");
+		rc = 1;
+		goto end;
+	}
+
+	out = fopen(argv[1], "wb");
+	if (!out)
+	{
+		rc = errno;
+		fprintf(stderr, "Error opening %s: %s\n", argv[1],
+			strerror(rc));
+		goto end;
+	}
+
+	if (fwrite(data + DICTIONARY_MAX - length, 1, length, out) != length)
+		rc = errno;
+
+	if (fclose(out) && !rc)
+		rc = errno;
+
+	if (rc)
+	{
+		fprintf(stderr, "Error writing %s: %s\n", argv[1],
+			strerror(rc));
+		goto end;
+	}
+
+	dict = dictionary_new(data + DICTIONARY_MAX - length, length);
+	if (dict)
+	{
+		report_ratio(builtin_dictionary(), corpus);
+		report_ratio(dict, corpus);
+		dictionary_free(dict);
+	}
+
+end:
+	for (i = 0; t.entries && i <= t.mask; ++i)
+		free(t.entries[i].text);
+	free(t.entries);
+	fclose(corpus);
+	return rc;
+}
@@ -0,0 +1,77 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef WB_COMPRESS_H
+#define WB_COMPRESS_H
+
+#include <stdint.h>
+
+#include "bigbuffer.h"
+#include "config.h"
+
+#define DICTIONARY_MAX 1024
+#define BUILTIN_DICTIONARY_ID 0
+
+struct dictionary
+{
+	uint8_t id;
+	unsigned int length;
+	uint8_t data[DICTIONARY_MAX];
+
+	/* hash chains over the dictionary, so each message need not redo them */
+	uint32_t *head;
+	uint32_t prev[DICTIONARY_MAX];
+};
+
+const struct dictionary *
+builtin_dictionary(void);
+
+struct dictionary *
+dictionary_new(const uint8_t *data, unsigned int length);
+
+struct dictionary *
+dictionary_load(const char *path);
+
+void
+dictionary_free(struct dictionary *dict);
+
+struct bigbuffer *
+compress_message(const struct dictionary *dict, const uint8_t *src,
+		unsigned int length);
+
+int
+decompress_message(const struct dictionary *custom, const uint8_t *src,
+		unsigned int length, struct bigbuffer *dest);
+
+int
+train_dictionary(struct windbag_config *config, int argc, char **argv);
+
+#endif
@@ -34,12 +34,15 @@
 #include <libgen.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <termios.h>
 
+#include "ax25link.h"
 #include "callsign.h"
 #include "config.h"
 #include "os.h"
 #include "tty.h"
+#include "txqueue.h"
 #include "util.h"
 
 const char * const CONFIG_FILE_NAME = "windbag.conf";
@@ -208,6 +211,292 @@ set_keyring_path(struct windbag_config *config, const char *args)
 	return 0;
 }
 
+static int
+parse_uint(const char *name, const char *args, unsigned int *dest)
+{
+	unsigned int value;
+	char c;
+
+	if (sscanf(args, "%u%c", &value, &c) != 1)
+	{
+		fprintf(stderr, "Syntax error in %s\n", name);
+		return 1;
+	}
+
+	*dest = value;
+	return 0;
+}
+
+static int
+parse_bool(const char *name, const char *args, int *dest)
+{
+	static const char * const TRUE_WORDS[] = { "yes", "on", "true", "1" };
+	static const char * const FALSE_WORDS[] = { "no", "off", "false", "0" };
+	unsigned int i;
+
+	for (i = 0; i < sizeof TRUE_WORDS / sizeof TRUE_WORDS[0]; ++i)
+	{
+		if (strcasecmp(args, TRUE_WORDS[i]) == 0)
+		{
+			*dest = 1;
+			return 0;
+		}
+
+		if (strcasecmp(args, FALSE_WORDS[i]) == 0)
+		{
+			*dest = 0;
+			return 0;
+		}
+	}
+
+	fprintf(stderr, "%s must be yes or no\n", name);
+	return 1;
+}
+
+static int
+set_defer_signatures(struct windbag_config *config, const char *args)
+{
+	return parse_bool("defer-signatures", args,
+			&config->defer_signatures);
+}
+
+static int
+set_verify_rate(struct windbag_config *config, const char *args)
+{
+	return parse_uint("verify-rate", args, &config->verify_rate);
+}
+
+static int
+set_verify_source_rate(struct windbag_config *config, const char *args)
+{
+	return parse_uint("verify-source-rate", args,
+			&config->verify_source_rate);
+}
+
+static int
+set_compress(struct windbag_config *config, const char *args)
+{
+	return parse_bool("compress", args, &config->compress);
+}
+
+static int
+set_dictionary_path(struct windbag_config *config, const char *args)
+{
+	strncpy(config->dictionary_path, args,
+		sizeof config->dictionary_path - 1);
+	return 0;
+}
+
+static int
+set_coalesce_ms(struct windbag_config *config, const char *args)
+{
+	return parse_uint("coalesce-ms", args, &config->coalesce_ms);
+}
+
+static int
+set_coalesce_bytes(struct windbag_config *config, const char *args)
+{
+	return parse_uint("coalesce-bytes", args, &config->coalesce_bytes);
+}
+
+static int
+set_fec(struct windbag_config *config, const char *args)
+{
+	return parse_bool("fec", args, &config->fec);
+}
+
+static int
+set_fec_max_parity(struct windbag_config *config, const char *args)
+{
+	return parse_uint("fec-max-parity", args, &config->fec_max_parity);
+}
+
+static int
+set_repair(struct windbag_config *config, const char *args)
+{
+	return parse_bool("repair", args, &config->repair);
+}
+
+static int
+set_adapt_fragments(struct windbag_config *config, const char *args)
+{
+	return parse_bool("adapt-fragments", args, &config->adapt_fragments);
+}
+
+static int
+set_air_baud(struct windbag_config *config, const char *args)
+{
+	return parse_uint("air-baud", args, &config->air_baud);
+}
+
+static int
+set_txdelay(struct windbag_config *config, const char *args)
+{
+	return parse_uint("txdelay", args, &config->txdelay_ms);
+}
+
+static int
+set_txtail(struct windbag_config *config, const char *args)
+{
+	return parse_uint("txtail", args, &config->txtail_ms);
+}
+
+static int
+set_airtime_interactive(struct windbag_config *config, const char *args)
+{
+	return parse_uint("airtime-interactive", args,
+			&config->airtime_interactive);
+}
+
+static int
+set_airtime_control(struct windbag_config *config, const char *args)
+{
+	return parse_uint("airtime-control", args, &config->airtime_control);
+}
+
+static int
+set_airtime_bulk(struct windbag_config *config, const char *args)
+{
+	return parse_uint("airtime-bulk", args, &config->airtime_bulk);
+}
+
+static int
+set_airtime_beacon(struct windbag_config *config, const char *args)
+{
+	return parse_uint("airtime-beacon", args, &config->airtime_beacon);
+}
+
+static int
+set_csma(struct windbag_config *config, const char *args)
+{
+	return parse_bool("csma", args, &config->csma);
+}
+
+static int
+set_persist(struct windbag_config *config, const char *args)
+{
+	int rc = parse_uint("persist", args, &config->persist);
+
+	if (!rc && config->persist > 255)
+	{
+		fprintf(stderr, "persist must be between 0 and 255\n");
+		return 1;
+	}
+
+	return rc;
+}
+
+static int
+set_slot_time(struct windbag_config *config, const char *args)
+{
+	return parse_uint("slot-time", args, &config->slot_time_ms);
+}
+
+static int
+set_output(struct windbag_config *config, const char *args)
+{
+	if (strcasecmp(args, "text") == 0)
+		config->output = OUTPUT_TEXT;
+	else if (strcasecmp(args, "json") == 0)
+		config->output = OUTPUT_JSON;
+	else
+	{
+		fprintf(stderr, "output must be text or json\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+set_history(struct windbag_config *config, const char *args)
+{
+	return parse_bool("history", args, &config->history);
+}
+
+static int
+set_history_path(struct windbag_config *config, const char *args)
+{
+	strncpy(config->history_path, args, sizeof config->history_path - 1);
+	return 0;
+}
+
+static int
+set_history_size(struct windbag_config *config, const char *args)
+{
+	return parse_uint("history-size", args, &config->history_size);
+}
+
+static int
+set_history_days(struct windbag_config *config, const char *args)
+{
+	return parse_uint("history-days", args, &config->history_days);
+}
+
+static int
+set_max_file_size(struct windbag_config *config, const char *args)
+{
+	return parse_uint("max-file-size", args, &config->max_file_size);
+}
+
+static int
+set_connected_mode(struct windbag_config *config, const char *args)
+{
+	return parse_bool("connected-mode", args, &config->connected_mode);
+}
+
+static int
+set_link_modulo(struct windbag_config *config, const char *args)
+{
+	int rc = parse_uint("link-modulo", args, &config->link_modulo);
+
+	if (!rc && config->link_modulo != 8 && config->link_modulo != 128)
+	{
+		fprintf(stderr, "link-modulo must be 8 or 128\n");
+		return 1;
+	}
+
+	return rc;
+}
+
+static int
+set_link_window(struct windbag_config *config, const char *args)
+{
+	int rc = parse_uint("link-window", args, &config->link_window);
+
+	if (!rc && config->link_window > 127)
+	{
+		fprintf(stderr, "link-window must be between 1 and 127\n");
+		return 1;
+	}
+
+	return rc;
+}
+
+static int
+set_link_retries(struct windbag_config *config, const char *args)
+{
+	return parse_uint("link-retries", args, &config->link_retries);
+}
+
+static int
+set_link_t1(struct windbag_config *config, const char *args)
+{
+	return parse_uint("link-t1", args, &config->link_t1_ms);
+}
+
+static int
+set_link_t2(struct windbag_config *config, const char *args)
+{
+	return parse_uint("link-t2", args, &config->link_t2_ms);
+}
+
+static int
+set_link_t3(struct windbag_config *config, const char *args)
+{
+	return parse_uint("link-t3", args, &config->link_t3_ms);
+}
+
 typedef struct config_setter
 {
 	const char *name;
@@ -223,11 +512,105 @@ static const SETTER SETTERS[] = {
 	{ "public-key", set_pubkey_path },
 	{ "secret-key", set_seckey_path },
 	{ "private-key", set_seckey_path },
-	{ "keyring", set_keyring_path }
+	{ "keyring", set_keyring_path },
+	{ "defer-signatures", set_defer_signatures },
+	{ "verify-rate", set_verify_rate },
+	{ "verify-source-rate", set_verify_source_rate },
+	{ "compress", set_compress },
+	{ "dictionary", set_dictionary_path },
+	{ "coalesce-ms", set_coalesce_ms },
+	{ "coalesce-bytes", set_coalesce_bytes },
+	{ "fec", set_fec },
+	{ "fec-max-parity", set_fec_max_parity },
+	{ "repair", set_repair },
+	{ "adapt-fragments", set_adapt_fragments },
+	{ "air-baud", set_air_baud },
+	{ "txdelay", set_txdelay },
+	{ "txtail", set_txtail },
+	{ "airtime-interactive", set_airtime_interactive },
+	{ "airtime-control", set_airtime_control },
+	{ "airtime-bulk", set_airtime_bulk },
+	{ "airtime-beacon", set_airtime_beacon },
+	{ "csma", set_csma },
+	{ "persist", set_persist },
+	{ "slot-time", set_slot_time },
+	{ "output", set_output },
+	{ "history", set_history },
+	{ "history-path", set_history_path },
+	{ "history-size", set_history_size },
+	{ "history-days", set_history_days },
+	{ "max-file-size", set_max_file_size },
+	{ "connected-mode", set_connected_mode },
+	{ "link-modulo", set_link_modulo },
+	{ "link-window", set_link_window },
+	{ "link-retries", set_link_retries },
+	{ "link-t1", set_link_t1 },
+	{ "link-t2", set_link_t2 },
+	{ "link-t3", set_link_t3 }
 };
 
 #define NUM_SETTERS (sizeof SETTERS / sizeof SETTERS[0])
 
+void
+config_defaults(struct windbag_config *config)
+{
+	memset(config, 0, sizeof *config);
+	config->tty_speed = B9600;
+	config->coalesce_ms = DEFAULT_COALESCE_MS;
+	config->coalesce_bytes = DEFAULT_COALESCE_BYTES;
+	config->air_baud = DEFAULT_AIR_BAUD;
+	config->txdelay_ms = DEFAULT_TXDELAY_MS;
+	config->txtail_ms = DEFAULT_TXTAIL_MS;
+	config->airtime_interactive = 100;
+	config->airtime_control = 50;
+	config->airtime_bulk = 50;
+	config->airtime_beacon = 10;
+	config->persist = DEFAULT_PERSIST;
+	config->slot_time_ms = DEFAULT_SLOT_TIME_MS;
+	config->history_size = DEFAULT_HISTORY_SIZE;
+	config->max_file_size = DEFAULT_MAX_FILE_SIZE;
+	config->link_modulo = DEFAULT_LINK_MODULO;
+}
+
+void
+config_airtime(const struct windbag_config *config,
+	struct airtime_params *params)
+{
+	params->baud = config->air_baud;
+	params->txdelay_ms = config->txdelay_ms;
+	params->txtail_ms = config->txtail_ms;
+}
+
+/* fills in the percentage of the airtime each transmit class may use */
+void
+config_airtime_shares(const struct windbag_config *config,
+	unsigned int *percent)
+{
+	percent[TX_INTERACTIVE] = config->airtime_interactive;
+	percent[TX_CONTROL] = config->airtime_control;
+	percent[TX_BULK] = config->airtime_bulk;
+	percent[TX_BEACON] = config->airtime_beacon;
+}
+
+/* the link's own defaults, for whatever is not set */
+void
+config_link(const struct windbag_config *config,
+	struct ax25_link_params *params)
+{
+	ax25_link_defaults(params, config->link_modulo == 128);
+
+	if (config->link_window)
+		params->window = config->link_window;
+	if (config->link_retries)
+		params->retries = config->link_retries;
+	if (config->link_t1_ms)
+		params->t1_ms = config->link_t1_ms;
+	if (config->link_t2_ms)
+		params->t2_ms = config->link_t2_ms;
+	if (config->link_t3_ms)
+		params->t3_ms = config->link_t3_ms;
+}
+
 int
 read_config(struct windbag_config *config, FILE *f)
 {
@@ -236,8 +619,7 @@ read_config(struct windbag_config *config, FILE *f)
 	ssize_t line_len;
 	int rc = 0;
 
-	memset(config, 0, sizeof *config);
-	config->tty_speed = B9600;
+	config_defaults(config);
 
 	buf = malloc(bufsize);
 	if (!buf)
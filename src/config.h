@@ -35,17 +35,40 @@
 #include <sodium.h>
 #include <stdio.h>
 
+#include "airtime.h"
 #include "ax25.h"
 
 #define MAX_FILE_PATH 1025
 #define MAX_HBAUD_LEN 6
 
+#define DEFAULT_COALESCE_MS 200
+#define DEFAULT_COALESCE_BYTES 1024
+#define DEFAULT_AIR_BAUD 1200
+#define DEFAULT_PERSIST 63
+#define DEFAULT_SLOT_TIME_MS 100
+#define DEFAULT_HISTORY_SIZE 16384 /* KiB */
+#define DEFAULT_MAX_FILE_SIZE 4096 /* KiB */
+#define DEFAULT_LINK_MODULO 8
+
 extern const char * const CONFIG_FILE_NAME;
 extern const char * const DEFAULT_PUBKEY;
 extern const char * const DEFAULT_SECKEY;
 extern const char * const DEFAULT_KEYRING;
 
+enum windbag_output
+{
+	OUTPUT_TEXT,
+	OUTPUT_JSON /* a line of JSON for each message heard */
+};
+
+struct ax25_link_params;
+struct budget;
+struct dictionary;
+struct fec_estimator;
 struct keyring;
+struct link_table;
+struct repair;
+struct sig_cache;
 
 struct windbag_config
 {
@@ -58,12 +81,70 @@ struct windbag_config
 	unsigned int tty_speed;
 
 	int sign_messages;
+	int defer_signatures;
 	char pubkey_path[MAX_FILE_PATH];
 	char seckey_path[MAX_FILE_PATH];
 	char keyring_path[MAX_FILE_PATH];
 	unsigned char pubkey[crypto_sign_PUBLICKEYBYTES];
 	unsigned char seckey[crypto_sign_SECRETKEYBYTES];
 	struct keyring *keyring;
+	struct sig_cache *sig_cache;
+
+	unsigned int verify_rate;
+	unsigned int verify_source_rate;
+	struct budget *budget;
+
+	int compress;
+	char dictionary_path[MAX_FILE_PATH];
+	struct dictionary *dictionary;
+
+	unsigned int coalesce_ms;
+	unsigned int coalesce_bytes;
+
+	int fec;
+	unsigned int fec_max_parity;
+	struct fec_estimator *fec_estimator;
+
+	int repair;
+	struct repair *repair_state;
+
+	int adapt_fragments;
+	struct link_table *link_table;
+
+	unsigned int air_baud;
+	unsigned int txdelay_ms;
+	unsigned int txtail_ms;
+
+	/* the share of airtime, in percent, each transmit class may use */
+	unsigned int airtime_interactive;
+	unsigned int airtime_control;
+	unsigned int airtime_bulk;
+	unsigned int airtime_beacon;
+
+	/* channel access done here rather than by the TNC */
+	int csma;
+	unsigned int persist;
+	unsigned int slot_time_ms;
+
+	enum windbag_output output;
+
+	/* messages heard are kept, within these limits */
+	int history;
+	char history_path[MAX_FILE_PATH];
+	unsigned int history_size;
+	unsigned int history_days;
+
+	/* the biggest file receive-file will take, in KiB */
+	unsigned int max_file_size;
+
+	/* files sent over a connected AX.25 link; 0 for the link's defaults */
+	int connected_mode;
+	unsigned int link_modulo;
+	unsigned int link_window;
+	unsigned int link_retries;
+	unsigned int link_t1_ms;
+	unsigned int link_t2_ms;
+	unsigned int link_t3_ms;
 };
 
 struct windbag_option
@@ -75,6 +156,21 @@ struct windbag_option
 char *
 default_config_dir_path(char *buf, int bufsize);
 
+void
+config_defaults(struct windbag_config *config);
+
+void
+config_airtime(const struct windbag_config *config,
+	struct airtime_params *params);
+
+void
+config_airtime_shares(const struct windbag_config *config,
+	unsigned int *percent);
+
+void
+config_link(const struct windbag_config *config,
+	struct ax25_link_params *params);
+
 int
 read_config(struct windbag_config *config, FILE *f);
 
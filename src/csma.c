@@ -0,0 +1,239 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <sodium.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "csma.h"
+#include "util.h"
+
+#define HOLD_SLOTS 2 /* the channel is busy this long after any frame */
+#define BURST_GAP_MAX 1000 /* frames closer than this are one burst */
+#define HOLD_MAX 5000
+#define GAP_WEIGHT 0.25
+
+#define ADDR_END 0x01
+#define REPEATED 0x80
+
+static void
+wait_until(struct csma *csma, uint64_t when)
+{
+	struct timespec ts;
+
+	ts.tv_sec = when / 1000;
+	ts.tv_nsec = (when % 1000) * 1000000;
+	pthread_cond_timedwait(&csma->changed, &csma->lock, &ts);
+}
+
+/* whether a digipeater in the frame's path has yet to repeat it */
+static int
+repeat_pending(const struct ax25_frame *frame)
+{
+	unsigned int i;
+
+	for (i = 0; (i + 1) * AX25_ADDR_SIZE <= frame->length; ++i)
+	{
+		uint8_t ssid = frame->data[i * AX25_ADDR_SIZE + 6];
+
+		if (i >= 2 && !(ssid & REPEATED))
+			return 1;
+
+		if (ssid & ADDR_END)
+			break;
+	}
+
+	return 0;
+}
+
+static void
+heard(struct csma *csma, const struct ax25_frame *frame, uint64_t now)
+{
+	unsigned long us = airtime_frame_us(csma->air.baud, frame->data,
+				frame->length);
+	unsigned long airtime = (us + 999) / 1000;
+	uint64_t hold = csma->slot_ms * HOLD_SLOTS;
+	uint64_t start = now > airtime ? now - airtime : 0;
+
+	/* a frame soon after another is likely part of a burst */
+	if (csma->last_heard && start >= csma->last_heard
+		&& start - csma->last_heard < BURST_GAP_MAX)
+	{
+		double gap = start - csma->last_heard;
+
+		csma->burst_gap += GAP_WEIGHT * (gap - csma->burst_gap);
+		if (csma->burst_gap + csma->slot_ms > hold)
+			hold = csma->burst_gap + csma->slot_ms;
+	}
+
+	/* the repeat will take as long again, once the digipeater keys up */
+	if (repeat_pending(frame))
+		hold += airtime_transmission_ms(&csma->air, us);
+
+	if (hold > HOLD_MAX)
+		hold = HOLD_MAX;
+
+	if (now + hold > csma->busy_until)
+		csma->busy_until = now + hold;
+
+	csma->last_heard = now;
+	++csma->stats.frames_heard;
+	pthread_cond_broadcast(&csma->changed);
+}
+
+static struct ax25_frame *
+csma_read(void *arg)
+{
+	struct csma *csma = arg;
+	struct ax25_frame *frame;
+
+	frame = csma->lower->read_frame(csma->lower->tnc);
+	if (!frame)
+		return NULL;
+
+	pthread_mutex_lock(&csma->lock);
+	heard(csma, frame, monotonic_ms());
+	pthread_mutex_unlock(&csma->lock);
+
+	return frame;
+}
+
+static ssize_t
+csma_write(void *arg, const struct ax25_frame *frame)
+{
+	struct csma *csma = arg;
+	unsigned long bits_ms;
+	uint64_t now;
+	ssize_t rc;
+	int deferred = 0;
+
+	pthread_mutex_lock(&csma->lock);
+
+	for (;;)
+	{
+		now = monotonic_ms();
+		if (now < csma->keyed_until)
+			break;
+
+		if (now < csma->busy_until)
+		{
+			deferred = 1;
+			wait_until(csma, csma->busy_until);
+			continue;
+		}
+
+		if (csma->persist >= 255
+			|| randombytes_uniform(256) <= csma->persist)
+			break;
+
+		/* a frame heard meanwhile wakes us to wait for it to end */
+		++csma->stats.slots_waited;
+		wait_until(csma, now + csma->slot_ms);
+	}
+
+	if (deferred)
+		++csma->stats.deferred;
+
+	pthread_mutex_unlock(&csma->lock);
+
+	rc = csma->lower->write_frame(csma->lower->tnc, frame);
+
+	/* we cannot hear anyone else while we are sending */
+	pthread_mutex_lock(&csma->lock);
+	bits_ms = (airtime_frame_us(csma->air.baud, frame->data, frame->length)
+		+ 999) / 1000;
+	if (now < csma->keyed_until)
+		csma->keyed_until += bits_ms;
+	else
+		csma->keyed_until = now + csma->air.txdelay_ms + bits_ms;
+
+	now = csma->keyed_until + csma->air.txtail_ms;
+	if (now > csma->busy_until)
+		csma->busy_until = now;
+
+	++csma->stats.frames_sent;
+	pthread_mutex_unlock(&csma->lock);
+
+	return rc;
+}
+
+struct csma *
+csma_new(const struct ax25_io *lower, unsigned int persist,
+	unsigned int slot_ms, const struct airtime_params *air)
+{
+	struct csma *csma;
+	pthread_condattr_t attr;
+
+	csma = calloc(1, sizeof (struct csma));
+	if (!csma)
+		return NULL;
+
+	if (pthread_mutex_init(&csma->lock, NULL))
+		goto fail1;
+
+	if (pthread_condattr_init(&attr))
+		goto fail2;
+
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if (pthread_cond_init(&csma->changed, &attr))
+	{
+		pthread_condattr_destroy(&attr);
+		goto fail2;
+	}
+
+	pthread_condattr_destroy(&attr);
+
+	csma->lower = lower;
+	csma->persist = persist;
+	csma->slot_ms = slot_ms;
+	csma->air = *air;
+
+	csma->io.read_frame = csma_read;
+	csma->io.write_frame = csma_write;
+	csma->io.tnc = csma;
+	csma->io.other_frame = lower->other_frame;
+	csma->io.other_arg = lower->other_arg;
+	return csma;
+
+fail2:
+	pthread_mutex_destroy(&csma->lock);
+fail1:
+	free(csma);
+	return NULL;
+}
+
+void
+csma_free(struct csma *csma)
+{
+	pthread_cond_destroy(&csma->changed);
+	pthread_mutex_destroy(&csma->lock);
+	free(csma);
+}
@@ -0,0 +1,84 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef WB_CSMA_H
+#define WB_CSMA_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "airtime.h"
+#include "ax25.h"
+
+#define CSMA_DEFAULT_PERSIST 63
+#define CSMA_DEFAULT_SLOT_MS 100
+
+struct csma_stats
+{
+	unsigned long frames_heard;
+	unsigned long frames_sent;
+	unsigned long deferred; /* frames that waited for a busy channel */
+	unsigned long slots_waited;
+};
+
+/*
+ * p-persistent CSMA for TNCs that leave channel access to us, such as plain
+ * audio modems. We cannot hear the carrier, only the frames that come out
+ * of it, so the channel is taken to be busy for a while after each frame:
+ * long enough for a digipeater to repeat it, or for the rest of a burst.
+ * Once the channel seems clear, each slot we send with probability
+ * (persist + 1) / 256. A frame written while our last is still going out
+ * follows it in the same transmission, without waiting.
+ */
+struct csma
+{
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	struct ax25_io io; /* reads and writes through this layer */
+	const struct ax25_io *lower;
+	unsigned int persist;
+	unsigned int slot_ms;
+	struct airtime_params air;
+	uint64_t busy_until;
+	uint64_t keyed_until; /* the end of our own frames on the air */
+	uint64_t last_heard;
+	double burst_gap;
+	struct csma_stats stats;
+};
+
+struct csma *
+csma_new(const struct ax25_io *lower, unsigned int persist,
+	unsigned int slot_ms, const struct airtime_params *air);
+
+void
+csma_free(struct csma *csma);
+
+#endif
@@ -35,6 +35,8 @@
 #include "os.h"
 
 #ifdef OS_WINDOWS
+# define htole16(N) ((uint16_t) N)
+# define le16toh(N) ((uint16_t) N)
 # define htole32(N) ((uint32_t) N)
 #else
 # include <endian.h>
@@ -0,0 +1,318 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fec.h"
+#include "gf256.h"
+
+/*
+ * A systematic Reed-Solomon erasure code: the data shards go out as they
+ * are, and parity shard j is the sum over i of data shard i times the Cauchy
+ * coefficient 1 / ((n_data + j) + i). Every square submatrix of a Cauchy
+ * matrix is invertible, so any n_data of the shards rebuild the rest.
+ */
+
+#define INITIAL_LOSS 0.05
+#define LOSS_WEIGHT 0.1
+#define MIN_LOSS 0.001
+#define MAX_LOSS 0.5
+#define TARGET_FAILURE 0.01
+
+static uint8_t
+coefficient(unsigned int n_data, unsigned int parity_index,
+	unsigned int data_index)
+{
+	return gf256_inv((n_data + parity_index) ^ data_index);
+}
+
+struct fec_estimator *
+fec_estimator_new(unsigned int max_parity)
+{
+	struct fec_estimator *fec = malloc(sizeof (struct fec_estimator));
+	if (!fec)
+		return NULL;
+
+	if (pthread_mutex_init(&fec->lock, NULL))
+	{
+		free(fec);
+		return NULL;
+	}
+
+	fec->loss = INITIAL_LOSS;
+	fec->max_parity = max_parity ? max_parity : FEC_DEFAULT_MAX_PARITY;
+	fec->observations = 0;
+
+	gf256_init();
+	return fec;
+}
+
+void
+fec_estimator_free(struct fec_estimator *fec)
+{
+	pthread_mutex_destroy(&fec->lock);
+	free(fec);
+}
+
+void
+fec_observe(struct fec_estimator *fec, unsigned int expected,
+	unsigned int received)
+{
+	double loss;
+
+	if (expected == 0 || received > expected)
+		return;
+
+	loss = 1.0 - (double) received / expected;
+
+	pthread_mutex_lock(&fec->lock);
+	fec->loss += (loss - fec->loss) * LOSS_WEIGHT;
+	++fec->observations;
+	pthread_mutex_unlock(&fec->lock);
+}
+
+double
+fec_loss(struct fec_estimator *fec)
+{
+	double loss;
+
+	pthread_mutex_lock(&fec->lock);
+	loss = fec->loss;
+	pthread_mutex_unlock(&fec->lock);
+
+	return loss;
+}
+
+/* the chance that more than `k` of `n` packets are lost */
+static double
+failure_chance(unsigned int n, unsigned int k, double p)
+{
+	double pmf = 1.0, cdf;
+	unsigned int x;
+
+	for (x = 0; x < n; ++x)
+		pmf *= 1.0 - p;
+
+	cdf = pmf;
+	for (x = 0; x < k && x < n; ++x)
+	{
+		pmf *= (double) (n - x) / (x + 1) * p / (1.0 - p);
+		cdf += pmf;
+	}
+
+	return 1.0 - cdf;
+}
+
+/*
+ * Picks the least parity that would let a message through the estimated
+ * loss rate nearly every time, within the configured maximum.
+ */
+unsigned int
+fec_parity_count(struct fec_estimator *fec, unsigned int n_data)
+{
+	double p = fec_loss(fec);
+	unsigned int k, max = fec->max_parity;
+
+	if (n_data >= FEC_MAX_SHARDS)
+		return 0;
+
+	if (max > FEC_MAX_SHARDS - n_data)
+		max = FEC_MAX_SHARDS - n_data;
+
+	if (p < MIN_LOSS)
+		p = MIN_LOSS;
+	else if (p > MAX_LOSS)
+		p = MAX_LOSS;
+
+	for (k = 1; k < max; ++k)
+		if (failure_chance(n_data + k, k, p) < TARGET_FAILURE)
+			break;
+
+	return k;
+}
+
+void
+fec_encode(const uint8_t * const *data, unsigned int n_data,
+	uint8_t **parity, unsigned int n_parity, unsigned int length)
+{
+	unsigned int i, j;
+
+	gf256_init();
+
+	for (j = 0; j < n_parity; ++j)
+	{
+		memset(parity[j], 0, length);
+		for (i = 0; i < n_data; ++i)
+			gf256_mul_add(parity[j], data[i],
+				coefficient(n_data, j, i), length);
+	}
+}
+
+/* inverts the n * n matrix `m` in place by Gauss-Jordan elimination */
+static int
+invert(uint8_t *m, unsigned int n)
+{
+	uint8_t *inverse;
+	unsigned int row, col, i;
+
+	inverse = calloc(n, n);
+	if (!inverse)
+		return ENOMEM;
+
+	for (i = 0; i < n; ++i)
+		inverse[i * n + i] = 1;
+
+	for (col = 0; col < n; ++col)
+	{
+		uint8_t scale;
+
+		for (row = col; row < n && m[row * n + col] == 0; ++row)
+			;
+
+		if (row == n)
+		{
+			free(inverse);
+			return EINVAL;
+		}
+
+		if (row != col)
+		{
+			for (i = 0; i < n; ++i)
+			{
+				uint8_t t = m[row * n + i];
+				m[row * n + i] = m[col * n + i];
+				m[col * n + i] = t;
+
+				t = inverse[row * n + i];
+				inverse[row * n + i] = inverse[col * n + i];
+				inverse[col * n + i] = t;
+			}
+		}
+
+		scale = gf256_inv(m[col * n + col]);
+		for (i = 0; i < n; ++i)
+		{
+			m[col * n + i] = gf256_mul(m[col * n + i], scale);
+			inverse[col * n + i] = gf256_mul(inverse[col * n + i],
+							scale);
+		}
+
+		for (row = 0; row < n; ++row)
+		{
+			uint8_t factor = m[row * n + col];
+
+			if (row == col || factor == 0)
+				continue;
+
+			gf256_mul_add(m + row * n, m + col * n, factor, n);
+			gf256_mul_add(inverse + row * n, inverse + col * n,
+				factor, n);
+		}
+	}
+
+	memcpy(m, inverse, n * n);
+	free(inverse);
+	return 0;
+}
+
+/*
+ * Rebuilds the data shards not marked present, writing them over whatever
+ * data[i] holds. Needs at least as many parity shards as missing data.
+ */
+int
+fec_decode(uint8_t **data, const int *present, unsigned int n_data,
+	const uint8_t * const *parity, const unsigned int *parity_index,
+	unsigned int n_parity, unsigned int length)
+{
+	unsigned int missing[FEC_MAX_SHARDS];
+	unsigned int n_missing = 0, i, r, t;
+	uint8_t *matrix, *syndromes;
+	int rc;
+
+	for (i = 0; i < n_data; ++i)
+		if (!present[i])
+			missing[n_missing++] = i;
+
+	if (n_missing == 0)
+		return 0;
+
+	if (n_missing > n_parity)
+		return EINVAL;
+
+	gf256_init();
+
+	matrix = malloc(n_missing * n_missing);
+	syndromes = malloc(n_missing * length);
+	if (!matrix || !syndromes)
+	{
+		rc = ENOMEM;
+		goto end;
+	}
+
+	/* take away what the data we have put into each parity shard */
+	for (r = 0; r < n_missing; ++r)
+	{
+		uint8_t *s = syndromes + r * length;
+
+		memcpy(s, parity[r], length);
+		for (i = 0; i < n_data; ++i)
+			if (present[i])
+				gf256_mul_add(s, data[i],
+					coefficient(n_data, parity_index[r],
+						i), length);
+
+		for (t = 0; t < n_missing; ++t)
+			matrix[r * n_missing + t] = coefficient(n_data,
+							parity_index[r],
+							missing[t]);
+	}
+
+	rc = invert(matrix, n_missing);
+	if (rc)
+		goto end;
+
+	for (t = 0; t < n_missing; ++t)
+	{
+		uint8_t *d = data[missing[t]];
+
+		memset(d, 0, length);
+		for (r = 0; r < n_missing; ++r)
+			gf256_mul_add(d, syndromes + r * length,
+				matrix[t * n_missing + r], length);
+	}
+
+end:
+	free(matrix);
+	free(syndromes);
+	return rc;
+}
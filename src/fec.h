@@ -0,0 +1,78 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef WB_FEC_H
+#define WB_FEC_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#define FEC_MAX_SHARDS 256
+#define FEC_DEFAULT_MAX_PARITY 16
+
+/*
+ * Tracks the share of multipart packets lost on the channel, as seen in
+ * messages from other stations, to decide how much parity to send.
+ */
+struct fec_estimator
+{
+	pthread_mutex_t lock;
+	double loss;
+	unsigned int max_parity;
+	unsigned long observations;
+};
+
+struct fec_estimator *
+fec_estimator_new(unsigned int max_parity);
+
+void
+fec_estimator_free(struct fec_estimator *fec);
+
+void
+fec_observe(struct fec_estimator *fec, unsigned int expected,
+	unsigned int received);
+
+double
+fec_loss(struct fec_estimator *fec);
+
+unsigned int
+fec_parity_count(struct fec_estimator *fec, unsigned int n_data);
+
+void
+fec_encode(const uint8_t * const *data, unsigned int n_data,
+	uint8_t **parity, unsigned int n_parity, unsigned int length);
+
+int
+fec_decode(uint8_t **data, const int *present, unsigned int n_data,
+	const uint8_t * const *parity, const unsigned int *parity_index,
+	unsigned int n_parity, unsigned int length);
+
+#endif
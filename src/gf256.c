@@ -0,0 +1,106 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <pthread.h>
+
+#include "gf256.h"
+
+#define POLYNOMIAL 0x11D
+
+static uint8_t exp_table[510];
+static uint8_t log_table[256];
+
+/* a full product table, so multiplying a whole fragment is one lookup/byte */
+static uint8_t mul_table[256][256];
+
+static pthread_once_t tables_once = PTHREAD_ONCE_INIT;
+
+static void
+build_tables(void)
+{
+	unsigned int i, j, x = 1;
+
+	for (i = 0; i < 255; ++i)
+	{
+		exp_table[i] = x;
+		exp_table[i + 255] = x;
+		log_table[x] = i;
+
+		x <<= 1;
+		if (x & 0x100)
+			x ^= POLYNOMIAL;
+	}
+
+	for (i = 1; i < 256; ++i)
+		for (j = 1; j < 256; ++j)
+			mul_table[i][j] = exp_table[log_table[i]
+				+ log_table[j]];
+}
+
+void
+gf256_init(void)
+{
+	pthread_once(&tables_once, build_tables);
+}
+
+uint8_t
+gf256_mul(uint8_t a, uint8_t b)
+{
+	return mul_table[a][b];
+}
+
+uint8_t
+gf256_inv(uint8_t a)
+{
+	return a ? exp_table[255 - log_table[a]] : 0;
+}
+
+/* dest += c * src, over `length` bytes */
+void
+gf256_mul_add(uint8_t *dest, const uint8_t *src, uint8_t c,
+	unsigned int length)
+{
+	const uint8_t *row = mul_table[c];
+	unsigned int i;
+
+	if (c == 0)
+		return;
+
+	if (c == 1)
+	{
+		for (i = 0; i < length; ++i)
+			dest[i] ^= src[i];
+		return;
+	}
+
+	for (i = 0; i < length; ++i)
+		dest[i] ^= row[src[i]];
+}
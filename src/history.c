@@ -0,0 +1,1362 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "callsign.h"
+#include "endian.h"
+#include "history.h"
+#include "jsonout.h"
+#include "os.h"
+#include "util.h"
+
+#define MAGIC "WBHI"
+#define VERSION 1
+#define ALIGN 8
+#define STATIONS_MIN 64
+#define SEGMENT_MIN 65536
+#define MS_PER_DAY (24 * 60 * 60 * 1000ULL)
+
+/* a message in the log */
+#define RECORD_SENT 0
+#define RECORD_STATUS 4
+#define RECORD_PARTS 5
+#define RECORD_SOURCE 8
+#define RECORD_DEST (RECORD_SOURCE + AX25_ADDR_MAX)
+#define RECORD_VERIFIED (RECORD_DEST + AX25_ADDR_MAX)
+#define RECORD_PATH (RECORD_VERIFIED + AX25_ADDR_MAX)
+#define RECORD_LENGTH (RECORD_PATH + (AX25_MAX_ADDRS - 2) * AX25_ADDR_MAX)
+
+static uint64_t
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t
+align(uint64_t offset)
+{
+	return (offset + ALIGN - 1) & ~(uint64_t) (ALIGN - 1);
+}
+
+char *
+history_default_path(char *buf, int bufsize)
+{
+	default_config_dir_path(buf, bufsize);
+	strncat(buf, FILE_SEPARATOR HISTORY_DIR, bufsize - strlen(buf) - 1);
+	return buf;
+}
+
+static void
+segment_path(char *buf, size_t size, const char *dir, unsigned int seq,
+	const char *ext)
+{
+	snprintf(buf, size, "%s" FILE_SEPARATOR "%08x.%s", dir, seq, ext);
+}
+
+static int
+compare_seq(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *) a;
+	unsigned int y = *(const unsigned int *) b;
+
+	return (x > y) - (x < y);
+}
+
+/* the segments in `dir`, oldest first */
+static int
+list_segments(const char *dir, unsigned int **seqs, unsigned int *n)
+{
+	struct dirent *ent;
+	unsigned int size = 16;
+	DIR *d;
+
+	*n = 0;
+	*seqs = malloc(size * sizeof (unsigned int));
+	if (!*seqs)
+		return ENOMEM;
+
+	d = opendir(dir);
+	if (!d)
+		return errno == ENOENT ? 0 : errno;
+
+	while ((ent = readdir(d)))
+	{
+		unsigned int seq, i;
+
+		if (strlen(ent->d_name) != 12
+			|| strcmp(ent->d_name + 8, ".idx") != 0)
+			continue;
+
+		for (i = 0; i < 8 && isxdigit((unsigned char) ent->d_name[i]);
+		     ++i)
+			;
+
+		if (i < 8 || sscanf(ent->d_name, "%8x", &seq) != 1)
+			continue;
+
+		if (*n == size)
+		{
+			unsigned int *temp;
+
+			temp = realloc(*seqs, size * 2 * sizeof (unsigned int));
+			if (!temp)
+			{
+				closedir(d);
+				return ENOMEM;
+			}
+
+			*seqs = temp;
+			size *= 2;
+		}
+
+		(*seqs)[(*n)++] = seq;
+	}
+
+	closedir(d);
+	qsort(*seqs, *n, sizeof (unsigned int), compare_seq);
+	return 0;
+}
+
+static int
+valid_header(const struct history_file_header *header)
+{
+	return memcmp(header->magic, MAGIC, sizeof header->magic) == 0
+		&& le16toh(header->version) == VERSION
+		&& le16toh(header->header_length) >= sizeof *header
+		&& le16toh(header->header_length) % ALIGN == 0;
+}
+
+/* the writer */
+
+static int
+write_header(struct history *history)
+{
+	struct history_file_header header = history->header;
+
+	header.count = htole32(header.count);
+	header.buckets = htole32(header.buckets);
+	header.table_offset = htole64(header.table_offset);
+	header.first_ms = htole64(header.first_ms);
+	header.last_ms = htole64(header.last_ms);
+
+	if (pwrite(history->index_fd, &header, sizeof header, 0)
+		!= sizeof header)
+		return errno ? errno : EIO;
+
+	return 0;
+}
+
+/* where the entries of the segment being written start */
+static off_t
+entries_offset(const struct history *history)
+{
+	return le16toh(history->header.header_length);
+}
+
+static struct history_station *
+find_station(struct history_station *table, uint32_t mask, uint64_t source)
+{
+	uint32_t i = callsign_hash(source) & mask;
+
+	while (table[i].source && table[i].source != source)
+		i = (i + 1) & mask;
+
+	return table + i;
+}
+
+/* keeps the station table at most half full */
+static int
+reserve_station(struct history *history)
+{
+	struct history_station *table;
+	uint32_t i, mask;
+
+	if ((history->n_stations + 1) * 2 <= history->station_mask + 1)
+		return 0;
+
+	mask = history->station_mask ? history->station_mask * 2 + 1
+		: STATIONS_MIN - 1;
+	table = calloc(mask + 1, sizeof (struct history_station));
+	if (!table)
+		return ENOMEM;
+
+	for (i = 0; history->stations && i <= history->station_mask; ++i)
+		if (history->stations[i].source)
+			*find_station(table, mask, history->stations[i].source)
+				= history->stations[i];
+
+	free(history->stations);
+	history->stations = table;
+	history->station_mask = mask;
+	return 0;
+}
+
+/* records that entry `index` is from `source`; returns the one before */
+static uint32_t
+note_station(struct history *history, uint64_t source, uint32_t index)
+{
+	struct history_station *station;
+	uint32_t prev = HISTORY_NONE;
+
+	station = find_station(history->stations, history->station_mask,
+			source);
+	if (station->source)
+		prev = station->last;
+	else
+	{
+		station->source = source;
+		++history->n_stations;
+	}
+
+	station->last = index;
+	++station->count;
+	return prev;
+}
+
+static void
+close_segment(struct history *history)
+{
+	if (history->log_fd != -1)
+		close(history->log_fd);
+	if (history->index_fd != -1)
+		close(history->index_fd);
+
+	history->log_fd = -1;
+	history->index_fd = -1;
+}
+
+static int
+open_files(struct history *history, unsigned int seq, int flags)
+{
+	char path[MAX_FILE_PATH + 16];
+
+	segment_path(path, sizeof path, history->dir, seq, "log");
+	history->log_fd = open(path, O_RDWR | O_CLOEXEC | flags, 0600);
+	if (history->log_fd < 0)
+		return errno;
+
+	segment_path(path, sizeof path, history->dir, seq, "idx");
+	history->index_fd = open(path, O_RDWR | O_CLOEXEC | flags, 0600);
+	if (history->index_fd < 0)
+	{
+		close_segment(history);
+		return errno;
+	}
+
+	history->seq = seq;
+	return 0;
+}
+
+static int
+create_segment(struct history *history, unsigned int seq)
+{
+	int rc;
+
+	rc = open_files(history, seq, O_CREAT | O_TRUNC);
+	if (rc)
+		return rc;
+
+	memset(&history->header, 0, sizeof history->header);
+	memcpy(history->header.magic, MAGIC, sizeof history->header.magic);
+	history->header.version = htole16(VERSION);
+	history->header.header_length = htole16(sizeof history->header);
+	history->log_length = 0;
+
+	memset(history->stations, 0, (history->station_mask + 1)
+		* sizeof (struct history_station));
+	history->n_stations = 0;
+
+	rc = write_header(history);
+	if (rc)
+		close_segment(history);
+
+	return rc;
+}
+
+/* picks up writing a segment left unsealed, as far as it is whole */
+static int
+resume_segment(struct history *history, unsigned int seq)
+{
+	struct history_file_header header;
+	struct history_entry entry;
+	uint32_t i, count;
+	off_t pos;
+	int rc;
+
+	rc = open_files(history, seq, 0);
+	if (rc)
+		return rc;
+
+	if (pread(history->index_fd, &header, sizeof header, 0)
+		!= sizeof header || !valid_header(&header) || header.buckets)
+		goto fail;
+
+	count = le32toh(header.count);
+	history->header = header;
+	history->header.count = 0;
+	history->header.table_offset = 0;
+	history->header.first_ms = le64toh(header.first_ms);
+	history->header.last_ms = le64toh(header.last_ms);
+	history->log_length = 0;
+
+	memset(history->stations, 0, (history->station_mask + 1)
+		* sizeof (struct history_station));
+	history->n_stations = 0;
+
+	pos = entries_offset(history);
+	for (i = 0; i < count; ++i, pos += sizeof entry)
+	{
+		if (pread(history->index_fd, &entry, sizeof entry, pos)
+			!= sizeof entry
+			|| le32toh(entry.offset) != history->log_length
+			|| reserve_station(history))
+			break;
+
+		note_station(history, le64toh(entry.source), i);
+		history->log_length += le32toh(entry.length);
+		if (i == 0)
+			history->header.first_ms = le64toh(entry.time_ms);
+		history->header.last_ms = le64toh(entry.time_ms);
+		++history->header.count;
+	}
+
+	/* anything after the last whole entry was cut short */
+	if (ftruncate(history->log_fd, history->log_length)
+		|| write_header(history))
+		goto fail;
+
+	return 0;
+
+fail:
+	close_segment(history);
+	return -1;
+}
+
+/* adds the station table, after which the segment is never written */
+static int
+seal_segment(struct history *history)
+{
+	struct history_station *table;
+	uint32_t i, buckets = history->station_mask + 1;
+	uint64_t offset;
+	ssize_t size = buckets * sizeof (struct history_station);
+	int rc = 0;
+
+	offset = align(entries_offset(history)
+		+ (uint64_t) history->header.count
+		* sizeof (struct history_entry));
+
+	table = malloc(size);
+	if (!table)
+		return ENOMEM;
+
+	for (i = 0; i < buckets; ++i)
+	{
+		table[i].source = htole64(history->stations[i].source);
+		table[i].last = htole32(history->stations[i].last);
+		table[i].count = htole32(history->stations[i].count);
+	}
+
+	if (pwrite(history->index_fd, table, size, offset) != size)
+		rc = errno ? errno : EIO;
+
+	free(table);
+	if (rc)
+		return rc;
+
+	history->header.buckets = buckets;
+	history->header.table_offset = offset;
+	return write_header(history);
+}
+
+static uint64_t
+file_size(const char *dir, unsigned int seq, const char *ext)
+{
+	char path[MAX_FILE_PATH + 16];
+	struct stat st;
+
+	segment_path(path, sizeof path, dir, seq, ext);
+	return stat(path, &st) ? 0 : (uint64_t) st.st_size;
+}
+
+static uint64_t
+last_ms(const char *dir, unsigned int seq)
+{
+	struct history_file_header header;
+	char path[MAX_FILE_PATH + 16];
+	int fd;
+
+	segment_path(path, sizeof path, dir, seq, "idx");
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return 0;
+
+	if (pread(fd, &header, sizeof header, 0) != sizeof header
+		|| !valid_header(&header))
+		header.last_ms = 0;
+
+	close(fd);
+	return le64toh(header.last_ms);
+}
+
+/* deletes the oldest segments, past the size or age kept */
+static void
+prune(struct history *history)
+{
+	unsigned int *seqs, n, i;
+	uint64_t total = 0, cutoff = 0;
+	char path[MAX_FILE_PATH + 16];
+
+	if (list_segments(history->dir, &seqs, &n))
+	{
+		free(seqs);
+		return;
+	}
+
+	for (i = 0; i < n; ++i)
+		total += file_size(history->dir, seqs[i], "log")
+			+ file_size(history->dir, seqs[i], "idx");
+
+	if (history->max_days)
+		cutoff = now_ms() - history->max_days * MS_PER_DAY;
+
+	for (i = 0; i < n && seqs[i] != history->seq; ++i)
+	{
+		uint64_t size;
+
+		if (total <= history->max_bytes
+			&& last_ms(history->dir, seqs[i]) >= cutoff)
+			break;
+
+		size = file_size(history->dir, seqs[i], "log")
+			+ file_size(history->dir, seqs[i], "idx");
+
+		/* readers go by the index, so it goes first */
+		segment_path(path, sizeof path, history->dir, seqs[i], "idx");
+		unlink(path);
+		segment_path(path, sizeof path, history->dir, seqs[i], "log");
+		unlink(path);
+
+		total -= size < total ? size : total;
+	}
+
+	free(seqs);
+}
+
+static int
+rotate(struct history *history)
+{
+	unsigned int seq = history->seq + 1;
+	int rc;
+
+	rc = seal_segment(history);
+	close_segment(history);
+	if (rc)
+		return rc;
+
+	rc = create_segment(history, seq);
+	if (rc)
+		return rc;
+
+	prune(history);
+	return 0;
+}
+
+/*
+ * Opens the history in `dir` for writing, keeping at most `max_bytes` of
+ * it, and nothing older than `max_days` unless that is 0. Only one process
+ * may write at a time; others fail with EBUSY.
+ */
+struct history *
+history_open(const char *dir, uint64_t max_bytes, unsigned int max_days)
+{
+	struct history *history;
+	char path[MAX_FILE_PATH + 16];
+	unsigned int *seqs = NULL, n = 0;
+	int rc;
+
+	history = calloc(1, sizeof (struct history));
+	if (!history)
+		return NULL;
+
+	strncpy(history->dir, dir, sizeof history->dir - 1);
+	history->max_bytes = max_bytes;
+	history->max_days = max_days;
+	history->log_fd = -1;
+	history->index_fd = -1;
+
+	rc = mkdir_recursive(dir, 0700);
+	if (rc)
+		goto fail1;
+
+	snprintf(path, sizeof path, "%s" FILE_SEPARATOR "lock", dir);
+	history->lock_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (history->lock_fd < 0)
+	{
+		rc = errno;
+		goto fail1;
+	}
+
+	if (flock(history->lock_fd, LOCK_EX | LOCK_NB))
+	{
+		rc = errno == EWOULDBLOCK ? EBUSY : errno;
+		goto fail2;
+	}
+
+	rc = reserve_station(history);
+	if (rc)
+		goto fail2;
+
+	rc = list_segments(dir, &seqs, &n);
+	if (rc)
+		goto fail3;
+
+	if (n == 0 || resume_segment(history, seqs[n - 1]))
+	{
+		rc = create_segment(history, n ? seqs[n - 1] + 1 : 1);
+		if (rc)
+			goto fail3;
+	}
+
+	if (pthread_mutex_init(&history->lock, NULL))
+	{
+		rc = ENOMEM;
+		close_segment(history);
+		goto fail3;
+	}
+
+	free(seqs);
+	prune(history);
+	return history;
+
+fail3:
+	free(seqs);
+	free(history->stations);
+fail2:
+	close(history->lock_fd);
+fail1:
+	free(history);
+	errno = rc;
+	return NULL;
+}
+
+void
+history_close(struct history *history)
+{
+	close_segment(history);
+	close(history->lock_fd);
+	pthread_mutex_destroy(&history->lock);
+	free(history->stations);
+	free(history);
+}
+
+static void
+copy_callsign(uint8_t *dest, const char *callsign)
+{
+	memcpy(dest, callsign, strnlen(callsign, AX25_ADDR_MAX - 1));
+}
+
+static uint8_t *
+encode(const struct windbag_packet *packet, uint32_t *length)
+{
+	const struct ax25_header *header = &packet->header;
+	uint32_t sent = htole32(packet->timestamp);
+	uint8_t *record;
+
+	*length = RECORD_LENGTH + packet->payload->length;
+	record = calloc(1, *length);
+	if (!record)
+		return NULL;
+
+	memcpy(record + RECORD_SENT, &sent, sizeof sent);
+	record[RECORD_STATUS] = packet->signature_status;
+	record[RECORD_PARTS] = packet->multipart_final;
+	copy_callsign(record + RECORD_SOURCE, header->src_addr);
+	copy_callsign(record + RECORD_DEST, header->dest_addr);
+	if (packet->signature_status == ALTERNATE_SIGNATURE)
+		copy_callsign(record + RECORD_VERIFIED,
+			packet->verified_callsign);
+	memcpy(record + RECORD_PATH, header->digi_path,
+		sizeof header->digi_path);
+	memcpy(record + RECORD_LENGTH, packet->payload->data,
+		packet->payload->length);
+
+	return record;
+}
+
+int
+history_append(struct history *history, const struct windbag_packet *packet)
+{
+	struct history_file_header *header = &history->header;
+	struct history_entry entry;
+	uint64_t now = now_ms(), size;
+	uint8_t *record;
+	uint32_t length;
+	off_t pos;
+	int rc = 0;
+
+	record = encode(packet, &length);
+	if (!record)
+		return ENOMEM;
+
+	pthread_mutex_lock(&history->lock);
+
+	if (history->log_fd == -1)
+	{
+		rc = EIO;
+		goto end;
+	}
+
+	/* the clock may step back, but the index must stay in order */
+	if (now < header->last_ms)
+		now = header->last_ms;
+
+	rc = reserve_station(history);
+	if (rc)
+		goto end;
+
+	if (pwrite(history->log_fd, record, length, history->log_length)
+		!= (ssize_t) length)
+	{
+		rc = errno ? errno : EIO;
+		goto end;
+	}
+
+	memset(&entry, 0, sizeof entry);
+	entry.time_ms = htole64(now);
+	entry.source = htole64(callsign_pack(packet->header.src_addr));
+	entry.offset = htole32(history->log_length);
+	entry.length = htole32(length);
+	entry.prev = htole32(note_station(history, le64toh(entry.source),
+				header->count));
+
+	pos = entries_offset(history) + (off_t) header->count * sizeof entry;
+	if (pwrite(history->index_fd, &entry, sizeof entry, pos)
+		!= sizeof entry)
+	{
+		rc = errno ? errno : EIO;
+		goto end;
+	}
+
+	/* the entry counts once the header says so */
+	if (header->count++ == 0)
+		header->first_ms = now;
+	header->last_ms = now;
+	history->log_length += length;
+
+	rc = write_header(history);
+	if (rc)
+		goto end;
+
+	size = history->log_length + pos + sizeof entry;
+	if (size >= history->max_bytes / HISTORY_SEGMENTS && size >= SEGMENT_MIN)
+	{
+		rc = rotate(history);
+		if (rc)
+			fprintf(stderr, "Error starting a new history file: %s\n",
+				strerror(rc));
+	}
+
+end:
+	pthread_mutex_unlock(&history->lock);
+	free(record);
+	return rc;
+}
+
+/* the reader */
+
+struct segment
+{
+	const uint8_t *index;
+	size_t index_size;
+	const uint8_t *log;
+	size_t log_size;
+	const struct history_entry *entries;
+	uint32_t count;
+	const struct history_station *table;
+	uint32_t buckets;
+	uint64_t first_ms;
+	uint64_t last_ms;
+};
+
+static const void *
+map_file(const char *path, size_t *size)
+{
+	struct stat st;
+	void *data;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || st.st_size == 0)
+	{
+		close(fd);
+		return NULL;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return NULL;
+
+	*size = st.st_size;
+	return data;
+}
+
+static void
+unmap_segment(struct segment *seg)
+{
+	if (seg->index)
+		munmap((void *) seg->index, seg->index_size);
+	if (seg->log)
+		munmap((void *) seg->log, seg->log_size);
+}
+
+static int
+map_segment(const char *dir, unsigned int seq, struct segment *seg)
+{
+	const struct history_file_header *header;
+	char path[MAX_FILE_PATH + 16];
+	uint64_t offset;
+	uint16_t header_length;
+
+	memset(seg, 0, sizeof *seg);
+
+	segment_path(path, sizeof path, dir, seq, "idx");
+	seg->index = map_file(path, &seg->index_size);
+	if (!seg->index || seg->index_size < sizeof *header)
+		goto fail;
+
+	header = (const struct history_file_header *) seg->index;
+	if (!valid_header(header))
+		goto fail;
+
+	header_length = le16toh(header->header_length);
+	seg->entries = (const struct history_entry *) (seg->index
+						+ header_length);
+	seg->count = le32toh(header->count);
+	if (header_length > seg->index_size || seg->count
+		> (seg->index_size - header_length) / sizeof *seg->entries)
+		goto fail;
+
+	seg->first_ms = le64toh(header->first_ms);
+	seg->last_ms = le64toh(header->last_ms);
+
+	seg->buckets = le32toh(header->buckets);
+	offset = le64toh(header->table_offset);
+	if (seg->buckets)
+	{
+		if (seg->buckets & (seg->buckets - 1) || offset % ALIGN
+			|| offset > seg->index_size || seg->buckets
+			> (seg->index_size - offset) / sizeof *seg->table)
+			goto fail;
+
+		seg->table = (const struct history_station *) (seg->index
+							+ offset);
+	}
+
+	segment_path(path, sizeof path, dir, seq, "log");
+	seg->log = map_file(path, &seg->log_size);
+	if (!seg->log && seg->count)
+		goto fail;
+
+	return 0;
+
+fail:
+	unmap_segment(seg);
+	return -1;
+}
+
+/* the latest entry from `source` in the segment */
+static uint32_t
+last_from(const struct segment *seg, uint64_t source)
+{
+	uint32_t i, n, mask = seg->buckets - 1;
+
+	if (!seg->table)
+	{
+		/* still being written: there is no table yet */
+		for (i = seg->count; i-- > 0;)
+			if (le64toh(seg->entries[i].source) == source)
+				return i;
+
+		return HISTORY_NONE;
+	}
+
+	i = callsign_hash(source) & mask;
+	for (n = 0; n < seg->buckets; ++n, i = (i + 1) & mask)
+	{
+		const struct history_station *station = seg->table + i;
+		uint32_t last;
+
+		if (!station->source)
+			break;
+
+		if (le64toh(station->source) != source)
+			continue;
+
+		last = le32toh(station->last);
+		return last < seg->count ? last : HISTORY_NONE;
+	}
+
+	return HISTORY_NONE;
+}
+
+/* how many entries are no later than `until` */
+static uint32_t
+upper_bound(const struct segment *seg, uint64_t until)
+{
+	uint32_t low = 0, high = seg->count;
+
+	while (low < high)
+	{
+		uint32_t mid = low + (high - low) / 2;
+
+		if (le64toh(seg->entries[mid].time_ms) <= until)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return low;
+}
+
+static int
+decode(const struct segment *seg, const struct history_entry *entry,
+	struct windbag_packet *packet)
+{
+	struct ax25_header *header = &packet->header;
+	uint32_t offset = le32toh(entry->offset);
+	uint32_t length = le32toh(entry->length);
+	const uint8_t *record;
+	uint32_t sent;
+
+	if (length < RECORD_LENGTH || offset > seg->log_size
+		|| length > seg->log_size - offset
+		|| seg->log[offset + RECORD_STATUS] > DEFERRED_SIGNATURE)
+		return -1;
+
+	record = seg->log + offset;
+
+	memcpy(&sent, record + RECORD_SENT, sizeof sent);
+	packet->timestamp = le32toh(sent);
+	packet->signature_status = record[RECORD_STATUS];
+	packet->multipart_final = record[RECORD_PARTS];
+	packet->multipart_index = 0;
+	packet->control = 0;
+
+	memcpy(header->src_addr, record + RECORD_SOURCE, AX25_ADDR_MAX);
+	memcpy(header->dest_addr, record + RECORD_DEST, AX25_ADDR_MAX);
+	memcpy(packet->verified_callsign, record + RECORD_VERIFIED,
+		AX25_ADDR_MAX);
+	memcpy(header->digi_path, record + RECORD_PATH,
+		sizeof header->digi_path);
+
+	header->src_addr[AX25_ADDR_MAX - 1] = '\0';
+	header->dest_addr[AX25_ADDR_MAX - 1] = '\0';
+	packet->verified_callsign[AX25_ADDR_MAX - 1] = '\0';
+	header->digi_path[0][AX25_ADDR_MAX - 1] = '\0';
+	header->digi_path[1][AX25_ADDR_MAX - 1] = '\0';
+
+	packet->payload->length = 0;
+	if (bigbuffer_append(packet->payload, record + RECORD_LENGTH,
+			length - RECORD_LENGTH))
+		return -1;
+
+	bigbuffer_terminate(packet->payload);
+	return 0;
+}
+
+struct match
+{
+	uint32_t segment;
+	uint32_t entry;
+};
+
+struct matches
+{
+	struct match *list;
+	size_t length;
+	size_t size;
+};
+
+static int
+add_match(struct matches *matches, uint32_t segment, uint32_t entry)
+{
+	if (matches->length == matches->size)
+	{
+		size_t size = matches->size ? matches->size * 2 : 256;
+		struct match *temp;
+
+		temp = realloc(matches->list, size * sizeof (struct match));
+		if (!temp)
+			return ENOMEM;
+
+		matches->list = temp;
+		matches->size = size;
+	}
+
+	matches->list[matches->length].segment = segment;
+	matches->list[matches->length++].entry = entry;
+	return 0;
+}
+
+/* finds matching entries, latest first, up to the query's limit */
+static int
+find_matches(const struct segment *segs, uint32_t n,
+	const struct history_query *query, struct matches *matches)
+{
+	uint32_t s, i;
+
+	for (s = n; s-- > 0;)
+	{
+		const struct segment *seg = segs + s;
+
+		if (!seg->count || seg->first_ms > query->until_ms)
+			continue;
+
+		/* the segments before are older still */
+		if (seg->last_ms < query->since_ms)
+			break;
+
+		if (query->source)
+		{
+			i = last_from(seg, query->source);
+			while (i != HISTORY_NONE)
+			{
+				const struct history_entry *entry;
+				uint64_t t;
+				uint32_t prev;
+
+				entry = seg->entries + i;
+				t = le64toh(entry->time_ms);
+				if (t < query->since_ms)
+					break;
+
+				if (t <= query->until_ms
+					&& add_match(matches, s, i))
+					return ENOMEM;
+
+				if (query->limit
+					&& matches->length >= query->limit)
+					return 0;
+
+				/* links only ever go back */
+				prev = le32toh(entry->prev);
+				if (prev != HISTORY_NONE && prev >= i)
+					break;
+
+				i = prev;
+			}
+
+			continue;
+		}
+
+		for (i = upper_bound(seg, query->until_ms); i-- > 0;)
+		{
+			if (le64toh(seg->entries[i].time_ms) < query->since_ms)
+				break;
+
+			if (add_match(matches, s, i))
+				return ENOMEM;
+
+			if (query->limit && matches->length >= query->limit)
+				return 0;
+		}
+	}
+
+	return 0;
+}
+
+struct history_cursor
+{
+	struct segment *segs;
+	unsigned int mapped;
+	struct matches matches;
+	size_t next; /* counting down; the oldest match left is before it */
+	struct windbag_packet packet;
+};
+
+/*
+ * Finds the messages in the history that match the query, to be visited
+ * later by history_cursor_next. The segments stay mapped until the cursor
+ * is closed, so what is visited is what matched now.
+ */
+int
+history_cursor_open(const char *dir, const struct history_query *query,
+	struct history_cursor **cursor)
+{
+	struct history_cursor *c;
+	unsigned int *seqs, n, i;
+	int rc;
+
+	c = calloc(1, sizeof (struct history_cursor));
+	if (!c)
+		return ENOMEM;
+
+	rc = list_segments(dir, &seqs, &n);
+	if (rc)
+	{
+		free(seqs);
+		free(c);
+		return rc;
+	}
+
+	c->segs = malloc((n ? n : 1) * sizeof (struct segment));
+	if (!c->segs)
+	{
+		free(seqs);
+		free(c);
+		return ENOMEM;
+	}
+
+	/* a segment may be deleted meanwhile, and is then just skipped */
+	for (i = 0; i < n; ++i)
+		if (!map_segment(dir, seqs[i], c->segs + c->mapped))
+			++c->mapped;
+
+	free(seqs);
+
+	if (windbag_packet_init(&c->packet))
+	{
+		rc = ENOMEM;
+		goto fail;
+	}
+
+	rc = find_matches(c->segs, c->mapped, query, &c->matches);
+	if (rc)
+		goto fail;
+
+	c->next = c->matches.length;
+	*cursor = c;
+	return 0;
+
+fail:
+	history_cursor_close(c);
+	return rc;
+}
+
+/*
+ * Calls `visit` for each message the cursor has left, oldest first, until
+ * it returns nonzero. Returns nonzero if any are left then.
+ */
+int
+history_cursor_next(struct history_cursor *cursor, history_visitor visit,
+	void *arg)
+{
+	while (cursor->next > 0)
+	{
+		const struct match *match = cursor->matches.list
+			+ --cursor->next;
+		const struct segment *seg = cursor->segs + match->segment;
+		const struct history_entry *entry = seg->entries + match->entry;
+
+		if (decode(seg, entry, &cursor->packet))
+			continue;
+
+		if (visit(arg, &cursor->packet, le64toh(entry->time_ms)))
+			break;
+	}
+
+	return cursor->next > 0;
+}
+
+void
+history_cursor_close(struct history_cursor *cursor)
+{
+	unsigned int i;
+
+	if (cursor->packet.payload)
+		windbag_packet_cleanup(&cursor->packet);
+
+	free(cursor->matches.list);
+	for (i = 0; i < cursor->mapped; ++i)
+		unmap_segment(cursor->segs + i);
+	free(cursor->segs);
+	free(cursor);
+}
+
+/*
+ * Calls `visit` for each message in the history that matches the query,
+ * oldest first.
+ */
+int
+history_query(const char *dir, const struct history_query *query,
+	history_visitor visit, void *arg)
+{
+	struct history_cursor *cursor;
+	int rc;
+
+	rc = history_cursor_open(dir, query, &cursor);
+	if (rc)
+		return rc;
+
+	history_cursor_next(cursor, visit, arg);
+	history_cursor_close(cursor);
+	return 0;
+}
+
+/*
+ * Reads a time given as seconds since the epoch, as an age such as 30m,
+ * 2h or 7d, or as a UTC date and time such as 2024-06-01T12:00:00Z.
+ */
+int
+history_parse_time(const char *s, uint64_t *ms)
+{
+	unsigned long n, frac = 0, scale = 1000;
+	struct tm tm;
+	const char *p;
+	char *end;
+	time_t t;
+
+	if (isdigit((unsigned char) s[0]))
+	{
+		n = strtoul(s, &end, 10);
+		if (*end == '\0')
+		{
+			*ms = (uint64_t) n * 1000;
+			return 0;
+		}
+
+		if (end[0] && end[1] == '\0' && strchr("smhd", end[0]))
+		{
+			uint64_t unit = end[0] == 's' ? 1000
+				: end[0] == 'm' ? 60 * 1000
+				: end[0] == 'h' ? 60 * 60 * 1000 : MS_PER_DAY;
+			uint64_t now = now_ms();
+
+			*ms = n * unit < now ? now - n * unit : 0;
+			return 0;
+		}
+	}
+
+	memset(&tm, 0, sizeof tm);
+	p = strptime(s, "%Y-%m-%d", &tm);
+	if (!p)
+		return EINVAL;
+
+	if (*p == 'T' || *p == ' ')
+	{
+		p = strptime(p + 1, "%H:%M:%S", &tm);
+		if (!p)
+			return EINVAL;
+
+		/* milliseconds, ignoring any finer digits */
+		if (*p == '.')
+		{
+			for (++p; isdigit((unsigned char) *p); ++p)
+			{
+				if (scale == 1)
+					continue;
+
+				frac = frac * 10 + (*p - '0');
+				scale /= 10;
+			}
+		}
+	}
+
+	if (*p == 'Z')
+		++p;
+
+	if (*p != '\0')
+		return EINVAL;
+
+	t = timegm(&tm);
+	if (t < 0)
+		return EINVAL;
+
+	*ms = (uint64_t) t * 1000 + frac * scale;
+	return 0;
+}
+
+static const char *
+status_text(const struct windbag_packet *packet, char *buf)
+{
+	switch (packet->signature_status)
+	{
+	case NO_SIGNATURE:
+		return NULL;
+	case GOOD_SIGNATURE:
+		return "verified";
+	case ALTERNATE_SIGNATURE:
+		sprintf(buf, "verified %s", packet->verified_callsign);
+		return buf;
+	case UNKNOWN_SIGNATURE:
+	case DEFERRED_SIGNATURE:
+		return "unverified";
+	case BAD_SIGNATURE:
+		return "BAD SIGNATURE!";
+	case THROTTLED_SIGNATURE:
+		return "unverified, throttled";
+	}
+
+	return "unknown signature status";
+}
+
+static int
+print_text(void *arg, const struct windbag_packet *packet, uint64_t time_ms)
+{
+	char when[32], temp[9 + AX25_ADDR_MAX];
+	time_t t = time_ms / 1000;
+	const char *status;
+	struct tm tm;
+
+	UNUSED(arg);
+
+	localtime_r(&t, &tm);
+	strftime(when, sizeof when, "%Y-%m-%d %H:%M:%S", &tm);
+	printf("%s %s", when, packet->header.src_addr);
+
+	status = status_text(packet, temp);
+	if (status)
+		printf(" (%s)", status);
+
+	if (packet->multipart_final)
+		printf(" (%u parts)", packet->multipart_final + 1);
+
+	printf(": %s\n", packet->payload->data);
+	return 0;
+}
+
+static int
+print_json(void *arg, const struct windbag_packet *packet, uint64_t time_ms)
+{
+	struct bigbuffer *buf = arg;
+	struct timespec when;
+
+	when.tv_sec = time_ms / 1000;
+	when.tv_nsec = (time_ms % 1000) * 1000000;
+
+	buf->length = 0;
+	if (jsonout_format(buf, packet, &when))
+		return 1;
+
+	return fwrite(buf->data, 1, buf->length, stdout) != buf->length;
+}
+
+int
+show_history(struct windbag_config *config, int argc, char **argv)
+{
+	struct history_query query;
+	char dir[MAX_FILE_PATH];
+	char callsign[AX25_ADDR_MAX];
+	struct bigbuffer *buf = NULL;
+	int i, rc, json = 0;
+
+	memset(&query, 0, sizeof query);
+	query.until_ms = UINT64_MAX;
+
+	for (i = 0; i < argc; ++i)
+	{
+		const char *word = argv[i], *value = argv[i + 1];
+
+		if (strcmp(word, "json") == 0)
+		{
+			json = 1;
+			continue;
+		}
+
+		if (i + 1 == argc)
+			goto usage;
+
+		++i;
+		if (strcmp(word, "from") == 0)
+		{
+			strncpy(callsign, value, sizeof callsign - 1);
+			callsign[sizeof callsign - 1] = '\0';
+			sanitize_callsign(callsign);
+
+			rc = validate_callsign(callsign);
+			if (rc)
+			{
+				fprintf(stderr, "Error in call sign '%s': %s\n",
+					value, callsign_strerror(rc));
+				return 1;
+			}
+
+			query.source = callsign_pack(callsign);
+		}
+		else if (strcmp(word, "since") == 0
+			&& !history_parse_time(value, &query.since_ms))
+			;
+		else if (strcmp(word, "until") == 0
+			&& !history_parse_time(value, &query.until_ms))
+			;
+		else if (strcmp(word, "last") == 0 && value[0] != '-'
+			&& (query.limit = strtoul(value, NULL, 10)))
+			;
+		else
+			goto usage;
+	}
+
+	if (config->history_path[0] != '\0')
+		strcpy(dir, config->history_path);
+	else
+		history_default_path(dir, sizeof dir);
+
+	if (json)
+	{
+		buf = bigbuffer_new(AX25_INFO_MAX * 8);
+		if (!buf)
+			return ENOMEM;
+	}
+
+	rc = history_query(dir, &query, json ? print_json : print_text, buf);
+	if (rc)
+		fprintf(stderr, "Error reading history in %s: %s\n", dir,
+			strerror(rc));
+
+	if (buf)
+		bigbuffer_free(buf);
+	return rc;
+
+usage:
+	fprintf(stderr, "Usage: windbag history [from <callsign>] "
+		"[since <time>] [until <time>] [last <count>] [json]\n");
+	return -1;
+}
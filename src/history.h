@@ -0,0 +1,149 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef WB_HISTORY_H
+#define WB_HISTORY_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "windbag.h"
+
+#define HISTORY_DIR "history"
+#define HISTORY_SEGMENTS 8 /* the size limit is split among this many */
+#define HISTORY_NONE UINT32_MAX
+
+/*
+ * The history is kept in segments, each a log of messages and an index
+ * file. The index file starts with this header, all integers little
+ * endian, followed by an entry for each message in the order they were
+ * heard, so by time. Each entry also links to the one before it from the
+ * same station. A segment that is full is sealed by adding a table of the
+ * last entry from each station, which is where those chains start.
+ */
+struct history_file_header
+{
+	uint8_t magic[4];
+	uint16_t version;
+	uint16_t header_length;
+	uint32_t count;
+	uint32_t buckets; /* of the station table; 0 until sealed */
+	uint64_t table_offset;
+	uint64_t first_ms;
+	uint64_t last_ms;
+};
+
+struct history_entry
+{
+	uint64_t time_ms;
+	uint64_t source; /* see callsign_pack() */
+	uint32_t offset; /* of the message in the log */
+	uint32_t length;
+	uint32_t prev; /* the station's entry before, or HISTORY_NONE */
+	uint32_t reserved;
+};
+
+struct history_station
+{
+	uint64_t source;
+	uint32_t last;
+	uint32_t count;
+};
+
+/* the writer, of which there is one at a time */
+struct history
+{
+	pthread_mutex_t lock;
+	char dir[MAX_FILE_PATH];
+	int lock_fd;
+	uint64_t max_bytes;
+	unsigned int max_days;
+
+	/* the segment being written */
+	unsigned int seq;
+	int log_fd;
+	int index_fd;
+	struct history_file_header header;
+	uint32_t log_length;
+	struct history_station *stations;
+	uint32_t station_mask;
+	uint32_t n_stations;
+};
+
+struct history_query
+{
+	uint64_t since_ms;
+	uint64_t until_ms;
+	uint64_t source; /* 0 for all */
+	unsigned int limit; /* the latest this many; 0 for all */
+};
+
+/* returns nonzero to stop */
+typedef int (*history_visitor)(void *arg, const struct windbag_packet *packet,
+			uint64_t time_ms);
+
+char *
+history_default_path(char *buf, int bufsize);
+
+struct history *
+history_open(const char *dir, uint64_t max_bytes, unsigned int max_days);
+
+void
+history_close(struct history *history);
+
+int
+history_append(struct history *history, const struct windbag_packet *packet);
+
+int
+history_query(const char *dir, const struct history_query *query,
+	history_visitor visit, void *arg);
+
+struct history_cursor;
+
+int
+history_cursor_open(const char *dir, const struct history_query *query,
+	struct history_cursor **cursor);
+
+int
+history_cursor_next(struct history_cursor *cursor, history_visitor visit,
+	void *arg);
+
+void
+history_cursor_close(struct history_cursor *cursor);
+
+int
+history_parse_time(const char *s, uint64_t *ms);
+
+int
+show_history(struct windbag_config *config, int argc, char **argv);
+
+#endif
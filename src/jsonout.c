@@ -0,0 +1,428 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jsonout.h"
+#include "util.h"
+
+static const char *
+status_name(enum windbag_signature_status status)
+{
+	switch (status)
+	{
+	case NO_SIGNATURE:
+		return "none";
+	case GOOD_SIGNATURE:
+		return "good";
+	case UNKNOWN_SIGNATURE:
+		return "unknown";
+	case BAD_SIGNATURE:
+		return "bad";
+	case ALTERNATE_SIGNATURE:
+		return "alternate";
+	case THROTTLED_SIGNATURE:
+		return "throttled";
+	case DEFERRED_SIGNATURE:
+		return "deferred";
+	}
+
+	return "invalid";
+}
+
+static int
+append(struct bigbuffer *buf, const char *s)
+{
+	return bigbuffer_append(buf, (const uint8_t *) s, strlen(s));
+}
+
+/* the length of the valid UTF-8 sequence at `s`, or 0 */
+static unsigned int
+utf8_length(const uint8_t *s, unsigned int left)
+{
+	unsigned int n, i;
+	uint32_t c;
+
+	if (s[0] < 0xC2)
+		return 0;
+	else if (s[0] < 0xE0)
+		n = 2;
+	else if (s[0] < 0xF0)
+		n = 3;
+	else if (s[0] < 0xF5)
+		n = 4;
+	else
+		return 0;
+
+	if (n > left)
+		return 0;
+
+	c = s[0] & (0x7F >> n);
+	for (i = 1; i < n; ++i)
+	{
+		if ((s[i] & 0xC0) != 0x80)
+			return 0;
+
+		c = (c << 6) | (s[i] & 0x3F);
+	}
+
+	/* no overlong forms or surrogates */
+	if ((n == 3 && (c < 0x800 || (c >= 0xD800 && c <= 0xDFFF)))
+		|| (n == 4 && (c < 0x10000 || c > 0x10FFFF)))
+		return 0;
+
+	return n;
+}
+
+/*
+ * Appends a JSON string. Bytes that are not UTF-8 are taken to be Latin-1,
+ * as old packet software tends to send.
+ */
+static int
+append_string(struct bigbuffer *buf, const uint8_t *s, unsigned int length)
+{
+	unsigned int i, start = 0;
+	char escape[8];
+
+	if (append(buf, "\""))
+		return -1;
+
+	for (i = 0; i < length;)
+	{
+		unsigned int n = 1;
+
+		if (s[i] >= 0x20 && s[i] < 0x7F && s[i] != '"' && s[i] != '\\')
+		{
+			++i;
+			continue;
+		}
+
+		if (s[i] >= 0x80 && (n = utf8_length(s + i, length - i)))
+		{
+			i += n;
+			continue;
+		}
+
+		if (bigbuffer_append(buf, s + start, i - start))
+			return -1;
+
+		switch (s[i])
+		{
+		case '"':
+			strcpy(escape, "\\\"");
+			break;
+		case '\\':
+			strcpy(escape, "\\\\");
+			break;
+		case '\n':
+			strcpy(escape, "\\n");
+			break;
+		case '\r':
+			strcpy(escape, "\\r");
+			break;
+		case '\t':
+			strcpy(escape, "\\t");
+			break;
+		default:
+			snprintf(escape, sizeof escape, "\\u%04x", s[i]);
+			break;
+		}
+
+		if (append(buf, escape))
+			return -1;
+
+		start = ++i;
+	}
+
+	if (bigbuffer_append(buf, s + start, i - start))
+		return -1;
+
+	return append(buf, "\"");
+}
+
+static int
+append_field(struct bigbuffer *buf, const char *name, const char *value)
+{
+	if (append(buf, ",\"") || append(buf, name) || append(buf, "\":"))
+		return -1;
+
+	if (!value)
+		return append(buf, "null");
+
+	return append_string(buf, (const uint8_t *) value, strlen(value));
+}
+
+/* appends a packet as a line of JSON */
+int
+jsonout_format(struct bigbuffer *buf, const struct windbag_packet *packet,
+	const struct timespec *received)
+{
+	const struct ax25_header *header = &packet->header;
+	const char *verified = NULL;
+	char temp[64];
+	struct tm tm;
+	unsigned int i;
+
+	gmtime_r(&received->tv_sec, &tm);
+	strftime(temp, sizeof temp, "{\"time\":\"%Y-%m-%dT%H:%M:%S", &tm);
+	if (append(buf, temp))
+		return -1;
+
+	snprintf(temp, sizeof temp, ".%03ldZ\"", received->tv_nsec / 1000000);
+	if (append(buf, temp))
+		return -1;
+
+	if (append_field(buf, "source", header->src_addr)
+		|| append_field(buf, "dest", header->dest_addr)
+		|| append(buf, ",\"path\":["))
+		return -1;
+
+	for (i = 0; i < AX25_MAX_ADDRS - 2 && header->digi_path[i][0]; ++i)
+	{
+		if ((i && append(buf, ","))
+			|| append_string(buf,
+				(const uint8_t *) header->digi_path[i],
+				strlen(header->digi_path[i])))
+			return -1;
+	}
+
+	if (packet->signature_status == GOOD_SIGNATURE)
+		verified = header->src_addr;
+	else if (packet->signature_status == ALTERNATE_SIGNATURE)
+		verified = packet->verified_callsign;
+
+	snprintf(temp, sizeof temp, "],\"sent\":%lu,\"parts\":%u",
+		(unsigned long) packet->timestamp, packet->multipart_final + 1);
+
+	if (append(buf, temp)
+		|| append_field(buf, "signature",
+			status_name(packet->signature_status))
+		|| append_field(buf, "verified", verified)
+		|| append(buf, ",\"message\":")
+		|| append_string(buf, packet->payload->data,
+			packet->payload->length)
+		|| append(buf, "}\n"))
+		return -1;
+
+	return 0;
+}
+
+static int
+write_all(int fd, const uint8_t *data, unsigned int length)
+{
+	while (length > 0)
+	{
+		ssize_t n = write(fd, data, length);
+
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return errno;
+		}
+
+		data += n;
+		length -= n;
+	}
+
+	return 0;
+}
+
+/* call with the lock held */
+static int
+flush(struct jsonout *out)
+{
+	int rc;
+
+	if (out->buf->length == 0)
+		return 0;
+
+	rc = write_all(out->fd, out->buf->data, out->buf->length);
+	out->buf->length = 0;
+	if (rc && !out->error)
+	{
+		out->error = rc;
+		fprintf(stderr, "Error writing packets: %s\n", strerror(rc));
+	}
+
+	return rc;
+}
+
+static void
+wait_until(struct jsonout *out, uint64_t when)
+{
+	struct timespec ts;
+
+	ts.tv_sec = when / 1000;
+	ts.tv_nsec = (when % 1000) * 1000000;
+	pthread_cond_timedwait(&out->changed, &out->lock, &ts);
+}
+
+/* writes out what has waited long enough for company */
+static void *
+run(void *arg)
+{
+	struct jsonout *out = arg;
+
+	pthread_mutex_lock(&out->lock);
+
+	while (!out->stopping)
+	{
+		uint64_t idle_at;
+
+		if (out->buf->length == 0)
+		{
+			pthread_cond_wait(&out->changed, &out->lock);
+			continue;
+		}
+
+		idle_at = out->last_packet + out->idle_ms;
+		if (idle_at > out->first_packet + JSONOUT_DELAY_MAX_MS)
+			idle_at = out->first_packet + JSONOUT_DELAY_MAX_MS;
+
+		if (monotonic_ms() < idle_at)
+		{
+			wait_until(out, idle_at);
+			continue;
+		}
+
+		flush(out);
+	}
+
+	flush(out);
+	pthread_mutex_unlock(&out->lock);
+	return NULL;
+}
+
+struct jsonout *
+jsonout_new(int fd, unsigned int flush_bytes, unsigned int idle_ms)
+{
+	struct jsonout *out;
+	pthread_condattr_t attr;
+
+	out = calloc(1, sizeof (struct jsonout));
+	if (!out)
+		return NULL;
+
+	out->buf = bigbuffer_new(flush_bytes + AX25_INFO_MAX * 8);
+	if (!out->buf)
+		goto fail1;
+
+	if (pthread_mutex_init(&out->lock, NULL))
+		goto fail2;
+
+	if (pthread_condattr_init(&attr))
+		goto fail3;
+
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if (pthread_cond_init(&out->changed, &attr))
+	{
+		pthread_condattr_destroy(&attr);
+		goto fail3;
+	}
+
+	pthread_condattr_destroy(&attr);
+
+	out->fd = fd;
+	out->flush_bytes = flush_bytes;
+	out->idle_ms = idle_ms;
+
+	if (pthread_create(&out->thread, NULL, run, out))
+		goto fail4;
+
+	return out;
+
+fail4:
+	pthread_cond_destroy(&out->changed);
+fail3:
+	pthread_mutex_destroy(&out->lock);
+fail2:
+	bigbuffer_free(out->buf);
+fail1:
+	free(out);
+	return NULL;
+}
+
+/* writes out whatever is left */
+void
+jsonout_free(struct jsonout *out)
+{
+	pthread_mutex_lock(&out->lock);
+	out->stopping = 1;
+	pthread_cond_signal(&out->changed);
+	pthread_mutex_unlock(&out->lock);
+
+	pthread_join(out->thread, NULL);
+
+	pthread_cond_destroy(&out->changed);
+	pthread_mutex_destroy(&out->lock);
+	bigbuffer_free(out->buf);
+	free(out);
+}
+
+int
+jsonout_packet(struct jsonout *out, const struct windbag_packet *packet)
+{
+	struct timespec received;
+	unsigned int length;
+	int rc = 0;
+
+	clock_gettime(CLOCK_REALTIME, &received);
+
+	pthread_mutex_lock(&out->lock);
+
+	length = out->buf->length;
+	if (jsonout_format(out->buf, packet, &received))
+	{
+		out->buf->length = length; /* no half lines */
+		rc = ENOMEM;
+		goto end;
+	}
+
+	out->last_packet = monotonic_ms();
+	if (length == 0)
+		out->first_packet = out->last_packet;
+
+	if (out->buf->length >= out->flush_bytes)
+		rc = flush(out);
+	else if (length == 0)
+		pthread_cond_signal(&out->changed);
+
+end:
+	pthread_mutex_unlock(&out->lock);
+	return rc;
+}
@@ -0,0 +1,80 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef WB_JSONOUT_H
+#define WB_JSONOUT_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "bigbuffer.h"
+#include "windbag.h"
+
+#define JSONOUT_FLUSH_BYTES 65536
+#define JSONOUT_IDLE_MS 50
+#define JSONOUT_DELAY_MAX_MS 1000 /* even when packets never let up */
+
+/*
+ * Writes packets as JSON, one object to a line. Lines are gathered in a
+ * buffer that is written out when it fills, or when no packet has come for
+ * a little while, so a busy channel costs few writes and a quiet one sees
+ * each packet at once.
+ */
+struct jsonout
+{
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	pthread_t thread;
+	int fd;
+	struct bigbuffer *buf;
+	unsigned int flush_bytes;
+	unsigned int idle_ms;
+	uint64_t first_packet; /* of those in the buffer */
+	uint64_t last_packet;
+	int stopping;
+	int error;
+};
+
+struct jsonout *
+jsonout_new(int fd, unsigned int flush_bytes, unsigned int idle_ms);
+
+void
+jsonout_free(struct jsonout *out);
+
+int
+jsonout_packet(struct jsonout *out, const struct windbag_packet *packet);
+
+int
+jsonout_format(struct bigbuffer *buf, const struct windbag_packet *packet,
+	const struct timespec *received);
+
+#endif
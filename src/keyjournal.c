@@ -0,0 +1,285 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "keyjournal.h"
+#include "os.h"
+#include "util.h"
+
+/*
+ * A journal record is an operation, a call sign and a key (zeros for a
+ * delete), then a checksum of the rest, so that a record torn by a crash
+ * is recognized and skipped. Records all being the same length, what
+ * follows one is still found where it should be.
+ */
+#define RECORD_CALLSIGN 1
+#define RECORD_PUBKEY (RECORD_CALLSIGN + AX25_ADDR_MAX)
+#define RECORD_CHECK (RECORD_PUBKEY + crypto_sign_PUBLICKEYBYTES)
+#define CHECK_LENGTH 4
+#define RECORD_LENGTH (RECORD_CHECK + CHECK_LENGTH)
+
+/* a journal past this share of the keyring file is compacted into it */
+#define MIN_COMPACT (64 * 1024)
+#define COMPACT_SHARE 2
+
+static void
+journal_path(char *buf, size_t bufsize, const char *keyring_path)
+{
+	snprintf(buf, bufsize, "%s" KEYJOURNAL_SUFFIX, keyring_path);
+}
+
+static void
+check(unsigned char *out, const unsigned char *record)
+{
+	unsigned char hash[crypto_generichash_BYTES_MIN];
+
+	crypto_generichash(hash, sizeof hash, record, RECORD_CHECK, NULL, 0);
+	memcpy(out, hash, CHECK_LENGTH);
+}
+
+/*
+ * Opens and locks the journal of the keyring at `keyring_path`: shared to
+ * read it along with the keyring, or exclusive, creating it if need be, to
+ * change either. Returns the descriptor, or -1 and errno, which is ENOENT
+ * if a shared lock was wanted and there is no journal.
+ */
+int
+keyjournal_open(const char *keyring_path, int exclusive)
+{
+	char path[MAX_FILE_PATH + sizeof KEYJOURNAL_SUFFIX];
+	int fd, rc;
+
+	journal_path(path, sizeof path, keyring_path);
+
+	if (exclusive)
+	{
+		char *dpath = strdup(path);
+
+		if (!dpath)
+		{
+			errno = ENOMEM;
+			return -1;
+		}
+
+		rc = mkdir_recursive(dirname(dpath), 0755);
+		free(dpath);
+		if (rc)
+		{
+			errno = rc;
+			return -1;
+		}
+
+		fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+	}
+	else
+		fd = open(path, O_RDONLY);
+
+	if (fd == -1)
+		return -1;
+
+	if (flock(fd, exclusive ? LOCK_EX : LOCK_SH))
+	{
+		rc = errno;
+		close(fd);
+		errno = rc;
+		return -1;
+	}
+
+	return fd;
+}
+
+void
+keyjournal_close(int fd)
+{
+	flock(fd, LOCK_UN);
+	close(fd);
+}
+
+/* adds a record and waits for it to reach the disk */
+int
+keyjournal_append(int fd, enum keyjournal_op op, const char *callsign,
+	const unsigned char *pubkey)
+{
+	unsigned char record[RECORD_LENGTH];
+	off_t size = keyjournal_size(fd);
+	ssize_t written;
+
+	/* a crash in the middle of the last append left part of a record */
+	if (size % RECORD_LENGTH && ftruncate(fd, size - size % RECORD_LENGTH))
+		return errno;
+
+	memset(record, 0, sizeof record);
+	record[0] = op;
+	strncpy((char *) record + RECORD_CALLSIGN, callsign,
+		AX25_ADDR_MAX - 1);
+	if (pubkey)
+		memcpy(record + RECORD_PUBKEY, pubkey,
+			crypto_sign_PUBLICKEYBYTES);
+
+	check(record + RECORD_CHECK, record);
+
+	written = write(fd, record, sizeof record);
+	if (written != sizeof record)
+		return written < 0 ? errno : EIO;
+
+	return fsync(fd) ? errno : 0;
+}
+
+static int
+apply(struct keyring *keyring, const unsigned char *record)
+{
+	unsigned char expected[CHECK_LENGTH];
+	const char *callsign = (const char *) record + RECORD_CALLSIGN;
+
+	check(expected, record);
+	if (memcmp(expected, record + RECORD_CHECK, CHECK_LENGTH) != 0
+		|| record[RECORD_PUBKEY - 1] != '\0')
+		return -1;
+
+	switch (record[0])
+	{
+	case KEYJOURNAL_ADD:
+		return keyring_add_pubkey(keyring, callsign,
+			record + RECORD_PUBKEY);
+
+	case KEYJOURNAL_DELETE:
+		keyring_delete(keyring, callsign);
+		return 0;
+
+	default:
+		return -1;
+	}
+}
+
+/*
+ * Applies the journal's records to a keyring just loaded from its file.
+ * Records are idempotent, so replaying some that the file already holds,
+ * as after a compaction cut short, does no harm.
+ */
+int
+keyjournal_replay(int fd, struct keyring *keyring)
+{
+	unsigned char buf[RECORD_LENGTH * 64];
+	size_t have = 0, used;
+	off_t offset = 0;
+	ssize_t n;
+	int rc;
+
+	for (;;)
+	{
+		n = pread(fd, buf + have, sizeof buf - have, offset);
+		if (n < 0)
+			return errno;
+
+		offset += n;
+		have += n;
+
+		for (used = 0; used + RECORD_LENGTH <= have;
+		     used += RECORD_LENGTH)
+		{
+			rc = apply(keyring, buf + used);
+			if (rc > 0)
+				return rc;
+		}
+
+		memmove(buf, buf + used, have - used);
+		have -= used;
+
+		if (n == 0)
+			return 0;
+	}
+}
+
+/* empties the journal once the keyring file holds all of it */
+int
+keyjournal_clear(int fd)
+{
+	if (ftruncate(fd, 0) || fsync(fd))
+		return errno;
+
+	return 0;
+}
+
+off_t
+keyjournal_size(int fd)
+{
+	struct stat st;
+
+	return fstat(fd, &st) ? 0 : st.st_size;
+}
+
+/*
+ * Records one change to the keyring at `path` in its journal, which costs
+ * the same however big the keyring is. Once the journal outgrows a share
+ * of the keyring file, a child process compacts the two, so compaction
+ * work stays in proportion to the edits that call for it.
+ */
+int
+keyjournal_record(const char *path, enum keyjournal_op op,
+	const char *callsign, const unsigned char *pubkey)
+{
+	struct stat st;
+	off_t limit = MIN_COMPACT;
+	int fd, rc;
+
+	fd = keyjournal_open(path, 1);
+	if (fd == -1)
+		return errno;
+
+	rc = keyjournal_append(fd, op, callsign, pubkey);
+
+	if (!stat(path, &st) && st.st_size / COMPACT_SHARE > limit)
+		limit = st.st_size / COMPACT_SHARE;
+
+	if (!rc && keyjournal_size(fd) > limit)
+	{
+		keyjournal_close(fd);
+
+		/* if it cannot start, the next edit will try again */
+		fflush(NULL);
+		if (fork() == 0)
+			_exit(keyring_compact(path) ? 1 : 0);
+
+		return 0;
+	}
+
+	keyjournal_close(fd);
+	return rc;
+}
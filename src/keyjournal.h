@@ -0,0 +1,70 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef WB_KEYJOURNAL_H
+#define WB_KEYJOURNAL_H
+
+#include <sys/types.h>
+
+#include "keyring.h"
+
+#define KEYJOURNAL_SUFFIX ".journal"
+
+enum keyjournal_op
+{
+	KEYJOURNAL_ADD = 'A',
+	KEYJOURNAL_DELETE = 'D'
+};
+
+int
+keyjournal_open(const char *keyring_path, int exclusive);
+
+void
+keyjournal_close(int fd);
+
+int
+keyjournal_append(int fd, enum keyjournal_op op, const char *callsign,
+	const unsigned char *pubkey);
+
+int
+keyjournal_replay(int fd, struct keyring *keyring);
+
+int
+keyjournal_clear(int fd);
+
+off_t
+keyjournal_size(int fd);
+
+int
+keyjournal_record(const char *keyring_path, enum keyjournal_op op,
+	const char *callsign, const unsigned char *pubkey);
+
+#endif
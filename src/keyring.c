@@ -30,13 +30,19 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <libgen.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "callsign.h"
 #include "base64.h"
+#include "endian.h"
+#include "keyjournal.h"
 #include "keyring.h"
 #include "os.h"
 #include "util.h"
@@ -44,6 +50,234 @@
 #define STEP 32
 #define RECORD_LENGTH (AX25_CALL_MAX + 1 + crypto_sign_PUBLICKEYBYTES)
 
+#define INDEXED_MAGIC "WBKR"
+#define INDEXED_VERSION 1
+#define INDEXED_ALIGN 8
+
+/* where the fields of an identity lie in the records of an indexed file */
+#define RECORD_PACKED 0
+#define RECORD_CALLSIGN 8
+#define RECORD_PUBKEY (RECORD_CALLSIGN + AX25_ADDR_MAX)
+#define RECORD_FINGERPRINT (RECORD_PUBKEY + crypto_sign_PUBLICKEYBYTES + 2)
+#define INDEXED_RECORD_LENGTH (RECORD_FINGERPRINT + 4)
+
+static unsigned long last_generation = 0;
+
+static void
+touch(struct keyring *keyring)
+{
+	keyring->generation = ++last_generation;
+}
+
+static unsigned int
+base_bucket(const struct keyring *keyring, uint64_t packed)
+{
+	return callsign_hash(packed & ~(uint64_t) CALLSIGN_SSID_MASK)
+		& keyring->index_mask;
+}
+
+static unsigned int
+fingerprint_bucket(const struct keyring *keyring, uint32_t fingerprint)
+{
+	return fingerprint & keyring->index_mask;
+}
+
+/* twice as many slots as buckets keeps the slot table at most half full */
+static unsigned int
+slot_mask(const struct keyring *keyring)
+{
+	return keyring->index_mask << 1 | 1;
+}
+
+/*
+ * The slot holding the identity packed as given, or the empty slot ending
+ * its probe sequence. There is always an empty slot, but should a corrupt
+ * table have none, NULL once every slot has been probed.
+ */
+static unsigned int *
+find_slot(const struct keyring *keyring, uint64_t packed)
+{
+	unsigned int mask = slot_mask(keyring);
+	unsigned int slot = callsign_hash(packed) & mask, probes = 0;
+
+	while (keyring->slots[slot]
+		&& keyring->keys[keyring->slots[slot] - 1].packed != packed)
+	{
+		if (probes++ == mask)
+			return NULL;
+
+		slot = (slot + 1) & mask;
+	}
+
+	return keyring->slots + slot;
+}
+
+/*
+ * Empties a slot, moving later entries of its probe sequence back so that
+ * no lookup stops short at the hole
+ */
+static void
+clear_slot(struct keyring *keyring, unsigned int *hole)
+{
+	unsigned int mask = slot_mask(keyring);
+	unsigned int empty = hole - keyring->slots, slot = empty;
+
+	for (;;)
+	{
+		unsigned int home;
+
+		slot = (slot + 1) & mask;
+		if (!keyring->slots[slot])
+			break;
+
+		home = callsign_hash(keyring->keys[keyring->slots[slot] - 1]
+				.packed) & mask;
+
+		/* stays put if its home lies cyclically in (empty, slot] */
+		if (((slot - home) & mask) < ((slot - empty) & mask))
+			continue;
+
+		keyring->slots[empty] = keyring->slots[slot];
+		empty = slot;
+	}
+
+	keyring->slots[empty] = 0;
+}
+
+static void
+link_fingerprint(struct keyring *keyring, unsigned int i)
+{
+	unsigned int bucket;
+
+	bucket = fingerprint_bucket(keyring, keyring->keys[i].fingerprint);
+	keyring->fingerprint_next[i] = keyring->fingerprint_heads[bucket];
+	keyring->fingerprint_heads[bucket] = i + 1;
+}
+
+static void
+link_identity(struct keyring *keyring, unsigned int i)
+{
+	const struct identity *identity = keyring->keys + i;
+	unsigned int bucket;
+
+	bucket = base_bucket(keyring, identity->packed);
+	keyring->base_next[i] = keyring->base_heads[bucket];
+	keyring->base_heads[bucket] = i + 1;
+
+	link_fingerprint(keyring, i);
+	*find_slot(keyring, identity->packed) = i + 1;
+}
+
+/* the link in a hash chain that refers to identity i */
+static unsigned int *
+find_link(unsigned int *head, unsigned int *next, unsigned int i)
+{
+	while (*head != i + 1)
+		head = next + *head - 1;
+
+	return head;
+}
+
+static void
+unlink_fingerprint(struct keyring *keyring, unsigned int i)
+{
+	unsigned int *link;
+
+	link = find_link(keyring->fingerprint_heads + fingerprint_bucket(
+				keyring, keyring->keys[i].fingerprint),
+			keyring->fingerprint_next, i);
+	*link = keyring->fingerprint_next[i];
+}
+
+static void
+unlink_identity(struct keyring *keyring, unsigned int i)
+{
+	unsigned int *link;
+
+	link = find_link(keyring->base_heads
+				+ base_bucket(keyring, keyring->keys[i].packed),
+			keyring->base_next, i);
+	*link = keyring->base_next[i];
+
+	unlink_fingerprint(keyring, i);
+	clear_slot(keyring, find_slot(keyring, keyring->keys[i].packed));
+}
+
+/* moves identity `from` into the unused place `to`, links and all */
+static void
+move_identity(struct keyring *keyring, unsigned int from, unsigned int to)
+{
+	const struct identity *identity = keyring->keys + from;
+
+	*find_link(keyring->base_heads
+			+ base_bucket(keyring, identity->packed),
+		keyring->base_next, from) = to + 1;
+	keyring->base_next[to] = keyring->base_next[from];
+
+	*find_link(keyring->fingerprint_heads
+			+ fingerprint_bucket(keyring, identity->fingerprint),
+		keyring->fingerprint_next, from) = to + 1;
+	keyring->fingerprint_next[to] = keyring->fingerprint_next[from];
+
+	*find_slot(keyring, identity->packed) = to + 1;
+	keyring->keys[to] = *identity;
+}
+
+static int
+resize_chain(unsigned int **chain, unsigned int n)
+{
+	unsigned int *temp = realloc(*chain, n * sizeof (unsigned int));
+	if (!temp)
+		return ENOMEM;
+
+	*chain = temp;
+	return 0;
+}
+
+static int
+reindex(struct keyring *keyring)
+{
+	unsigned int i, buckets = STEP;
+
+	while (buckets < keyring->bufsize)
+		buckets <<= 1;
+
+	if (buckets != keyring->index_mask + 1)
+	{
+		if (resize_chain(&keyring->base_heads, buckets)
+			|| resize_chain(&keyring->fingerprint_heads, buckets)
+			|| resize_chain(&keyring->slots, buckets * 2))
+			return ENOMEM;
+
+		keyring->index_mask = buckets - 1;
+	}
+
+	if (resize_chain(&keyring->base_next, keyring->bufsize)
+		|| resize_chain(&keyring->fingerprint_next, keyring->bufsize))
+		return ENOMEM;
+
+	memset(keyring->base_heads, 0, buckets * sizeof (unsigned int));
+	memset(keyring->fingerprint_heads, 0, buckets * sizeof (unsigned int));
+	memset(keyring->slots, 0, buckets * 2 * sizeof (unsigned int));
+
+	for (i = 0; i < keyring->length; ++i)
+		link_identity(keyring, i);
+
+	return 0;
+}
+
+uint32_t
+keyring_fingerprint(const unsigned char *pubkey)
+{
+	unsigned char hash[crypto_generichash_BYTES_MIN];
+
+	crypto_generichash(hash, sizeof hash, pubkey,
+			crypto_sign_PUBLICKEYBYTES, NULL, 0);
+
+	return (uint32_t) hash[0] | ((uint32_t) hash[1] << 8)
+		| ((uint32_t) hash[2] << 16) | ((uint32_t) hash[3] << 24);
+}
+
 struct keyring *
 keyring_new()
 {
@@ -60,217 +294,844 @@ keyring_new()
 
 	keyring->bufsize = STEP;
 	keyring->length = 0;
+	keyring->index_mask = 0;
+	keyring->base_heads = NULL;
+	keyring->base_next = NULL;
+	keyring->fingerprint_heads = NULL;
+	keyring->fingerprint_next = NULL;
+	keyring->slots = NULL;
+	keyring->format = KEYRING_INDEXED;
+	keyring->map = NULL;
+
+	if (reindex(keyring))
+	{
+		keyring_free(keyring);
+		return NULL;
+	}
+
+	touch(keyring);
 	return keyring;
 }
 
 void
 keyring_free(struct keyring *keyring)
 {
+	if (keyring->map)
+	{
+		munmap(keyring->map, keyring->map_length);
+		free(keyring);
+		return;
+	}
+
+	free(keyring->base_heads);
+	free(keyring->base_next);
+	free(keyring->fingerprint_heads);
+	free(keyring->fingerprint_next);
+	free(keyring->slots);
 	free(keyring->keys);
 	free(keyring);
 }
 
+/* moves a mapped keyring's arrays to the heap, so that they can grow */
+static int
+own(struct keyring *keyring, unsigned int bufsize)
+{
+	struct identity *keys;
+
+	if (bufsize < STEP)
+		bufsize = STEP;
+
+	keys = malloc(bufsize * sizeof (struct identity));
+	if (!keys)
+		return ENOMEM;
+
+	memcpy(keys, keyring->keys, keyring->length * sizeof (struct identity));
+	munmap(keyring->map, keyring->map_length);
+	keyring->map = NULL;
+
+	keyring->keys = keys;
+	keyring->bufsize = bufsize;
+	keyring->index_mask = 0;
+	keyring->slots = NULL;
+	keyring->base_heads = NULL;
+	keyring->base_next = NULL;
+	keyring->fingerprint_heads = NULL;
+	keyring->fingerprint_next = NULL;
+
+	return reindex(keyring);
+}
+
+/* makes room for at least `n` identities */
+static int
+reserve(struct keyring *keyring, unsigned int n)
+{
+	struct identity *temp;
+
+	if (keyring->map)
+		return own(keyring, n);
+
+	if (n <= keyring->bufsize)
+		return 0;
+
+	temp = realloc(keyring->keys, n * sizeof (struct identity));
+	if (!temp)
+		return ENOMEM;
+
+	keyring->keys = temp;
+	keyring->bufsize = n;
+	return reindex(keyring);
+}
+
 static int
 add_identity(struct keyring *keyring, const char *callsign,
-	unsigned char *pubkey)
+	const unsigned char *pubkey)
 {
 	struct identity *identity;
 
-	if (keyring->length == keyring->bufsize)
-	{
-		unsigned int new_bufsize = keyring->bufsize + STEP;
-		struct identity *temp = realloc(keyring->keys,
-						new_bufsize * sizeof (struct identity));
-		if (!temp)
-			return ENOMEM;
-
-		keyring->keys = temp;
-		keyring->bufsize = new_bufsize;
-	}
+	/* doubling keeps adding n keys O(n), reindexing included */
+	if (keyring->length == keyring->bufsize
+		&& reserve(keyring, keyring->bufsize * 2))
+		return ENOMEM;
 
-	identity = keyring->keys + keyring->length++;
+	identity = keyring->keys + keyring->length;
+	identity->packed = callsign_pack(callsign);
 	strcpy(identity->callsign, callsign);
 	memcpy(identity->pubkey, pubkey, crypto_sign_PUBLICKEYBYTES);
+	identity->fingerprint = keyring_fingerprint(pubkey);
+	link_identity(keyring, keyring->length++);
+	touch(keyring);
 	return 0;
 }
 
+int
+keyring_add_pubkey(struct keyring *keyring, const char *callsign,
+	const unsigned char *pubkey)
+{
+	struct identity *existing = keyring_search(keyring, callsign);
+
+	if (existing)
+	{
+		unsigned int i = existing - keyring->keys;
+
+		unlink_fingerprint(keyring, i);
+		memcpy(existing->pubkey, pubkey, crypto_sign_PUBLICKEYBYTES);
+		existing->fingerprint = keyring_fingerprint(pubkey);
+		link_fingerprint(keyring, i);
+		touch(keyring);
+		return 0;
+	}
+
+	return add_identity(keyring, callsign, pubkey);
+}
+
 int
 keyring_add(struct keyring *keyring, const char *callsign,
 	const char *pubkey_base64)
 {
-	struct identity *existing;
 	uint8_t *pubkey;
 	size_t pubkey_length;
-	int rc = 0;
+	int rc;
 
 	pubkey = base64_decode(&pubkey_length, pubkey_base64);
 	if (!pubkey || pubkey_length != crypto_sign_PUBLICKEYBYTES)
+	{
+		free(pubkey);
 		return -1;
+	}
 
-	existing = keyring_search(keyring, callsign);
-	if (existing)
-		memcpy(existing->pubkey, pubkey, pubkey_length);
+	rc = keyring_add_pubkey(keyring, callsign, pubkey);
+	free(pubkey);
+	return rc;
+}
+
+void
+keyring_delete(struct keyring *keyring, const char *callsign)
+{
+	struct identity *found = keyring_search(keyring, callsign);
+
+	if (found)
+	{
+		unsigned int i = found - keyring->keys;
+
+		/* the last identity fills the hole; order does not matter */
+		unlink_identity(keyring, i);
+		if (i != --keyring->length)
+			move_identity(keyring, keyring->length, i);
+
+		touch(keyring);
+	}
+}
+
+static int
+load_legacy(struct keyring *keyring, const unsigned char *data, size_t size)
+{
+	unsigned int i, n;
+	int rc;
+
+	if (size % RECORD_LENGTH != 0)
+		return -1;
+
+	/* one allocation and one reindex for the whole file */
+	n = size / RECORD_LENGTH;
+	rc = reserve(keyring, keyring->length + n);
+	if (rc)
+		return rc;
+
+	for (i = 0; i < n; ++i)
+	{
+		const unsigned char *record = data + (size_t) i * RECORD_LENGTH;
+		unsigned char pubkey[crypto_sign_PUBLICKEYBYTES];
+		char callsign[AX25_ADDR_MAX];
+		unsigned int length;
+		int ssid;
+
+		ssid = record[AX25_CALL_MAX];
+		if (ssid > AX25_SSID_MAX)
+			return -1;
+
+		for (length = 0; length < AX25_CALL_MAX && record[length];
+		     ++length)
+			callsign[length] = record[length];
+
+		if (ssid)
+			sprintf(callsign + length, "-%d", ssid);
+		else
+			callsign[length] = '\0';
+
+		memcpy(pubkey, record + AX25_CALL_MAX + 1, sizeof pubkey);
+		if ((rc = add_identity(keyring, callsign, pubkey)))
+			return rc;
+	}
+
+	return 0;
+}
+
+/* whether an indexed file's arrays can be used as they lie */
+static int
+in_place(void)
+{
+	return htole32(1) == 1 && sizeof (unsigned int) == sizeof (uint32_t)
+		&& sizeof (struct identity) == INDEXED_RECORD_LENGTH
+		&& offsetof(struct identity, packed) == RECORD_PACKED
+		&& offsetof(struct identity, callsign) == RECORD_CALLSIGN
+		&& offsetof(struct identity, pubkey) == RECORD_PUBKEY
+		&& offsetof(struct identity, fingerprint) == RECORD_FINGERPRINT;
+}
+
+/* whether `count` items of `width` octets at `offset` fit in the file */
+static int
+fits(uint64_t offset, uint64_t count, unsigned int width, size_t size)
+{
+	return offset % INDEXED_ALIGN == 0 && offset <= size
+		&& count <= (size - offset) / width;
+}
+
+/* whether every link in an index refers to one of `length` identities */
+static int
+valid_links(const uint32_t *links, size_t n, uint32_t length)
+{
+	size_t i;
+
+	for (i = 0; i < n; ++i)
+		if (links[i] > length)
+			return 0;
+
+	return 1;
+}
+
+/*
+ * Whether the hash chains hold every identity once, each in the chain of
+ * its own bucket. Since every identity has only the one link onward, a
+ * chain that loops back on itself would take more than `length` steps.
+ */
+static int
+valid_chains(const struct keyring *keyring, const unsigned int *heads,
+	const unsigned int *next, int by_fingerprint)
+{
+	unsigned int bucket, steps = 0;
+
+	for (bucket = 0; bucket <= keyring->index_mask; ++bucket)
+	{
+		unsigned int i;
+
+		for (i = heads[bucket]; i; i = next[i - 1])
+		{
+			const struct identity *key = keyring->keys + i - 1;
+
+			if (steps++ == keyring->length)
+				return 0;
+
+			if ((by_fingerprint
+					? fingerprint_bucket(keyring,
+						key->fingerprint)
+					: base_bucket(keyring, key->packed))
+				!= bucket)
+				return 0;
+		}
+	}
+
+	return steps == keyring->length;
+}
+
+/*
+ * Whether the slot table leads to every identity, and to nothing else, so
+ * that it has empty slots left to end each probe sequence
+ */
+static int
+valid_slots(const struct keyring *keyring)
+{
+	unsigned int i, used = 0;
+
+	for (i = 0; i <= slot_mask(keyring); ++i)
+		if (keyring->slots[i])
+			++used;
+
+	if (used != keyring->length)
+		return 0;
+
+	for (i = 0; i < keyring->length; ++i)
+	{
+		const unsigned int *slot;
+
+		slot = find_slot(keyring, keyring->keys[i].packed);
+		if (!slot || *slot != i + 1)
+			return 0;
+	}
+
+	return 1;
+}
+
+static int
+load_indexed(struct keyring *keyring, unsigned char *data, size_t size)
+{
+	struct keyring_file_header header;
+	struct keyring view;
+	uint64_t keys, slots, base_heads, base_next, fp_heads, fp_next;
+	uint32_t length, buckets, i;
+	int rc;
+
+	if (size < sizeof header)
+		return -1;
+
+	memcpy(&header, data, sizeof header);
+	if (le16toh(header.version) != INDEXED_VERSION
+		|| le16toh(header.header_length) < sizeof header
+		|| le32toh(header.record_length) != INDEXED_RECORD_LENGTH)
+		return -1;
+
+	length = le32toh(header.length);
+	buckets = le32toh(header.buckets);
+	keys = le64toh(header.keys_offset);
+	slots = le64toh(header.slots_offset);
+	base_heads = le64toh(header.base_heads_offset);
+	base_next = le64toh(header.base_next_offset);
+	fp_heads = le64toh(header.fingerprint_heads_offset);
+	fp_next = le64toh(header.fingerprint_next_offset);
+
+	/* a power of two, with the call sign table at most half full */
+	if (buckets == 0 || buckets & (buckets - 1) || length > buckets
+		|| buckets > UINT32_MAX / 2)
+		return -1;
+
+	if (!fits(keys, length, INDEXED_RECORD_LENGTH, size)
+		|| !fits(slots, buckets * 2, sizeof (uint32_t), size)
+		|| !fits(base_heads, buckets, sizeof (uint32_t), size)
+		|| !fits(base_next, length, sizeof (uint32_t), size)
+		|| !fits(fp_heads, buckets, sizeof (uint32_t), size)
+		|| !fits(fp_next, length, sizeof (uint32_t), size))
+		return -1;
+
+	for (i = 0; i < length; ++i)
+	{
+		const unsigned char *record = data + keys
+			+ (size_t) i * INDEXED_RECORD_LENGTH;
+
+		if (record[RECORD_CALLSIGN + AX25_ADDR_MAX - 1] != '\0')
+			return -1;
+	}
+
+	/* otherwise take the identities and build the indexes afresh */
+	if (!in_place() || keyring->length)
+	{
+		rc = reserve(keyring, keyring->length + length);
+		if (rc)
+			return rc;
+
+		for (i = 0; i < length; ++i)
+		{
+			unsigned char *record = data + keys
+				+ (size_t) i * INDEXED_RECORD_LENGTH;
+
+			rc = add_identity(keyring,
+				(char *) record + RECORD_CALLSIGN,
+				record + RECORD_PUBKEY);
+			if (rc)
+				return rc;
+		}
+
+		return 0;
+	}
+
+	if (!valid_links((uint32_t *) (data + slots), buckets * 2, length)
+		|| !valid_links((uint32_t *) (data + base_heads), buckets,
+			length)
+		|| !valid_links((uint32_t *) (data + base_next), length, length)
+		|| !valid_links((uint32_t *) (data + fp_heads), buckets, length)
+		|| !valid_links((uint32_t *) (data + fp_next), length, length))
+		return -1;
+
+	memset(&view, 0, sizeof view);
+	view.keys = (struct identity *) (data + keys);
+	view.slots = (unsigned int *) (data + slots);
+	view.base_heads = (unsigned int *) (data + base_heads);
+	view.base_next = (unsigned int *) (data + base_next);
+	view.fingerprint_heads = (unsigned int *) (data + fp_heads);
+	view.fingerprint_next = (unsigned int *) (data + fp_next);
+	view.index_mask = buckets - 1;
+	view.length = length;
+
+	/* walks of the indexes trust them to end, so they must be sound */
+	if (!valid_chains(&view, view.base_heads, view.base_next, 0)
+		|| !valid_chains(&view, view.fingerprint_heads,
+			view.fingerprint_next, 1)
+		|| !valid_slots(&view))
+		return -1;
+
+	free(keyring->keys);
+	free(keyring->slots);
+	free(keyring->base_heads);
+	free(keyring->base_next);
+	free(keyring->fingerprint_heads);
+	free(keyring->fingerprint_next);
+
+	keyring->keys = view.keys;
+	keyring->slots = view.slots;
+	keyring->base_heads = view.base_heads;
+	keyring->base_next = view.base_next;
+	keyring->fingerprint_heads = view.fingerprint_heads;
+	keyring->fingerprint_next = view.fingerprint_next;
+	keyring->index_mask = view.index_mask;
+	keyring->length = length;
+	keyring->bufsize = length;
+	keyring->map = data;
+	keyring->map_length = size;
+	touch(keyring);
+	return 0;
+}
+
+/*
+ * Loads a keyring file of either format. An indexed file is mapped
+ * privately, so that a keyring loaded from it is ready at once, and
+ * changes to it stay in this process until it is saved.
+ */
+static int
+load_file(struct keyring *keyring, const char *path)
+{
+	struct stat st;
+	unsigned char *data;
+	int fd, rc;
+
+	fd = open(path, O_RDONLY);
+	if (fd == -1)
+		return errno;
+
+	if (fstat(fd, &st))
+	{
+		rc = errno;
+		close(fd);
+		return rc;
+	}
+
+	keyring->format = KEYRING_LEGACY;
+	if (st.st_size == 0)
+	{
+		close(fd);
+		return 0;
+	}
+
+	data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+		0);
+	rc = errno;
+	close(fd);
+	if (data == MAP_FAILED)
+		return rc;
+
+	if ((size_t) st.st_size >= sizeof INDEXED_MAGIC - 1
+		&& memcmp(data, INDEXED_MAGIC, sizeof INDEXED_MAGIC - 1) == 0)
+	{
+		keyring->format = KEYRING_INDEXED;
+		rc = load_indexed(keyring, data, st.st_size);
+	}
 	else
-		rc = add_identity(keyring, callsign, pubkey);
+		rc = load_legacy(keyring, data, st.st_size);
+
+	if (keyring->map != data)
+		munmap(data, st.st_size);
+
+	return rc;
+}
+
+static int
+write_legacy(struct keyring *keyring, FILE *f)
+{
+	unsigned int i;
+
+	for (i = 0; i < keyring->length; ++i)
+	{
+		const struct identity *key = keyring->keys + i;
+		const char *hyphen = strchr(key->callsign, '-');
+		char callsign[AX25_CALL_MAX];
+		int ssid = 0;
+
+		memset(callsign, 0, sizeof callsign);
+		memcpy(callsign, key->callsign, hyphen
+			? (size_t) (hyphen - key->callsign)
+			: strlen(key->callsign));
+
+		if (hyphen)
+			sscanf(hyphen + 1, "%d", &ssid);
+
+		if (fwrite(callsign, sizeof callsign, 1, f) != 1
+			|| fputc(ssid, f) == EOF
+			|| fwrite(key->pubkey, sizeof key->pubkey, 1, f) != 1)
+			return EIO;
+	}
+
+	return 0;
+}
+
+static uint64_t
+align(uint64_t offset)
+{
+	return (offset + INDEXED_ALIGN - 1) / INDEXED_ALIGN * INDEXED_ALIGN;
+}
+
+static int
+write_links(FILE *f, uint64_t *pos, const unsigned int *links, size_t n)
+{
+	size_t i;
+
+	for (; *pos % INDEXED_ALIGN; ++*pos)
+		if (fputc(0, f) == EOF)
+			return EIO;
+
+	for (i = 0; i < n; ++i)
+	{
+		uint32_t link = htole32(links[i]);
+
+		if (fwrite(&link, sizeof link, 1, f) != 1)
+			return EIO;
+	}
+
+	*pos += n * sizeof (uint32_t);
+	return 0;
+}
+
+static int
+write_indexed(struct keyring *keyring, FILE *f)
+{
+	struct keyring_file_header header;
+	unsigned int i, buckets = keyring->index_mask + 1;
+	uint64_t pos = sizeof header;
+	int rc;
+
+	memset(&header, 0, sizeof header);
+	memcpy(header.magic, INDEXED_MAGIC, sizeof header.magic);
+	header.version = htole16(INDEXED_VERSION);
+	header.header_length = htole16(sizeof header);
+	header.length = htole32(keyring->length);
+	header.buckets = htole32(buckets);
+	header.record_length = htole32(INDEXED_RECORD_LENGTH);
+
+	header.keys_offset = htole64(pos);
+	pos = align(pos + (uint64_t) keyring->length * INDEXED_RECORD_LENGTH);
+	header.slots_offset = htole64(pos);
+	pos = align(pos + buckets * 2 * sizeof (uint32_t));
+	header.base_heads_offset = htole64(pos);
+	pos = align(pos + buckets * sizeof (uint32_t));
+	header.base_next_offset = htole64(pos);
+	pos = align(pos + keyring->length * sizeof (uint32_t));
+	header.fingerprint_heads_offset = htole64(pos);
+	pos = align(pos + buckets * sizeof (uint32_t));
+	header.fingerprint_next_offset = htole64(pos);
+
+	if (fwrite(&header, sizeof header, 1, f) != 1)
+		return EIO;
+
+	pos = sizeof header;
+	for (i = 0; i < keyring->length; ++i)
+	{
+		const struct identity *key = keyring->keys + i;
+		unsigned char record[INDEXED_RECORD_LENGTH];
+		uint64_t packed = htole64(key->packed);
+		uint32_t fingerprint = htole32(key->fingerprint);
+
+		memset(record, 0, sizeof record);
+		memcpy(record + RECORD_PACKED, &packed, sizeof packed);
+		strcpy((char *) record + RECORD_CALLSIGN, key->callsign);
+		memcpy(record + RECORD_PUBKEY, key->pubkey, sizeof key->pubkey);
+		memcpy(record + RECORD_FINGERPRINT, &fingerprint,
+			sizeof fingerprint);
+
+		if (fwrite(record, sizeof record, 1, f) != 1)
+			return EIO;
+	}
+
+	pos += (uint64_t) keyring->length * INDEXED_RECORD_LENGTH;
+
+	if ((rc = write_links(f, &pos, keyring->slots, buckets * 2))
+		|| (rc = write_links(f, &pos, keyring->base_heads, buckets))
+		|| (rc = write_links(f, &pos, keyring->base_next,
+				keyring->length))
+		|| (rc = write_links(f, &pos, keyring->fingerprint_heads,
+				buckets))
+		|| (rc = write_links(f, &pos, keyring->fingerprint_next,
+				keyring->length)))
+		return rc;
+
+	return 0;
+}
+
+/*
+ * Writes the keyring in the given format to a temporary file beside
+ * `path`, then puts it in place, so the file is never seen half written.
+ */
+static int
+save_file(struct keyring *keyring, const char *path,
+	enum keyring_format format)
+{
+	char temp[MAX_FILE_PATH + 8];
+	FILE *f;
+	char *dpath;
+	int rc;
+
+	dpath = strdup(path);
+	if (!dpath)
+		return ENOMEM;
+
+	rc = mkdir_recursive(dirname(dpath), 0755);
+	free(dpath);
+	if (rc)
+		return rc;
+
+	snprintf(temp, sizeof temp, "%s.tmp", path);
+	f = fopen(temp, "wb");
+	if (!f)
+		return errno;
+
+	if (format == KEYRING_INDEXED)
+		rc = write_indexed(keyring, f);
+	else
+		rc = write_legacy(keyring, f);
+
+	if (fflush(f) || fsync(fileno(f)))
+		rc = rc ? rc : errno;
+
+	if (fclose(f))
+		rc = rc ? rc : errno;
+
+	if (!rc && rename(temp, path))
+		rc = errno;
+
+	if (rc)
+		unlink(temp);
+	else
+		keyring->format = format;
+
+	return rc;
+}
+
+/*
+ * Loads the keyring file at `path` and the edits in its journal `fd`, which
+ * the caller has locked.
+ */
+static int
+load_locked(struct keyring *keyring, const char *path, int fd)
+{
+	int rc = load_file(keyring, path);
+
+	/* a keyring yet to be compacted may be all journal */
+	if (rc == ENOENT && keyjournal_size(fd) == 0)
+		return rc;
+
+	if (!rc || rc == ENOENT)
+		rc = keyjournal_replay(fd, keyring);
+
+	return rc;
+}
+
+/* saves the keyring whole, which leaves its journal with nothing to add */
+static int
+save_locked(struct keyring *keyring, const char *path,
+	enum keyring_format format, int fd)
+{
+	int rc = save_file(keyring, path, format);
+
+	if (!rc)
+		rc = keyjournal_clear(fd);
 
-	free(pubkey);
 	return rc;
 }
 
-void
-keyring_delete(struct keyring *keyring, const char *callsign)
+/*
+ * Loads the keyring at `path` with the edits in its journal. Holding the
+ * journal's lock keeps a compaction from changing both in between.
+ */
+int
+keyring_load(struct keyring *keyring, const char *path)
 {
-	struct identity *found = keyring_search(keyring, callsign);
+	int fd, rc;
 
-	if (found)
-	{
-		unsigned int i = found - keyring->keys;
+	fd = keyjournal_open(path, 0);
+	if (fd == -1)
+		return errno == ENOENT ? load_file(keyring, path) : errno;
 
-		--keyring->length;
-		for (; i <= keyring->length; ++i)
-			memcpy(keyring->keys + i, keyring->keys + i + 1,
-				sizeof (struct identity));
-	}
+	rc = load_locked(keyring, path, fd);
+	keyjournal_close(fd);
+	return rc;
 }
 
+/*
+ * Saves the keyring whole, which leaves its journal with nothing to add.
+ * Any edit journaled after `keyring` was loaded is lost.
+ */
 int
-keyring_load(struct keyring *keyring, const char *path)
+keyring_save_as(struct keyring *keyring, const char *path,
+	enum keyring_format format)
 {
-	FILE *f;
-	long fsize;
-	unsigned int i, n;
-	int rc = 0;
+	int fd, rc;
 
-	f = fopen(path, "rb");
-	if (!f)
+	fd = keyjournal_open(path, 1);
+	if (fd == -1)
 		return errno;
 
-	fseek(f, 0L, SEEK_END);
-	fsize = ftell(f);
-	if (fsize % RECORD_LENGTH != 0)
-	{
-		fclose(f);
-		return -1;
-	}
-
-	rewind(f);
-	n = fsize / RECORD_LENGTH;
-	for (i = 0; i < n; ++i)
-	{
-		unsigned char buf[RECORD_LENGTH];
-		char callsign[AX25_ADDR_MAX];
-		unsigned char *pubkey = buf + AX25_CALL_MAX + 1;
-		int ssid;
+	rc = save_locked(keyring, path, format, fd);
+	keyjournal_close(fd);
+	return rc;
+}
 
-		if (fread(buf, sizeof buf, 1, f) != 1)
-		{
-			rc = EIO;
-			break;
-		}
+int
+keyring_save(struct keyring *keyring, const char *path)
+{
+	return keyring_save_as(keyring, path, keyring->format);
+}
 
-		ssid = buf[AX25_CALL_MAX];
-		if (ssid > AX25_SSID_MAX)
-		{
-			rc = -1;
-			break;
-		}
+/* folds the journal into the keyring file */
+int
+keyring_compact(const char *path)
+{
+	struct keyring *keyring;
+	int fd, rc;
 
-		buf[AX25_CALL_MAX] = '\0';
-		if (ssid)
-			sprintf(callsign, "%s-%d", buf, ssid);
-		else
-			strcpy(callsign, (char *) buf);
+	fd = keyjournal_open(path, 1);
+	if (fd == -1)
+		return errno;
 
-		if ((rc = add_identity(keyring, callsign, pubkey)))
-			break;
+	keyring = keyring_new();
+	if (!keyring)
+	{
+		rc = ENOMEM;
+		goto end;
 	}
 
-	fclose(f);
+	rc = load_locked(keyring, path, fd);
+	if (!rc)
+		rc = save_locked(keyring, path, keyring->format, fd);
+
+	keyring_free(keyring);
+end:
+	keyjournal_close(fd);
 	return rc;
 }
 
-int
-keyring_save(struct keyring *keyring, const char *path)
+/*
+ * Loads the keyring at `path` to be changed and saved whole. Its journal
+ * stays locked until edit_end, so no edit recorded meanwhile is lost when
+ * the save clears the journal.
+ */
+static int
+edit_begin(struct keyring *keyring, const char *path, int *fd)
 {
-	FILE *f;
-	unsigned int i;
-	char *dpath;
 	int rc;
 
-	dpath = strdup(path);
-	if (!dpath)
-		return ENOMEM;
-
-	rc = mkdir_recursive(dirname(dpath), 0755);
-	free(dpath);
-	if (rc)
-		return rc;
-
-	f = fopen(path, "wb");
-	if (!f)
+	*fd = keyjournal_open(path, 1);
+	if (*fd == -1)
 		return errno;
 
-	for (i = 0; i < keyring->length; ++i)
+	rc = load_locked(keyring, path, *fd);
+	if (rc && rc != ENOENT)
 	{
-		struct identity *key = keyring->keys + i;
-		char *hyphen = strchr(key->callsign, '-');
-		char callsign[AX25_CALL_MAX];
-		int ssid;
-		size_t written;
+		keyjournal_close(*fd);
+		*fd = -1;
+	}
 
-		memset(callsign, 0, sizeof callsign);
+	return rc;
+}
 
-		if (hyphen)
-		{
-			*hyphen = '\0';
-			memcpy(callsign, key->callsign, sizeof callsign);
-			*hyphen = '-';
+static void
+edit_end(int fd)
+{
+	if (fd != -1)
+		keyjournal_close(fd);
+}
 
-			sscanf(hyphen + 1, "%d", &ssid);
-		}
-		else
-		{
-			memcpy(callsign, key->callsign, sizeof callsign);
-			ssid = 0;
-		}
+struct identity *
+keyring_search(struct keyring *keyring, const char *callsign)
+{
+	unsigned int *slot = find_slot(keyring, callsign_pack(callsign));
+	struct identity *key;
 
-		written = fwrite(callsign, sizeof callsign, 1, f);
-		if (written != 1)
-		{
-			rc = EIO;
-			break;
-		}
+	if (!slot || !*slot)
+		return NULL;
 
-		rc = fputc(ssid, f);
-		if (rc == EOF)
-		{
-			rc = EIO;
-			break;
-		}
+	/* packing drops what does not fit a call sign, so check the rest */
+	key = keyring->keys + *slot - 1;
+	return strcmp(key->callsign, callsign) == 0 ? key : NULL;
+}
 
-		written = fwrite(key->pubkey, sizeof key->pubkey, 1, f);
-		if (written != 1)
-		{
-			rc = EIO;
-			break;
-		}
+struct identity *
+keyring_next_same_base(struct keyring *keyring, uint64_t packed,
+		struct identity *prev)
+{
+	uint64_t base = packed & ~(uint64_t) CALLSIGN_SSID_MASK;
+	unsigned int i, steps = 0;
+
+	if (prev)
+		i = keyring->base_next[prev - keyring->keys];
+	else
+		i = keyring->base_heads[base_bucket(keyring, packed)];
+
+	/* no chain is longer than the keyring */
+	for (; i && steps++ < keyring->length; i = keyring->base_next[i - 1])
+	{
+		struct identity *key = keyring->keys + i - 1;
 
-		rc = 0;
+		if ((key->packed & ~(uint64_t) CALLSIGN_SSID_MASK) == base
+			&& key->packed != packed)
+			return key;
 	}
 
-	fclose(f);
-	return rc;
+	return NULL;
 }
 
 struct identity *
-keyring_search(struct keyring *keyring, const char *callsign)
+keyring_next_fingerprint(struct keyring *keyring, uint32_t fingerprint,
+			struct identity *prev)
 {
-	unsigned int i;
+	unsigned int i, steps = 0;
 
-	for (i = 0; i < keyring->length; ++i)
+	if (prev)
+		i = keyring->fingerprint_next[prev - keyring->keys];
+	else
+		i = keyring->fingerprint_heads[fingerprint_bucket(keyring,
+								fingerprint)];
+
+	for (; i && steps++ < keyring->length;
+	     i = keyring->fingerprint_next[i - 1])
 	{
-		struct identity *key = keyring->keys + i;
-		if (strcmp(key->callsign, callsign) == 0)
+		struct identity *key = keyring->keys + i - 1;
+
+		if (key->fingerprint == fingerprint)
 			return key;
 	}
 
@@ -290,8 +1151,9 @@ int
 import_key(struct windbag_config *config, int argc, char **argv)
 {
 	int rc = 0;
-	char *callsign, *pubkey_base64;
-	struct keyring *keyring;
+	char *callsign;
+	uint8_t *pubkey;
+	size_t pubkey_length;
 
 	if (argc != 2)
 	{
@@ -309,40 +1171,249 @@ import_key(struct windbag_config *config, int argc, char **argv)
 	}
 
 	sanitize_callsign(callsign);
-	pubkey_base64 = argv[1];
+	pubkey = base64_decode(&pubkey_length, argv[1]);
+	if (!pubkey || pubkey_length != crypto_sign_PUBLICKEYBYTES)
+	{
+		free(pubkey);
+		fprintf(stderr, "Error adding key: not a public key\n");
+		return -1;
+	}
+
+	if (config->keyring_path[0] == '\0')
+		set_default_keyring_path(config);
+
+	rc = keyjournal_record(config->keyring_path, KEYJOURNAL_ADD, callsign,
+			pubkey);
+	if (rc)
+		fprintf(stderr, "Error saving keyring: %s\n", strerror(rc));
+	else
+		printf("Key successfully imported.\n");
+
+	free(pubkey);
+	return rc;
+}
+
+/*
+ * Reads one "callsign key" pair, as export-key writes them, from `line`.
+ * Returns NULL, or what is wrong with the line.
+ */
+static const char *
+parse_key_line(char *line, char **callsign, unsigned char *pubkey)
+{
+	char *key, *extra, *save;
+	uint8_t *decoded;
+	size_t length;
+	int rc;
+
+	*callsign = strtok_r(line, " \t\r\n", &save);
+	key = strtok_r(NULL, " \t\r\n", &save);
+	extra = strtok_r(NULL, " \t\r\n", &save);
+	if (!key || extra)
+		return "expected a call sign and a key";
+
+	rc = validate_callsign(*callsign);
+	if (rc)
+		return callsign_strerror(rc);
+
+	sanitize_callsign(*callsign);
+
+	decoded = base64_decode(&length, key);
+	if (!decoded || length != crypto_sign_PUBLICKEYBYTES)
+	{
+		free(decoded);
+		return "not a public key";
+	}
+
+	memcpy(pubkey, decoded, crypto_sign_PUBLICKEYBYTES);
+	free(decoded);
+	return NULL;
+}
+
+struct key_line
+{
+	unsigned long n;
+	char callsign[AX25_ADDR_MAX];
+	unsigned char pubkey[crypto_sign_PUBLICKEYBYTES];
+};
+
+/*
+ * Reads every key listed in `f`, reporting and counting the bad lines. All
+ * are read before the keyring is locked, so that input slow to arrive never
+ * holds up other changes to it.
+ */
+static int
+read_key_lines(FILE *f, const char *name, struct key_line **keys,
+	size_t *n_keys, unsigned long *bad)
+{
+	char *line = NULL;
+	size_t bufsize = 0, capacity = 0;
+	unsigned long n = 0;
+	int rc = 0;
+
+	*keys = NULL;
+	*n_keys = 0;
+
+	while (getline(&line, &bufsize, f) != -1)
+	{
+		struct key_line *key;
+		const char *error;
+		char *callsign, *start = line;
+
+		++n;
+		start += strspn(start, " \t\r\n");
+		if (*start == '\0' || *start == '#')
+			continue;
+
+		if (*n_keys == capacity)
+		{
+			size_t grown = capacity ? capacity * 2 : STEP;
+
+			key = realloc(*keys, grown * sizeof (struct key_line));
+			if (!key)
+			{
+				rc = ENOMEM;
+				fprintf(stderr, "Error importing keys: %s\n",
+					strerror(rc));
+				goto end;
+			}
+
+			*keys = key;
+			capacity = grown;
+		}
+
+		key = *keys + *n_keys;
+		error = parse_key_line(start, &callsign, key->pubkey);
+		if (error)
+		{
+			fprintf(stderr, "%s:%lu: %s\n", name, n, error);
+			++*bad;
+			continue;
+		}
+
+		key->n = n;
+		strcpy(key->callsign, callsign);
+		++*n_keys;
+	}
+
+	if (ferror(f))
+	{
+		rc = errno;
+		fprintf(stderr, "Error reading %s: %s\n", name, strerror(rc));
+	}
+
+end:
+	free(line);
+	return rc;
+}
+
+/*
+ * Imports every key listed in a file, or on standard input, then writes
+ * the keyring once. A bad line is reported and skipped; the rest still go
+ * in.
+ */
+int
+import_keys(struct windbag_config *config, int argc, char **argv)
+{
+	const char *name = "stdin";
+	struct keyring *keyring = NULL;
+	struct key_line *keys;
+	FILE *f = stdin;
+	size_t i, n_keys;
+	unsigned long added = 0, replaced = 0, unchanged = 0, bad = 0;
+	int rc, fd = -1;
+
+	if (argc > 1)
+	{
+		fprintf(stderr, "Usage: windbag import-keys [file]\n");
+		return -1;
+	}
+
+	if (argc == 1 && strcmp(argv[0], "-") != 0)
+	{
+		name = argv[0];
+		f = fopen(name, "r");
+		if (!f)
+		{
+			fprintf(stderr, "Error opening %s: %s\n", name,
+				strerror(errno));
+			return errno;
+		}
+	}
 
 	if (config->keyring_path[0] == '\0')
 		set_default_keyring_path(config);
 
+	rc = read_key_lines(f, name, &keys, &n_keys, &bad);
+	if (f != stdin)
+		fclose(f);
+
+	if (rc)
+		goto end;
+
 	keyring = keyring_new();
 	if (!keyring)
 	{
-		fprintf(stderr, "Error importing key: %s\n", strerror(ENOMEM));
-		return ENOMEM;
+		rc = ENOMEM;
+		fprintf(stderr, "Error importing keys: %s\n", strerror(rc));
+		goto end;
 	}
 
-	rc = keyring_load(keyring, config->keyring_path);
+	rc = edit_begin(keyring, config->keyring_path, &fd);
 	if (rc && rc != ENOENT)
 	{
-		fprintf(stderr, "Error loading keyring: %s\n", strerror(errno));
+		fprintf(stderr, "Error loading keyring: %s\n",
+			rc == -1 ? "file is corrupt" : strerror(rc));
 		goto end;
 	}
 
-	rc = keyring_add(keyring, callsign, pubkey_base64);
-	if (rc)
+	for (i = 0; i < n_keys; ++i)
 	{
-		fprintf(stderr, "Error adding key: %s\n", strerror(errno));
-		goto end;
+		const struct key_line *key = keys + i;
+		struct identity *existing;
+
+		existing = keyring_search(keyring, key->callsign);
+		if (existing && memcmp(existing->pubkey, key->pubkey,
+				sizeof key->pubkey) == 0)
+		{
+			++unchanged;
+			continue;
+		}
+
+		rc = keyring_add_pubkey(keyring, key->callsign, key->pubkey);
+		if (rc)
+		{
+			fprintf(stderr, "%s:%lu: %s\n", name, key->n,
+				strerror(rc));
+			goto end;
+		}
+
+		if (existing)
+			++replaced;
+		else
+			++added;
 	}
 
-	rc = keyring_save(keyring, config->keyring_path);
-	if (rc)
-		fprintf(stderr, "Error saving keyring: %s\n", strerror(errno));
-	else
-		printf("Key successfully imported.\n");
+	if (added || replaced)
+	{
+		rc = save_locked(keyring, config->keyring_path,
+			keyring->format, fd);
+		if (rc)
+		{
+			fprintf(stderr, "Error saving keyring: %s\n",
+				strerror(rc));
+			goto end;
+		}
+	}
+
+	printf("%lu keys added, %lu replaced, %lu unchanged, %lu bad lines.\n",
+		added, replaced, unchanged, bad);
+	rc = bad ? 1 : 0;
 
 end:
-	free(keyring);
+	edit_end(fd);
+	if (keyring)
+		keyring_free(keyring);
+	free(keys);
 	return rc;
 }
 
@@ -447,7 +1518,7 @@ export_key(struct windbag_config *config, int argc, char **argv)
 
 end:
 	if (keyring)
-		free(keyring);
+		keyring_free(keyring);
 	return rc;
 }
 
@@ -456,7 +1527,6 @@ delete_key(struct windbag_config *config, int argc, char **argv)
 {
 	int rc = 0;
 	char *callsign;
-	struct keyring *keyring;
 
 	if (argc != 1)
 	{
@@ -475,32 +1545,66 @@ delete_key(struct windbag_config *config, int argc, char **argv)
 
 	sanitize_callsign(callsign);
 
+	if (config->keyring_path[0] == '\0')
+		set_default_keyring_path(config);
+
+	rc = keyjournal_record(config->keyring_path, KEYJOURNAL_DELETE,
+			callsign, NULL);
+	if (rc)
+		fprintf(stderr, "Error saving keyring: %s\n", strerror(rc));
+	else
+		printf("Key successfully deleted.\n");
+
+	return rc;
+}
+
+int
+convert_keyring(struct windbag_config *config, int argc, char **argv)
+{
+	enum keyring_format format = KEYRING_INDEXED;
+	struct keyring *keyring;
+	int rc, fd = -1;
+
+	if (argc > 1 || (argc == 1 && strcmp(argv[0], "indexed") != 0
+			&& strcmp(argv[0], "legacy") != 0))
+	{
+		fprintf(stderr, "Usage: windbag convert-keyring "
+			"[indexed|legacy]\n");
+		return -1;
+	}
+
+	if (argc == 1 && strcmp(argv[0], "legacy") == 0)
+		format = KEYRING_LEGACY;
+
 	if (config->keyring_path[0] == '\0')
 		set_default_keyring_path(config);
 
 	keyring = keyring_new();
 	if (!keyring)
 	{
-		fprintf(stderr, "Error deleting key: %s\n", strerror(ENOMEM));
+		fprintf(stderr, "Error converting keyring: %s\n",
+			strerror(ENOMEM));
 		return ENOMEM;
 	}
 
-	rc = keyring_load(keyring, config->keyring_path);
+	rc = edit_begin(keyring, config->keyring_path, &fd);
 	if (rc)
 	{
-		fprintf(stderr, "Error loading keyring: %s\n", strerror(errno));
+		fprintf(stderr, "Error loading keyring: %s\n",
+			rc == -1 ? "file is corrupt" : strerror(rc));
 		goto end;
 	}
 
-	keyring_delete(keyring, callsign);
-
-	rc = keyring_save(keyring, config->keyring_path);
+	rc = save_locked(keyring, config->keyring_path, format, fd);
 	if (rc)
-		fprintf(stderr, "Error saving keyring: %s\n", strerror(errno));
+		fprintf(stderr, "Error saving keyring: %s\n", strerror(rc));
 	else
-		printf("Key successfully deleted.\n");
+		printf("Converted %u keys to the %s format.\n",
+			keyring->length,
+			format == KEYRING_INDEXED ? "indexed" : "legacy");
 
 end:
-	free(keyring);
+	edit_end(fd);
+	keyring_free(keyring);
 	return rc;
 }
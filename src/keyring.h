@@ -33,21 +33,77 @@
 #define WB_KEYRING_H
 
 #include <sodium.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #include "ax25.h"
 #include "config.h"
 
+enum keyring_format
+{
+	KEYRING_LEGACY, /* fixed records, in no order */
+	KEYRING_INDEXED /* see keyring_file_header */
+};
+
+/*
+ * An indexed keyring file starts with this header, all integers little
+ * endian, followed at the given offsets by the identities and by the
+ * arrays of struct keyring's indexes, exactly as they are kept in memory.
+ * On a little-endian host the file is mapped and used where it lies.
+ */
+struct keyring_file_header
+{
+	uint8_t magic[4];
+	uint16_t version;
+	uint16_t header_length;
+	uint32_t length;
+	uint32_t buckets;
+	uint32_t record_length;
+	uint32_t reserved;
+	uint64_t keys_offset;
+	uint64_t slots_offset; /* 2 * buckets */
+	uint64_t base_heads_offset; /* buckets */
+	uint64_t base_next_offset; /* length */
+	uint64_t fingerprint_heads_offset; /* buckets */
+	uint64_t fingerprint_next_offset; /* length */
+};
+
 struct identity
 {
+	uint64_t packed; /* see callsign_pack() */
 	char callsign[AX25_ADDR_MAX];
 	unsigned char pubkey[crypto_sign_PUBLICKEYBYTES];
+	uint32_t fingerprint; /* see keyring_fingerprint() */
 };
 
 struct keyring
 {
 	unsigned int bufsize;
 	unsigned int length;
+	unsigned long generation; /* changes whenever the set of keys does */
 	struct identity *keys;
+
+	/*
+	 * Open-addressed table of identities by packed call sign, probed
+	 * linearly. Each slot holds an index into keys plus one, or 0.
+	 */
+	unsigned int *slots;
+
+	/*
+	 * Hash chains linking identities that share a base call sign
+	 * (regardless of SSID) or a key fingerprint, respectively
+	 */
+	unsigned int index_mask;
+	unsigned int *base_heads;
+	unsigned int *base_next;
+	unsigned int *fingerprint_heads;
+	unsigned int *fingerprint_next;
+
+	enum keyring_format format; /* as loaded, and so as saved */
+
+	/* if set, the arrays above lie in this private mapping of the file */
+	void *map;
+	size_t map_length;
 };
 
 struct keyring *
@@ -60,6 +116,10 @@ int
 keyring_add(struct keyring *keyring, const char *callsign,
 	const char *pubkey_base64);
 
+int
+keyring_add_pubkey(struct keyring *keyring, const char *callsign,
+	const unsigned char *pubkey);
+
 void
 keyring_delete(struct keyring *keyring, const char *callsign);
 
@@ -69,16 +129,40 @@ keyring_load(struct keyring *keyring, const char *path);
 int
 keyring_save(struct keyring *keyring, const char *path);
 
+int
+keyring_save_as(struct keyring *keyring, const char *path,
+	enum keyring_format format);
+
+int
+keyring_compact(const char *path);
+
 struct identity *
 keyring_search(struct keyring *keyring, const char *callsign);
 
+struct identity *
+keyring_next_same_base(struct keyring *keyring, uint64_t packed,
+		struct identity *prev);
+
+uint32_t
+keyring_fingerprint(const unsigned char *pubkey);
+
+struct identity *
+keyring_next_fingerprint(struct keyring *keyring, uint32_t fingerprint,
+			struct identity *prev);
+
 int
 import_key(struct windbag_config *config, int argc, char **argv);
 
+int
+import_keys(struct windbag_config *config, int argc, char **argv);
+
 int
 export_key(struct windbag_config *config, int argc, char **argv);
 
 int
 delete_key(struct windbag_config *config, int argc, char **argv);
 
+int
+convert_keyring(struct windbag_config *config, int argc, char **argv);
+
 #endif
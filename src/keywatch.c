@@ -0,0 +1,389 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+# include <sys/inotify.h>
+#endif
+
+#include "keyjournal.h"
+#include "keywatch.h"
+
+#define POLL_MS 2000 /* between looks at the files, without inotify */
+#define SETTLE_MS 200 /* for the rest of a burst of changes */
+#define GRACE_POLL_MS 100
+
+/* what changes when either file does */
+struct file_state
+{
+	ino_t ino[2];
+	off_t size[2];
+	time_t mtime[2];
+};
+
+static void
+file_state(const char *path, struct file_state *state)
+{
+	char journal[MAX_FILE_PATH + sizeof KEYJOURNAL_SUFFIX];
+	const char *paths[2];
+	struct stat st;
+	unsigned int i;
+
+	snprintf(journal, sizeof journal, "%s" KEYJOURNAL_SUFFIX, path);
+	paths[0] = path;
+	paths[1] = journal;
+
+	memset(state, 0, sizeof *state);
+	for (i = 0; i < 2; ++i)
+	{
+		if (stat(paths[i], &st))
+			continue;
+
+		state->ino[i] = st.st_ino;
+		state->size[i] = st.st_size;
+		state->mtime[i] = st.st_mtime;
+	}
+}
+
+/* waits up to `ms` for a stop; returns nonzero if asked to */
+static int
+stopping(struct keywatch *watch, int ms)
+{
+	struct pollfd pfd;
+
+	pfd.fd = watch->wake[0];
+	pfd.events = POLLIN;
+	return poll(&pfd, 1, ms) > 0;
+}
+
+#ifdef __linux__
+/* whether any of the pending events concern the keyring or its journal */
+static int
+drain_events(struct keywatch *watch)
+{
+	char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+	char *name, *dpath;
+	ssize_t n;
+	int relevant = 0;
+
+	dpath = strdup(watch->path);
+	if (!dpath)
+		return 1;
+
+	name = basename(dpath);
+	while ((n = read(watch->inotify, buf, sizeof buf)) > 0)
+	{
+		char *p;
+
+		for (p = buf; p < buf + n;)
+		{
+			const struct inotify_event *event = (void *) p;
+
+			if (event->len && strncmp(event->name, name,
+					strlen(name)) == 0
+				&& (event->name[strlen(name)] == '\0'
+					|| strcmp(event->name + strlen(name),
+						KEYJOURNAL_SUFFIX) == 0))
+				relevant = 1;
+
+			p += sizeof *event + event->len;
+		}
+	}
+
+	free(dpath);
+	return relevant;
+}
+#endif
+
+/* waits for the keyring to change; returns nonzero when asked to stop */
+static int
+wait_for_change(struct keywatch *watch, struct file_state *last)
+{
+	struct pollfd pfd[2];
+	struct file_state now;
+
+	for (;;)
+	{
+		pfd[0].fd = watch->wake[0];
+		pfd[0].events = POLLIN;
+		pfd[1].fd = watch->inotify;
+		pfd[1].events = POLLIN;
+
+		if (poll(pfd, watch->inotify == -1 ? 1 : 2,
+				watch->inotify == -1 ? POLL_MS : -1) < 0
+			&& errno != EINTR)
+			return 1;
+
+		if (pfd[0].revents)
+			return 1;
+
+#ifdef __linux__
+		if (watch->inotify != -1)
+		{
+			if (!(pfd[1].revents & POLLIN) || !drain_events(watch))
+				continue;
+
+			/* a save is a rename, and an edit a journal append */
+			if (stopping(watch, SETTLE_MS))
+				return 1;
+
+			drain_events(watch);
+			return 0;
+		}
+#endif
+
+		file_state(watch->path, &now);
+		if (memcmp(&now, last, sizeof now) == 0)
+			continue;
+
+		*last = now;
+		return 0;
+	}
+}
+
+/* waits until no reader can still hold what was published before */
+static int
+synchronize(struct keywatch *watch)
+{
+	struct keywatch_reader *reader;
+	unsigned long *seen;
+	unsigned int i, n = 0;
+
+	pthread_mutex_lock(&watch->lock);
+
+	for (reader = watch->readers; reader; reader = reader->next)
+		++n;
+
+	seen = malloc((n ? n : 1) * sizeof (unsigned long));
+	if (!seen)
+	{
+		pthread_mutex_unlock(&watch->lock);
+		return ENOMEM;
+	}
+
+	for (i = 0, reader = watch->readers; reader; reader = reader->next)
+		seen[i++] = __atomic_load_n(&reader->count, __ATOMIC_SEQ_CST);
+
+	for (;;)
+	{
+		/* an offline reader holds nothing, so it need not be waited for */
+		for (i = 0, reader = watch->readers; reader;
+		     reader = reader->next, ++i)
+			if (!(seen[i] & 1)
+				&& __atomic_load_n(&reader->count,
+					__ATOMIC_SEQ_CST) == seen[i])
+				break;
+
+		if (!reader)
+			break;
+
+		/* the reader is busy with a packet, which takes no time */
+		pthread_mutex_unlock(&watch->lock);
+		if (stopping(watch, GRACE_POLL_MS))
+		{
+			free(seen);
+			return EINTR;
+		}
+
+		pthread_mutex_lock(&watch->lock);
+	}
+
+	pthread_mutex_unlock(&watch->lock);
+	free(seen);
+	return 0;
+}
+
+static void *
+run(void *arg)
+{
+	struct keywatch *watch = arg;
+	struct file_state state;
+
+	file_state(watch->path, &state);
+
+	while (!wait_for_change(watch, &state))
+	{
+		struct keyring *keyring, *old;
+		int rc;
+
+		keyring = keyring_new();
+		if (!keyring)
+		{
+			++watch->failures;
+			continue;
+		}
+
+		rc = keyring_load(keyring, watch->path);
+		if (rc && rc != ENOENT)
+		{
+			/* keep using the keyring we have */
+			fprintf(stderr, "\nError reloading keyring %s: %s\n",
+				watch->path,
+				rc == -1 ? "file is corrupt" : strerror(rc));
+			keyring_free(keyring);
+			++watch->failures;
+			continue;
+		}
+
+		old = __atomic_exchange_n(watch->slot, keyring,
+					__ATOMIC_ACQ_REL);
+		++watch->reloads;
+
+		/* if stopping, the readers are done anyway */
+		synchronize(watch);
+		keyring_free(old);
+	}
+
+	return NULL;
+}
+
+struct keywatch *
+keywatch_new(struct keyring **slot, const char *path)
+{
+	struct keywatch *watch;
+
+	watch = calloc(1, sizeof (struct keywatch));
+	if (!watch)
+		return NULL;
+
+	watch->slot = slot;
+	strncpy(watch->path, path, sizeof watch->path - 1);
+	watch->inotify = -1;
+
+	if (pthread_mutex_init(&watch->lock, NULL))
+		goto fail1;
+
+	if (pipe(watch->wake))
+		goto fail2;
+
+#ifdef __linux__
+	watch->inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (watch->inotify != -1)
+	{
+		char *dpath = strdup(path);
+
+		/* the directory, since a save replaces the file */
+		if (!dpath || inotify_add_watch(watch->inotify, dirname(dpath),
+				IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE
+				| IN_DELETE | IN_MODIFY) == -1)
+		{
+			close(watch->inotify);
+			watch->inotify = -1;
+		}
+
+		free(dpath);
+	}
+#endif
+
+	if (pthread_create(&watch->thread, NULL, run, watch))
+		goto fail3;
+
+	return watch;
+
+fail3:
+	if (watch->inotify != -1)
+		close(watch->inotify);
+	close(watch->wake[0]);
+	close(watch->wake[1]);
+fail2:
+	pthread_mutex_destroy(&watch->lock);
+fail1:
+	free(watch);
+	return NULL;
+}
+
+/* stops watching; call once the readers are done with the keyring */
+void
+keywatch_free(struct keywatch *watch)
+{
+	char c = 0;
+
+	if (write(watch->wake[1], &c, 1) == 1)
+		pthread_join(watch->thread, NULL);
+
+	if (watch->inotify != -1)
+		close(watch->inotify);
+	close(watch->wake[0]);
+	close(watch->wake[1]);
+	pthread_mutex_destroy(&watch->lock);
+	free(watch);
+}
+
+void
+keywatch_register(struct keywatch *watch, struct keywatch_reader *reader)
+{
+	reader->count = 0;
+
+	pthread_mutex_lock(&watch->lock);
+	reader->next = watch->readers;
+	watch->readers = reader;
+	pthread_mutex_unlock(&watch->lock);
+}
+
+/* tells the watch that the reader holds on to no keyring just now */
+void
+keywatch_quiescent(struct keywatch_reader *reader)
+{
+	__atomic_add_fetch(&reader->count, 2, __ATOMIC_RELEASE);
+}
+
+/*
+ * Tells the watch that the reader holds no keyring until it comes back
+ * online, as while it waits for a frame, so reloads need not wait for it.
+ * The count is odd meanwhile.
+ */
+void
+keywatch_offline(struct keywatch_reader *reader)
+{
+	__atomic_add_fetch(&reader->count, 1, __ATOMIC_SEQ_CST);
+}
+
+/* from here on, the reader may use the keyring again */
+void
+keywatch_online(struct keywatch_reader *reader)
+{
+	__atomic_add_fetch(&reader->count, 1, __ATOMIC_SEQ_CST);
+}
+
+struct keyring *
+keywatch_current(struct keyring *const *slot)
+{
+	return __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+}
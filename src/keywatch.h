@@ -0,0 +1,89 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef WB_KEYWATCH_H
+#define WB_KEYWATCH_H
+
+#include <pthread.h>
+
+#include "config.h"
+#include "keyring.h"
+
+/* a thread that uses the published keyring */
+struct keywatch_reader
+{
+	unsigned long count; /* bumped when it holds no keyring; odd offline */
+	struct keywatch_reader *next;
+};
+
+/*
+ * Reloads a keyring whenever its file or journal changes, and publishes
+ * the new one by swapping a pointer, so readers take no lock and only ever
+ * see a keyring that is complete. The old keyring is freed once every
+ * reader has passed a quiescent point, as in RCU: readers must not keep a
+ * keyring from one call of keywatch_quiescent to the next, nor while they
+ * are offline.
+ */
+struct keywatch
+{
+	pthread_mutex_t lock; /* guards the list of readers */
+	struct keywatch_reader *readers;
+	struct keyring **slot;
+	char path[MAX_FILE_PATH];
+	pthread_t thread;
+	int wake[2];
+	int inotify;
+	unsigned long reloads;
+	unsigned long failures;
+};
+
+struct keywatch *
+keywatch_new(struct keyring **slot, const char *path);
+
+void
+keywatch_free(struct keywatch *watch);
+
+void
+keywatch_register(struct keywatch *watch, struct keywatch_reader *reader);
+
+void
+keywatch_quiescent(struct keywatch_reader *reader);
+
+void
+keywatch_offline(struct keywatch_reader *reader);
+
+void
+keywatch_online(struct keywatch_reader *reader);
+
+struct keyring *
+keywatch_current(struct keyring *const *slot);
+
+#endif
@@ -190,6 +190,9 @@ kiss_write_frame(KISS_TNC *tnc, const struct ax25_frame *frame)
 	size_t out_length = 2;
 	unsigned int i;
 	uint8_t *buf = tnc->output_buf;
+	ssize_t rc;
+
+	pthread_mutex_lock(&tnc->write_lock);
 
 	buf[0] = FEND;
 	buf[1] = DATA_FRAME;
@@ -217,7 +220,51 @@ kiss_write_frame(KISS_TNC *tnc, const struct ax25_frame *frame)
 	}
 
 	buf[out_length++] = FEND;
-	return tnc->io->write(tnc->io, buf, out_length);
+	rc = tnc->io->write(tnc->io, buf, out_length);
+
+	pthread_mutex_unlock(&tnc->write_lock);
+	return rc;
+}
+
+static ssize_t
+write_command(KISS_TNC *tnc, enum kiss_command command, uint8_t value)
+{
+	uint8_t buf[5];
+	size_t length = 0;
+	ssize_t rc;
+
+	buf[length++] = FEND;
+	buf[length++] = command;
+
+	if (value == FEND || value == FESC)
+	{
+		buf[length++] = FESC;
+		buf[length++] = value == FEND ? TFEND : TFESC;
+	}
+	else
+	{
+		buf[length++] = value;
+	}
+
+	buf[length++] = FEND;
+
+	pthread_mutex_lock(&tnc->write_lock);
+	rc = tnc->io->write(tnc->io, buf, length);
+	pthread_mutex_unlock(&tnc->write_lock);
+	return rc;
+}
+
+ssize_t
+kiss_set_persistence(KISS_TNC *tnc, uint8_t persistence)
+{
+	return write_command(tnc, PERSISTENCE, persistence);
+}
+
+/* in units of 10 ms */
+ssize_t
+kiss_set_slot_time(KISS_TNC *tnc, uint8_t slot_time)
+{
+	return write_command(tnc, SLOT_TIME, slot_time);
 }
 
 KISS_TNC *
@@ -226,6 +273,7 @@ kiss_init(KISS_TNC *tnc, struct io *io)
 	bzero(tnc, sizeof (KISS_TNC));
 	tnc->io = io;
 	tnc->command = NO_COMMAND;
+	pthread_mutex_init(&tnc->write_lock, NULL);
 
 	return tnc;
 }
@@ -32,6 +32,7 @@
 #ifndef WB_KISS_H
 #define WB_KISS_H
 
+#include <pthread.h>
 #include <stdint.h>
 #include <termios.h>
 
@@ -51,6 +52,9 @@ typedef struct
 	struct ax25_frame input_frame;
 
 	uint8_t input_buf[KISS_FRAME_MAX];
+
+	/* frames may be written from more than one thread */
+	pthread_mutex_t write_lock;
 	uint8_t output_buf[KISS_FRAME_MAX];
 } KISS_TNC;
 
@@ -60,6 +64,12 @@ kiss_read_frame(KISS_TNC *tnc);
 ssize_t
 kiss_write_frame(KISS_TNC *tnc, const struct ax25_frame *frame);
 
+ssize_t
+kiss_set_persistence(KISS_TNC *tnc, uint8_t persistence);
+
+ssize_t
+kiss_set_slot_time(KISS_TNC *tnc, uint8_t slot_time);
+
 KISS_TNC *
 kiss_init(KISS_TNC *tnc, struct io *io);
 
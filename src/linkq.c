@@ -0,0 +1,317 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "callsign.h"
+#include "linkq.h"
+
+#define PROBE_LENGTH 8
+
+#define LOSS_WEIGHT 0.2
+#define MIN_PARTS 8 /* before the loss estimate for a station is trusted */
+#define RECENT 600 /* seconds a station counts toward group messages */
+
+/* octets of a frame that the content does not account for: flags, FCS */
+#define FRAME_OVERHEAD 4
+
+struct link_table *
+link_table_new(unsigned int capacity)
+{
+	struct link_table *table;
+	unsigned int size = PROBE_LENGTH;
+
+	while (size < capacity)
+		size <<= 1;
+
+	table = malloc(sizeof (struct link_table));
+	if (!table)
+		return NULL;
+
+	table->entries = calloc(size, sizeof (struct link_entry));
+	if (!table->entries || pthread_mutex_init(&table->lock, NULL))
+	{
+		free(table->entries);
+		free(table);
+		return NULL;
+	}
+
+	table->mask = size - 1;
+	return table;
+}
+
+void
+link_table_free(struct link_table *table)
+{
+	pthread_mutex_destroy(&table->lock);
+	free(table->entries);
+	free(table);
+}
+
+static struct link_entry *
+find(struct link_table *table, uint64_t station)
+{
+	unsigned int i, home = callsign_hash(station);
+
+	for (i = 0; i < PROBE_LENGTH; ++i)
+	{
+		struct link_entry *entry;
+
+		entry = table->entries + ((home + i) & table->mask);
+		if (entry->station == station)
+			return entry;
+	}
+
+	return NULL;
+}
+
+static struct link_entry *
+claim(struct link_table *table, const char *callsign, time_t now)
+{
+	struct link_entry *victim;
+	uint64_t station = callsign_pack(callsign);
+	unsigned int i, home = callsign_hash(station);
+
+	victim = find(table, station);
+	if (victim)
+		goto found;
+
+	for (i = 0; i < PROBE_LENGTH; ++i)
+	{
+		struct link_entry *entry;
+
+		entry = table->entries + ((home + i) & table->mask);
+		if (!entry->station)
+		{
+			victim = entry;
+			break;
+		}
+
+		if (!victim || entry->last_heard < victim->last_heard)
+			victim = entry;
+	}
+
+	memset(victim, 0, sizeof *victim);
+	victim->station = station;
+	strcpy(victim->callsign, callsign);
+
+found:
+	victim->last_heard = now;
+	return victim;
+}
+
+void
+link_table_heard(struct link_table *table, const struct ax25_header *header)
+{
+	struct link_entry *entry;
+
+	pthread_mutex_lock(&table->lock);
+
+	entry = claim(table, header->src_addr, time(NULL));
+	memcpy(entry->digi_path, header->digi_path, sizeof entry->digi_path);
+	++entry->packets_heard;
+
+	pthread_mutex_unlock(&table->lock);
+}
+
+/* the station's airtime, decayed to `now` */
+static double
+airtime(const struct link_entry *entry, time_t now)
+{
+	return entry->airtime_ms
+		* exp(-(double) (now - entry->airtime_at) / LINK_AIRTIME_WINDOW);
+}
+
+/*
+ * Charges a station for the time its frame held the channel. Older use
+ * counts for less and less, so that the total over the window is the
+ * station's recent share of the channel.
+ */
+void
+link_table_occupy(struct link_table *table, const char *station,
+	unsigned long airtime_ms)
+{
+	struct link_entry *entry;
+	time_t now = time(NULL);
+
+	pthread_mutex_lock(&table->lock);
+
+	entry = claim(table, station, now);
+	entry->airtime_ms = airtime(entry, now) + airtime_ms;
+	entry->airtime_at = now;
+
+	pthread_mutex_unlock(&table->lock);
+}
+
+/*
+ * Records that `heard` of the `expected` packets of a multipart message
+ * from a station arrived, their content being `length` octets on average.
+ * Frames are lost to noise in proportion to their length, so the loss is
+ * kept as a rate per octet, which applies to frames of any size.
+ */
+void
+link_table_observe(struct link_table *table, const char *station,
+	unsigned int expected, unsigned int heard, unsigned int length)
+{
+	struct link_entry *entry;
+	double delivered, rate;
+
+	if (expected == 0 || heard > expected)
+		return;
+
+	pthread_mutex_lock(&table->lock);
+
+	entry = claim(table, station, time(NULL));
+	++entry->messages;
+	entry->parts_expected += expected;
+	entry->parts_heard += heard;
+
+	/* nothing is heard of a message with no parts at all, so heard > 0 */
+	delivered = heard ? (double) heard / expected : 0.5 / expected;
+	rate = -log(delivered) / (length + AX25_HEADER_MAX + FRAME_OVERHEAD);
+
+	if (entry->messages == 1)
+		entry->byte_loss = rate;
+	else
+		entry->byte_loss += LOSS_WEIGHT * (rate - entry->byte_loss);
+
+	pthread_mutex_unlock(&table->lock);
+}
+
+/* the loss rate to assume for a station, or a group of them */
+static double
+byte_loss(struct link_table *table, const char *dest)
+{
+	struct link_entry *entry;
+	time_t now = time(NULL);
+	double worst = 0;
+	unsigned int i;
+
+	entry = find(table, callsign_pack(dest));
+	if (entry && entry->parts_expected >= MIN_PARTS)
+		return entry->byte_loss;
+
+	/* a message to a group had better reach its worst listener too */
+	for (i = 0; i <= table->mask; ++i)
+	{
+		entry = table->entries + i;
+		if (entry->station && entry->parts_expected >= MIN_PARTS
+			&& entry->last_heard + RECENT > now
+			&& entry->byte_loss > worst)
+			worst = entry->byte_loss;
+	}
+
+	return worst;
+}
+
+static unsigned int
+best_size(double loss, unsigned int max_content, unsigned int overhead)
+{
+	double h = overhead + FRAME_OVERHEAD, c;
+
+	if (loss <= 0)
+		return max_content;
+
+	/*
+	 * A part of c octets arrives with probability exp(-loss * (c + h)),
+	 * so the share of airtime that delivers content is
+	 * c / (c + h) * exp(-loss * (c + h)), largest where
+	 * c^2 + h * c - h / loss = 0.
+	 */
+	c = (sqrt(h * h + 4 * h / loss) - h) / 2;
+
+	if (c < LINK_MIN_FRAGMENT)
+		return LINK_MIN_FRAGMENT < max_content ? LINK_MIN_FRAGMENT
+			: max_content;
+
+	return c < max_content ? (unsigned int) c : max_content;
+}
+
+/*
+ * The content size for the parts of a multipart message to `dest`, when
+ * each frame also carries `overhead` octets of headers. This only pays
+ * when lost parts can be rebuilt or resent one by one.
+ */
+unsigned int
+link_table_fragment_size(struct link_table *table, const char *dest,
+	unsigned int max_content, unsigned int overhead)
+{
+	double loss;
+
+	pthread_mutex_lock(&table->lock);
+	loss = byte_loss(table, dest);
+	pthread_mutex_unlock(&table->lock);
+
+	return best_size(loss, max_content, overhead);
+}
+
+void
+link_table_print(struct link_table *table, FILE *f)
+{
+	time_t now = time(NULL);
+	unsigned int i, j;
+
+	pthread_mutex_lock(&table->lock);
+
+	fprintf(f, "%-10s %8s %8s %11s %6s %5s %6s  %s\n", "Station",
+		"Heard", "Ago", "Parts", "Loss", "Size", "Air", "Path");
+
+	for (i = 0; i <= table->mask; ++i)
+	{
+		const struct link_entry *entry = table->entries + i;
+		double loss;
+
+		if (!entry->station)
+			continue;
+
+		/* as it would be for a full frame */
+		loss = 1 - exp(-entry->byte_loss * AX25_FRAME_MAX);
+
+		fprintf(f, "%-10s %8lu %7lds %5lu/%-5lu %5.1f%% %5u %5.1f%%  %s",
+			entry->callsign, entry->packets_heard,
+			(long) (now - entry->last_heard), entry->parts_heard,
+			entry->parts_expected, loss * 100,
+			best_size(entry->byte_loss, AX25_INFO_MAX,
+				AX25_HEADER_MAX),
+			airtime(entry, now) / (LINK_AIRTIME_WINDOW * 10.0),
+			entry->digi_path[0][0] ? "" : "direct");
+
+		for (j = 0; j < AX25_MAX_ADDRS - 2 && entry->digi_path[j][0];
+		     ++j)
+			fprintf(f, "%s%s", j ? "," : "", entry->digi_path[j]);
+
+		fprintf(f, "\n");
+	}
+
+	pthread_mutex_unlock(&table->lock);
+}
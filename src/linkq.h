@@ -0,0 +1,99 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef WB_LINKQ_H
+#define WB_LINKQ_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "ax25.h"
+
+#define LINK_TABLE_STATIONS 256
+#define LINK_MIN_FRAGMENT 32
+#define LINK_AIRTIME_WINDOW 300 /* seconds */
+
+struct link_entry
+{
+	uint64_t station; /* 0 if the entry is free */
+	char callsign[AX25_ADDR_MAX];
+	char digi_path[AX25_MAX_ADDRS - 2][AX25_ADDR_MAX]; /* as last heard */
+	time_t last_heard;
+	unsigned long packets_heard;
+	unsigned long messages;
+	unsigned long parts_expected;
+	unsigned long parts_heard;
+	double byte_loss; /* chance per octet of losing the frame, as a rate */
+	double airtime_ms; /* recent, decaying over LINK_AIRTIME_WINDOW */
+	time_t airtime_at;
+};
+
+/*
+ * How well we hear each station, kept so that multipart messages can be
+ * cut into parts of the size that gets the most through. Paths are assumed
+ * to be about as lossy in both directions. Like the signature cache, the
+ * table is set-associative, and a full set gives up the station heard
+ * least recently.
+ */
+struct link_table
+{
+	pthread_mutex_t lock;
+	unsigned int mask;
+	struct link_entry *entries;
+};
+
+struct link_table *
+link_table_new(unsigned int capacity);
+
+void
+link_table_free(struct link_table *table);
+
+void
+link_table_heard(struct link_table *table, const struct ax25_header *header);
+
+void
+link_table_occupy(struct link_table *table, const char *station,
+	unsigned long airtime_ms);
+
+void
+link_table_observe(struct link_table *table, const char *station,
+	unsigned int expected, unsigned int heard, unsigned int length);
+
+unsigned int
+link_table_fragment_size(struct link_table *table, const char *dest,
+	unsigned int max_content, unsigned int overhead);
+
+void
+link_table_print(struct link_table *table, FILE *f);
+
+#endif
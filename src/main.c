@@ -38,11 +38,14 @@
 
 #include "callsign.h"
 #include "chat.h"
+#include "compress.h"
 #include "config.h"
+#include "history.h"
 #include "keygen.h"
 #include "keyring.h"
 #include "os.h"
 #include "tnc2.h"
+#include "transfer.h"
 #include "tty.h"
 #include "windbag.h"
 
@@ -54,10 +57,17 @@ typedef struct
 
 static const COMMAND COMMANDS[] = {
 	{ "chat", chat },
+	{ "convert-keyring", convert_keyring },
+	{ "daemon", windbag_daemon },
 	{ "delete-key", delete_key },
 	{ "export-key", export_key },
+	{ "history", show_history },
 	{ "import-key", import_key },
-	{ "keygen", keygen }
+	{ "import-keys", import_keys },
+	{ "keygen", keygen },
+	{ "receive-file", receive_file },
+	{ "send-file", send_file },
+	{ "train-dictionary", train_dictionary }
 };
 
 static int
@@ -156,7 +166,7 @@ main(int argc, char *argv[])
 		else
 		{
 			rc = 0;
-			memset(&config, 0, sizeof config);
+			config_defaults(&config);
 		}
 
 		strncpy(config.config_path, config_path, sizeof config.config_path - 1);
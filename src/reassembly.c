@@ -0,0 +1,840 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "callsign.h"
+#include "endian.h"
+#include "reassembly.h"
+
+#define MIN_BUCKETS 64
+
+struct sender
+{
+	uint64_t source;
+	size_t bytes;
+	struct message_slot *oldest, *newest;
+	struct sender *hash_next;
+};
+
+static unsigned int
+slot_hash(uint64_t source, uint32_t timestamp)
+{
+	return callsign_hash(source ^ ((uint64_t) timestamp << 32 | timestamp));
+}
+
+struct reassembly *
+reassembly_new(unsigned int timeout, size_t max_bytes,
+	size_t max_sender_bytes, unsigned int max_slots)
+{
+	struct reassembly *r = calloc(1, sizeof (struct reassembly));
+	if (!r)
+		return NULL;
+
+	r->slots = calloc(MIN_BUCKETS, sizeof (struct message_slot *));
+	r->senders = calloc(MIN_BUCKETS, sizeof (struct sender *));
+	if (!r->slots || !r->senders)
+	{
+		free(r->slots);
+		free(r->senders);
+		free(r);
+		return NULL;
+	}
+
+	r->slot_mask = MIN_BUCKETS - 1;
+	r->sender_mask = MIN_BUCKETS - 1;
+	r->timeout = timeout;
+	r->max_bytes = max_bytes;
+	r->max_sender_bytes = max_sender_bytes;
+	r->max_slots = max_slots;
+	return r;
+}
+
+static void
+free_parts(struct message_slot *slot)
+{
+	unsigned int i;
+
+	if (!slot->parts)
+		return;
+
+	for (i = 0; i <= slot->final; ++i)
+		free(slot->parts[i]);
+
+	free(slot->parts);
+	slot->parts = NULL;
+
+	if (!slot->parity)
+		return;
+
+	for (i = 0; i < slot->n_parity; ++i)
+		free(slot->parity[i]);
+
+	free(slot->parity);
+	slot->parity = NULL;
+}
+
+static void
+free_slot(struct message_slot *slot)
+{
+	free_parts(slot);
+	free(slot);
+}
+
+void
+reassembly_free(struct reassembly *r)
+{
+	unsigned int i;
+
+	while (r->oldest)
+	{
+		struct message_slot *next = r->oldest->age_next;
+		free_slot(r->oldest);
+		r->oldest = next;
+	}
+
+	for (i = 0; i <= r->sender_mask; ++i)
+	{
+		while (r->senders[i])
+		{
+			struct sender *next = r->senders[i]->hash_next;
+			free(r->senders[i]);
+			r->senders[i] = next;
+		}
+	}
+
+	free(r->slots);
+	free(r->senders);
+	free(r);
+}
+
+/*
+ * The hash tables double once they average more than one entry per bucket,
+ * keeping lookups O(1) however many senders are active. If memory is short,
+ * they carry on with longer chains instead.
+ */
+static void
+grow_senders(struct reassembly *r)
+{
+	struct sender **grown;
+	unsigned int i, size = (r->sender_mask + 1) * 2;
+
+	if (r->n_senders <= r->sender_mask + 1)
+		return;
+
+	grown = calloc(size, sizeof (struct sender *));
+	if (!grown)
+		return;
+
+	for (i = 0; i <= r->sender_mask; ++i)
+	{
+		struct sender *sender, *next;
+
+		for (sender = r->senders[i]; sender; sender = next)
+		{
+			unsigned int bucket = callsign_hash(sender->source)
+				& (size - 1);
+
+			next = sender->hash_next;
+			sender->hash_next = grown[bucket];
+			grown[bucket] = sender;
+		}
+	}
+
+	free(r->senders);
+	r->senders = grown;
+	r->sender_mask = size - 1;
+}
+
+static void
+grow_slots(struct reassembly *r)
+{
+	struct message_slot **grown;
+	unsigned int i, size = (r->slot_mask + 1) * 2;
+
+	if (r->n_slots <= r->slot_mask + 1)
+		return;
+
+	grown = calloc(size, sizeof (struct message_slot *));
+	if (!grown)
+		return;
+
+	for (i = 0; i <= r->slot_mask; ++i)
+	{
+		struct message_slot *slot, *next;
+
+		for (slot = r->slots[i]; slot; slot = next)
+		{
+			unsigned int bucket = slot_hash(slot->source,
+						slot->timestamp) & (size - 1);
+
+			next = slot->hash_next;
+			slot->hash_next = grown[bucket];
+			grown[bucket] = slot;
+		}
+	}
+
+	free(r->slots);
+	r->slots = grown;
+	r->slot_mask = size - 1;
+}
+
+static struct sender *
+find_sender(struct reassembly *r, uint64_t source, int create)
+{
+	struct sender **head, *sender;
+
+	head = r->senders + (callsign_hash(source) & r->sender_mask);
+	for (sender = *head; sender; sender = sender->hash_next)
+		if (sender->source == source)
+			return sender;
+
+	if (!create)
+		return NULL;
+
+	sender = calloc(1, sizeof (struct sender));
+	if (!sender)
+		return NULL;
+
+	sender->source = source;
+	sender->hash_next = *head;
+	*head = sender;
+	++r->n_senders;
+
+	grow_senders(r);
+	return sender;
+}
+
+static void
+drop_sender(struct reassembly *r, struct sender *sender)
+{
+	struct sender **p;
+
+	p = r->senders + (callsign_hash(sender->source) & r->sender_mask);
+	for (; *p; p = &(*p)->hash_next)
+	{
+		if (*p == sender)
+		{
+			*p = sender->hash_next;
+			--r->n_senders;
+			free(sender);
+			return;
+		}
+	}
+}
+
+struct message_slot *
+reassembly_find(struct reassembly *r, uint64_t source, uint32_t timestamp)
+{
+	struct message_slot *slot;
+
+	slot = r->slots[slot_hash(source, timestamp) & r->slot_mask];
+	for (; slot; slot = slot->hash_next)
+		if (slot->source == source && slot->timestamp == timestamp)
+			return slot;
+
+	return NULL;
+}
+
+/*
+ * Each slot sits on two oldest-first lists: one of every slot in the table,
+ * ordered by last update, and one of its sender's slots, by creation.
+ */
+static void
+unlink_age(struct reassembly *r, struct message_slot *slot)
+{
+	if (slot->age_prev)
+		slot->age_prev->age_next = slot->age_next;
+	else
+		r->oldest = slot->age_next;
+
+	if (slot->age_next)
+		slot->age_next->age_prev = slot->age_prev;
+	else
+		r->newest = slot->age_prev;
+}
+
+static void
+append_age(struct reassembly *r, struct message_slot *slot)
+{
+	slot->age_prev = r->newest;
+	slot->age_next = NULL;
+
+	if (r->newest)
+		r->newest->age_next = slot;
+	else
+		r->oldest = slot;
+
+	r->newest = slot;
+}
+
+static void
+unlink_sender(struct sender *sender, struct message_slot *slot)
+{
+	if (slot->sender_prev)
+		slot->sender_prev->sender_next = slot->sender_next;
+	else
+		sender->oldest = slot->sender_next;
+
+	if (slot->sender_next)
+		slot->sender_next->sender_prev = slot->sender_prev;
+	else
+		sender->newest = slot->sender_prev;
+}
+
+static void
+append_sender(struct sender *sender, struct message_slot *slot)
+{
+	slot->sender_prev = sender->newest;
+	slot->sender_next = NULL;
+
+	if (sender->newest)
+		sender->newest->sender_next = slot;
+	else
+		sender->oldest = slot;
+
+	sender->newest = slot;
+}
+
+/*
+ * What a slot costs against the caps: itself and its array of parts as
+ * well as the parts, so that messages of many empty parts cost something.
+ */
+static size_t
+slot_cost(unsigned int final)
+{
+	return sizeof (struct message_slot)
+		+ ((size_t) final + 1) * sizeof (struct fragment *);
+}
+
+static size_t
+fragment_cost(size_t length)
+{
+	return sizeof (struct fragment) + length;
+}
+
+static void
+charge(struct reassembly *r, struct message_slot *slot, size_t bytes)
+{
+	slot->bytes += bytes;
+	slot->sender->bytes += bytes;
+	r->bytes += bytes;
+}
+
+static void
+remove_slot(struct reassembly *r, struct message_slot *slot)
+{
+	struct message_slot **p;
+	struct sender *sender = slot->sender;
+
+	p = r->slots + (slot_hash(slot->source, slot->timestamp) & r->slot_mask);
+	for (; *p; p = &(*p)->hash_next)
+	{
+		if (*p == slot)
+		{
+			*p = slot->hash_next;
+			break;
+		}
+	}
+
+	--r->n_slots;
+	unlink_age(r, slot);
+	unlink_sender(sender, slot);
+
+	r->bytes -= slot->bytes;
+	sender->bytes -= slot->bytes;
+	if (!sender->oldest)
+		drop_sender(r, sender);
+
+	free_slot(slot);
+}
+
+static struct message_slot *
+new_slot(struct reassembly *r, const struct windbag_packet *packet,
+	uint64_t source)
+{
+	struct message_slot *slot, **head;
+	struct sender *sender;
+
+	/* however little each costs, there are only so many to go around */
+	if (r->n_slots >= r->max_slots)
+	{
+		if (!r->oldest)
+			return NULL;
+
+		remove_slot(r, r->oldest);
+		++r->stats.evicted;
+	}
+
+	sender = find_sender(r, source, 1);
+	if (!sender)
+		return NULL;
+
+	slot = calloc(1, sizeof (struct message_slot));
+	if (!slot)
+		goto fail1;
+
+	slot->parts = calloc(packet->multipart_final + 1,
+			sizeof (struct fragment *));
+	if (!slot->parts)
+		goto fail2;
+
+	slot->source = source;
+	slot->timestamp = packet->timestamp;
+	slot->final = packet->multipart_final;
+	slot->sender = sender;
+	memcpy(&slot->header, &packet->header, sizeof slot->header);
+	slot->status = packet->signature_status;
+	slot->compressed = packet->compressed;
+	strcpy(slot->verified_callsign, packet->verified_callsign);
+
+	head = r->slots + (slot_hash(source, slot->timestamp) & r->slot_mask);
+	slot->hash_next = *head;
+	*head = slot;
+	++r->n_slots;
+
+	append_sender(sender, slot);
+	append_age(r, slot);
+	charge(r, slot, slot_cost(slot->final));
+
+	grow_slots(r);
+	return slot;
+
+fail2:
+	free(slot);
+fail1:
+	if (!sender->oldest)
+		drop_sender(r, sender);
+	return NULL;
+}
+
+static int
+severity(enum windbag_signature_status status)
+{
+	switch (status)
+	{
+	case GOOD_SIGNATURE:
+		return 0;
+
+	case ALTERNATE_SIGNATURE:
+		return 1;
+
+	case DEFERRED_SIGNATURE:
+	case NO_SIGNATURE:
+		return 2;
+
+	case UNKNOWN_SIGNATURE:
+		return 3;
+
+	case THROTTLED_SIGNATURE:
+		return 4;
+
+	case BAD_SIGNATURE:
+		break;
+	}
+
+	return 5;
+}
+
+static void
+merge_status(struct message_slot *slot, const struct windbag_packet *packet)
+{
+	enum windbag_signature_status status = packet->signature_status;
+
+	/* parts vouched for by different identities vouch for nothing */
+	if (status == ALTERNATE_SIGNATURE
+		&& slot->status == ALTERNATE_SIGNATURE
+		&& strcmp(packet->verified_callsign,
+			slot->verified_callsign) != 0)
+		status = UNKNOWN_SIGNATURE;
+
+	if (severity(status) > severity(slot->status))
+	{
+		slot->status = status;
+		strcpy(slot->verified_callsign, packet->verified_callsign);
+	}
+}
+
+/*
+ * Makes room for `length` more bytes in `keep`, which is already charged for,
+ * evicting the oldest messages first.
+ */
+static int
+make_room(struct reassembly *r, struct message_slot *keep, size_t length)
+{
+	struct sender *sender = keep->sender;
+
+	if (length > r->max_sender_bytes || length > r->max_bytes)
+		return 0;
+
+	while (sender->bytes + length > r->max_sender_bytes)
+	{
+		struct message_slot *victim = sender->oldest;
+		if (victim == keep)
+			victim = victim->sender_next;
+		if (!victim)
+			return 0;
+
+		remove_slot(r, victim);
+		++r->stats.evicted;
+	}
+
+	while (r->bytes + length > r->max_bytes)
+	{
+		struct message_slot *victim = r->oldest;
+		if (victim == keep)
+			victim = victim->age_next;
+		if (!victim)
+			return 0;
+
+		remove_slot(r, victim);
+		++r->stats.evicted;
+	}
+
+	return 1;
+}
+
+static int
+deliver(struct reassembly *r, struct message_slot *slot,
+	struct windbag_packet *complete)
+{
+	unsigned int i;
+	int rc = 1;
+
+	memcpy(&complete->header, &slot->header, sizeof complete->header);
+	complete->timestamp = slot->timestamp;
+	complete->multipart_index = slot->final;
+	complete->multipart_final = slot->final;
+	complete->signature_status = slot->status;
+	complete->compressed = slot->compressed;
+	strcpy(complete->verified_callsign, slot->verified_callsign);
+
+	/* a whole-message signature overrules whatever the parts said */
+	memcpy(&complete->signature, &slot->signature,
+		sizeof complete->signature);
+	if (slot->signature.length)
+		complete->signature_status = DEFERRED_SIGNATURE;
+
+	complete->payload->length = 0;
+	for (i = 0; i <= slot->final; ++i)
+	{
+		const struct fragment *part = slot->parts[i];
+
+		if (bigbuffer_append(complete->payload, part->data,
+					part->length))
+		{
+			rc = -ENOMEM;
+			break;
+		}
+	}
+
+	bigbuffer_terminate(complete->payload);
+
+	/*
+	 * Keep the emptied slot until it times out so that stragglers and
+	 * retransmissions of this message are recognized as duplicates. It
+	 * still costs its own size.
+	 */
+	free_parts(slot);
+	r->bytes -= slot->bytes - sizeof (struct message_slot);
+	slot->sender->bytes -= slot->bytes - sizeof (struct message_slot);
+	slot->bytes = sizeof (struct message_slot);
+
+	++r->stats.completed;
+	return rc;
+}
+
+/* rebuilds the missing parts of a slot from its parity, if it can */
+static int
+recover(struct reassembly *r, struct message_slot *slot)
+{
+	uint8_t *shards[FEC_MAX_SHARDS];
+	const uint8_t *parity[FEC_MAX_SHARDS];
+	unsigned int parity_index[FEC_MAX_SHARDS];
+	int present[FEC_MAX_SHARDS] = { 0 };
+	unsigned int i, n = 0, n_data = slot->final + 1, length = 0;
+	int rc = 0;
+
+	for (i = 0; i < slot->n_parity; ++i)
+	{
+		if (!slot->parity[i])
+			continue;
+
+		if (n > 0 && slot->parity[i]->length != length)
+			return 0;
+
+		length = slot->parity[i]->length;
+		parity[n] = slot->parity[i]->data;
+		parity_index[n++] = i;
+	}
+
+	if (length < 2)
+		return 0;
+
+	shards[0] = calloc(n_data, length);
+	if (!shards[0])
+		return -ENOMEM;
+
+	for (i = 0; i < n_data; ++i)
+	{
+		const struct fragment *part = slot->parts[i];
+		uint16_t part_length;
+
+		shards[i] = shards[0] + i * length;
+		present[i] = part != NULL;
+		if (!part)
+			continue;
+
+		if (part->length + 2 > length)
+			goto end;
+
+		part_length = htole16(part->length);
+		memcpy(shards[i], &part_length, sizeof part_length);
+		memcpy(shards[i] + 2, part->data, part->length);
+	}
+
+	if (fec_decode(shards, present, n_data, parity, parity_index, n,
+			length))
+		goto end;
+
+	for (i = 0; i < n_data; ++i)
+	{
+		struct fragment *part;
+		uint16_t part_length;
+
+		if (present[i])
+			continue;
+
+		memcpy(&part_length, shards[i], sizeof part_length);
+		part_length = le16toh(part_length);
+		if ((unsigned int) part_length + 2 > length)
+			goto end;
+
+		part = malloc(sizeof (struct fragment) + part_length);
+		if (!part)
+		{
+			rc = -ENOMEM;
+			goto end;
+		}
+
+		part->length = part_length;
+		memcpy(part->data, shards[i] + 2, part_length);
+		slot->parts[i] = part;
+		++slot->received;
+		charge(r, slot, fragment_cost(part_length));
+	}
+
+	++r->stats.recovered;
+	rc = 1;
+
+end:
+	free(shards[0]);
+	return rc;
+}
+
+void
+reassembly_expire(struct reassembly *r, time_t now)
+{
+	while (r->oldest && r->oldest->updated + r->timeout <= now)
+	{
+		struct message_slot *slot = r->oldest;
+
+		/* by now, anything not heard was lost on the way */
+		if (r->fec)
+			fec_observe(r->fec, slot->final + 1 + slot->n_parity,
+				slot->heard);
+
+		if (r->links && slot->heard)
+			link_table_observe(r->links, slot->header.src_addr,
+				slot->final + 1 + slot->n_parity, slot->heard,
+				slot->heard_bytes / slot->heard);
+
+		remove_slot(r, slot);
+		++r->stats.expired;
+	}
+}
+
+static int
+seen(const struct message_slot *slot, unsigned int bit)
+{
+	return (slot->seen[bit / 8] >> (bit % 8)) & 1;
+}
+
+static void
+mark_seen(struct message_slot *slot, unsigned int bit, size_t length)
+{
+	slot->seen[bit / 8] |= 1 << (bit % 8);
+	++slot->heard;
+	slot->heard_bytes += length;
+}
+
+int
+reassembly_add(struct reassembly *r, const struct windbag_packet *packet,
+	struct windbag_packet *complete)
+{
+	struct message_slot *slot;
+	struct fragment *part, **dest;
+	const struct bigbuffer *payload = packet->payload;
+	uint64_t source = callsign_pack(packet->header.src_addr);
+	time_t now = time(NULL);
+	unsigned int bit;
+	size_t cost;
+
+	reassembly_expire(r, now);
+
+	/* written so that no index off the air can wrap around */
+	if (packet->parity_count >= FEC_MAX_SHARDS
+		|| packet->multipart_final
+			>= FEC_MAX_SHARDS - packet->parity_count
+		|| packet->multipart_index > packet->multipart_final
+		|| (packet->parity_count
+			&& packet->parity_index >= packet->parity_count))
+	{
+		++r->stats.rejected;
+		return 0;
+	}
+
+	bit = packet->parity_count
+		? FEC_MAX_SHARDS + packet->parity_index
+		: packet->multipart_index;
+
+	slot = reassembly_find(r, source, packet->timestamp);
+	if (!slot)
+	{
+		slot = new_slot(r, packet, source);
+		if (!slot)
+			return -ENOMEM;
+	}
+	else if (slot->final != packet->multipart_final
+		|| slot->compressed != packet->compressed
+		|| (packet->parity_count && slot->n_parity
+			&& slot->n_parity != packet->parity_count))
+	{
+		++r->stats.rejected;
+		return 0;
+	}
+
+	if (seen(slot, bit))
+	{
+		++r->stats.duplicates;
+		return 0;
+	}
+
+	/* too late to help, but it still tells how lossy the channel is */
+	if (!slot->parts)
+	{
+		mark_seen(slot, bit, payload->length);
+		++r->stats.duplicates;
+		return 0;
+	}
+
+	cost = fragment_cost(payload->length);
+	if (packet->parity_count && !slot->parity)
+		cost += packet->parity_count * sizeof (struct fragment *);
+
+	if (!make_room(r, slot, cost))
+	{
+		++r->stats.rejected;
+		if (slot->received + slot->parity_received == 0)
+			remove_slot(r, slot);
+		return 0;
+	}
+
+	if (packet->parity_count)
+	{
+		if (!slot->parity)
+		{
+			slot->parity = calloc(packet->parity_count,
+					sizeof (struct fragment *));
+			if (!slot->parity)
+			{
+				if (slot->received + slot->parity_received == 0)
+					remove_slot(r, slot);
+				return -ENOMEM;
+			}
+
+			slot->n_parity = packet->parity_count;
+		}
+
+		dest = slot->parity + packet->parity_index;
+	}
+	else
+	{
+		dest = slot->parts + packet->multipart_index;
+	}
+
+	part = malloc(sizeof (struct fragment) + payload->length);
+	if (!part)
+	{
+		if (slot->received + slot->parity_received == 0)
+			remove_slot(r, slot);
+		return -ENOMEM;
+	}
+
+	part->length = payload->length;
+	memcpy(part->data, payload->data, payload->length);
+	*dest = part;
+	mark_seen(slot, bit, payload->length);
+
+	if (slot->received + slot->parity_received > 0)
+		merge_status(slot, packet);
+
+	if (packet->parity_count)
+		++slot->parity_received;
+	else
+		++slot->received;
+
+	if (packet->signature.length)
+		memcpy(&slot->signature, &packet->signature,
+			sizeof slot->signature);
+
+	charge(r, slot, cost);
+
+	slot->updated = now;
+	unlink_age(r, slot);
+	append_age(r, slot);
+
+	if (slot->received > slot->final)
+		return deliver(r, slot, complete);
+
+	if (slot->received + slot->parity_received > slot->final)
+	{
+		int rc = recover(r, slot);
+		if (rc <= 0)
+			return rc;
+
+		return deliver(r, slot, complete);
+	}
+
+	return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef WB_REASSEMBLY_H
+#define WB_REASSEMBLY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "fec.h"
+#include "linkq.h"
+#include "windbag.h"
+
+#define REASSEMBLY_TIMEOUT 60
+#define REASSEMBLY_MAX_BYTES (1024 * 1024)
+#define REASSEMBLY_MAX_SENDER_BYTES (64 * 1024)
+#define REASSEMBLY_MAX_SLOTS 4096
+
+struct fragment
+{
+	unsigned int length;
+	uint8_t data[];
+};
+
+struct sender;
+
+struct message_slot
+{
+	uint64_t source;
+	uint32_t timestamp;
+	struct ax25_header header; /* as heard on the first part to arrive */
+	enum windbag_signature_status status; /* worst of all parts */
+	char verified_callsign[AX25_ADDR_MAX];
+	struct windbag_signature signature; /* of the whole message, if any */
+	int compressed;
+	unsigned int final;
+	unsigned int received;
+	size_t bytes; /* charged against the caps, the slot itself included */
+	time_t updated;
+	struct fragment **parts; /* NULL once the message is delivered */
+
+	unsigned int n_parity;
+	unsigned int parity_received;
+	struct fragment **parity;
+
+	/* when we may next ask the sender for missing parts, and how often */
+	time_t repair_after;
+	unsigned int repairs;
+
+	/* every data and parity packet heard, even after delivery */
+	unsigned int heard;
+	size_t heard_bytes;
+	uint8_t seen[(FEC_MAX_SHARDS * 2) / 8];
+
+	struct sender *sender;
+	struct message_slot *hash_next;
+	struct message_slot *sender_prev, *sender_next; /* oldest first */
+	struct message_slot *age_prev, *age_next; /* oldest first */
+};
+
+struct reassembly_stats
+{
+	unsigned long completed;
+	unsigned long duplicates;
+	unsigned long expired;
+	unsigned long evicted;
+	unsigned long rejected;
+	unsigned long recovered;
+};
+
+/*
+ * Collects the parts of multipart messages, keyed by source and timestamp,
+ * until each message is complete. Incomplete messages are dropped after
+ * sitting idle for the timeout, or oldest first when a sender or the table
+ * as a whole would exceed its memory cap, or the table its count of slots.
+ */
+struct reassembly
+{
+	unsigned int timeout;
+	size_t max_bytes;
+	size_t max_sender_bytes;
+	unsigned int max_slots;
+	size_t bytes;
+
+	unsigned int slot_mask;
+	unsigned int n_slots;
+	struct message_slot **slots;
+
+	unsigned int sender_mask;
+	unsigned int n_senders;
+	struct sender **senders;
+
+	struct message_slot *oldest, *newest;
+	struct reassembly_stats stats;
+
+	struct fec_estimator *fec; /* told how many parts each message lost */
+	struct link_table *links; /* and so is this, for each sender */
+};
+
+struct reassembly *
+reassembly_new(unsigned int timeout, size_t max_bytes,
+	size_t max_sender_bytes, unsigned int max_slots);
+
+void
+reassembly_free(struct reassembly *r);
+
+int
+reassembly_add(struct reassembly *r, const struct windbag_packet *packet,
+	struct windbag_packet *complete);
+
+struct message_slot *
+reassembly_find(struct reassembly *r, uint64_t source, uint32_t timestamp);
+
+void
+reassembly_expire(struct reassembly *r, time_t now);
+
+#endif
@@ -0,0 +1,352 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <sodium.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "callsign.h"
+#include "endian.h"
+#include "repair.h"
+#include "util.h"
+
+#define REPAIR_DELAY 3 /* seconds of silence before a message is stalled */
+#define REPAIR_JITTER 3 /* so receivers do not all ask at once */
+#define REPAIR_INTERVAL 10
+#define REPAIR_MAX_TRIES 3
+#define REPAIR_MIN_GAP 2 /* between any two requests we send */
+#define REPAIR_HOLDOFF 10 /* between resends of the same packet */
+
+#define ENTRY_HEADER_LENGTH 5
+
+struct repair *
+repair_new(unsigned int capacity, unsigned int ttl)
+{
+	struct repair *repair = calloc(1, sizeof (struct repair));
+	if (!repair)
+		return NULL;
+
+	repair->entries = calloc(capacity, sizeof (struct repair_entry));
+	if (!repair->entries || pthread_mutex_init(&repair->lock, NULL))
+	{
+		free(repair->entries);
+		free(repair);
+		return NULL;
+	}
+
+	repair->capacity = capacity;
+	repair->ttl = ttl;
+	return repair;
+}
+
+void
+repair_free(struct repair *repair)
+{
+	pthread_mutex_destroy(&repair->lock);
+	free(repair->entries);
+	free(repair);
+}
+
+void
+repair_remember(struct repair *repair, uint32_t timestamp, unsigned int index,
+	int parity, const struct ax25_packet *packet)
+{
+	struct repair_entry *entry;
+
+	pthread_mutex_lock(&repair->lock);
+
+	entry = repair->entries + repair->next;
+	repair->next = (repair->next + 1) % repair->capacity;
+
+	entry->timestamp = timestamp;
+	entry->index = index;
+	entry->parity = parity;
+	entry->sent = time(NULL);
+	entry->resent = 0;
+	memcpy(&entry->packet, packet, sizeof entry->packet);
+
+	pthread_mutex_unlock(&repair->lock);
+}
+
+static struct repair_entry *
+find_entry(struct repair *repair, uint32_t timestamp, unsigned int index,
+	time_t now)
+{
+	unsigned int i;
+
+	for (i = 0; i < repair->capacity; ++i)
+	{
+		struct repair_entry *entry = repair->entries + i;
+
+		if (entry->sent && entry->timestamp == timestamp
+			&& entry->index == index && !entry->parity
+			&& entry->sent + repair->ttl > now)
+			return entry;
+	}
+
+	return NULL;
+}
+
+/*
+ * Walks the entries of a NACK, each a timestamp, a count, and that many
+ * part indices, calling `visit` on each until it returns nonzero.
+ */
+static void
+walk_nack(const struct windbag_packet *nack,
+	int (*visit)(void *arg, uint32_t timestamp, const uint8_t *indices,
+		unsigned int n_indices),
+	void *arg)
+{
+	const uint8_t *p = nack->payload->data + 1;
+	const uint8_t *end = nack->payload->data + nack->payload->length;
+
+	if (nack->payload->length < 1
+		|| nack->payload->data[0] != WINDBAG_CONTROL_NACK)
+		return;
+
+	while (end - p >= ENTRY_HEADER_LENGTH)
+	{
+		uint32_t timestamp;
+		unsigned int n;
+
+		memcpy(&timestamp, p, sizeof timestamp);
+		n = p[4];
+		p += ENTRY_HEADER_LENGTH;
+
+		if ((unsigned int) (end - p) < n)
+			break;
+
+		if (visit(arg, le32toh(timestamp), p, n))
+			break;
+
+		p += n;
+	}
+}
+
+struct answer
+{
+	struct repair *repair;
+	const struct ax25_io *io;
+	time_t now;
+	int resent;
+};
+
+static int
+answer_entry(void *arg, uint32_t timestamp, const uint8_t *indices,
+	unsigned int n_indices)
+{
+	struct answer *a = arg;
+	struct repair *repair = a->repair;
+	unsigned int i;
+
+	for (i = 0; i < n_indices; ++i)
+	{
+		struct repair_entry *entry;
+		struct ax25_packet packet;
+
+		pthread_mutex_lock(&repair->lock);
+
+		entry = find_entry(repair, timestamp, indices[i], a->now);
+		if (!entry)
+		{
+			pthread_mutex_unlock(&repair->lock);
+			continue;
+		}
+
+		/* another receiver probably asked for the same part */
+		if (entry->resent + REPAIR_HOLDOFF > a->now)
+		{
+			++repair->stats.resends_held;
+			pthread_mutex_unlock(&repair->lock);
+			continue;
+		}
+
+		entry->resent = a->now;
+		memcpy(&packet, &entry->packet, sizeof packet);
+		++repair->stats.packets_resent;
+		pthread_mutex_unlock(&repair->lock);
+
+		if (ax25_write_packet(a->io, &packet) < 0)
+			return 1;
+
+		++a->resent;
+	}
+
+	return 0;
+}
+
+/* resends the parts a NACK addressed to us asks for; returns how many */
+int
+repair_answer(struct repair *repair, const struct ax25_io *io,
+	const struct windbag_packet *nack)
+{
+	struct answer a;
+
+	a.repair = repair;
+	a.io = io;
+	a.now = time(NULL);
+	a.resent = 0;
+
+	pthread_mutex_lock(&repair->lock);
+	++repair->stats.requests_heard;
+	pthread_mutex_unlock(&repair->lock);
+
+	walk_nack(nack, answer_entry, &a);
+	return a.resent;
+}
+
+struct overheard
+{
+	struct repair *repair;
+	struct reassembly *r;
+	uint64_t source;
+	time_t now;
+};
+
+static int
+overheard_entry(void *arg, uint32_t timestamp, const uint8_t *indices,
+	unsigned int n_indices)
+{
+	struct overheard *o = arg;
+	struct message_slot *slot;
+
+	UNUSED(indices);
+	UNUSED(n_indices);
+
+	slot = reassembly_find(o->r, o->source, timestamp);
+	if (!slot || !slot->parts)
+		return 0;
+
+	/* the answer to their request will likely fill our gaps too */
+	slot->repair_after = o->now + REPAIR_INTERVAL;
+	++o->repair->stats.requests_suppressed;
+	return 0;
+}
+
+void
+repair_overheard(struct repair *repair, struct reassembly *r,
+	const struct windbag_packet *nack)
+{
+	struct overheard o;
+
+	o.repair = repair;
+	o.r = r;
+	o.source = callsign_pack(nack->header.dest_addr);
+	o.now = time(NULL);
+
+	pthread_mutex_lock(&repair->lock);
+	walk_nack(nack, overheard_entry, &o);
+	pthread_mutex_unlock(&repair->lock);
+}
+
+static int
+due(struct message_slot *slot, time_t now)
+{
+	if (!slot->parts || slot->repairs >= REPAIR_MAX_TRIES
+		|| slot->updated + REPAIR_DELAY > now)
+		return 0;
+
+	if (!slot->repair_after)
+		slot->repair_after = now + randombytes_uniform(REPAIR_JITTER + 1);
+
+	return slot->repair_after <= now;
+}
+
+/* appends a request for what `slot` still needs; returns the bytes used */
+static unsigned int
+add_entry(const struct message_slot *slot, uint8_t *buf,
+	unsigned int max_length)
+{
+	uint32_t timestamp = htole32(slot->timestamp);
+	unsigned int i, n = 0, needed;
+
+	/* with parity on hand, any of the missing parts will do */
+	needed = slot->final + 1 - slot->received;
+	if (needed > slot->parity_received)
+		needed -= slot->parity_received;
+	if (max_length < ENTRY_HEADER_LENGTH + needed)
+		return 0;
+
+	for (i = 0; i <= slot->final && n < needed; ++i)
+		if (!slot->parts[i])
+			buf[ENTRY_HEADER_LENGTH + n++] = i;
+
+	memcpy(buf, &timestamp, sizeof timestamp);
+	buf[4] = n;
+	return ENTRY_HEADER_LENGTH + n;
+}
+
+/*
+ * Builds a NACK for the stalled messages of one sender, if any are due,
+ * setting the header's destination to that sender. Returns its length.
+ */
+unsigned int
+repair_request(struct repair *repair, struct reassembly *r, time_t now,
+	struct ax25_header *header, uint8_t *buf, unsigned int max_length)
+{
+	struct message_slot *slot, *first = NULL;
+	unsigned int length = 1;
+
+	if (repair->last_request + REPAIR_MIN_GAP > now || max_length < 1)
+		return 0;
+
+	for (slot = r->oldest; slot && !first; slot = slot->age_next)
+		if (due(slot, now))
+			first = slot;
+
+	if (!first)
+		return 0;
+
+	buf[0] = WINDBAG_CONTROL_NACK;
+	for (slot = first; slot; slot = slot->age_next)
+	{
+		unsigned int used;
+
+		if (slot->source != first->source || !due(slot, now))
+			continue;
+
+		used = add_entry(slot, buf + length, max_length - length);
+		if (!used)
+			break;
+
+		length += used;
+		++slot->repairs;
+		slot->repair_after = now + (REPAIR_INTERVAL << slot->repairs);
+	}
+
+	if (length == 1)
+		return 0;
+
+	strcpy(header->dest_addr, first->header.src_addr);
+	repair->last_request = now;
+	++repair->stats.requests_sent;
+	return length;
+}
@@ -0,0 +1,105 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef WB_REPAIR_H
+#define WB_REPAIR_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "ax25.h"
+#include "reassembly.h"
+#include "windbag.h"
+
+#define REPAIR_CACHE_PACKETS 512
+#define REPAIR_CACHE_TTL 120
+
+struct repair_entry
+{
+	uint32_t timestamp;
+	unsigned int index;
+	int parity;
+	time_t sent;
+	time_t resent;
+	struct ax25_packet packet;
+};
+
+struct repair_stats
+{
+	unsigned long requests_sent;
+	unsigned long requests_heard;
+	unsigned long requests_suppressed;
+	unsigned long packets_resent;
+	unsigned long resends_held;
+};
+
+/*
+ * Selective repair of multipart messages. Senders keep their recent
+ * multipart packets in a ring, so that a receiver missing parts can send a
+ * NACK naming them. Receivers wait a moment before asking, and hold off when
+ * they hear someone else ask for the same message; senders resend a packet
+ * at most once per holdoff, however many receivers ask for it.
+ */
+struct repair
+{
+	pthread_mutex_t lock;
+	unsigned int capacity;
+	unsigned int next;
+	unsigned int ttl;
+	struct repair_entry *entries;
+	time_t last_request;
+	struct repair_stats stats;
+};
+
+struct repair *
+repair_new(unsigned int capacity, unsigned int ttl);
+
+void
+repair_free(struct repair *repair);
+
+void
+repair_remember(struct repair *repair, uint32_t timestamp, unsigned int index,
+	int parity, const struct ax25_packet *packet);
+
+int
+repair_answer(struct repair *repair, const struct ax25_io *io,
+	const struct windbag_packet *nack);
+
+void
+repair_overheard(struct repair *repair, struct reassembly *r,
+	const struct windbag_packet *nack);
+
+unsigned int
+repair_request(struct repair *repair, struct reassembly *r, time_t now,
+	struct ax25_header *header, uint8_t *buf, unsigned int max_length);
+
+#endif
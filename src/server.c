@@ -0,0 +1,612 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jsonout.h"
+#include "server.h"
+
+#define BACKLOG 16
+#define SEND_BATCH 64
+
+/* call with the lock held */
+static void
+release(struct server_frame *frame)
+{
+	if (--frame->refs == 0)
+		free(frame);
+}
+
+static void
+wake(struct server *server)
+{
+	char c = 0;
+
+	/* a full pipe will wake the thread just as well */
+	if (write(server->wake[1], &c, 1) < 0)
+		return;
+}
+
+/* call with the lock held */
+static int
+enqueue(struct server_client *client, struct server_frame *frame)
+{
+	if (client->dead || client->count == SERVER_CLIENT_QUEUE)
+		return 1;
+
+	client->queue[(client->head + client->count++)
+		% SERVER_CLIENT_QUEUE] = frame;
+	++frame->refs;
+	return 0;
+}
+
+static struct server_frame *
+new_frame(const uint8_t *data, unsigned int length)
+{
+	struct server_frame *frame;
+
+	frame = malloc(sizeof (struct server_frame) + length);
+	if (!frame)
+		return NULL;
+
+	frame->refs = 1; /* ours, until it is queued everywhere */
+	frame->length = length;
+	memcpy(frame->data, data, length);
+	return frame;
+}
+
+int
+server_publish(struct server *server, const struct windbag_packet *packet)
+{
+	struct server_client *client;
+	struct server_frame *frame;
+	struct timespec received;
+	int rc = 0;
+
+	clock_gettime(CLOCK_REALTIME, &received);
+
+	pthread_mutex_lock(&server->lock);
+
+	if (!server->clients)
+		goto end;
+
+	server->scratch->length = 0;
+	if (jsonout_format(server->scratch, packet, &received))
+	{
+		rc = ENOMEM;
+		goto end;
+	}
+
+	frame = new_frame(server->scratch->data, server->scratch->length);
+	if (!frame)
+	{
+		rc = ENOMEM;
+		goto end;
+	}
+
+	for (client = server->clients; client; client = client->next)
+	{
+		/* a client that cannot keep up is let go */
+		if (enqueue(client, frame) && !client->dead)
+		{
+			client->dead = 1;
+			++server->stats.dropped;
+		}
+	}
+
+	release(frame);
+	++server->stats.messages;
+	wake(server);
+
+end:
+	pthread_mutex_unlock(&server->lock);
+	return rc;
+}
+
+static void
+kill_client(struct server *server, struct server_client *client)
+{
+	pthread_mutex_lock(&server->lock);
+	client->dead = 1;
+	pthread_mutex_unlock(&server->lock);
+}
+
+/* queues something for one client alone */
+int
+server_reply(struct server *server, struct server_client *client,
+	const uint8_t *data, unsigned int length)
+{
+	struct server_frame *frame;
+	int rc = 0;
+
+	frame = new_frame(data, length);
+	if (!frame)
+		return ENOMEM;
+
+	pthread_mutex_lock(&server->lock);
+
+	if (enqueue(client, frame) && !client->dead)
+	{
+		client->dead = 1;
+		++server->stats.dropped;
+		rc = ENOBUFS;
+	}
+
+	release(frame);
+	wake(server);
+	pthread_mutex_unlock(&server->lock);
+	return rc;
+}
+
+/*
+ * Sends what the client has queued, as far as it will take it. Returns
+ * nonzero if it took it all.
+ */
+static int
+send_queue(struct server *server, struct server_client *client)
+{
+	int drained;
+
+	pthread_mutex_lock(&server->lock);
+
+	while (client->count && !client->dead)
+	{
+		struct iovec iov[SEND_BATCH];
+		struct msghdr msg;
+		unsigned int i;
+		ssize_t n;
+
+		/* many messages to a syscall, each straight from its frame */
+		for (i = 0; i < client->count && i < SEND_BATCH; ++i)
+		{
+			struct server_frame *frame = client->queue[
+				(client->head + i) % SERVER_CLIENT_QUEUE];
+
+			iov[i].iov_base = frame->data;
+			iov[i].iov_len = frame->length;
+		}
+
+		iov[0].iov_base = (uint8_t *) iov[0].iov_base + client->offset;
+		iov[0].iov_len -= client->offset;
+
+		memset(&msg, 0, sizeof msg);
+		msg.msg_iov = iov;
+		msg.msg_iovlen = i;
+
+		n = sendmsg(client->fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK
+				&& errno != EINTR)
+				client->dead = 1;
+			break;
+		}
+
+		while (n > 0)
+		{
+			struct server_frame *frame = client->queue[client->head];
+			unsigned int left = frame->length - client->offset;
+
+			if ((size_t) n < left)
+			{
+				client->offset += n;
+				break;
+			}
+
+			n -= left;
+			release(frame);
+			client->head = (client->head + 1) % SERVER_CLIENT_QUEUE;
+			--client->count;
+			client->offset = 0;
+		}
+	}
+
+	drained = !client->count && !client->dead;
+	pthread_mutex_unlock(&server->lock);
+	return drained;
+}
+
+/* reads what the client sent, passing on each whole line */
+static void
+receive(struct server *server, struct server_client *client)
+{
+	ssize_t n;
+
+	n = read(client->fd, client->line + client->line_length,
+		sizeof client->line - client->line_length);
+	if (n < 0)
+	{
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+			kill_client(server, client);
+		return;
+	}
+
+	/* a client may only listen, having nothing to say */
+	if (n == 0)
+	{
+		client->eof = 1;
+		return;
+	}
+
+	client->line_length += n;
+
+	for (;;)
+	{
+		char *end = memchr(client->line, '\n', client->line_length);
+		unsigned int length;
+
+		if (!end)
+			break;
+
+		length = end - client->line;
+		if (length && client->line[length - 1] == '\r')
+			--length;
+
+		if (length)
+			server->submit(server->arg, client, client->line,
+				length);
+
+		client->line_length -= end + 1 - client->line;
+		memmove(client->line, end + 1, client->line_length);
+	}
+
+	if (client->line_length == sizeof client->line)
+	{
+		fprintf(stderr, "Client sent a line too long; dropping it\n");
+		kill_client(server, client);
+	}
+}
+
+static void
+accept_client(struct server *server)
+{
+	struct server_client *client;
+	int fd;
+
+	fd = accept(server->listener, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	client = calloc(1, sizeof (struct server_client));
+	if (!client)
+	{
+		close(fd);
+		return;
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	client->fd = fd;
+
+	pthread_mutex_lock(&server->lock);
+	client->next = server->clients;
+	server->clients = client;
+	++server->n_clients;
+	++server->stats.clients;
+	pthread_mutex_unlock(&server->lock);
+}
+
+static void
+free_client(struct server_client *client)
+{
+	while (client->count)
+	{
+		release(client->queue[client->head]);
+		client->head = (client->head + 1) % SERVER_CLIENT_QUEUE;
+		--client->count;
+	}
+
+	close(client->fd);
+	free(client);
+}
+
+static void
+remove_dead(struct server *server)
+{
+	struct server_client **p, *gone = NULL;
+
+	pthread_mutex_lock(&server->lock);
+
+	for (p = &server->clients; *p;)
+	{
+		struct server_client *client = *p;
+
+		if (!client->dead)
+		{
+			p = &client->next;
+			continue;
+		}
+
+		*p = client->next;
+		--server->n_clients;
+		client->next = gone;
+		gone = client;
+	}
+
+	pthread_mutex_unlock(&server->lock);
+
+	while (gone)
+	{
+		struct server_client *client = gone;
+
+		gone = client->next;
+
+		/* the submitter may reply, so it is not called locked */
+		if (client->pending)
+			server->more(server->arg, client);
+
+		pthread_mutex_lock(&server->lock);
+		free_client(client);
+		pthread_mutex_unlock(&server->lock);
+	}
+}
+
+static void *
+run(void *arg)
+{
+	struct server *server = arg;
+	struct pollfd *pfds = NULL;
+	struct server_client **polled = NULL;
+	unsigned int size = 0;
+
+	while (!__atomic_load_n(&server->stopping, __ATOMIC_ACQUIRE))
+	{
+		struct server_client *client;
+		unsigned int i, n = 2;
+
+		pthread_mutex_lock(&server->lock);
+
+		if (server->n_clients + 2 > size)
+		{
+			unsigned int new_size = (server->n_clients + 2) * 2;
+			struct pollfd *p;
+			struct server_client **c;
+
+			p = realloc(pfds, new_size * sizeof *pfds);
+			if (p)
+				pfds = p;
+
+			c = realloc(polled, new_size * sizeof *polled);
+			if (c)
+				polled = c;
+
+			if (p && c)
+				size = new_size;
+			else if (size == 0)
+			{
+				pthread_mutex_unlock(&server->lock);
+				break;
+			}
+		}
+
+		pfds[0].fd = server->wake[0];
+		pfds[0].events = POLLIN;
+		pfds[1].fd = server->listener;
+		pfds[1].events = POLLIN;
+
+		for (client = server->clients; client && n < size;
+		     client = client->next)
+		{
+			pfds[n].fd = client->fd;
+			pfds[n].events = (client->eof ? 0 : POLLIN)
+				| (client->count || client->pending
+					? POLLOUT : 0);
+			polled[n++] = client;
+		}
+
+		pthread_mutex_unlock(&server->lock);
+
+		if (poll(pfds, n, -1) < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			break;
+		}
+
+		if (pfds[0].revents)
+		{
+			char buf[64];
+
+			while (read(server->wake[0], buf, sizeof buf) > 0)
+				;
+		}
+
+		if (pfds[1].revents & POLLIN)
+			accept_client(server);
+
+		for (i = 2; i < n; ++i)
+		{
+			if (pfds[i].revents & (POLLERR | POLLNVAL)
+				|| (polled[i]->eof && pfds[i].revents & POLLHUP))
+				kill_client(server, polled[i]);
+			else if (pfds[i].revents & (POLLIN | POLLHUP))
+				receive(server, polled[i]);
+
+			/* what is pending is sent as it drains, not at once */
+			if (pfds[i].revents & POLLOUT
+				&& send_queue(server, polled[i])
+				&& polled[i]->pending)
+				server->more(server->arg, polled[i]);
+		}
+
+		remove_dead(server);
+	}
+
+	free(pfds);
+	free(polled);
+	return NULL;
+}
+
+/* binds the socket, taking it over if no one is listening there now */
+static int
+listen_at(const char *path)
+{
+	struct sockaddr_un addr;
+	int fd;
+
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, path, sizeof addr.sun_path - 1);
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof addr) < 0)
+	{
+		int probe;
+
+		if (errno != EADDRINUSE)
+			goto fail;
+
+		probe = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (probe < 0)
+			goto fail;
+
+		if (connect(probe, (struct sockaddr *) &addr, sizeof addr) == 0)
+		{
+			close(probe);
+			errno = EADDRINUSE;
+			goto fail;
+		}
+
+		close(probe);
+
+		/* left behind by a daemon that is gone */
+		if (unlink(path) < 0
+			|| bind(fd, (struct sockaddr *) &addr, sizeof addr) < 0)
+			goto fail;
+	}
+
+	/* only its owner may use the station */
+	if (chmod(path, S_IRUSR | S_IWUSR) < 0 || listen(fd, BACKLOG) < 0)
+		goto fail;
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	return fd;
+
+fail:
+	close(fd);
+	return -1;
+}
+
+struct server *
+server_new(const char *path, server_submit submit, server_more more,
+	void *arg)
+{
+	struct server *server;
+
+	if (strlen(path) >= sizeof server->path)
+	{
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
+
+	server = calloc(1, sizeof (struct server));
+	if (!server)
+		return NULL;
+
+	strcpy(server->path, path);
+	server->submit = submit;
+	server->more = more;
+	server->arg = arg;
+
+	server->scratch = bigbuffer_new(AX25_INFO_MAX * 8);
+	if (!server->scratch)
+		goto fail1;
+
+	if (pthread_mutex_init(&server->lock, NULL))
+		goto fail2;
+
+	if (pipe(server->wake))
+		goto fail3;
+
+	fcntl(server->wake[0], F_SETFL, O_NONBLOCK);
+	fcntl(server->wake[1], F_SETFL, O_NONBLOCK);
+
+	server->listener = listen_at(path);
+	if (server->listener < 0)
+		goto fail4;
+
+	if (pthread_create(&server->thread, NULL, run, server))
+		goto fail5;
+
+	return server;
+
+fail5:
+	close(server->listener);
+	unlink(path);
+fail4:
+	close(server->wake[0]);
+	close(server->wake[1]);
+fail3:
+	pthread_mutex_destroy(&server->lock);
+fail2:
+	bigbuffer_free(server->scratch);
+fail1:
+	free(server);
+	return NULL;
+}
+
+void
+server_free(struct server *server)
+{
+	struct server_client *client;
+
+	__atomic_store_n(&server->stopping, 1, __ATOMIC_RELEASE);
+	wake(server);
+	pthread_join(server->thread, NULL);
+
+	for (client = server->clients; client; client = client->next)
+		client->dead = 1;
+
+	remove_dead(server);
+
+	close(server->listener);
+	unlink(server->path);
+	close(server->wake[0]);
+	close(server->wake[1]);
+	pthread_mutex_destroy(&server->lock);
+	bigbuffer_free(server->scratch);
+	free(server);
+}
@@ -0,0 +1,124 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef WB_SERVER_H
+#define WB_SERVER_H
+
+#include <pthread.h>
+#include <sys/un.h>
+
+#include "bigbuffer.h"
+#include "windbag.h"
+
+#define SERVER_SOCKET_NAME "windbag.sock"
+#define SERVER_CLIENT_QUEUE 1024 /* messages a client may fall behind */
+#define SERVER_LINE_MAX 2048
+
+/* a message as sent to clients, shared by all of them */
+struct server_frame
+{
+	unsigned int refs;
+	unsigned int length;
+	uint8_t data[];
+};
+
+struct server_client
+{
+	int fd;
+	int dead;
+	int eof; /* it will send nothing more */
+	struct server_frame *queue[SERVER_CLIENT_QUEUE];
+	unsigned int head;
+	unsigned int count;
+	unsigned int offset; /* into the frame at the head */
+	void *pending; /* the submitter's, while it has more to send */
+	char line[SERVER_LINE_MAX];
+	unsigned int line_length;
+	struct server_client *next;
+};
+
+/* takes a line a client sent: a message to transmit, or a command */
+typedef void (*server_submit)(void *arg, struct server_client *client,
+			const char *line, unsigned int length);
+
+/*
+ * Sends more to a client that has something pending, once it has taken
+ * all that was queued; or, if the client is dead, lets go of what was
+ * pending. Either way, it clears `pending` when there is no more.
+ */
+typedef void (*server_more)(void *arg, struct server_client *client);
+
+struct server_stats
+{
+	unsigned long clients;
+	unsigned long messages;
+	unsigned long dropped; /* clients that fell too far behind */
+};
+
+/*
+ * Serves local clients over a Unix domain socket. Each message heard is
+ * formatted once, as a line of JSON, and queued by reference to every
+ * client; each line a client sends is handed to `submit`, and a client
+ * with something pending to `more` as it drains, from the server's own
+ * thread.
+ */
+struct server
+{
+	pthread_mutex_t lock; /* guards the clients' queues */
+	pthread_t thread;
+	int listener;
+	int wake[2];
+	int stopping;
+	char path[sizeof ((struct sockaddr_un *) 0)->sun_path];
+	struct server_client *clients;
+	unsigned int n_clients;
+	struct bigbuffer *scratch;
+	server_submit submit;
+	server_more more;
+	void *arg;
+	struct server_stats stats;
+};
+
+struct server *
+server_new(const char *path, server_submit submit, server_more more,
+	void *arg);
+
+void
+server_free(struct server *server);
+
+int
+server_publish(struct server *server, const struct windbag_packet *packet);
+
+int
+server_reply(struct server *server, struct server_client *client,
+	const uint8_t *data, unsigned int length);
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "callsign.h"
+#include "sigcache.h"
+
+/*
+ * The cache is a set-associative table: a source may live in any of the
+ * PROBE_LENGTH slots following its home slot. When those are all taken, the
+ * entry closest to expiry is replaced, so there is never any need for
+ * tombstones or rehashing.
+ */
+#define PROBE_LENGTH 8
+
+struct sig_cache *
+sig_cache_new(unsigned int capacity, unsigned int ttl,
+		unsigned int no_match_ttl)
+{
+	struct sig_cache *cache;
+	unsigned int size = PROBE_LENGTH;
+
+	while (size < capacity)
+		size <<= 1;
+
+	cache = malloc(sizeof (struct sig_cache));
+	if (!cache)
+		return NULL;
+
+	cache->entries = calloc(size, sizeof (struct sig_cache_entry));
+	if (!cache->entries)
+	{
+		free(cache);
+		return NULL;
+	}
+
+	cache->mask = size - 1;
+	cache->ttl = ttl;
+	cache->no_match_ttl = no_match_ttl;
+	return cache;
+}
+
+void
+sig_cache_free(struct sig_cache *cache)
+{
+	free(cache->entries);
+	free(cache);
+}
+
+static struct sig_cache_entry *
+find(struct sig_cache *cache, uint64_t source, time_t now)
+{
+	unsigned int i, home = callsign_hash(source);
+
+	for (i = 0; i < PROBE_LENGTH; ++i)
+	{
+		struct sig_cache_entry *entry;
+
+		entry = cache->entries + ((home + i) & cache->mask);
+		if (entry->result != SIG_CACHE_MISS && entry->source == source)
+		{
+			if (entry->expires <= now)
+			{
+				entry->result = SIG_CACHE_MISS;
+				return NULL;
+			}
+
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+static struct sig_cache_entry *
+claim(struct sig_cache *cache, uint64_t source, time_t now, unsigned int ttl)
+{
+	struct sig_cache_entry *victim;
+	unsigned int i, home = callsign_hash(source);
+
+	victim = find(cache, source, now);
+	if (victim)
+		goto found;
+
+	for (i = 0; i < PROBE_LENGTH; ++i)
+	{
+		struct sig_cache_entry *entry;
+
+		entry = cache->entries + ((home + i) & cache->mask);
+		if (entry->result == SIG_CACHE_MISS || entry->expires <= now)
+		{
+			victim = entry;
+			break;
+		}
+
+		if (!victim || entry->expires < victim->expires)
+			victim = entry;
+	}
+
+found:
+	victim->source = source;
+	victim->expires = now + ttl;
+	return victim;
+}
+
+enum sig_cache_result
+sig_cache_lookup(struct sig_cache *cache, const char *source,
+		unsigned long generation, char *callsign)
+{
+	struct sig_cache_entry *entry;
+
+	entry = find(cache, callsign_pack(source), time(NULL));
+	if (!entry)
+		return SIG_CACHE_MISS;
+
+	if (entry->result == SIG_CACHE_NO_MATCH)
+	{
+		/* a new key may have been imported for this sender */
+		if (entry->generation != generation)
+		{
+			entry->result = SIG_CACHE_MISS;
+			return SIG_CACHE_MISS;
+		}
+	}
+	else
+	{
+		strcpy(callsign, entry->callsign);
+	}
+
+	return entry->result;
+}
+
+void
+sig_cache_set_identity(struct sig_cache *cache, const char *source,
+		const char *callsign)
+{
+	struct sig_cache_entry *entry;
+
+	entry = claim(cache, callsign_pack(source), time(NULL), cache->ttl);
+	entry->result = SIG_CACHE_IDENTITY;
+	strcpy(entry->callsign, callsign);
+}
+
+/*
+ * Notes that nothing in the keyring matched the source's last signature.
+ * Anyone can send under any source, so one bad signature does not undo an
+ * identity already learned, and the note is kept only briefly.
+ */
+void
+sig_cache_set_no_match(struct sig_cache *cache, const char *source,
+		unsigned long generation)
+{
+	struct sig_cache_entry *entry;
+	uint64_t packed = callsign_pack(source);
+	time_t now = time(NULL);
+
+	entry = find(cache, packed, now);
+	if (entry && entry->result == SIG_CACHE_IDENTITY)
+		return;
+
+	entry = claim(cache, packed, now, cache->no_match_ttl);
+	entry->result = SIG_CACHE_NO_MATCH;
+	entry->generation = generation;
+}
+
+void
+sig_cache_forget(struct sig_cache *cache, const char *source)
+{
+	struct sig_cache_entry *entry;
+
+	entry = find(cache, callsign_pack(source), time(NULL));
+	if (entry)
+		entry->result = SIG_CACHE_MISS;
+}
@@ -0,0 +1,89 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef WB_SIGCACHE_H
+#define WB_SIGCACHE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "ax25.h"
+
+#define SIG_CACHE_TTL 3600
+#define SIG_CACHE_NO_MATCH_TTL 300
+
+enum sig_cache_result
+{
+	SIG_CACHE_MISS,
+	SIG_CACHE_IDENTITY,
+	SIG_CACHE_NO_MATCH
+};
+
+struct sig_cache_entry
+{
+	uint64_t source;
+	time_t expires;
+	unsigned long generation;
+	enum sig_cache_result result;
+	char callsign[AX25_ADDR_MAX];
+};
+
+struct sig_cache
+{
+	unsigned int mask;
+	unsigned int ttl;
+	unsigned int no_match_ttl;
+	struct sig_cache_entry *entries;
+};
+
+struct sig_cache *
+sig_cache_new(unsigned int capacity, unsigned int ttl,
+		unsigned int no_match_ttl);
+
+void
+sig_cache_free(struct sig_cache *cache);
+
+enum sig_cache_result
+sig_cache_lookup(struct sig_cache *cache, const char *source,
+		unsigned long generation, char *callsign);
+
+void
+sig_cache_set_identity(struct sig_cache *cache, const char *source,
+		const char *callsign);
+
+void
+sig_cache_set_no_match(struct sig_cache *cache, const char *source,
+		unsigned long generation);
+
+void
+sig_cache_forget(struct sig_cache *cache, const char *source);
+
+#endif
@@ -31,16 +31,222 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
 #include "tnc2.h"
+#include "util.h"
+
+#define PROMPT "cmd:"
+#define FEND 0xC0
+
+#define REPLY_MAX 256
+#define PROMPT_MS 250 /* for a TNC in command mode to answer a return */
+#define POWER_ON_MS 1000 /* for a TNC just switched on to prompt */
+#define COMMAND_MS 1000
+#define REBOOT_MS 2000 /* the least a restart is given to take */
+#define SETTLE_MS 250 /* of silence that ends the banner after a restart */
+#define RESTART_MS 5000
+
+struct reply
+{
+	char text[REPLY_MAX + 1];
+	size_t length;
+	int kiss; /* a frame was heard, so the TNC is in KISS mode already */
+};
+
+/* whether the TNC's output so far ends with its prompt */
+static int
+prompted(const struct reply *reply)
+{
+	size_t n = reply->length;
+
+	while (n && (reply->text[n - 1] == ' ' || reply->text[n - 1] == '\r'
+			|| reply->text[n - 1] == '\n'))
+		--n;
+
+	return n >= strlen(PROMPT)
+		&& memcmp(reply->text + n - strlen(PROMPT), PROMPT,
+			strlen(PROMPT)) == 0;
+}
+
+/*
+ * Waits up to `timeout_ms` for the TNC to say something, and adds it to the
+ * reply. Returns 0, ETIMEDOUT if it said nothing, or an error.
+ */
+static int
+take_reply(int fd, unsigned int timeout_ms, struct reply *reply)
+{
+	struct pollfd pfd;
+	ssize_t n;
+	int rc;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	rc = poll(&pfd, 1, timeout_ms);
+	if (rc < 0)
+		return errno == EINTR ? 0 : errno;
+
+	if (rc == 0)
+		return ETIMEDOUT;
+
+	/* keep the end, where the prompt is */
+	if (reply->length == REPLY_MAX)
+	{
+		memmove(reply->text, reply->text + REPLY_MAX / 2,
+			REPLY_MAX / 2);
+		reply->length = REPLY_MAX / 2;
+	}
+
+	n = read(fd, reply->text + reply->length, REPLY_MAX - reply->length);
+	if (n < 0)
+		return errno == EINTR || errno == EAGAIN ? 0 : errno;
+
+	if (memchr(reply->text + reply->length, FEND, n))
+		reply->kiss = 1;
+
+	reply->length += n;
+	reply->text[reply->length] = '\0';
+	return 0;
+}
+
+/* reads what the TNC says until it prompts for a command */
+static int
+expect_prompt(int fd, unsigned int timeout_ms, struct reply *reply)
+{
+	uint64_t deadline = monotonic_ms() + timeout_ms;
+
+	reply->length = 0;
+	reply->text[0] = '\0';
+
+	for (;;)
+	{
+		uint64_t now = monotonic_ms();
+		int rc;
+
+		if (now >= deadline)
+			return ETIMEDOUT;
+
+		rc = take_reply(fd, deadline - now, reply);
+		if (rc == ETIMEDOUT)
+			continue;
+		else if (rc)
+			return rc;
+
+		if (reply->kiss)
+			return EPROTO;
+
+		if (prompted(reply))
+			return 0;
+	}
+}
+
+/*
+ * Waits out a restart: never for less than a TNC takes to reboot, then
+ * until it has finished any banner. Returns EPROTO if it came back
+ * prompting for commands, so KISS mode did not take.
+ */
+static int
+await_restart(int fd)
+{
+	uint64_t start = monotonic_ms(), heard = start;
+	struct reply reply;
+
+	reply.length = 0;
+	reply.text[0] = '\0';
+	reply.kiss = 0;
+
+	for (;;)
+	{
+		uint64_t now = monotonic_ms();
+		uint64_t until = heard + SETTLE_MS;
+		int rc;
+
+		if (until < start + REBOOT_MS)
+			until = start + REBOOT_MS;
+
+		if (now >= until || now >= start + RESTART_MS)
+			break;
+
+		rc = take_reply(fd, until - now, &reply);
+		if (!rc)
+			heard = monotonic_ms();
+		else if (rc != ETIMEDOUT)
+			return rc;
+	}
+
+	return prompted(&reply) ? EPROTO : 0;
+}
+
+/*
+ * Sends the setup commands without waiting for answers, as for a TNC that
+ * never answered, then gives it as long to restart as ever it needed.
+ */
+static void
+setup_blind(int fd, const char *hbaud)
+{
+	if (hbaud)
+		dprintf(fd, "HBAUD %s\r", hbaud);
+
+	dprintf(fd, "KISS ON\rRESTART\r\n");
+	tcdrain(fd);
+	sleep(REBOOT_MS / 1000);
+}
+
+static int
+command(int fd, const char *cmd)
+{
+	struct reply reply;
+	int rc;
+
+	dprintf(fd, "%s\r", cmd);
+
+	reply.kiss = 0;
+	rc = expect_prompt(fd, COMMAND_MS, &reply);
+	if (rc == ETIMEDOUT)
+		fprintf(stderr, "TNC did not answer \"%s\"\n", cmd);
+	else if (!rc && strchr(reply.text, '?'))
+		fprintf(stderr, "TNC rejected \"%s\"\n", cmd);
+
+	return rc;
+}
+
+/*
+ * Finds out what mode the TNC is in: 0 if it is taking commands, EPROTO if
+ * it is in KISS mode, ENODATA if it stayed silent, which only a TNC in KISS
+ * mode does, or ETIMEDOUT if it said something but never prompted.
+ */
+static int
+find_mode(int fd)
+{
+	struct reply reply;
+	int rc;
+
+	reply.kiss = 0;
+
+	dprintf(fd, "\r");
+	rc = expect_prompt(fd, PROMPT_MS, &reply);
+	if (rc != ETIMEDOUT)
+		return rc;
+
+	/*
+	 * A Kenwood radio's TNC may be switched off; this turns it on, and
+	 * either it or the radio answers. A TNC in KISS mode ignores it.
+	 */
+	dprintf(fd, "TC 1\rTN 2,1\r");
+	rc = expect_prompt(fd, POWER_ON_MS, &reply);
+	if (rc == ETIMEDOUT && reply.length == 0)
+		return ENODATA;
+
+	return rc;
+}
 
 int
 tnc2_init(const char *path, speed_t speed, const char *hbaud)
 {
-	int fd;
+	int fd, rc;
 	struct termios tty;
 
 	fd = open(path, O_RDWR | O_NOCTTY | O_SYNC);
@@ -64,9 +270,9 @@ tnc2_init(const char *path, speed_t speed, const char *hbaud)
 	tty.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
 	tty.c_oflag &= ~OPOST;
 
-	/* fetch bytes as they become available */
-	tty.c_cc[VMIN] = 1;
-	tty.c_cc[VTIME] = 5;
+	/* reads return what there is; poll does the waiting */
+	tty.c_cc[VMIN] = 0;
+	tty.c_cc[VTIME] = 0;
 
 	if (tcsetattr(fd, TCSANOW, &tty) != 0)
 	{
@@ -75,15 +281,55 @@ tnc2_init(const char *path, speed_t speed, const char *hbaud)
 		return -1;
 	}
 
-	dprintf(fd, "TC 1\rTN 2,1\r\n"); /* turn on Kenwood radio TNC */
-	sleep(1);
+	tcflush(fd, TCIFLUSH);
+
+	rc = find_mode(fd);
+	if (rc == EPROTO || rc == ENODATA)
+	{
+		rc = 0; /* already in KISS mode */
+		goto end;
+	}
+	else if (rc == ETIMEDOUT)
+	{
+		/* whatever it is, it may yet take the commands */
+		fprintf(stderr, "No prompt from the TNC on %s; "
+			"sending the setup commands blind.\n", path);
+		setup_blind(fd, hbaud);
+		rc = 0;
+		goto end;
+	}
+	else if (rc)
+	{
+		fprintf(stderr, "Error reading from %s: %s\n", path,
+			strerror(rc));
+		goto end;
+	}
 
 	if (hbaud)
-		dprintf(fd, "HBAUD %s\r", hbaud);
+	{
+		char buf[sizeof "HBAUD " + 16];
 
-	dprintf(fd, "KISS ON\rRESTART\r\n");
-	sleep(2);
+		snprintf(buf, sizeof buf, "HBAUD %s", hbaud);
+		command(fd, buf);
+	}
+
+	command(fd, "KISS ON");
 
+	dprintf(fd, "RESTART\r");
+	tcdrain(fd);
+	rc = await_restart(fd);
+	if (rc == EPROTO)
+	{
+		fprintf(stderr, "The TNC on %s is still taking commands; "
+			"it did not switch to KISS mode.\n", path);
+	}
+	else if (rc)
+	{
+		fprintf(stderr, "Error reading from %s: %s\n", path,
+			strerror(rc));
+	}
+
+end:
 	close(fd);
-	return 0;
+	return rc;
 }
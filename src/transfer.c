@@ -0,0 +1,1069 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "airtime.h"
+#include "ax25link.h"
+#include "callsign.h"
+#include "csma.h"
+#include "endian.h"
+#include "keygen.h"
+#include "keyring.h"
+#include "kiss.h"
+#include "transfer.h"
+#include "txqueue.h"
+#include "util.h"
+#include "windbag.h"
+
+/* the control type, then the fragment size every part but the last has */
+#define FRAGMENT_HEADER_LENGTH 3
+
+#define PROGRESS_STEPS 20
+
+/* how far the sender may get ahead of the transmit queue */
+#define QUEUE_AHEAD_BYTES (4 * AX25_FRAME_MAX)
+
+/* how often a link is checked on while waiting for it */
+#define LINK_POLL_MS 100
+
+static volatile sig_atomic_t interrupted = 0;
+
+static void
+interrupt(int sig)
+{
+	UNUSED(sig);
+	interrupted = 1;
+}
+
+/* what the link has delivered, waiting to be read as a UI frame */
+struct delivery
+{
+	struct delivery *next;
+	unsigned int length;
+	uint8_t data[AX25_INFO_MAX];
+};
+
+/* the TNC, and the layers a transfer reads and writes it through */
+struct radio
+{
+	struct io io;
+	KISS_TNC tnc;
+	struct ax25_io kiss_aio;
+	struct csma *csma;
+	struct tx_queue *tx;
+	struct tx_port port;
+	struct ax25_io queue_aio; /* submits each frame as it is written */
+	const struct ax25_io *aio; /* for reading */
+	struct ax25_io out; /* for the fragments of a file */
+	pthread_t listener;
+	int listening;
+
+	/* in connected mode, the link and what comes out of it */
+	struct ax25_link *link;
+	struct ax25_io link_aio;
+	pthread_t ticker;
+	int ticking;
+	pthread_mutex_t lock;
+	pthread_cond_t delivered;
+	struct delivery *head, *tail;
+	struct ax25_frame frame; /* the last delivery read */
+	int link_error;
+};
+
+static ssize_t
+queue_frame(void *arg, const struct ax25_frame *frame)
+{
+	struct radio *radio = arg;
+
+	if (radio->port.io.write_frame(radio->port.io.tnc, frame) < 0
+		|| tx_queue_submit(&radio->port))
+		return -1;
+
+	return frame->length;
+}
+
+/* keeps reading while we send, for channel access and for the link */
+static void *
+listen_radio(void *arg)
+{
+	struct radio *radio = arg;
+	struct ax25_frame *frame;
+	int state;
+
+	for (;;)
+	{
+		frame = radio->aio->read_frame(radio->aio->tnc);
+		if (!frame || !radio->link)
+			continue;
+
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+		ax25_link_receive(radio->link, frame, monotonic_ms());
+		pthread_setcancelstate(state, NULL);
+	}
+
+	return NULL;
+}
+
+static void *
+tick_link(void *arg)
+{
+	struct radio *radio = arg;
+	long wait;
+	int state;
+
+	for (;;)
+	{
+		wait = ax25_link_timeout(radio->link, monotonic_ms());
+		if (wait < 0 || wait > LINK_POLL_MS)
+			wait = LINK_POLL_MS;
+
+		poll(NULL, 0, wait);
+
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+		ax25_link_tick(radio->link, monotonic_ms());
+		pthread_setcancelstate(state, NULL);
+	}
+
+	return NULL;
+}
+
+static void
+close_radio(struct radio *radio)
+{
+	if (radio->listening)
+	{
+		pthread_cancel(radio->listener);
+		pthread_join(radio->listener, NULL);
+	}
+
+	if (radio->ticking)
+	{
+		pthread_cancel(radio->ticker);
+		pthread_join(radio->ticker, NULL);
+	}
+
+	if (radio->link)
+	{
+		while (radio->head)
+		{
+			struct delivery *next = radio->head->next;
+			free(radio->head);
+			radio->head = next;
+		}
+
+		ax25_link_free(radio->link);
+		pthread_cond_destroy(&radio->delivered);
+		pthread_mutex_destroy(&radio->lock);
+	}
+
+	if (radio->tx)
+		tx_queue_free(radio->tx);
+	if (radio->csma)
+		csma_free(radio->csma);
+}
+
+/*
+ * Opens the TNC with the same channel access and transmit queue as chat,
+ * so that a transfer keeps to its share of the airtime. What is written to
+ * radio->out goes out as `class` traffic.
+ */
+static int
+open_radio(const struct windbag_config *config, struct radio *radio,
+	enum tx_class class)
+{
+	struct airtime_params air;
+	unsigned int airtime[TX_CLASSES];
+
+	memset(radio, 0, sizeof *radio);
+
+	if (config->my_call[0] == '\0')
+	{
+		fprintf(stderr, "Set a call sign with -c\n");
+		return 1;
+	}
+
+	if (config->tty[0] == '\0')
+	{
+		fprintf(stderr, "Set the TNC device with -t\n");
+		return 1;
+	}
+
+	if (!kiss_init_serial(&radio->tnc, &radio->io, config->tty,
+			config->tty_speed))
+	{
+		fprintf(stderr, "Failed to set up TNC: %s\n", strerror(errno));
+		return 1;
+	}
+
+	radio->kiss_aio.read_frame = (ax25_frame_reader) kiss_read_frame;
+	radio->kiss_aio.write_frame = (ax25_frame_writer) kiss_write_frame;
+	radio->kiss_aio.tnc = (void *) &radio->tnc;
+	radio->kiss_aio.other_frame = NULL;
+	radio->aio = &radio->kiss_aio;
+
+	config_airtime(config, &air);
+	if (config->csma)
+	{
+		radio->csma = csma_new(radio->aio, config->persist,
+				config->slot_time_ms, &air);
+		if (!radio->csma)
+		{
+			fprintf(stderr, "Failed to set up channel access.\n");
+			return 1;
+		}
+
+		/* so the TNC does not defer a second time */
+		kiss_set_persistence(&radio->tnc, 255);
+		kiss_set_slot_time(&radio->tnc, 0);
+		radio->aio = &radio->csma->io;
+	}
+
+	config_airtime_shares(config, airtime);
+	radio->tx = tx_queue_new(radio->aio, &air, airtime);
+	if (!radio->tx)
+	{
+		fprintf(stderr, "Failed to set up the transmit queue.\n");
+		return 1;
+	}
+
+	tx_port_init(&radio->port, radio->tx, class);
+	radio->queue_aio.write_frame = queue_frame;
+	radio->queue_aio.tnc = radio;
+	radio->out = radio->queue_aio;
+	return 0;
+}
+
+static int
+start_listening(struct radio *radio)
+{
+	if (pthread_create(&radio->listener, NULL, listen_radio, radio))
+	{
+		fprintf(stderr, "Failed to start listening to the TNC\n");
+		return 1;
+	}
+
+	radio->listening = 1;
+	return 0;
+}
+
+static void
+link_state_changed(void *arg, enum ax25_link_state state, int error)
+{
+	struct radio *radio = arg;
+
+	pthread_mutex_lock(&radio->lock);
+	if (error)
+		radio->link_error = error;
+	pthread_cond_broadcast(&radio->delivered);
+	pthread_mutex_unlock(&radio->lock);
+
+	if (error)
+		fprintf(stderr, "Link to %s %s: %s\n",
+			radio->link->header.dest_addr,
+			ax25_link_state_name(state), strerror(error));
+}
+
+static void
+link_deliver(void *arg, const uint8_t *data, unsigned int length)
+{
+	struct radio *radio = arg;
+	struct delivery *delivery;
+
+	delivery = malloc(sizeof (struct delivery));
+	if (!delivery)
+	{
+		fprintf(stderr, "Not enough memory; fragment lost\n");
+		return;
+	}
+
+	delivery->next = NULL;
+	delivery->length = length;
+	memcpy(delivery->data, data, length);
+
+	pthread_mutex_lock(&radio->lock);
+	if (radio->tail)
+		radio->tail->next = delivery;
+	else
+		radio->head = delivery;
+
+	radio->tail = delivery;
+	pthread_cond_broadcast(&radio->delivered);
+	pthread_mutex_unlock(&radio->lock);
+}
+
+/*
+ * Hands over what the link delivered as the UI frame it would have been
+ * without the link, so that it is read like any other packet. Returns NULL
+ * if nothing came for a while, so the caller can check for an interrupt.
+ */
+static struct ax25_frame *
+read_delivery(void *arg)
+{
+	struct radio *radio = arg;
+	struct delivery *delivery;
+	struct ax25_header header;
+	struct timespec ts;
+
+	pthread_mutex_lock(&radio->lock);
+
+	if (!radio->head)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		ts.tv_nsec += LINK_POLL_MS * 1000000L;
+		if (ts.tv_nsec >= 1000000000L)
+		{
+			ts.tv_nsec -= 1000000000L;
+			++ts.tv_sec;
+		}
+
+		pthread_cond_timedwait(&radio->delivered, &radio->lock, &ts);
+	}
+
+	delivery = radio->head;
+	if (delivery)
+	{
+		radio->head = delivery->next;
+		if (!radio->head)
+			radio->tail = NULL;
+	}
+
+	pthread_mutex_unlock(&radio->lock);
+
+	if (!delivery)
+		return NULL;
+
+	memset(&header, 0, sizeof header);
+	strcpy(header.dest_addr, radio->link->header.src_addr);
+	strcpy(header.src_addr, radio->link->header.dest_addr);
+
+	radio->frame.length = ax25_encode_addresses(&header,
+				radio->frame.data, AX25_NO_CR);
+	radio->frame.data[radio->frame.length++] = 0x03;
+	radio->frame.data[radio->frame.length++] = AX25_PID_NO_L3;
+	memcpy(radio->frame.data + radio->frame.length, delivery->data,
+		delivery->length);
+	radio->frame.length += delivery->length;
+
+	free(delivery);
+	return &radio->frame;
+}
+
+static int
+link_error(struct radio *radio)
+{
+	int error;
+
+	pthread_mutex_lock(&radio->lock);
+	error = radio->link_error;
+	pthread_mutex_unlock(&radio->lock);
+	return error;
+}
+
+/* sends the information field of a UI frame over the link instead */
+static ssize_t
+send_over_link(void *arg, const struct ax25_frame *frame)
+{
+	struct radio *radio = arg;
+	struct ax25_header header;
+	int addr_len, rc;
+
+	addr_len = ax25_decode_addresses(frame, &header, NULL);
+	if (addr_len < 0 || addr_len + 2 > (int) frame->length)
+		return -1;
+
+	/* what was in flight when the link reset is gone */
+	if (link_error(radio))
+		return -1;
+
+	while ((rc = ax25_link_send(radio->link, frame->data + addr_len + 2,
+				frame->length - (addr_len + 2),
+				monotonic_ms())) == EAGAIN)
+		poll(NULL, 0, LINK_POLL_MS);
+
+	return rc ? -1 : (ssize_t) frame->length;
+}
+
+/*
+ * Sets up a connected link to `peer`, to be read from radio->link_aio, and
+ * sends what is written to radio->out over it. The link's own frames go
+ * through the transmit queue like any others.
+ */
+static int
+open_link(const struct windbag_config *config, struct radio *radio,
+	const char *peer, int listening)
+{
+	struct ax25_header header;
+	struct ax25_link_params params;
+	pthread_condattr_t attr;
+
+	memset(&header, 0, sizeof header);
+	strcpy(header.src_addr, config->my_call);
+	strncpy(header.dest_addr, peer, sizeof header.dest_addr - 1);
+	memcpy(header.digi_path, config->digi_path, sizeof header.digi_path);
+
+	config_link(config, &params);
+	radio->link = ax25_link_new(&radio->queue_aio, &header, &params);
+	if (!radio->link)
+	{
+		fprintf(stderr, "Failed to set up the link\n");
+		return 1;
+	}
+
+	pthread_mutex_init(&radio->lock, NULL);
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&radio->delivered, &attr);
+	pthread_condattr_destroy(&attr);
+
+	radio->link->on_data = link_deliver;
+	radio->link->on_state = link_state_changed;
+	radio->link->arg = radio;
+	ax25_link_listen(radio->link, listening);
+
+	radio->link_aio.read_frame = read_delivery;
+	radio->link_aio.tnc = radio;
+	radio->out.write_frame = send_over_link;
+	radio->out.tnc = radio;
+
+	if (start_listening(radio))
+		return 1;
+
+	if (pthread_create(&radio->ticker, NULL, tick_link, radio))
+	{
+		fprintf(stderr, "Failed to start the link's timers\n");
+		return 1;
+	}
+
+	radio->ticking = 1;
+	return 0;
+}
+
+/* waits while the link is in `state`; returns the state it moved to */
+static enum ax25_link_state
+wait_link(struct radio *radio, enum ax25_link_state state)
+{
+	enum ax25_link_state now;
+
+	while ((now = ax25_link_get_state(radio->link)) == state
+		&& !interrupted)
+		poll(NULL, 0, LINK_POLL_MS);
+
+	return now;
+}
+
+static int
+connect_link(struct radio *radio)
+{
+	fprintf(stderr, "Connecting to %s\n", radio->link->header.dest_addr);
+	ax25_link_connect(radio->link, monotonic_ms());
+
+	if (wait_link(radio, AX25_LINK_CONNECTING) != AX25_LINK_CONNECTED)
+	{
+		fprintf(stderr, "Could not connect to %s\n",
+			radio->link->header.dest_addr);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* waits for everything sent to be acknowledged, then hangs up */
+static int
+finish_link(struct radio *radio)
+{
+	enum ax25_link_state state;
+
+	while (ax25_link_unacked(radio->link) > 0)
+	{
+		state = ax25_link_get_state(radio->link);
+		if ((state != AX25_LINK_CONNECTED
+				&& state != AX25_LINK_TIMER_RECOVERY)
+			|| link_error(radio))
+			return 1;
+
+		poll(NULL, 0, LINK_POLL_MS);
+	}
+
+	ax25_link_disconnect(radio->link, monotonic_ms());
+	wait_link(radio, AX25_LINK_DISCONNECTING);
+	return 0;
+}
+
+/* gives the sender time to hear that we have it all, and to hang up */
+static void
+linger_link(struct radio *radio)
+{
+	uint64_t until = monotonic_ms() + radio->link->params.t1_ms * 3;
+
+	while (ax25_link_get_state(radio->link) != AX25_LINK_DISCONNECTED
+		&& monotonic_ms() < until && !interrupted)
+		poll(NULL, 0, LINK_POLL_MS);
+
+	tx_queue_drain(radio->tx);
+}
+
+static int
+progress_due(uint32_t done, uint32_t total)
+{
+	uint64_t step = ((uint64_t) total + PROGRESS_STEPS - 1) / PROGRESS_STEPS;
+	return done == total || done % step == 0;
+}
+
+/*
+ * Sends a file as one numbered fragment after another. Each fragment is a
+ * control packet with a wide multipart field, so there is no limit of 256
+ * parts, and a regular file is mapped rather than read into memory. In
+ * connected mode the same packets go over a link to DEST, which sees that
+ * every one of them arrives.
+ */
+int
+send_file(struct windbag_config *config, int argc, char **argv)
+{
+	struct radio radio;
+	struct ax25_header header;
+	struct airtime_params air;
+	struct stat st;
+	uint8_t fragment[AX25_INFO_MAX];
+	uint8_t addresses[AX25_HEADER_MAX];
+	const uint8_t *map = NULL;
+	unsigned int chunk;
+	uint64_t n_fragments, airtime;
+	uint32_t i, final, timestamp;
+	int fd, rc = 1;
+
+	memset(&radio, 0, sizeof radio);
+	if (argc < 1)
+	{
+		fprintf(stderr, "Usage: send-file FILE [DEST]\n");
+		return 1;
+	}
+
+	if (config->connected_mode && argc < 2)
+	{
+		fprintf(stderr, "Name the station to send to "
+			"over a connected link\n");
+		return 1;
+	}
+
+	fd = open(argv[0], O_RDONLY);
+	if (fd == -1)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", argv[0],
+			strerror(errno));
+		return 1;
+	}
+
+	if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode))
+	{
+		fprintf(stderr, "%s is not a regular file\n", argv[0]);
+		goto end;
+	}
+
+	if (config->sign_messages && load_keypair(config))
+		goto end;
+
+	chunk = windbag_fragment_max(config) - FRAGMENT_HEADER_LENGTH;
+	n_fragments = st.st_size ? ((uint64_t) st.st_size + chunk - 1) / chunk : 1;
+	if (n_fragments - 1 > UINT32_MAX)
+	{
+		fprintf(stderr, "%s is too big to send\n", argv[0]);
+		goto end;
+	}
+
+	final = n_fragments - 1;
+
+	/* reading it piece by piece still works if it cannot be mapped */
+	if (st.st_size > 0)
+	{
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map == MAP_FAILED)
+			map = NULL;
+		else
+			madvise((void *) map, st.st_size, MADV_SEQUENTIAL);
+	}
+
+	if (open_radio(config, &radio, TX_BULK))
+		goto end;
+
+	if (config->connected_mode)
+	{
+		if (open_link(config, &radio, argv[1], 0)
+			|| connect_link(&radio))
+			goto end;
+	}
+	else if (radio.csma && start_listening(&radio))
+	{
+		goto end;
+	}
+
+	memset(&header, 0, sizeof header);
+	strncpy(header.dest_addr, argc > 1 ? argv[1] : "CQ",
+		sizeof header.dest_addr - 1);
+	strcpy(header.src_addr, config->my_call);
+	memcpy(header.digi_path, config->digi_path, sizeof header.digi_path);
+
+	timestamp = (uint32_t) time(NULL);
+	fragment[0] = WINDBAG_CONTROL_FILE;
+	*((uint16_t *) &fragment[1]) = htole16(chunk);
+
+	/* every fragment but the last fills a frame, and they go back to back */
+	config_airtime(config, &air);
+	airtime = airtime_transmission_ms(&air, n_fragments
+		* airtime_estimate_us(air.baud, AX25_INFO_MAX + 2
+			+ ax25_encode_addresses(&header, addresses,
+				AX25_NO_CR)));
+
+	fprintf(stderr, "Sending %s: %llu bytes in %llu fragments, "
+		"about %llu:%02llu on the air\n", argv[0],
+		(unsigned long long) st.st_size,
+		(unsigned long long) n_fragments,
+		(unsigned long long) (airtime / 60000),
+		(unsigned long long) (airtime / 1000 % 60));
+
+	for (i = 0; ; ++i)
+	{
+		off_t offset = (off_t) i * chunk;
+		size_t length = (uint64_t) (st.st_size - offset) < chunk
+			? (size_t) (st.st_size - offset) : chunk;
+
+		if (map)
+		{
+			memcpy(fragment + FRAGMENT_HEADER_LENGTH, map + offset,
+				length);
+		}
+		else if (length > 0
+			&& pread(fd, fragment + FRAGMENT_HEADER_LENGTH, length,
+				offset) != (ssize_t) length)
+		{
+			fprintf(stderr, "Error reading %s: %s\n", argv[0],
+				strerror(errno));
+			goto end;
+		}
+
+		tx_queue_wait(radio.tx, QUEUE_AHEAD_BYTES);
+		if (windbag_send_fragment(config, &radio.out, &header,
+				timestamp, i, final, fragment,
+				length + FRAGMENT_HEADER_LENGTH) < 0)
+		{
+			fprintf(stderr, "Error sending fragment %lu\n",
+				(unsigned long) i);
+			goto end;
+		}
+
+		if (progress_due(i + 1, final + 1))
+			fprintf(stderr, "Sent %lu of %lu fragments\n",
+				(unsigned long) i + 1,
+				(unsigned long) final + 1);
+
+		if (i == final)
+			break;
+	}
+
+	if (radio.link && finish_link(&radio))
+	{
+		fprintf(stderr, "%s did not acknowledge everything\n",
+			radio.link->header.dest_addr);
+		goto end;
+	}
+
+	tx_queue_drain(radio.tx);
+	rc = 0;
+
+end:
+	close_radio(&radio);
+	if (map)
+		munmap((void *) map, st.st_size);
+	close(fd);
+	return rc;
+}
+
+struct transfer
+{
+	char source[AX25_ADDR_MAX];
+	uint32_t timestamp;
+	uint32_t final;
+	unsigned int chunk;
+	unsigned int last_length; /* of the final fragment, once received */
+	char signer[AX25_ADDR_MAX]; /* who signed the first fragment, if anyone */
+	uint8_t *received; /* a bit for each fragment */
+	uint32_t n_received;
+	unsigned long bad_signatures;
+	unsigned long unverified; /* ignored before the transfer started */
+	unsigned long too_big;
+};
+
+static int
+have(const struct transfer *t, uint32_t index)
+{
+	return t->received[index / 8] & (1 << (index % 8));
+}
+
+static void
+print_missing(const struct transfer *t)
+{
+	uint32_t i, start;
+	int first = 1;
+
+	fprintf(stderr, "Missing fragments:");
+
+	for (i = 0; i <= t->final; ++i)
+	{
+		if (have(t, i))
+			continue;
+
+		start = i;
+		while (i < t->final && !have(t, i + 1))
+			++i;
+
+		fprintf(stderr, "%s %lu", first ? "" : ",", (unsigned long) start);
+		if (i != start)
+			fprintf(stderr, "-%lu", (unsigned long) i);
+
+		first = 0;
+		if (i == t->final)
+			break;
+	}
+
+	fprintf(stderr, "\n");
+}
+
+static int
+load_keyring(struct windbag_config *config)
+{
+	int rc;
+
+	config->keyring = keyring_new();
+	if (!config->keyring)
+	{
+		fprintf(stderr, "Failed to make keyring.\n");
+		return 1;
+	}
+
+	if (config->keyring_path[0] == '\0')
+		return 0;
+
+	rc = keyring_load(config->keyring, config->keyring_path);
+	if (rc == -1)
+	{
+		fprintf(stderr, "Keyring file %s is corrupt.\n",
+			config->keyring_path);
+		return 1;
+	}
+	else if (rc && rc != ENOENT)
+	{
+		fprintf(stderr, "Error opening keyring %s: %s\n",
+			config->keyring_path, strerror(rc));
+		return 1;
+	}
+
+	return 0;
+}
+
+/* the identity whose key verified the packet, or NULL if none did */
+static const char *
+signer(const struct windbag_packet *packet)
+{
+	switch (packet->signature_status)
+	{
+	case GOOD_SIGNATURE:
+		return packet->header.src_addr;
+
+	case ALTERNATE_SIGNATURE:
+		return packet->verified_callsign;
+
+	default:
+		return NULL;
+	}
+}
+
+/*
+ * Returns 1 when the fragment belongs to the transfer, starting it if need
+ * be. Since anyone can send under any call sign, only a fragment with a
+ * good signature, or from the sender asked for, starts a transfer, and one
+ * started by a good signature takes only fragments signed by the same key.
+ */
+static int
+accept_fragment(struct transfer *t, const struct windbag_packet *packet,
+	const char *from, uint64_t max_size)
+{
+	const struct bigbuffer *payload = packet->payload;
+	const char *identity = signer(packet);
+	unsigned int chunk, length;
+
+	if (!packet->control || payload->length < FRAGMENT_HEADER_LENGTH
+		|| payload->data[0] != WINDBAG_CONTROL_FILE)
+		return 0;
+
+	if (from && callsign_pack(packet->header.src_addr)
+			!= callsign_pack(from))
+		return 0;
+
+	chunk = le16toh(*((uint16_t *) &payload->data[1]));
+	length = payload->length - FRAGMENT_HEADER_LENGTH;
+	if (chunk == 0 || packet->multipart_index > packet->multipart_final
+		|| length > chunk
+		|| (length != chunk
+			&& packet->multipart_index != packet->multipart_final))
+		return 0;
+
+	if (!t->received)
+	{
+		if (!from && !identity)
+		{
+			++t->unverified;
+			return 0;
+		}
+
+		/* the fragments before the last are all full */
+		if ((uint64_t) packet->multipart_final * chunk + length
+			> max_size)
+		{
+			++t->too_big;
+			return 0;
+		}
+
+		t->received = calloc(packet->multipart_final / 8 + 1, 1);
+		if (!t->received)
+			return -1;
+
+		strcpy(t->source, packet->header.src_addr);
+		t->timestamp = packet->timestamp;
+		t->final = packet->multipart_final;
+		t->chunk = chunk;
+		if (identity)
+			strcpy(t->signer, identity);
+
+		fprintf(stderr, "Receiving %lu fragments from %s\n",
+			(unsigned long) t->final + 1, t->source);
+		return 1;
+	}
+
+	if (strcmp(t->source, packet->header.src_addr) != 0
+		|| t->timestamp != packet->timestamp
+		|| t->final != packet->multipart_final || t->chunk != chunk)
+		return 0;
+
+	if (t->signer[0] != '\0'
+		&& (!identity || strcmp(identity, t->signer) != 0))
+	{
+		++t->bad_signatures;
+		return 0;
+	}
+
+	return 1;
+}
+
+/*
+ * Receives one file from send-file, writing each fragment to its place in
+ * the output as it arrives. Whatever has not arrived is left as a hole.
+ */
+int
+receive_file(struct windbag_config *config, int argc, char **argv)
+{
+	struct radio radio;
+	struct windbag_packet packet;
+	struct transfer t;
+	struct sigaction sa;
+	sigset_t signals;
+	const char *from;
+	int fd, rc = 1;
+
+	if (argc < 1)
+	{
+		fprintf(stderr, "Usage: receive-file OUTPUT [FROM]\n");
+		return 1;
+	}
+
+	if (config->connected_mode && argc < 2)
+	{
+		fprintf(stderr, "Name the station to receive from "
+			"over a connected link\n");
+		return 1;
+	}
+
+	from = argc > 1 ? argv[1] : NULL;
+	memset(&t, 0, sizeof t);
+	memset(&radio, 0, sizeof radio);
+
+	if (load_keyring(config))
+		goto end;
+
+	/*
+	 * Let a read be interrupted, so an incomplete transfer can be
+	 * reported; the threads the radio starts leave the signals to us.
+	 */
+	memset(&sa, 0, sizeof sa);
+	sa.sa_handler = interrupt;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGINT);
+	sigaddset(&signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	rc = open_radio(config, &radio, TX_CONTROL);
+	if (!rc && config->connected_mode)
+		rc = open_link(config, &radio, from, 1);
+
+	pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+	if (rc)
+		goto end;
+
+	rc = 1;
+	if (windbag_packet_init(&packet))
+		goto end;
+
+	fd = open(argv[0], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd == -1)
+	{
+		fprintf(stderr, "Error opening %s: %s\n", argv[0],
+			strerror(errno));
+		goto cleanup;
+	}
+
+	while (!interrupted && (!t.received || t.n_received <= t.final))
+	{
+		const struct bigbuffer *payload;
+		uint32_t index;
+		int accepted;
+
+		if (!windbag_read_packet(&packet, config,
+				radio.link ? &radio.link_aio : radio.aio))
+			continue;
+
+		accepted = accept_fragment(&t, &packet, from,
+				(uint64_t) config->max_file_size * 1024);
+		if (accepted < 0)
+		{
+			fprintf(stderr, "Not enough memory for %lu fragments\n",
+				(unsigned long) packet.multipart_final + 1);
+			goto done;
+		}
+
+		if (!accepted)
+			continue;
+
+		if (packet.signature_status == BAD_SIGNATURE)
+		{
+			++t.bad_signatures;
+			continue;
+		}
+
+		index = packet.multipart_index;
+		if (have(&t, index))
+			continue;
+
+		payload = packet.payload;
+		if (pwrite(fd, payload->data + FRAGMENT_HEADER_LENGTH,
+				payload->length - FRAGMENT_HEADER_LENGTH,
+				(off_t) index * t.chunk)
+			!= (ssize_t) (payload->length - FRAGMENT_HEADER_LENGTH))
+		{
+			fprintf(stderr, "Error writing %s: %s\n", argv[0],
+				strerror(errno));
+			goto done;
+		}
+
+		t.received[index / 8] |= 1 << (index % 8);
+		++t.n_received;
+		if (index == t.final)
+			t.last_length = payload->length - FRAGMENT_HEADER_LENGTH;
+
+		if (progress_due(t.n_received, t.final + 1))
+			fprintf(stderr, "Received %lu of %lu fragments\n",
+				(unsigned long) t.n_received,
+				(unsigned long) t.final + 1);
+	}
+
+	if (radio.link && t.received && t.n_received > t.final)
+		linger_link(&radio);
+
+	if (t.bad_signatures)
+		fprintf(stderr, "Dropped %lu fragments with bad signatures\n",
+			t.bad_signatures);
+
+	if (!t.received && t.unverified)
+		fprintf(stderr, "Ignored %lu fragments without a good "
+			"signature; name the sender to take them\n",
+			t.unverified);
+
+	if (!t.received && t.too_big)
+		fprintf(stderr, "Ignored %lu fragments of a file bigger than "
+			"max-file-size\n", t.too_big);
+
+	if (!t.received)
+	{
+		fprintf(stderr, "No file received\n");
+	}
+	else if (t.n_received <= t.final)
+	{
+		print_missing(&t);
+	}
+	else if (ftruncate(fd, (off_t) t.final * t.chunk + t.last_length))
+	{
+		fprintf(stderr, "Error writing %s: %s\n", argv[0],
+			strerror(errno));
+	}
+	else
+	{
+		fprintf(stderr, "Received %s from %s\n", argv[0], t.source);
+		rc = 0;
+	}
+
+done:
+	if (close(fd) == -1 && rc == 0)
+	{
+		fprintf(stderr, "Error writing %s: %s\n", argv[0],
+			strerror(errno));
+		rc = 1;
+	}
+cleanup:
+	windbag_packet_cleanup(&packet);
+end:
+	close_radio(&radio);
+	free(t.received);
+	if (config->keyring)
+		keyring_free(config->keyring);
+	return rc;
+}
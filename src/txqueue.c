@@ -0,0 +1,523 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "txqueue.h"
+#include "util.h"
+
+#define BURST_MS 10000 /* of airtime a class may save up */
+
+static const char * const CLASS_NAMES[TX_CLASSES] = {
+	"interactive",
+	"control",
+	"bulk",
+	"beacon"
+};
+
+static unsigned long
+frame_us(const struct tx_queue *queue, const struct ax25_frame *frame)
+{
+	return airtime_frame_us(queue->air.baud, frame->data, frame->length);
+}
+
+const char *
+tx_class_name(enum tx_class class)
+{
+	return class < TX_CLASSES ? CLASS_NAMES[class] : "unknown";
+}
+
+static void
+free_frames(struct tx_frame *frame)
+{
+	while (frame)
+	{
+		struct tx_frame *next = frame->next;
+		free(frame);
+		frame = next;
+	}
+}
+
+static int
+limited(const struct tx_bucket *bucket)
+{
+	return bucket->percent < 100;
+}
+
+static void
+refill(struct tx_queue *queue, uint64_t now)
+{
+	unsigned int i;
+	uint64_t elapsed = now - queue->refilled;
+
+	queue->refilled = now;
+
+	for (i = 0; i < TX_CLASSES; ++i)
+	{
+		struct tx_bucket *bucket = queue->classes + i;
+		double cap = BURST_MS * bucket->percent / 100.0;
+
+		if (!limited(bucket))
+			continue;
+
+		bucket->tokens += elapsed * bucket->percent / 100.0;
+		if (bucket->tokens > cap)
+			bucket->tokens = cap;
+	}
+}
+
+/*
+ * Picks the class to send from next, or returns -1 and sets *wait to the
+ * milliseconds until one has airtime again, or to -1 if nothing is queued.
+ */
+static int
+pick(const struct tx_queue *queue, long *wait)
+{
+	unsigned int i;
+
+	*wait = -1;
+
+	for (i = 0; i < TX_CLASSES; ++i)
+	{
+		const struct tx_bucket *bucket = queue->classes + i;
+		long until;
+
+		if (!bucket->flows)
+			continue;
+
+		if (!limited(bucket) || bucket->tokens > 0)
+			return i;
+
+		until = (long) (-bucket->tokens * 100 / bucket->percent) + 1;
+		if (*wait < 0 || until < *wait)
+			*wait = until;
+	}
+
+	return -1;
+}
+
+static struct tx_frame *
+pop(struct tx_bucket *bucket)
+{
+	struct tx_flow *flow = bucket->flows;
+	struct tx_frame *frame = flow->head;
+
+	flow->head = frame->next;
+	--flow->length;
+	flow->bytes -= frame->frame.length;
+
+	bucket->flows = flow->next;
+	if (!bucket->flows)
+		bucket->last = NULL;
+
+	/* the flow goes to the back of the line, if it has more to send */
+	if (flow->head)
+	{
+		flow->next = NULL;
+		if (bucket->last)
+			bucket->last->next = flow;
+		else
+			bucket->flows = flow;
+
+		bucket->last = flow;
+	}
+	else
+	{
+		free(flow);
+	}
+
+	return frame;
+}
+
+static void
+wait_until(struct tx_queue *queue, uint64_t when)
+{
+	struct timespec ts;
+
+	ts.tv_sec = when / 1000;
+	ts.tv_nsec = (when % 1000) * 1000000;
+	pthread_cond_timedwait(&queue->changed, &queue->lock, &ts);
+}
+
+static void *
+run(void *arg)
+{
+	struct tx_queue *queue = arg;
+
+	pthread_mutex_lock(&queue->lock);
+
+	while (!queue->stop)
+	{
+		struct tx_bucket *bucket;
+		struct tx_frame *frame;
+		uint64_t now = monotonic_ms();
+		unsigned long airtime, us, bits_ms;
+		uint64_t start;
+		long wait;
+		int class;
+
+		if (now < queue->next_at)
+		{
+			wait_until(queue, queue->next_at);
+			continue;
+		}
+
+		refill(queue, now);
+		class = pick(queue, &wait);
+		if (class < 0)
+		{
+			if (wait < 0)
+				pthread_cond_wait(&queue->changed, &queue->lock);
+			else
+				wait_until(queue, now + wait);
+
+			continue;
+		}
+
+		bucket = queue->classes + class;
+		frame = pop(bucket);
+		queue->bytes -= frame->frame.length;
+
+		us = frame_us(queue, &frame->frame);
+		bits_ms = (us + 999) / 1000;
+		++bucket->stats.frames;
+		bucket->stats.bytes += frame->frame.length;
+
+		queue->sending = 1;
+		pthread_mutex_unlock(&queue->lock);
+		queue->io->write_frame(queue->io->tnc, &frame->frame);
+		free(frame);
+		pthread_mutex_lock(&queue->lock);
+		queue->sending = 0;
+
+		/*
+		 * A frame taken while the one before is still going out
+		 * follows it in the same transmission; only one that finds
+		 * the transmitter idle pays to key it up and down again. The
+		 * layer below may have held it a while, waiting for a clear
+		 * channel, so this is worked out once it has been taken.
+		 */
+		now = monotonic_ms();
+		if (now < queue->busy_until)
+		{
+			start = queue->busy_until;
+			airtime = bits_ms;
+		}
+		else
+		{
+			start = now + queue->air.txdelay_ms;
+			airtime = airtime_transmission_ms(&queue->air, us);
+		}
+
+		if (limited(bucket))
+			bucket->tokens -= airtime;
+
+		bucket->stats.airtime_ms += airtime;
+
+		/* the next is handed over once this one is on the air */
+		queue->next_at = start;
+		queue->busy_until = start + bits_ms;
+
+		pthread_cond_broadcast(&queue->changed);
+	}
+
+	pthread_mutex_unlock(&queue->lock);
+	return NULL;
+}
+
+/*
+ * Makes a queue sending to `io` over a channel described by `air`,
+ * with each class limited to the given percentage of the airtime.
+ */
+struct tx_queue *
+tx_queue_new(const struct ax25_io *io, const struct airtime_params *air,
+	const unsigned int *percent)
+{
+	struct tx_queue *queue;
+	pthread_condattr_t attr;
+	unsigned int i;
+
+	queue = calloc(1, sizeof (struct tx_queue));
+	if (!queue)
+		return NULL;
+
+	if (pthread_mutex_init(&queue->lock, NULL))
+		goto fail1;
+
+	if (pthread_condattr_init(&attr))
+		goto fail2;
+
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	if (pthread_cond_init(&queue->changed, &attr))
+	{
+		pthread_condattr_destroy(&attr);
+		goto fail2;
+	}
+
+	pthread_condattr_destroy(&attr);
+
+	queue->io = io;
+	queue->air = *air;
+	queue->refilled = monotonic_ms();
+
+	for (i = 0; i < TX_CLASSES; ++i)
+	{
+		struct tx_bucket *bucket = queue->classes + i;
+
+		bucket->percent = percent[i] == 0 || percent[i] > 100
+			? 100 : percent[i];
+		bucket->tokens = BURST_MS * bucket->percent / 100.0;
+	}
+
+	if (pthread_create(&queue->thread, NULL, run, queue))
+		goto fail3;
+
+	return queue;
+
+fail3:
+	pthread_cond_destroy(&queue->changed);
+fail2:
+	pthread_mutex_destroy(&queue->lock);
+fail1:
+	free(queue);
+	return NULL;
+}
+
+/* stops sending, dropping whatever is still queued */
+void
+tx_queue_free(struct tx_queue *queue)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&queue->lock);
+	queue->stop = 1;
+	pthread_cond_broadcast(&queue->changed);
+	pthread_mutex_unlock(&queue->lock);
+	pthread_join(queue->thread, NULL);
+
+	for (i = 0; i < TX_CLASSES; ++i)
+	{
+		struct tx_flow *flow = queue->classes[i].flows;
+
+		while (flow)
+		{
+			struct tx_flow *next = flow->next;
+
+			free_frames(flow->head);
+			free(flow);
+			flow = next;
+		}
+	}
+
+	pthread_cond_destroy(&queue->changed);
+	pthread_mutex_destroy(&queue->lock);
+	free(queue);
+}
+
+static struct ax25_frame *
+port_read(void *arg)
+{
+	const struct ax25_io *io = ((struct tx_port *) arg)->queue->io;
+	return io->read_frame(io->tnc);
+}
+
+static ssize_t
+port_write(void *arg, const struct ax25_frame *frame)
+{
+	struct tx_port *port = arg;
+	struct tx_frame *copy;
+
+	copy = malloc(sizeof (struct tx_frame));
+	if (!copy)
+		return -1;
+
+	copy->next = NULL;
+	copy->frame = *frame;
+
+	if (port->staged.tail)
+		port->staged.tail->next = copy;
+	else
+		port->staged.head = copy;
+
+	port->staged.tail = copy;
+	++port->staged.length;
+	port->staged.bytes += frame->length;
+	port->staged.airtime_us += frame_us(port->queue, frame);
+	return frame->length;
+}
+
+/*
+ * How long what is staged will take to send, once its turn comes, as one
+ * transmission.
+ */
+unsigned long
+tx_port_airtime_ms(const struct tx_port *port)
+{
+	return airtime_transmission_ms(&port->queue->air,
+		port->staged.airtime_us);
+}
+
+void
+tx_port_init(struct tx_port *port, struct tx_queue *queue,
+	enum tx_class class)
+{
+	memset(port, 0, sizeof *port);
+	port->queue = queue;
+	port->class = class;
+	port->io.read_frame = port_read;
+	port->io.write_frame = port_write;
+	port->io.tnc = port;
+	port->io.other_frame = queue->io->other_frame;
+	port->io.other_arg = queue->io->other_arg;
+}
+
+void
+tx_port_discard(struct tx_port *port)
+{
+	free_frames(port->staged.head);
+	memset(&port->staged, 0, sizeof port->staged);
+}
+
+/*
+ * Queues the frames written to the port since the last submit, as one
+ * flow. Never blocks: if the queue is too full, the frames are dropped and
+ * EAGAIN is returned.
+ */
+int
+tx_queue_submit(struct tx_port *port)
+{
+	struct tx_queue *queue = port->queue;
+	struct tx_bucket *bucket;
+	struct tx_flow *flow;
+	enum tx_class class = port->class;
+	int rc = 0;
+
+	if (!port->staged.head)
+		return 0;
+
+	/* a long message is bulk, whoever sent it */
+	if (class == TX_INTERACTIVE
+		&& port->staged.length > TX_INTERACTIVE_MAX_FRAMES)
+		class = TX_BULK;
+
+	bucket = queue->classes + class;
+
+	pthread_mutex_lock(&queue->lock);
+
+	if (queue->bytes + port->staged.bytes > TX_QUEUE_MAX_BYTES)
+	{
+		++bucket->stats.rejected;
+		rc = EAGAIN;
+		goto end;
+	}
+
+	flow = malloc(sizeof (struct tx_flow));
+	if (!flow)
+	{
+		rc = ENOMEM;
+		goto end;
+	}
+
+	*flow = port->staged;
+	flow->next = NULL;
+
+	if (bucket->last)
+		bucket->last->next = flow;
+	else
+		bucket->flows = flow;
+
+	bucket->last = flow;
+	queue->bytes += flow->bytes;
+	memset(&port->staged, 0, sizeof port->staged);
+
+	pthread_cond_broadcast(&queue->changed);
+
+end:
+	pthread_mutex_unlock(&queue->lock);
+	if (rc)
+		tx_port_discard(port);
+
+	return rc;
+}
+
+/* waits until no more than `bytes` are left waiting to be sent */
+void
+tx_queue_wait(struct tx_queue *queue, size_t bytes)
+{
+	pthread_mutex_lock(&queue->lock);
+
+	while (queue->bytes > bytes)
+		pthread_cond_wait(&queue->changed, &queue->lock);
+
+	pthread_mutex_unlock(&queue->lock);
+}
+
+/* waits until everything queued has been handed to the TNC */
+void
+tx_queue_drain(struct tx_queue *queue)
+{
+	pthread_mutex_lock(&queue->lock);
+
+	while (queue->bytes > 0 || queue->sending)
+		pthread_cond_wait(&queue->changed, &queue->lock);
+
+	pthread_mutex_unlock(&queue->lock);
+}
+
+void
+tx_queue_print_stats(struct tx_queue *queue, FILE *f)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&queue->lock);
+
+	for (i = 0; i < TX_CLASSES; ++i)
+	{
+		const struct tx_bucket *bucket = queue->classes + i;
+		unsigned int queued = 0;
+		const struct tx_flow *flow;
+
+		for (flow = bucket->flows; flow; flow = flow->next)
+			queued += flow->length;
+
+		fprintf(f, "Sent %s: %lu frames, %lu bytes, %lu.%lus on air"
+			" (%u queued, %lu rejected)\n",
+			CLASS_NAMES[i], bucket->stats.frames,
+			bucket->stats.bytes, bucket->stats.airtime_ms / 1000,
+			(bucket->stats.airtime_ms % 1000) / 100, queued,
+			bucket->stats.rejected);
+	}
+
+	pthread_mutex_unlock(&queue->lock);
+}
@@ -0,0 +1,160 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#ifndef WB_TXQUEUE_H
+#define WB_TXQUEUE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "airtime.h"
+#include "ax25.h"
+
+#define TX_QUEUE_MAX_BYTES (256 * 1024)
+#define TX_INTERACTIVE_MAX_FRAMES 2
+
+/* in order of priority */
+enum tx_class
+{
+	TX_INTERACTIVE,
+	TX_CONTROL,
+	TX_BULK,
+	TX_BEACON,
+	TX_CLASSES
+};
+
+struct tx_frame
+{
+	struct tx_frame *next;
+	struct ax25_frame frame;
+};
+
+/* the frames of one message, sent in order */
+struct tx_flow
+{
+	struct tx_frame *head, *tail;
+	unsigned int length;
+	size_t bytes;
+	unsigned long airtime_us; /* of its frames alone */
+	struct tx_flow *next;
+};
+
+/*
+ * A way into the queue for one thread. Frames written to its io are held
+ * until tx_queue_submit hands them over together as one flow, so a message
+ * is queued whole or not at all.
+ */
+struct tx_port
+{
+	struct ax25_io io;
+	struct tx_queue *queue;
+	enum tx_class class;
+	struct tx_flow staged;
+};
+
+struct tx_class_stats
+{
+	unsigned long frames;
+	unsigned long bytes;
+	unsigned long airtime_ms;
+	unsigned long rejected;
+};
+
+struct tx_bucket
+{
+	unsigned int percent; /* of the channel's airtime */
+	double tokens; /* milliseconds of airtime we may still use */
+	struct tx_flow *flows, *last; /* served round robin */
+	struct tx_class_stats stats;
+};
+
+/*
+ * Frames waiting to go on the air. The highest priority class with frames
+ * and airtime left goes first, and the flows within a class take turns a
+ * frame at a time, so a short message is not stuck behind a long one.
+ * Each class may use only its share of the airtime, so that bulk traffic
+ * leaves room for other stations. Frames are handed to the TNC no faster
+ * than they can be sent, so that the choice of what goes next is made
+ * here rather than in the TNC's buffer; each is handed over as the one
+ * before goes on the air, so that frames sent back to back share one
+ * transmission.
+ */
+struct tx_queue
+{
+	pthread_mutex_t lock;
+	pthread_cond_t changed;
+	pthread_t thread;
+	int stop;
+
+	const struct ax25_io *io;
+	struct airtime_params air;
+	struct tx_bucket classes[TX_CLASSES];
+	size_t bytes;
+	uint64_t refilled;
+	uint64_t next_at; /* when the TNC may take another frame */
+	uint64_t busy_until; /* when it will have sent what it has */
+	int sending;
+};
+
+struct tx_queue *
+tx_queue_new(const struct ax25_io *io, const struct airtime_params *air,
+	const unsigned int *percent);
+
+void
+tx_queue_free(struct tx_queue *queue);
+
+void
+tx_port_init(struct tx_port *port, struct tx_queue *queue,
+	enum tx_class class);
+
+int
+tx_queue_submit(struct tx_port *port);
+
+void
+tx_port_discard(struct tx_port *port);
+
+void
+tx_queue_wait(struct tx_queue *queue, size_t bytes);
+
+void
+tx_queue_drain(struct tx_queue *queue);
+
+unsigned long
+tx_port_airtime_ms(const struct tx_port *port);
+
+const char *
+tx_class_name(enum tx_class class);
+
+void
+tx_queue_print_stats(struct tx_queue *queue, FILE *f);
+
+#endif
@@ -32,6 +32,7 @@
 #ifndef WB_UTIL_H
 #define WB_UTIL_H
 
+#include <stdint.h>
 #include <sys/stat.h>
 
 #define UNUSED(...) (void)(__VA_ARGS__)
@@ -39,4 +40,7 @@
 int
 mkdir_recursive(const char *path, mode_t mode);
 
+uint64_t
+monotonic_ms(void);
+
 #endif
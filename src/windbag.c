@@ -29,14 +29,23 @@
  *  THE USE OF OR OTHER DEALINGS IN THE WORK.
  */
 
+#include <errno.h>
 #include <sodium.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
 #include <time.h>
 
+#include "budget.h"
+#include "callsign.h"
+#include "compress.h"
 #include "endian.h"
+#include "fec.h"
 #include "keyring.h"
+#include "keywatch.h"
+#include "linkq.h"
+#include "repair.h"
+#include "sigcache.h"
 #include "windbag.h"
 
 const uint8_t MAGIC_NUMBER[2] = { 0xA4, 0x55 };
@@ -50,9 +59,29 @@ const uint8_t MAGIC_NUMBER[2] = { 0xA4, 0x55 };
 #define SIG_INDEX (SIGLENGTH_INDEX + 1)
 #define TIMESTAMP_INDEX (-4)
 #define MULTIPART_INDEX (TIMESTAMP_INDEX - 2)
+#define WIDE_MULTIPART_INDEX (TIMESTAMP_INDEX - 8)
+#define PARITY_INDEX (MULTIPART_INDEX - 2)
 
 #define FLAG_MULTIPART 0x01
 #define FLAG_SIGNED 0x02
+#define FLAG_KEY_ID 0x04
+#define FLAG_DEFERRED 0x08
+#define FLAG_COMPRESSED 0x10
+#define FLAG_PARITY 0x20
+#define FLAG_CONTROL 0x40
+#define FLAG_WIDE 0x80
+
+/*
+ * flags a signature covers: those saying how to read the content; the rest
+ * only describe fields of this packet, and parity packets sharing a deferred
+ * signature set different ones
+ */
+#define SIGNED_FLAGS (FLAG_MULTIPART | FLAG_DEFERRED | FLAG_COMPRESSED \
+			| FLAG_CONTROL | FLAG_WIDE)
+
+#define WIDE_HEADER_MIN (4 + 8 + 4)
+
+#define KEY_ID_LENGTH 4
 
 int
 windbag_packet_init(struct windbag_packet *packet)
@@ -68,12 +97,326 @@ windbag_packet_cleanup(struct windbag_packet *packet)
 	bigbuffer_free(packet->payload);
 }
 
+struct verification
+{
+	struct windbag_packet *dest;
+	struct keyring *keyring;
+	struct sig_cache *cache;
+	struct budget *budget;
+	struct budget_slot *slot;
+	const unsigned char *sig;
+	const unsigned char *msg;
+	unsigned long long mlen;
+	int throttled;
+};
+
+static int
+verify_with(struct verification *v, const struct identity *identity)
+{
+	if (v->throttled)
+		return 0;
+
+	if (v->budget && !budget_spend(v->budget, v->slot))
+	{
+		v->throttled = 1;
+		return 0;
+	}
+
+	return crypto_sign_verify_detached(v->sig, v->msg, v->mlen,
+					identity->pubkey) == 0;
+}
+
+static enum windbag_signature_status
+alternate(struct verification *v, const struct identity *identity)
+{
+	strcpy(v->dest->verified_callsign, identity->callsign);
+	if (v->cache)
+		sig_cache_set_identity(v->cache, v->dest->header.src_addr,
+				identity->callsign);
+
+	return ALTERNATE_SIGNATURE;
+}
+
+static enum windbag_signature_status
+verify_hinted(struct verification *v, uint32_t fingerprint)
+{
+	const char *source = v->dest->header.src_addr;
+	struct identity *identity = NULL;
+
+	while ((identity = keyring_next_fingerprint(v->keyring, fingerprint,
+							identity)))
+	{
+		if (!verify_with(v, identity))
+			continue;
+
+		if (strcmp(identity->callsign, source) == 0)
+			return GOOD_SIGNATURE;
+
+		return alternate(v, identity);
+	}
+
+	identity = keyring_search(v->keyring, source);
+	if (!identity)
+		return UNKNOWN_SIGNATURE;
+
+	/* the sender's own key was already tried if it has this fingerprint */
+	if (identity->fingerprint != fingerprint && verify_with(v, identity))
+		return GOOD_SIGNATURE;
+
+	return BAD_SIGNATURE;
+}
+
+static enum windbag_signature_status
+verify_unhinted(struct verification *v)
+{
+	struct keyring *keyring = v->keyring;
+	const char *source = v->dest->header.src_addr;
+	struct identity *identity, *tried = NULL;
+	uint64_t packed, base;
+	unsigned int i;
+
+	identity = keyring_search(keyring, source);
+	if (identity)
+	{
+		if (verify_with(v, identity))
+			return GOOD_SIGNATURE;
+
+		return BAD_SIGNATURE;
+	}
+
+	if (v->cache)
+	{
+		char callsign[AX25_ADDR_MAX];
+
+		switch (sig_cache_lookup(v->cache, source, keyring->generation,
+						callsign))
+		{
+		case SIG_CACHE_IDENTITY:
+			tried = keyring_search(keyring, callsign);
+			if (tried && verify_with(v, tried))
+			{
+				strcpy(v->dest->verified_callsign, callsign);
+				return ALTERNATE_SIGNATURE;
+			}
+
+			/*
+			 * the sender may have switched keys, or someone else
+			 * used the source; look again, but keep what we knew
+			 */
+			break;
+
+		case SIG_CACHE_NO_MATCH:
+			return UNKNOWN_SIGNATURE;
+
+		case SIG_CACHE_MISS:
+			break;
+		}
+	}
+
+	/* most alternate signatures come from the same operator on another SSID */
+	packed = callsign_pack(source);
+	identity = NULL;
+	while ((identity = keyring_next_same_base(keyring, packed, identity)))
+	{
+		if (identity != tried && verify_with(v, identity))
+			return alternate(v, identity);
+	}
+
+	base = packed & ~(uint64_t) CALLSIGN_SSID_MASK;
+	for (i = 0, identity = keyring->keys;
+	     i < keyring->length && !v->throttled;
+	     ++i, ++identity)
+	{
+		if (identity == tried
+			|| (identity->packed & ~(uint64_t) CALLSIGN_SSID_MASK) == base)
+			continue;
+
+		if (verify_with(v, identity))
+			return alternate(v, identity);
+	}
+
+	if (v->cache && !v->throttled)
+		sig_cache_set_no_match(v->cache, source, keyring->generation);
+
+	return UNKNOWN_SIGNATURE;
+}
+
+static enum windbag_signature_status
+verify_signature(struct windbag_packet *dest,
+		const struct windbag_config *config, const uint8_t *key_id,
+		const unsigned char *sig, const unsigned char *msg,
+		unsigned long long mlen)
+{
+	struct verification v;
+	enum windbag_signature_status status;
+
+	/* the keyring may be replaced meanwhile, but not freed */
+	v.keyring = keywatch_current(&config->keyring);
+	if (!v.keyring)
+		return UNKNOWN_SIGNATURE;
+
+	v.dest = dest;
+	v.cache = config->sig_cache;
+	v.budget = config->budget;
+	v.slot = NULL;
+	v.sig = sig;
+	v.msg = msg;
+	v.mlen = mlen;
+	v.throttled = 0;
+
+	if (v.budget)
+		v.slot = budget_claim(v.budget, dest->header.src_addr);
+
+	if (key_id && key_id[0] == KEY_ID_LENGTH)
+		status = verify_hinted(&v,
+				le32toh(*((uint32_t *) &key_id[1])));
+	else
+		status = verify_unhinted(&v);
+
+	if (v.throttled)
+		status = THROTTLED_SIGNATURE;
+
+	if (v.slot)
+		budget_settle(v.budget, v.slot, status == GOOD_SIGNATURE
+				|| status == ALTERNATE_SIGNATURE);
+
+	return status;
+}
+
+/*
+ * Finds the signature and key ID fields, which must both end before the
+ * fixed fields at `end`. Their lengths come off the air, so neither field is
+ * used unless it lies wholly within the header.
+ */
+static int
+find_signature(const uint8_t *payload, unsigned int end, unsigned int flags,
+	const uint8_t **sig, const uint8_t **key_id)
+{
+	unsigned int length = SIG_INDEX + payload[SIGLENGTH_INDEX];
+
+	if (end < SIG_INDEX || length > end)
+		return -1;
+
+	*sig = payload + SIG_INDEX;
+	*key_id = NULL;
+	if (!(flags & FLAG_KEY_ID))
+		return 0;
+
+	if (length == end || length + 1 + payload[length] > end)
+		return -1;
+
+	*key_id = payload + length;
+	return 0;
+}
+
+static int
+keep_signature(struct windbag_signature *signature, const uint8_t *payload,
+	unsigned int end, unsigned int flags)
+{
+	const uint8_t *sig, *key_id;
+	unsigned int length = payload[SIGLENGTH_INDEX];
+
+	if (find_signature(payload, end, flags, &sig, &key_id))
+		return -1;
+
+	if (length > sizeof signature->data)
+		length = sizeof signature->data;
+
+	signature->length = length;
+	memcpy(signature->data, sig, length);
+
+	signature->has_key_id = key_id && key_id[0] <= WINDBAG_KEY_ID_MAX;
+	if (signature->has_key_id)
+		memcpy(signature->key_id, key_id, key_id[0] + 1);
+
+	return 0;
+}
+
+void
+windbag_verify_message(const struct windbag_config *config,
+		struct windbag_packet *message)
+{
+	const struct windbag_signature *signature = &message->signature;
+	const struct bigbuffer *payload = message->payload;
+	unsigned char *buf;
+	uint32_t timestamp = htole32(message->timestamp);
+
+	if (signature->length != MAX_SIGNATURE_LENGTH)
+	{
+		message->signature_status = BAD_SIGNATURE;
+		return;
+	}
+
+	buf = malloc(payload->length + 3 + sizeof timestamp);
+	if (!buf)
+	{
+		message->signature_status = UNKNOWN_SIGNATURE;
+		return;
+	}
+
+	/*
+	 * laid out as if signing the final part, but with the whole message;
+	 * only chat is deferred, since control packets skip reassembly
+	 */
+	buf[0] = FLAG_MULTIPART | FLAG_DEFERRED
+		| (message->compressed ? FLAG_COMPRESSED : 0);
+	buf[1] = message->multipart_final;
+	buf[2] = message->multipart_final;
+	memcpy(buf + 3, &timestamp, sizeof timestamp);
+	memcpy(buf + 3 + sizeof timestamp, payload->data, payload->length);
+
+	message->signature_status = verify_signature(message, config,
+			signature->has_key_id ? signature->key_id : NULL,
+			signature->data, buf,
+			payload->length + 3 + sizeof timestamp);
+	free(buf);
+}
+
+static int
+expand(const struct windbag_config *config, struct windbag_packet *packet)
+{
+	struct bigbuffer *expanded, *temp;
+	int rc;
+
+	expanded = bigbuffer_new(packet->payload->length * 4 + 1);
+	if (!expanded)
+		return ENOMEM;
+
+	rc = decompress_message(config->dictionary, packet->payload->data,
+				packet->payload->length, expanded);
+	if (rc)
+	{
+		bigbuffer_free(expanded);
+		return rc;
+	}
+
+	temp = packet->payload;
+	packet->payload = expanded;
+	packet->compressed = 0;
+	bigbuffer_free(temp);
+	return 0;
+}
+
+int
+windbag_finish_message(const struct windbag_config *config,
+		struct windbag_packet *message)
+{
+	/* signatures cover the message as sent, so check before expanding */
+	if (message->signature_status == DEFERRED_SIGNATURE)
+		windbag_verify_message(config, message);
+
+	if (message->compressed)
+		return expand(config, message);
+
+	return 0;
+}
+
 struct windbag_packet *
 windbag_read_packet(struct windbag_packet *dest,
 		const struct windbag_config *config, const struct ax25_io *io)
 {
 	struct ax25_packet *src;
-	unsigned int header_length, flags, content_length;
+	unsigned int header_length, flags, content_length, trailer;
 	const uint8_t *content;
 	int need_free = !dest;
 
@@ -97,84 +440,130 @@ windbag_read_packet(struct windbag_packet *dest,
 	memcpy(&dest->header, &src->header, sizeof src->header);
 
 	header_length = src->payload[HEADER_INDEX];
+	if (header_length < MIN_PAYLOAD_LENGTH
+		|| header_length > src->payload_length)
+		goto fail2;
+
 	flags = src->payload[FLAGS_INDEX];
+
+	/* the fixed fields sit at the end of the header, before the content */
+	if (flags & FLAG_PARITY)
+		trailer = -PARITY_INDEX;
+	else if (flags & FLAG_WIDE)
+		trailer = -WIDE_MULTIPART_INDEX;
+	else if (flags & FLAG_MULTIPART)
+		trailer = -MULTIPART_INDEX;
+	else
+		trailer = -TIMESTAMP_INDEX;
+
+	if (header_length < SIGLENGTH_INDEX + trailer)
+		goto fail2;
+
 	content = src->payload + header_length;
 	content_length = src->payload_length - header_length;
 	dest->timestamp = le32toh(*((uint32_t *) &content[TIMESTAMP_INDEX]));
 
-	if (flags & FLAG_MULTIPART)
+	if (flags & FLAG_WIDE)
+	{
+		/*
+		 * only file fragments have so many parts, and never parity;
+		 * they are control packets, so never reach reassembly
+		 */
+		if (!(flags & FLAG_MULTIPART) || !(flags & FLAG_CONTROL)
+			|| (flags & FLAG_PARITY)
+			|| header_length < WIDE_HEADER_MIN)
+			goto fail2;
+
+		dest->multipart_index = le32toh(
+			*((uint32_t *) &content[WIDE_MULTIPART_INDEX]));
+		dest->multipart_final = le32toh(
+			*((uint32_t *) &content[WIDE_MULTIPART_INDEX + 4]));
+	}
+	else if (flags & FLAG_MULTIPART)
 	{
 		dest->multipart_index = content[MULTIPART_INDEX];
 		dest->multipart_final = content[MULTIPART_INDEX + 1];
 	}
 	else
 	{
+		dest->multipart_index = 0;
 		dest->multipart_final = 0;
 	}
 
-	if (flags & FLAG_SIGNED)
+	dest->control = (flags & FLAG_CONTROL) != 0;
+
+	/* parity only makes sense alongside the parts it protects */
+	dest->parity_count = 0;
+	if (flags & FLAG_PARITY)
 	{
-		struct keyring *keyring = config->keyring;
-		struct identity *identity;
+		if (!dest->multipart_final)
+			goto fail2;
 
-		if (!keyring)
-		{
-			dest->signature_status = UNKNOWN_SIGNATURE;
-		}
-		else
-		{
-			unsigned char *sig = src->payload + SIG_INDEX;
-			unsigned char *msg = (unsigned char *) content + TIMESTAMP_INDEX;
-			unsigned long long mlen;
+		dest->parity_index = content[PARITY_INDEX];
+		dest->parity_count = content[PARITY_INDEX + 1];
+		if (dest->parity_index >= dest->parity_count)
+			goto fail2;
+	}
 
-			if (dest->multipart_final)
-				msg -= 2;
+	dest->signature.length = 0;
 
-			mlen = content_length + (content - msg);
-			identity = keyring_search(keyring,
-						src->header.src_addr);
-			if (identity)
-			{
-				if (crypto_sign_verify_detached(sig, msg, mlen, identity->pubkey))
-					dest->signature_status = BAD_SIGNATURE;
-				else
-					dest->signature_status = GOOD_SIGNATURE;
-			}
-			else
-			{
-				unsigned int i;
-
-				dest->signature_status = UNKNOWN_SIGNATURE;
-
-				for(i = 0, identity = keyring->keys;
-				    i < keyring->length;
-				    ++i, ++identity)
-				{
-					int rc = crypto_sign_verify_detached(
-						sig, msg, mlen,
-						identity->pubkey);
-					if (rc == 0)
-					{
-						dest->signature_status = ALTERNATE_SIGNATURE;
-						strcpy(dest->verified_callsign,
-							identity->callsign);
-						break;
-					}
-				}
-			}
-		}
+	if (flags & FLAG_DEFERRED)
+	{
+		/* verified once the whole message has been reassembled */
+		if ((flags & FLAG_SIGNED)
+			&& keep_signature(&dest->signature, src->payload,
+				header_length - trailer, flags))
+			goto fail2;
+
+		dest->signature_status = DEFERRED_SIGNATURE;
+	}
+	else if (flags & FLAG_SIGNED)
+	{
+		const uint8_t *msg = content + TIMESTAMP_INDEX;
+		const uint8_t *sig, *key_id;
+		unsigned char signed_data[sizeof src->payload + 1];
+		unsigned long long mlen;
+
+		if (find_signature(src->payload, header_length - trailer,
+				flags, &sig, &key_id))
+			goto fail2;
+
+		if (flags & FLAG_WIDE)
+			msg -= 8;
+		else if (dest->multipart_final)
+			msg -= 2;
+
+		if (dest->parity_count)
+			msg -= 2;
+
+		/* the covered flags come first, so relays cannot alter them */
+		mlen = content_length + (content - msg);
+		signed_data[0] = flags & SIGNED_FLAGS;
+		memcpy(signed_data + 1, msg, mlen);
+
+		/* as for a whole message, only one length of signature is valid */
+		if (src->payload[SIGLENGTH_INDEX] != MAX_SIGNATURE_LENGTH)
+			dest->signature_status = BAD_SIGNATURE;
+		else
+			dest->signature_status = verify_signature(dest, config,
+						key_id, sig, signed_data,
+						mlen + 1);
 	}
 	else
 	{
 		dest->signature_status = NO_SIGNATURE;
 	}
 
-	/* TODO check compression flag */
-
 	dest->payload->length = 0;
 	bigbuffer_append(dest->payload, content, content_length);
 	bigbuffer_terminate(dest->payload);
 
+	/* the parts of a multipart message are expanded once reassembled */
+	dest->compressed = (flags & FLAG_COMPRESSED) != 0;
+	if (dest->compressed && !dest->multipart_final
+		&& expand(config, dest))
+		goto fail2;
+
 	free(src);
 	return dest;
 
@@ -190,24 +579,39 @@ struct msg_param
 {
 	unsigned int content_length;
 	int sign;
+	int defer;
+	int compressed;
 	int multi;
-	unsigned int multi_index;
-	unsigned int multi_final;
+	int wide;
+	uint32_t multi_index;
+	uint32_t multi_final;
+	int parity;
+	unsigned int parity_index;
+	unsigned int parity_count;
 	uint32_t timestamp;
+	uint32_t key_id;
 	const uint8_t *content;
+	const struct bigbuffer *message;
 	const unsigned char *seckey;
+	int control;
+	struct repair *repair;
 };
 
 static int
-sign_message(const struct msg_param *params, unsigned char *sig,
-	unsigned long long *sig_length)
+sign_message(const struct msg_param *params, unsigned int flags,
+	const uint8_t *content, unsigned int content_length,
+	unsigned char *sig, unsigned long long *sig_length)
 {
 	unsigned char *buf, *p;
 	unsigned int bufsize;
 	int rc;
 
-	bufsize = params->content_length + sizeof params->timestamp;
+	bufsize = 1 + content_length + sizeof params->timestamp;
 	if (params->multi)
+		bufsize += params->wide ? 8 : 2;
+
+	/* a deferred signature covers the message, not this parity packet */
+	if (params->parity && !params->defer)
 		bufsize += 2;
 
 	buf = malloc(bufsize);
@@ -215,8 +619,21 @@ sign_message(const struct msg_param *params, unsigned char *sig,
 		return -1;
 
 	p = buf;
+	*(p++) = flags & SIGNED_FLAGS;
 
-	if (params->multi)
+	if (params->parity && !params->defer)
+	{
+		*(p++) = params->parity_index;
+		*(p++) = params->parity_count;
+	}
+
+	if (params->multi && params->wide)
+	{
+		*((uint32_t *) p) = htole32(params->multi_index);
+		*((uint32_t *) (p + 4)) = htole32(params->multi_final);
+		p += 8;
+	}
+	else if (params->multi)
 	{
 		*(p++) = params->multi_index;
 		*(p++) = params->multi_final;
@@ -224,7 +641,7 @@ sign_message(const struct msg_param *params, unsigned char *sig,
 
 	*((uint32_t *) p) = params->timestamp;
 	p += sizeof params->timestamp;
-	memcpy(p, params->content, params->content_length);
+	memcpy(p, content, content_length);
 
 	rc = crypto_sign_detached(sig, sig_length, buf, bufsize,
 				params->seckey);
@@ -240,27 +657,70 @@ write_message(const struct ax25_io *io, struct ax25_packet *packet,
 	unsigned long long sig_length = 0;
 	unsigned int header_length, flags = 0;
 	uint8_t *payload = packet->payload;
+	ssize_t written;
 
 	header_length = 4;
 
+	if (params->defer)
+		flags |= FLAG_DEFERRED;
+
+	if (params->compressed)
+		flags |= FLAG_COMPRESSED;
+
+	if (params->control)
+		flags |= FLAG_CONTROL;
+
+	if (params->multi)
+		flags |= FLAG_MULTIPART;
+
+	if (params->multi && params->wide)
+		flags |= FLAG_WIDE;
+
 	if (params->sign)
 	{
 		int rc;
 
 		flags |= FLAG_SIGNED;
 
-		rc = sign_message(params, sig, &sig_length);
+		if (params->defer)
+			rc = sign_message(params, flags,
+					params->message->data,
+					params->message->length, sig,
+					&sig_length);
+		else
+			rc = sign_message(params, flags, params->content,
+					params->content_length, sig,
+					&sig_length);
 		if (rc < 0)
 			return rc;
 
 		payload[SIGLENGTH_INDEX] = sig_length;
 		memcpy(payload + SIG_INDEX, sig, sig_length);
 		header_length += sig_length + 1;
+
+		flags |= FLAG_KEY_ID;
+		payload[header_length++] = KEY_ID_LENGTH;
+		*((uint32_t *) &payload[header_length]) = params->key_id;
+		header_length += KEY_ID_LENGTH;
 	}
 
-	if (params->multi)
+	if (params->parity)
+	{
+		flags |= FLAG_PARITY;
+		payload[header_length++] = params->parity_index;
+		payload[header_length++] = params->parity_count;
+	}
+
+	if (params->multi && params->wide)
+	{
+		*((uint32_t *) &payload[header_length]) =
+			htole32(params->multi_index);
+		*((uint32_t *) &payload[header_length + 4]) =
+			htole32(params->multi_final);
+		header_length += 8;
+	}
+	else if (params->multi)
 	{
-		flags |= FLAG_MULTIPART;
 		payload[header_length++] = params->multi_index;
 		payload[header_length++] = params->multi_final;
 	}
@@ -274,7 +734,173 @@ write_message(const struct ax25_io *io, struct ax25_packet *packet,
 	memcpy(payload + header_length, params->content, params->content_length);
 	packet->payload_length = header_length + params->content_length;
 
-	return ax25_write_packet(io, packet);
+	written = ax25_write_packet(io, packet);
+
+	/* kept, exactly as sent, in case a receiver asks for it again */
+	if (written >= 0 && params->repair && params->multi)
+		repair_remember(params->repair, le32toh(params->timestamp),
+			params->parity ? params->parity_index
+				: params->multi_index,
+			params->parity, packet);
+
+	return written;
+}
+
+/*
+ * Splits a message into parts of at most max_content bytes, the last of
+ * which must also fit within max_final.
+ */
+static struct bigbuffer **
+split_message(const struct bigbuffer *message, unsigned int max_content,
+	unsigned int max_final, int binary, unsigned int *n_buffers)
+{
+	struct bigbuffer **(*split)(const struct bigbuffer *, unsigned int,
+				unsigned int *);
+	struct bigbuffer **buffers, **tail, **temp;
+	unsigned int n, n_tail;
+
+	/* compressed data is split anywhere; text only between characters */
+	split = binary ? bigbuffer_chunk : bigbuffer_split;
+
+	buffers = split(message, max_content, &n);
+	if (!buffers)
+		return NULL;
+
+	if (buffers[n - 1]->length <= max_final)
+	{
+		*n_buffers = n;
+		return buffers;
+	}
+
+	tail = split(buffers[n - 1], max_final, &n_tail);
+	if (!tail)
+		goto fail;
+
+	temp = realloc(buffers, (n - 1 + n_tail) * sizeof *buffers);
+	if (!temp)
+	{
+		while (n_tail)
+			bigbuffer_free(tail[--n_tail]);
+		free(tail);
+		goto fail;
+	}
+
+	buffers = temp;
+	bigbuffer_free(buffers[n - 1]);
+	memcpy(buffers + n - 1, tail, n_tail * sizeof *tail);
+	free(tail);
+
+	*n_buffers = n - 1 + n_tail;
+	return buffers;
+
+fail:
+	while (n)
+		bigbuffer_free(buffers[--n]);
+	free(buffers);
+	return NULL;
+}
+
+/*
+ * Sends parity packets for the parts of a message, enough to survive the
+ * loss rate lately seen on the channel. Each part is padded to the longest
+ * and prefixed with its real length before encoding, so a rebuilt part can
+ * be trimmed back.
+ */
+static ssize_t
+write_parity(const struct windbag_config *config, const struct ax25_io *io,
+	struct ax25_packet *packet, struct msg_param *params,
+	struct bigbuffer **parts, unsigned int n_parts)
+{
+	uint8_t *shards[FEC_MAX_SHARDS], *parity[FEC_MAX_SHARDS];
+	unsigned int i, n_parity, length = 0;
+	ssize_t written = 0;
+
+	n_parity = fec_parity_count(config->fec_estimator, n_parts);
+	if (n_parity == 0)
+		return 0;
+
+	for (i = 0; i < n_parts; ++i)
+		if (parts[i]->length > length)
+			length = parts[i]->length;
+
+	length += 2;
+
+	shards[0] = calloc(n_parts + n_parity, length);
+	if (!shards[0])
+		return -1;
+
+	for (i = 0; i < n_parts; ++i)
+	{
+		uint16_t part_length = htole16(parts[i]->length);
+
+		shards[i] = shards[0] + i * length;
+		memcpy(shards[i], &part_length, sizeof part_length);
+		memcpy(shards[i] + 2, parts[i]->data, parts[i]->length);
+	}
+
+	for (i = 0; i < n_parity; ++i)
+		parity[i] = shards[0] + (n_parts + i) * length;
+
+	fec_encode((const uint8_t * const *) shards, n_parts, parity,
+		n_parity, length);
+
+	params->parity = 1;
+	params->parity_count = n_parity;
+	params->multi_index = params->multi_final;
+	params->content_length = length;
+	params->sign = config->sign_messages;
+
+	for (i = 0; i < n_parity; ++i)
+	{
+		ssize_t rc;
+
+		params->parity_index = i;
+		params->content = parity[i];
+
+		rc = write_message(io, packet, params);
+		if (rc < 0)
+		{
+			written = rc;
+			break;
+		}
+
+		written += rc;
+	}
+
+	params->parity = 0;
+	free(shards[0]);
+	return written;
+}
+
+/*
+ * Shrinks the parts of a multipart message when the path to its destination
+ * is lossy enough that smaller frames get more through, though never so far
+ * that the message would need too many parts to index or protect.
+ */
+static void
+adapt_fragments(const struct windbag_config *config,
+	const struct ax25_header *header, unsigned int length,
+	unsigned int *max_content, unsigned int *max_unsigned)
+{
+	unsigned int i, overhead, size, least;
+
+	overhead = AX25_ADDR_SIZE * 2 + 2 + AX25_INFO_MAX - *max_content;
+	for (i = 0; i < AX25_MAX_ADDRS - 2 && header->digi_path[i][0]; ++i)
+		overhead += AX25_ADDR_SIZE;
+
+	size = link_table_fragment_size(config->link_table, header->dest_addr,
+					*max_content, overhead);
+
+	least = (length + FEC_MAX_SHARDS / 2 - 1) / (FEC_MAX_SHARDS / 2);
+	if (size < least)
+		size = least;
+
+	if (size >= *max_content)
+		return;
+
+	/* unsigned parts may be larger by what the signature would take */
+	*max_unsigned -= *max_content - size;
+	*max_content = size;
 }
 
 ssize_t
@@ -284,14 +910,31 @@ windbag_send_message(const struct windbag_config *config,
 {
 	struct ax25_packet packet;
 	struct msg_param params;
-	unsigned int content_length, max_content;
+	struct bigbuffer *compressed = NULL;
+	unsigned int content_length, max_content, max_unsigned;
 	ssize_t written = 0;
 
+	/* sent as it is whenever compressing would not make it any smaller */
+	if (config->compress && message->length > 0)
+	{
+		const struct dictionary *dict = config->dictionary;
+
+		if (!dict)
+			dict = builtin_dictionary();
+
+		if (dict)
+			compressed = compress_message(dict, message->data,
+						message->length);
+		if (compressed)
+			message = compressed;
+	}
+
 	max_content = sizeof packet.payload - MIN_PAYLOAD_LENGTH;
+	max_unsigned = max_content;
 	content_length = message->length;
 
 	if (config->sign_messages)
-		max_content -= MAX_SIGNATURE_LENGTH + 1;
+		max_content -= MAX_SIGNATURE_LENGTH + 1 + KEY_ID_LENGTH + 1;
 
 	memcpy(&packet.header, header, sizeof packet.header);
 	memcpy(&packet.payload, MAGIC_NUMBER, sizeof MAGIC_NUMBER);
@@ -299,6 +942,15 @@ windbag_send_message(const struct windbag_config *config,
 	params.timestamp = htole32((uint32_t) time(NULL));
 	params.sign = config->sign_messages;
 	params.seckey = config->seckey;
+	params.message = message;
+	params.defer = 0;
+	params.parity = 0;
+	params.control = 0;
+	params.wide = 0;
+	params.repair = config->repair_state;
+	params.compressed = compressed != NULL;
+	if (params.sign)
+		params.key_id = htole32(keyring_fingerprint(config->pubkey));
 
 	if (content_length > max_content)
 	{
@@ -306,9 +958,36 @@ windbag_send_message(const struct windbag_config *config,
 		unsigned int part_index, final_index;
 		/* adding indices to header */
 		max_content -= 2;
+		max_unsigned -= 2;
 		params.multi = 1;
 
-		buffers = bigbuffer_split(message, max_content, &final_index);
+		/* parity packets hold a part, its length and the parity field */
+		if (config->fec)
+		{
+			max_content -= 2 + 2;
+			max_unsigned = max_content;
+		}
+
+		if (config->adapt_fragments && config->link_table
+			&& (config->fec || config->repair))
+			adapt_fragments(config, header, message->length,
+				&max_content, &max_unsigned);
+
+		/* only the final part carries a signature, over the whole message */
+		if (config->sign_messages && config->defer_signatures)
+		{
+			params.defer = 1;
+			buffers = split_message(message, max_unsigned,
+						max_content, params.compressed,
+						&final_index);
+		}
+		else
+		{
+			buffers = split_message(message, max_content,
+						max_content, params.compressed,
+						&final_index);
+		}
+
 		if (!buffers)
 		{
 			written = -1;
@@ -325,6 +1004,8 @@ windbag_send_message(const struct windbag_config *config,
 			params.content_length = buf->length;
 			params.multi_index = part_index;
 			params.content = buf->data;
+			params.sign = config->sign_messages
+				&& (!params.defer || part_index == final_index);
 
 			rc = write_message(io, &packet, &params);
 			if (rc < 0)
@@ -336,6 +1017,14 @@ windbag_send_message(const struct windbag_config *config,
 			written += rc;
 		}
 
+		if (written >= 0 && config->fec && config->fec_estimator)
+		{
+			ssize_t rc = write_parity(config, io, &packet, &params,
+						buffers, final_index + 1);
+
+			written = rc < 0 ? rc : written + rc;
+		}
+
 		for (part_index = 0; part_index <= final_index; ++part_index)
 			bigbuffer_free(buffers[part_index]);
 
@@ -351,5 +1040,75 @@ windbag_send_message(const struct windbag_config *config,
 	}
 
 end:
+	if (compressed)
+		bigbuffer_free(compressed);
 	return written;
 }
+
+ssize_t
+windbag_send_control(const struct ax25_io *io,
+		const struct ax25_header *header, const uint8_t *content,
+		unsigned int length)
+{
+	struct ax25_packet packet;
+	struct msg_param params;
+
+	if (length > WINDBAG_CONTROL_MAX)
+		return -1;
+
+	memcpy(&packet.header, header, sizeof packet.header);
+	memcpy(&packet.payload, MAGIC_NUMBER, sizeof MAGIC_NUMBER);
+
+	memset(&params, 0, sizeof params);
+	params.timestamp = htole32((uint32_t) time(NULL));
+	params.control = 1;
+	params.content = content;
+	params.content_length = length;
+
+	return write_message(io, &packet, &params);
+}
+
+unsigned int
+windbag_fragment_max(const struct windbag_config *config)
+{
+	unsigned int max = AX25_INFO_MAX - WIDE_HEADER_MIN;
+
+	if (config->sign_messages)
+		max -= MAX_SIGNATURE_LENGTH + 1 + KEY_ID_LENGTH + 1;
+
+	return max;
+}
+
+ssize_t
+windbag_send_fragment(const struct windbag_config *config,
+		const struct ax25_io *io, const struct ax25_header *header,
+		uint32_t timestamp, uint32_t index, uint32_t final,
+		const uint8_t *content, unsigned int length)
+{
+	struct ax25_packet packet;
+	struct msg_param params;
+
+	if (length > windbag_fragment_max(config))
+		return -1;
+
+	memcpy(&packet.header, header, sizeof packet.header);
+	memcpy(&packet.payload, MAGIC_NUMBER, sizeof MAGIC_NUMBER);
+
+	memset(&params, 0, sizeof params);
+	params.timestamp = htole32(timestamp);
+	params.control = 1;
+	params.multi = 1;
+	params.wide = 1;
+	params.multi_index = index;
+	params.multi_final = final;
+	params.content = content;
+	params.content_length = length;
+
+	/* each fragment is signed alone, so it can be written out at once */
+	params.sign = config->sign_messages;
+	params.seckey = config->seckey;
+	if (params.sign)
+		params.key_id = htole32(keyring_fingerprint(config->pubkey));
+
+	return write_message(io, &packet, &params);
+}
@@ -38,13 +38,33 @@
 #include "config.h"
 #include "bigbuffer.h"
 
+#define WINDBAG_KEY_ID_MAX 8
+
 enum windbag_signature_status
 {
 	NO_SIGNATURE,
 	GOOD_SIGNATURE,
 	UNKNOWN_SIGNATURE,
 	BAD_SIGNATURE,
-	ALTERNATE_SIGNATURE
+	ALTERNATE_SIGNATURE,
+	THROTTLED_SIGNATURE,
+	DEFERRED_SIGNATURE
+};
+
+#define WINDBAG_SIGNATURE_MAX 64
+
+/* the first content octet of a control packet says what it is */
+#define WINDBAG_CONTROL_NACK 'N'
+#define WINDBAG_CONTROL_FILE 'F'
+#define WINDBAG_CONTROL_MAX (AX25_INFO_MAX - 8)
+
+/* a signature covering a whole multipart message, carried by its final part */
+struct windbag_signature
+{
+	unsigned int length;
+	uint8_t data[WINDBAG_SIGNATURE_MAX];
+	int has_key_id;
+	uint8_t key_id[1 + WINDBAG_KEY_ID_MAX];
 };
 
 struct windbag_packet
@@ -56,6 +76,11 @@ struct windbag_packet
 	struct bigbuffer *payload;
 	enum windbag_signature_status signature_status;
 	char verified_callsign[AX25_ADDR_MAX];
+	struct windbag_signature signature;
+	int compressed;
+	unsigned int parity_index;
+	unsigned int parity_count; /* 0 unless this is a parity packet */
+	int control;
 };
 
 int
@@ -68,9 +93,31 @@ struct windbag_packet *
 windbag_read_packet(struct windbag_packet *dest,
 		const struct windbag_config *config, const struct ax25_io *io);
 
+void
+windbag_verify_message(const struct windbag_config *config,
+		struct windbag_packet *message);
+
+int
+windbag_finish_message(const struct windbag_config *config,
+		struct windbag_packet *message);
+
 ssize_t
 windbag_send_message(const struct windbag_config *config,
 		const struct ax25_io *io, const struct ax25_header *header,
 		const struct bigbuffer *message);
 
+ssize_t
+windbag_send_control(const struct ax25_io *io,
+		const struct ax25_header *header, const uint8_t *content,
+		unsigned int length);
+
+unsigned int
+windbag_fragment_max(const struct windbag_config *config);
+
+ssize_t
+windbag_send_fragment(const struct windbag_config *config,
+		const struct ax25_io *io, const struct ax25_header *header,
+		uint32_t timestamp, uint32_t index, uint32_t final,
+		const uint8_t *content, unsigned int length);
+
 #endif
@@ -0,0 +1,276 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ax25link.h"
+
+#define CHANNEL_FRAMES 4096
+#define DELAY_MS 300 /* from one end to the other */
+#define STEP_MS 10
+#define TIME_LIMIT_MS (4 * 3600 * 1000)
+#define CHUNK 1000
+#define TOTAL 20000
+
+/* a frame on its way to the other end */
+struct flight
+{
+	uint64_t arrives;
+	int to;
+	struct ax25_frame frame;
+};
+
+struct end
+{
+	int id;
+	struct ax25_io io;
+	struct ax25_link *link;
+	uint8_t received[TOTAL];
+	size_t length;
+	int overflowed;
+};
+
+static struct flight channel[CHANNEL_FRAMES];
+static unsigned int in_flight;
+static struct end ends[2];
+static uint64_t now;
+static unsigned int loss; /* in percent */
+static int old_station; /* the far end refuses SABME, as v2.0 did */
+static uint32_t seed = 1;
+
+/* the same losses every run */
+static unsigned int
+next_random(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7FFF;
+}
+
+static ssize_t
+write_frame(void *tnc, const struct ax25_frame *frame)
+{
+	struct end *end = tnc;
+	struct flight *flight;
+
+	if (next_random() % 100 < loss)
+		return frame->length;
+
+	if (in_flight == CHANNEL_FRAMES)
+	{
+		fprintf(stderr, "channel overflowed\n");
+		exit(1);
+	}
+
+	flight = channel + in_flight++;
+	flight->arrives = now + DELAY_MS;
+	flight->to = !end->id;
+	flight->frame = *frame;
+	return frame->length;
+}
+
+static void
+on_data(void *arg, const uint8_t *data, unsigned int length)
+{
+	struct end *end = arg;
+
+	if (end->length + length > TOTAL)
+	{
+		end->overflowed = 1;
+		return;
+	}
+
+	memcpy(end->received + end->length, data, length);
+	end->length += length;
+}
+
+/* answers a SABME with DM, as a station that knows only modulo 8 would */
+static int
+refuse(const struct flight *flight)
+{
+	struct ax25_frame dm;
+	struct ax25_header header;
+	int addr_len;
+
+	addr_len = ax25_decode_addresses(&flight->frame, &header, NULL);
+	if (addr_len < 0 || (flight->frame.data[addr_len] & ~0x10) != 0x6F)
+		return 0;
+
+	strcpy(header.dest_addr, ends[0].link->header.src_addr);
+	strcpy(header.src_addr, ends[0].link->header.dest_addr);
+	dm.length = ax25_encode_addresses(&header, dm.data, AX25_RESPONSE);
+	dm.data[dm.length++] = 0x1F;
+
+	write_frame(&ends[1], &dm);
+	return 1;
+}
+
+/* hands over each frame that has arrived, in the order they were sent */
+static void
+deliver(void)
+{
+	unsigned int i = 0;
+
+	while (i < in_flight)
+	{
+		struct flight flight = channel[i];
+
+		if (flight.arrives > now)
+		{
+			++i;
+			continue;
+		}
+
+		memmove(channel + i, channel + i + 1,
+			(in_flight - i - 1) * sizeof channel[0]);
+		--in_flight;
+
+		if (old_station && flight.to == 1 && refuse(&flight))
+			continue;
+
+		ax25_link_receive(ends[flight.to].link, &flight.frame, now);
+	}
+}
+
+static int
+run(int extended, unsigned int percent)
+{
+	static uint8_t data[TOTAL];
+	struct ax25_link_params params;
+	struct ax25_header header;
+	size_t sent = 0;
+	unsigned int i;
+	int hung_up = 0, ok;
+
+	for (i = 0; i < TOTAL; ++i)
+		data[i] = next_random();
+
+	ax25_link_defaults(&params, extended);
+	params.t1_ms = 3000;
+	params.t2_ms = 200;
+
+	now = 1000;
+	in_flight = 0;
+	loss = 0;
+
+	for (i = 0; i < 2; ++i)
+	{
+		memset(&header, 0, sizeof header);
+		strcpy(header.src_addr, i ? "N0BBB" : "N0AAA-3");
+		strcpy(header.dest_addr, i ? "N0AAA-3" : "N0BBB");
+
+		ends[i].id = i;
+		ends[i].io.write_frame = write_frame;
+		ends[i].io.tnc = &ends[i];
+		ends[i].length = 0;
+		ends[i].overflowed = 0;
+		ends[i].link = ax25_link_new(&ends[i].io, &header, &params);
+		if (!ends[i].link)
+			return 0;
+
+		ends[i].link->on_data = on_data;
+		ends[i].link->arg = &ends[i];
+	}
+
+	ax25_link_listen(ends[1].link, 1);
+	ax25_link_connect(ends[0].link, now);
+	loss = percent;
+
+	for (; now < TIME_LIMIT_MS; now += STEP_MS)
+	{
+		deliver();
+		ax25_link_tick(ends[0].link, now);
+		ax25_link_tick(ends[1].link, now);
+
+		while (sent < TOTAL
+			&& ax25_link_get_state(ends[0].link)
+				>= AX25_LINK_CONNECTED)
+		{
+			size_t n = TOTAL - sent < CHUNK ? TOTAL - sent : CHUNK;
+
+			if (ax25_link_send(ends[0].link, data + sent, n, now))
+				break;
+
+			sent += n;
+		}
+
+		if (!hung_up && sent == TOTAL
+			&& ax25_link_unacked(ends[0].link) == 0)
+		{
+			ax25_link_disconnect(ends[0].link, now);
+			hung_up = 1;
+		}
+
+		if (ax25_link_get_state(ends[0].link)
+			== AX25_LINK_DISCONNECTED)
+			break;
+	}
+
+	ok = hung_up && !ends[1].overflowed && ends[1].length == TOTAL
+		&& memcmp(ends[1].received, data, TOTAL) == 0
+		&& ax25_link_get_state(ends[1].link)
+			== AX25_LINK_DISCONNECTED
+		&& (old_station ? ends[0].link->modulus == 8
+			: ends[0].link->modulus == (extended ? 128u : 8u));
+
+	printf("modulo %u, %u%% loss: %s, %zu of %d bytes in %llu s, "
+		"%lu sent, %lu resent\n", ends[0].link->modulus, percent,
+		ok ? "ok" : "FAILED", ends[1].length, TOTAL,
+		(unsigned long long) now / 1000,
+		ends[0].link->stats.frames_sent,
+		ends[0].link->stats.frames_resent);
+
+	for (i = 0; i < 2; ++i)
+		ax25_link_free(ends[i].link);
+
+	return ok;
+}
+
+int
+main(void)
+{
+	static const unsigned int losses[] = { 0, 5, 20 };
+	unsigned int i;
+	int failed = 0;
+
+	for (i = 0; i < sizeof losses / sizeof losses[0]; ++i)
+	{
+		failed |= !run(0, losses[i]);
+		failed |= !run(1, losses[i]);
+	}
+
+	old_station = 1;
+	failed |= !run(1, 0);
+
+	return failed;
+}
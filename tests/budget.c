@@ -0,0 +1,121 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <stdio.h>
+
+#include "budget.h"
+
+#define CAPACITY 16
+#define RATE 100 /* a burst of 200, a quarter of it kept for the trusted */
+#define SOURCE_RATE 10 /* a burst of 20 */
+
+/* spends until refused, or up to `max` */
+static unsigned int
+spend(struct budget *budget, const char *source, unsigned int max)
+{
+	struct budget_slot *slot = budget_claim(budget, source);
+	unsigned int n = 0;
+
+	while (n < max && budget_spend(budget, slot))
+		++n;
+
+	return n;
+}
+
+int
+main(void)
+{
+	struct budget *budget;
+	struct budget_slot *slot;
+	char source[16];
+	unsigned int i, n, total = 0;
+	int rc = 1;
+
+	budget = budget_new(CAPACITY, RATE, SOURCE_RATE);
+	if (!budget)
+		return 1;
+
+	/* each source has its own burst */
+	n = spend(budget, "N0GOOD", 1000);
+	if (n < SOURCE_RATE * 2 || n > SOURCE_RATE * 2 + 1)
+	{
+		fprintf(stderr, "one source spent %u\n", n);
+		goto end;
+	}
+
+	slot = budget_claim(budget, "N0GOOD");
+	budget_settle(budget, slot, 1);
+
+	/* a flood of made-up sources, none of which ever verifies */
+	for (i = 0; i < 5000; ++i)
+	{
+		sprintf(source, "X%uZ-%u", i, i % 16);
+		slot = budget_claim(budget, source);
+		total += spend(budget, source, 1);
+		budget_settle(budget, slot, 0);
+	}
+
+	slot = budget_claim(budget, "N0GOOD");
+	if (!slot->trusted)
+	{
+		fprintf(stderr, "the flood pushed out a trusted source\n");
+		goto end;
+	}
+
+	/* they got what was left of the global burst but the reserve */
+	if (total < RATE * 2 * 3 / 4 - n || total > RATE * 2 * 3 / 4 - n + 5)
+	{
+		fprintf(stderr, "the flood spent %u\n", total);
+		goto end;
+	}
+
+	/* the trusted source still has the reserve to draw on */
+	slot->bucket.tokens = SOURCE_RATE * 2;
+	if (!budget_spend(budget, slot))
+	{
+		fprintf(stderr, "the reserve was not kept\n");
+		goto end;
+	}
+
+	/* a bad signature in its name, which anyone could send */
+	budget_settle(budget, slot, 0);
+	if (!budget_claim(budget, "N0GOOD")->trusted)
+	{
+		fprintf(stderr, "a bad signature took away trust\n");
+		goto end;
+	}
+
+	rc = 0;
+
+end:
+	budget_free(budget);
+	return rc;
+}
@@ -0,0 +1,223 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fec.h"
+#include "gf256.h"
+
+#define LENGTH 258 /* a part of the widest frame and its length */
+
+static uint8_t shards[FEC_MAX_SHARDS][LENGTH];
+static uint8_t saved[FEC_MAX_SHARDS][LENGTH];
+
+static int
+check_field(void)
+{
+	unsigned int a, b;
+	uint8_t row[256], sum[256];
+
+	gf256_init();
+
+	for (a = 1; a < 256; ++a)
+	{
+		if (gf256_mul(a, gf256_inv(a)) != 1)
+		{
+			fprintf(stderr, "%u times its inverse is not 1\n", a);
+			return 1;
+		}
+	}
+
+	for (b = 0; b < 256; ++b)
+		row[b] = b;
+
+	/* mul_add agrees with mul, and adding twice takes away again */
+	for (a = 0; a < 256; ++a)
+	{
+		memset(sum, 0, sizeof sum);
+		gf256_mul_add(sum, row, a, sizeof sum);
+		for (b = 0; b < 256; ++b)
+		{
+			if (sum[b] != gf256_mul(a, b)
+				|| gf256_mul(a, b) != gf256_mul(b, a))
+			{
+				fprintf(stderr, "%u * %u is not consistent\n",
+					a, b);
+				return 1;
+			}
+		}
+
+		gf256_mul_add(sum, row, a, sizeof sum);
+		for (b = 0; b < 256; ++b)
+		{
+			if (sum[b])
+			{
+				fprintf(stderr, "%u * %u did not cancel\n",
+					a, b);
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Encodes n_data shards with n_parity, erases `lost` data shards and keeps
+ * only `lost` parity shards, chosen at random, and decodes.
+ */
+static int
+round_trip(unsigned int n_data, unsigned int n_parity, unsigned int lost)
+{
+	uint8_t *data[FEC_MAX_SHARDS], *parity[FEC_MAX_SHARDS];
+	const uint8_t *kept[FEC_MAX_SHARDS];
+	unsigned int parity_index[FEC_MAX_SHARDS], i, n;
+	int present[FEC_MAX_SHARDS];
+	int rc;
+
+	for (i = 0; i < n_data + n_parity; ++i)
+	{
+		unsigned int k;
+
+		for (k = 0; k < LENGTH; ++k)
+			shards[i][k] = rand();
+
+		if (i < n_data)
+			data[i] = shards[i];
+		else
+			parity[i - n_data] = shards[i];
+	}
+
+	memcpy(saved, shards, sizeof saved);
+	fec_encode((const uint8_t * const *) data, n_data, parity, n_parity,
+		LENGTH);
+
+	for (i = 0; i < n_data; ++i)
+		present[i] = 1;
+
+	for (n = 0; n < lost;)
+	{
+		i = rand() % n_data;
+		if (present[i])
+		{
+			present[i] = 0;
+			memset(data[i], 0xA5, LENGTH);
+			++n;
+		}
+	}
+
+	/* any of the parity shards will do, in any order */
+	for (n = 0; n < lost;)
+	{
+		unsigned int j = rand() % n_parity;
+
+		for (i = 0; i < n && parity_index[i] != j; ++i)
+			;
+
+		if (i == n)
+		{
+			parity_index[n] = j;
+			kept[n++] = parity[j];
+		}
+	}
+
+	rc = fec_decode(data, present, n_data, kept, parity_index, lost,
+		LENGTH);
+	if (rc)
+	{
+		fprintf(stderr, "%u + %u losing %u: %s\n", n_data, n_parity,
+			lost, strerror(rc));
+		return 1;
+	}
+
+	for (i = 0; i < n_data; ++i)
+	{
+		if (memcmp(data[i], saved[i], LENGTH))
+		{
+			fprintf(stderr, "%u + %u losing %u: shard %u differs\n",
+				n_data, n_parity, lost, i);
+			return 1;
+		}
+	}
+
+	/* one more loss than there is parity for cannot be made up */
+	if (lost < n_data)
+	{
+		for (i = 0; !present[i]; ++i)
+			;
+
+		present[i] = 0;
+		if (fec_decode(data, present, n_data, kept, parity_index,
+				lost, LENGTH) != EINVAL)
+		{
+			fprintf(stderr, "%u + %u losing %u: decoded too much\n",
+				n_data, n_parity, lost);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+int
+main(void)
+{
+	static const unsigned int sizes[][2] = {
+		{ 1, 1 }, { 2, 1 }, { 5, 3 }, { 16, 16 }, { 64, 8 },
+		{ 200, 16 }, { 128, 128 }, { 255, 1 }
+	};
+	unsigned int s, k, trial;
+
+	if (check_field())
+		return 1;
+
+	srand(1);
+	for (s = 0; s < sizeof sizes / sizeof sizes[0]; ++s)
+	{
+		unsigned int n_data = sizes[s][0], n_parity = sizes[s][1];
+		unsigned int losses[] = { 0, 1, n_parity / 2, n_parity };
+
+		for (k = 0; k < sizeof losses / sizeof losses[0]; ++k)
+		{
+			if (losses[k] > n_data)
+				continue;
+
+			for (trial = 0; trial < 3; ++trial)
+				if (round_trip(n_data, n_parity, losses[k]))
+					return 1;
+		}
+	}
+
+	return 0;
+}
@@ -0,0 +1,188 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "base64.h"
+#include "config.h"
+#include "keyjournal.h"
+#include "keyring.h"
+
+#define SINGLE_KEYS 200
+#define BULK_KEYS 50
+
+static char dir[] = "/tmp/windbag-keyjournal-XXXXXX";
+static char path[sizeof dir + 16];
+static char bulk[2][sizeof dir + 16];
+
+/* the same call signs under other keys, so that each import saves */
+static int
+write_bulk(unsigned int which)
+{
+	unsigned char pubkey[crypto_sign_PUBLICKEYBYTES];
+	unsigned int i;
+	FILE *f;
+
+	snprintf(bulk[which], sizeof bulk[which], "%s/bulk%u", dir, which);
+	f = fopen(bulk[which], "w");
+	if (!f)
+		return 1;
+
+	for (i = 0; i < BULK_KEYS; ++i)
+	{
+		char *encoded;
+
+		memset(pubkey, which * BULK_KEYS + i + 1, sizeof pubkey);
+		encoded = base64_encode(pubkey, sizeof pubkey);
+		if (!encoded)
+			break;
+
+		fprintf(f, "W%uBLK %s\n", i, encoded);
+		free(encoded);
+	}
+
+	return fclose(f) || i < BULK_KEYS;
+}
+
+/* import-key, run over and over beside the bulk imports */
+static int
+import_singles(void)
+{
+	unsigned char pubkey[crypto_sign_PUBLICKEYBYTES];
+	unsigned int i;
+
+	for (i = 0; i < SINGLE_KEYS; ++i)
+	{
+		char callsign[AX25_ADDR_MAX];
+
+		sprintf(callsign, "N%uONE", i);
+		memset(pubkey, i + 1, sizeof pubkey);
+		if (keyjournal_record(path, KEYJOURNAL_ADD, callsign, pubkey))
+			return 1;
+
+		usleep(500);
+	}
+
+	return 0;
+}
+
+int
+main(void)
+{
+	struct windbag_config config;
+	struct keyring *keyring = NULL;
+	unsigned int i, missing = 0, runs = 0;
+	pid_t child;
+	int status, out, rc = 1;
+
+	if (!mkdtemp(dir))
+		return 1;
+
+	snprintf(path, sizeof path, "%s/ring", dir);
+	if (write_bulk(0) || write_bulk(1))
+		goto end;
+
+	config_defaults(&config);
+	strcpy(config.keyring_path, path);
+
+	child = fork();
+	if (child < 0)
+		goto end;
+	else if (child == 0)
+		_exit(import_singles());
+
+	/* import-keys reports each run; only its errors matter here */
+	fflush(stdout);
+	out = dup(STDOUT_FILENO);
+	freopen("/dev/null", "w", stdout);
+
+	while (waitpid(child, &status, WNOHANG) == 0)
+	{
+		char *argv[] = { bulk[runs % 2] };
+
+		if (import_keys(&config, 1, argv))
+		{
+			waitpid(child, &status, 0);
+			status = -1;
+			break;
+		}
+
+		++runs;
+	}
+
+	fflush(stdout);
+	dup2(out, STDOUT_FILENO);
+	close(out);
+
+	if (status == -1 || !WIFEXITED(status) || WEXITSTATUS(status))
+	{
+		fprintf(stderr, "an import failed\n");
+		goto end;
+	}
+
+	keyring = keyring_new();
+	if (!keyring || keyring_load(keyring, path))
+		goto end;
+
+	for (i = 0; i < SINGLE_KEYS; ++i)
+	{
+		char callsign[AX25_ADDR_MAX];
+
+		sprintf(callsign, "N%uONE", i);
+		if (!keyring_search(keyring, callsign))
+			++missing;
+	}
+
+	if (missing || keyring->length != SINGLE_KEYS + BULK_KEYS)
+	{
+		fprintf(stderr, "%u of %u single imports lost over %u bulk "
+			"imports\n", missing, SINGLE_KEYS, runs);
+		goto end;
+	}
+
+	rc = 0;
+
+end:
+	if (keyring)
+		keyring_free(keyring);
+
+	unlink(bulk[0]);
+	unlink(bulk[1]);
+	unlink(path);
+	snprintf(path, sizeof path, "%s/ring.journal", dir);
+	unlink(path);
+	rmdir(dir);
+	return rc;
+}
@@ -0,0 +1,232 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "callsign.h"
+#include "endian.h"
+#include "keyring.h"
+
+#define FILE_MAX 65536
+
+static char dir[] = "/tmp/windbag-keyring-XXXXXX";
+static char path[sizeof dir + 16];
+static uint8_t file[FILE_MAX], intact[FILE_MAX];
+static size_t file_length;
+
+static uint32_t buckets, length;
+static unsigned int *slots, *base_next, *fingerprint_next;
+
+static int
+save_file(size_t n)
+{
+	FILE *f = fopen(path, "wb");
+	int rc;
+
+	if (!f)
+		return 1;
+
+	rc = fwrite(file, 1, n, f) != n;
+	return fclose(f) || rc;
+}
+
+/* whether the file as it now stands loads, and finds what it should */
+static int
+loads(void)
+{
+	struct keyring *keyring = keyring_new();
+	struct identity *key = NULL;
+	unsigned int same_base = 0;
+	int ok;
+
+	if (!keyring)
+		return 0;
+
+	ok = !keyring_load(keyring, path) && keyring_search(keyring, "K5AB");
+	while (ok && (key = keyring_next_same_base(keyring,
+				callsign_pack("K1AB-7"), key)))
+		++same_base;
+
+	keyring_free(keyring);
+	return ok && same_base == 2;
+}
+
+/* writes the keyring with one thing wrong, which must not be loaded */
+static int
+refused(const char *what, size_t n)
+{
+	int rc = 0;
+
+	if (save_file(n))
+		return 0;
+
+	if (loads())
+	{
+		fprintf(stderr, "a keyring with %s was loaded\n", what);
+		rc = 1;
+	}
+
+	memcpy(file, intact, file_length);
+	return rc;
+}
+
+static int
+build(void)
+{
+	struct keyring *keyring = keyring_new();
+	struct keyring_file_header header;
+	unsigned char pubkey[crypto_sign_PUBLICKEYBYTES];
+	unsigned int i;
+	FILE *f;
+
+	if (!keyring)
+		return 1;
+
+	/* ten base call signs, each twice */
+	for (i = 0; i < 20; ++i)
+	{
+		char callsign[16];
+
+		if (i < 10)
+			sprintf(callsign, "K%uAB", i % 10);
+		else
+			sprintf(callsign, "K%uAB-%u", i % 10, i / 10 + 2);
+
+		memset(pubkey, i + 1, sizeof pubkey);
+		if (keyring_add_pubkey(keyring, callsign, pubkey))
+			return 1;
+	}
+
+	if (keyring_save_as(keyring, path, KEYRING_INDEXED))
+		return 1;
+
+	keyring_free(keyring);
+
+	f = fopen(path, "rb");
+	if (!f)
+		return 1;
+
+	file_length = fread(file, 1, sizeof file, f);
+	fclose(f);
+	memcpy(intact, file, file_length);
+
+	memcpy(&header, file, sizeof header);
+	buckets = le32toh(header.buckets);
+	length = le32toh(header.length);
+	slots = (unsigned int *) (file + le64toh(header.slots_offset));
+	base_next = (unsigned int *) (file
+		+ le64toh(header.base_next_offset));
+	fingerprint_next = (unsigned int *) (file
+		+ le64toh(header.fingerprint_next_offset));
+
+	return length != 20;
+}
+
+int
+main(void)
+{
+	unsigned int i, j;
+	int rc = 1;
+
+	if (!mkdtemp(dir))
+		return 1;
+
+	snprintf(path, sizeof path, "%s/ring", dir);
+	if (build() || !loads())
+	{
+		fprintf(stderr, "the keyring as saved did not load\n");
+		goto end;
+	}
+
+	/* a base chain that loops back on itself */
+	for (i = 0; i < length && !base_next[i]; ++i)
+		;
+
+	base_next[base_next[i] - 1] = i + 1;
+	if (refused("a looping base chain", file_length))
+		goto end;
+
+	fingerprint_next[0] = 1;
+	if (refused("a fingerprint chain linked to itself", file_length))
+		goto end;
+
+	/* no empty slot left to end a probe */
+	for (i = 0; i < buckets * 2; ++i)
+		if (!slots[i])
+			slots[i] = 1;
+
+	if (refused("a full slot table", file_length))
+		goto end;
+
+	/* two identities in each other's slots, with an empty one between */
+	for (i = 0; !slots[i]; ++i)
+		;
+
+	for (j = i + 1; slots[j]; ++j)
+		;
+
+	while (!slots[j])
+		++j;
+
+	slots[i] ^= slots[j];
+	slots[j] ^= slots[i];
+	slots[i] ^= slots[j];
+	if (refused("swapped slots", file_length))
+		goto end;
+
+	for (i = 0; !slots[i]; ++i)
+		;
+
+	slots[i] = length + 1;
+	if (refused("a slot past the last identity", file_length))
+		goto end;
+
+	if (refused("its end cut off", file_length - 4))
+		goto end;
+
+	if (save_file(file_length) || !loads())
+	{
+		fprintf(stderr, "the keyring did not load once put back\n");
+		goto end;
+	}
+
+	rc = 0;
+
+end:
+	unlink(path);
+	snprintf(path, sizeof path, "%s/ring.journal", dir);
+	unlink(path);
+	rmdir(dir);
+	return rc;
+}
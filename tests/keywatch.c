@@ -0,0 +1,145 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "keyring.h"
+#include "keywatch.h"
+#include "util.h"
+
+#define WAIT_MS 5000
+
+static char dir[] = "/tmp/windbag-keywatch-XXXXXX";
+static char path[sizeof dir + 16];
+
+/* adds a call sign to the keyring on disk, as import-key would */
+static int
+add_key(const char *callsign)
+{
+	struct keyring *keyring = keyring_new();
+	unsigned char pubkey[crypto_sign_PUBLICKEYBYTES];
+	int rc;
+
+	if (!keyring)
+		return 1;
+
+	memset(pubkey, callsign[1], sizeof pubkey);
+	rc = keyring_load(keyring, path);
+	if ((!rc || rc == ENOENT)
+		&& !(rc = keyring_add_pubkey(keyring, callsign, pubkey)))
+		rc = keyring_save(keyring, path);
+
+	keyring_free(keyring);
+	return rc;
+}
+
+static int
+wait_for_reloads(const struct keywatch *watch, unsigned long reloads)
+{
+	uint64_t until = monotonic_ms() + WAIT_MS;
+
+	while (__atomic_load_n(&watch->reloads, __ATOMIC_ACQUIRE) < reloads)
+	{
+		if (monotonic_ms() > until)
+			return 1;
+
+		poll(NULL, 0, 10);
+	}
+
+	return 0;
+}
+
+int
+main(void)
+{
+	struct keyring *slot = NULL;
+	struct keywatch *watch = NULL;
+	struct keywatch_reader reader;
+	int rc = 1;
+
+	if (!mkdtemp(dir))
+		return 1;
+
+	snprintf(path, sizeof path, "%s/ring", dir);
+	slot = keyring_new();
+	if (!slot || add_key("N0AAA") || keyring_load(slot, path))
+		goto end;
+
+	watch = keywatch_new(&slot, path);
+	if (!watch)
+		goto end;
+
+	keywatch_register(watch, &reader);
+
+	/* the reader waits for a frame on a quiet channel */
+	keywatch_offline(&reader);
+
+	if (add_key("N0BBB") || wait_for_reloads(watch, 1))
+	{
+		fprintf(stderr, "first edit was not picked up\n");
+		goto end;
+	}
+
+	/* the second reload waits on the first grace period */
+	if (add_key("N0CCC") || wait_for_reloads(watch, 2))
+	{
+		fprintf(stderr, "reload waited for an offline reader\n");
+		goto end;
+	}
+
+	keywatch_online(&reader);
+	if (keywatch_current(&slot)->length != 3)
+	{
+		fprintf(stderr, "keyring has %u keys, not 3\n",
+			keywatch_current(&slot)->length);
+		goto end;
+	}
+
+	rc = 0;
+
+end:
+	if (watch)
+		keywatch_free(watch);
+	if (slot)
+		keyring_free(slot);
+
+	snprintf(path, sizeof path, "%s/ring", dir);
+	unlink(path);
+	snprintf(path, sizeof path, "%s/ring.journal", dir);
+	unlink(path);
+	rmdir(dir);
+	return rc;
+}
@@ -0,0 +1,180 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "reassembly.h"
+#include "windbag.h"
+
+#define MAX_BYTES (64 * 1024)
+#define MAX_SENDER_BYTES (16 * 1024)
+#define MAX_SLOTS 100
+
+static struct windbag_packet part, complete;
+
+static int
+add(struct reassembly *r, const char *source, uint32_t timestamp,
+	unsigned int index, unsigned int final, const char *data)
+{
+	strcpy(part.header.src_addr, source);
+	part.timestamp = timestamp;
+	part.multipart_index = index;
+	part.multipart_final = final;
+	part.payload->length = 0;
+	bigbuffer_append(part.payload, (const uint8_t *) data, strlen(data));
+	return reassembly_add(r, &part, &complete);
+}
+
+/* messages of many empty parts, from many senders, are not free */
+static int
+flood(struct reassembly *r)
+{
+	char source[16];
+	unsigned int s, t;
+
+	for (s = 0; s < 2000; ++s)
+	{
+		sprintf(source, "N%uA-%u", s % 10, s % 16);
+		for (t = 0; t < 50; ++t)
+		{
+			add(r, source, t, 0, 254, "");
+			if (r->bytes > MAX_BYTES || r->n_slots > MAX_SLOTS)
+			{
+				fprintf(stderr, "%zu bytes in %u slots\n",
+					r->bytes, r->n_slots);
+				return 1;
+			}
+		}
+	}
+
+	if (r->bytes < r->n_slots * sizeof (struct message_slot)
+		|| r->stats.evicted == 0)
+	{
+		fprintf(stderr, "%u slots of empty parts cost %zu bytes\n",
+			r->n_slots, r->bytes);
+		return 1;
+	}
+
+	return 0;
+}
+
+/* one sender alone is held to its own cap */
+static int
+one_sender(struct reassembly *r)
+{
+	unsigned int t;
+
+	for (t = 0; t < 1000; ++t)
+	{
+		add(r, "K1ABC", t, 0, 254, "");
+		if (r->bytes > MAX_SENDER_BYTES)
+		{
+			fprintf(stderr, "one sender holds %zu bytes\n",
+				r->bytes);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* a delivered message still costs its slot, until it expires */
+static int
+deliver(struct reassembly *r)
+{
+	size_t before = 0;
+	unsigned int i;
+
+	for (i = 0; i < 3; ++i)
+	{
+		int rc = add(r, "K1ABC", 7, i, 2, "xyz");
+
+		if (rc != (i == 2) || (i < 2 && r->bytes <= before))
+		{
+			fprintf(stderr, "part %u: rc %d, %zu bytes\n", i, rc,
+				r->bytes);
+			return 1;
+		}
+
+		before = r->bytes;
+	}
+
+	if (r->bytes != sizeof (struct message_slot) || r->n_slots != 1)
+	{
+		fprintf(stderr, "delivered slot costs %zu bytes\n", r->bytes);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+expire(struct reassembly *r)
+{
+	reassembly_expire(r, time(NULL) + REASSEMBLY_TIMEOUT + 1);
+	if (r->bytes != 0 || r->n_slots != 0)
+	{
+		fprintf(stderr, "%zu bytes in %u slots left after expiry\n",
+			r->bytes, r->n_slots);
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(void)
+{
+	struct reassembly *r;
+	int rc = 1;
+
+	r = reassembly_new(REASSEMBLY_TIMEOUT, MAX_BYTES, MAX_SENDER_BYTES,
+		MAX_SLOTS);
+	if (!r || windbag_packet_init(&part) || windbag_packet_init(&complete))
+		return 1;
+
+	memset(&part.header, 0, sizeof part.header);
+	strcpy(part.header.dest_addr, "CQ");
+
+	if (flood(r) || expire(r) || one_sender(r) || expire(r)
+		|| deliver(r) || expire(r))
+		goto end;
+
+	rc = 0;
+
+end:
+	reassembly_free(r);
+	windbag_packet_cleanup(&part);
+	windbag_packet_cleanup(&complete);
+	return rc;
+}
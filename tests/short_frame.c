@@ -0,0 +1,120 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ax25.h"
+#include "util.h"
+
+static struct ax25_frame frame;
+static unsigned int others;
+
+static struct ax25_frame *
+read_frame(void *tnc)
+{
+	UNUSED(tnc);
+	return &frame;
+}
+
+static void
+other_frame(void *arg, const struct ax25_frame *other)
+{
+	UNUSED(arg);
+	UNUSED(other);
+	++others;
+}
+
+/* the addresses, a control field, and optionally a PID and some text */
+static void
+build_frame(uint8_t control, const char *text)
+{
+	struct ax25_header header;
+
+	memset(&header, 0, sizeof header);
+	strcpy(header.dest_addr, "CQ");
+	strcpy(header.src_addr, "N0CALL");
+
+	frame.length = ax25_encode_addresses(&header, frame.data, AX25_NO_CR);
+	frame.data[frame.length++] = control;
+	if (text)
+	{
+		frame.data[frame.length++] = AX25_PID_NO_L3;
+		memcpy(frame.data + frame.length, text, strlen(text));
+		frame.length += strlen(text);
+	}
+}
+
+int
+main(void)
+{
+	struct ax25_io io = { read_frame, NULL, NULL, other_frame, NULL };
+	struct ax25_packet *packet;
+
+	/* leaves a PID behind in the buffer for the next frame to pick up */
+	build_frame(0x03, "hello");
+	packet = ax25_read_packet(&io);
+	if (!packet || packet->payload_length != 5)
+	{
+		fprintf(stderr, "normal frame was not read\n");
+		return 1;
+	}
+
+	free(packet);
+
+	/* a UI frame that ends at its control field */
+	build_frame(0x03, NULL);
+	if (frame.length != 15)
+		return 1;
+
+	packet = ax25_read_packet(&io);
+	if (packet)
+	{
+		fprintf(stderr, "UI frame without a PID was accepted, "
+			"with %u bytes\n", packet->payload_length);
+		free(packet);
+		return 1;
+	}
+
+	/* a SABM is as short, and still goes to the link layer */
+	others = 0;
+	build_frame(0x3F, NULL);
+	packet = ax25_read_packet(&io);
+	if (packet || others != 1)
+	{
+		fprintf(stderr, "SABM was not passed on\n");
+		free(packet);
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,299 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+/*
+ * Runs tnc2_init against a simulated TNC on a pseudo-terminal, in each of
+ * the states a real one may be found in, all at once.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "tnc2.h"
+#include "util.h"
+
+#define LOG_MAX 256
+#define QUIET_MS 3000 /* what the old fixed sleeps took */
+
+enum state
+{
+	COMMAND, /* at a prompt */
+	OFF, /* a Kenwood radio with its TNC switched off */
+	KISS, /* already in KISS mode, on a quiet channel */
+	KISS_BUSY, /* already in KISS mode, hearing frames */
+	STUCK, /* at a prompt, and ignoring KISS ON */
+	BANNER, /* at a prompt, and slow to restart */
+	STATES
+};
+
+struct expect
+{
+	const char *name;
+	enum state state;
+	int rc;
+	int configured; /* whether it should be told to go into KISS mode */
+	unsigned long min_ms, max_ms;
+};
+
+static const struct expect expected[STATES] = {
+	{ "command", COMMAND, 0, 1, 2000, QUIET_MS },
+	{ "off", OFF, 0, 1, 2000, QUIET_MS },
+	{ "kiss", KISS, 0, 0, 0, QUIET_MS / 2 },
+	{ "kiss busy", KISS_BUSY, 0, 0, 0, 500 },
+	{ "stuck", STUCK, EPROTO, 1, 2000, QUIET_MS },
+	{ "banner", BANNER, 0, 1, 2300, QUIET_MS }
+};
+
+struct sim
+{
+	const struct expect *expect;
+	enum state state;
+	int master;
+	char path[64];
+	char log[LOG_MAX]; /* the lines it was sent, each ended by | */
+	int done;
+	int rc;
+	unsigned long took_ms;
+};
+
+static struct sim sims[STATES];
+
+static void
+say(struct sim *sim, const char *text)
+{
+	if (write(sim->master, text, strlen(text)) < 0)
+		return;
+}
+
+/* answers a line as the TNC in its state would */
+static void
+answer(struct sim *sim, const char *line)
+{
+	strncat(sim->log, line, LOG_MAX - strlen(sim->log) - 2);
+	strcat(sim->log, "|");
+
+	switch (sim->state)
+	{
+	case COMMAND:
+	case STUCK:
+	case BANNER:
+		say(sim, line);
+		if (strcmp(line, "RESTART") != 0)
+		{
+			say(sim, "\r\ncmd:");
+		}
+		else if (sim->state == COMMAND)
+		{
+			sim->state = KISS;
+		}
+		else if (sim->state == STUCK)
+		{
+			say(sim, "\r\ncmd:");
+		}
+		else
+		{
+			/* still talking when the usual wait is up */
+			poll(NULL, 0, 1600);
+			say(sim, "TNC2 v1.1\r\n");
+			poll(NULL, 0, 200);
+			say(sim, "Checksum OK\r\n");
+			poll(NULL, 0, 200);
+			say(sim, "Memory OK\r\n");
+			poll(NULL, 0, 200);
+			say(sim, "ready\r\n");
+			sim->state = KISS;
+		}
+		break;
+
+	case OFF:
+		if (strcmp(line, "TC 1") == 0)
+		{
+			say(sim, "TC 1\r"); /* the radio answers */
+		}
+		else if (strcmp(line, "TN 2,1") == 0)
+		{
+			poll(NULL, 0, 300);
+			say(sim, "\r\nTNC2 banner\r\ncmd:");
+			sim->state = COMMAND;
+		}
+		break;
+
+	case KISS:
+		break;
+
+	case KISS_BUSY:
+		say(sim, "\xC0\x00" "abc\xC0");
+		break;
+
+	case STATES:
+		break;
+	}
+}
+
+static void *
+run_tnc(void *arg)
+{
+	struct sim *sim = arg;
+	char line[128];
+	unsigned int length = 0;
+
+	while (!__atomic_load_n(&sim->done, __ATOMIC_ACQUIRE))
+	{
+		struct pollfd pfd;
+		char c;
+
+		pfd.fd = sim->master;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, 20) <= 0)
+			continue;
+
+		/* hung up until tnc2_init opens the other end */
+		if (!(pfd.revents & POLLIN) || read(sim->master, &c, 1) != 1)
+		{
+			poll(NULL, 0, 5);
+			continue;
+		}
+
+		if (c != '\r')
+		{
+			if (length < sizeof line - 1)
+				line[length++] = c;
+
+			continue;
+		}
+
+		line[length] = '\0';
+		length = 0;
+		answer(sim, line);
+	}
+
+	return NULL;
+}
+
+static void *
+run_init(void *arg)
+{
+	struct sim *sim = arg;
+	uint64_t start = monotonic_ms();
+
+	sim->rc = tnc2_init(sim->path, B9600, "9600");
+	sim->took_ms = monotonic_ms() - start;
+	__atomic_store_n(&sim->done, 1, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+static int
+open_pty(struct sim *sim)
+{
+	const char *name;
+
+	sim->master = posix_openpt(O_RDWR | O_NOCTTY);
+	if (sim->master < 0 || grantpt(sim->master) || unlockpt(sim->master))
+		return 1;
+
+	name = ptsname(sim->master);
+	if (!name || strlen(name) >= sizeof sim->path)
+		return 1;
+
+	strcpy(sim->path, name);
+	return 0;
+}
+
+static int
+check(const struct sim *sim)
+{
+	const struct expect *expect = sim->expect;
+	int configured = strstr(sim->log, "KISS ON|RESTART|") != NULL;
+
+	if (sim->rc != expect->rc)
+	{
+		fprintf(stderr, "%s: returned %d, not %d\n", expect->name,
+			sim->rc, expect->rc);
+		return 1;
+	}
+
+	if (configured != expect->configured)
+	{
+		fprintf(stderr, "%s: %s told to go into KISS mode (%s)\n",
+			expect->name, configured ? "was" : "was not",
+			sim->log);
+		return 1;
+	}
+
+	if (sim->took_ms < expect->min_ms || sim->took_ms > expect->max_ms)
+	{
+		fprintf(stderr, "%s: took %lu ms\n", expect->name,
+			sim->took_ms);
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(void)
+{
+	pthread_t tnc[STATES], init[STATES];
+	unsigned int i;
+	int rc = 0;
+
+	for (i = 0; i < STATES; ++i)
+	{
+		sims[i].expect = expected + i;
+		sims[i].state = expected[i].state;
+		if (open_pty(sims + i))
+		{
+			perror("pty");
+			return 1;
+		}
+	}
+
+	for (i = 0; i < STATES; ++i)
+	{
+		pthread_create(&tnc[i], NULL, run_tnc, sims + i);
+		pthread_create(&init[i], NULL, run_init, sims + i);
+	}
+
+	for (i = 0; i < STATES; ++i)
+	{
+		pthread_join(init[i], NULL);
+		pthread_join(tnc[i], NULL);
+		rc |= check(sims + i);
+	}
+
+	return rc;
+}
@@ -0,0 +1,136 @@
+/*
+ *  windbag - AX.25 packet radio chat with cryptographic signature verification
+ *  Copyright (C) 2024 David McMackins II
+ *
+ *  Redistributions, modified or unmodified, in whole or in part, must retain
+ *  applicable notices of copyright or other legal privilege, these conditions,
+ *  and the following license terms and disclaimer.  Subject to these
+ *  conditions, each holder of copyright or other legal privileges, author or
+ *  assembler, and contributor of this work, henceforth "licensor", hereby
+ *  grants to any person who obtains a copy of this work in any form:
+ *
+ *  1. Permission to reproduce, modify, distribute, publish, sell, sublicense,
+ *  use, and/or otherwise deal in the licensed material without restriction.
+ *
+ *  2. A perpetual, worldwide, non-exclusive, royalty-free, gratis, irrevocable
+ *  patent license to make, have made, provide, transfer, import, use, and/or
+ *  otherwise deal in the licensed material without restriction, for any and
+ *  all patents held by such licensor and necessarily infringed by the form of
+ *  the work upon distribution of that licensor's contribution to the work
+ *  under the terms of this license.
+ *
+ *  NO WARRANTY OF ANY KIND IS IMPLIED BY, OR SHOULD BE INFERRED FROM, THIS
+ *  LICENSE OR THE ACT OF DISTRIBUTION UNDER THE TERMS OF THIS LICENSE,
+ *  INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR
+ *  A PARTICULAR PURPOSE, AND NONINFRINGEMENT.  IN NO EVENT SHALL THE AUTHORS,
+ *  ASSEMBLERS, OR HOLDERS OF COPYRIGHT OR OTHER LEGAL PRIVILEGE BE LIABLE FOR
+ *  ANY CLAIM, DAMAGES, OR OTHER LIABILITY, WHETHER IN ACTION OF CONTRACT,
+ *  TORT, OR OTHERWISE ARISING FROM, OUT OF, OR IN CONNECTION WITH THE WORK OR
+ *  THE USE OF OR OTHER DEALINGS IN THE WORK.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ax25.h"
+#include "config.h"
+#include "endian.h"
+#include "reassembly.h"
+#include "util.h"
+#include "windbag.h"
+
+#define FLAG_MULTIPART 0x01
+#define FLAG_CONTROL 0x40
+#define FLAG_WIDE 0x80
+
+static struct ax25_frame frame;
+
+static struct ax25_frame *
+read_frame(void *tnc)
+{
+	UNUSED(tnc);
+	return &frame;
+}
+
+/* a wide multipart frame claiming part 100000 of 2^32 */
+static void
+build_frame(unsigned int flags)
+{
+	struct ax25_header header;
+	uint32_t index = htole32(100000), final = htole32(0xFFFFFFFF);
+	uint32_t timestamp = htole32(1234);
+	uint8_t *payload;
+
+	memset(&header, 0, sizeof header);
+	strcpy(header.dest_addr, "CQ");
+	strcpy(header.src_addr, "N0CALL");
+
+	frame.length = ax25_encode_addresses(&header, frame.data, AX25_NO_CR);
+	frame.data[frame.length++] = 0x03;
+	frame.data[frame.length++] = AX25_PID_NO_L3;
+
+	payload = frame.data + frame.length;
+	payload[0] = 0xA4;
+	payload[1] = 0x55;
+	payload[2] = 16;
+	payload[3] = flags;
+	memcpy(payload + 4, &index, 4);
+	memcpy(payload + 8, &final, 4);
+	memcpy(payload + 12, &timestamp, 4);
+	memcpy(payload + 16, "payload", 7);
+	frame.length += 16 + 7;
+}
+
+int
+main(void)
+{
+	struct windbag_config config;
+	struct ax25_io io = { read_frame, NULL, NULL, NULL, NULL };
+	struct windbag_packet packet, complete;
+	struct reassembly *r;
+	int rc = 1;
+
+	config_defaults(&config);
+	if (windbag_packet_init(&packet) || windbag_packet_init(&complete))
+		return 1;
+
+	r = reassembly_new(REASSEMBLY_TIMEOUT, REASSEMBLY_MAX_BYTES,
+		REASSEMBLY_MAX_SENDER_BYTES, REASSEMBLY_MAX_SLOTS);
+	if (!r)
+		return 1;
+
+	/* only control packets may carry wide indices */
+	build_frame(FLAG_WIDE | FLAG_MULTIPART);
+	if (windbag_read_packet(&packet, &config, &io))
+	{
+		fprintf(stderr, "wide chat fragment was accepted\n");
+		goto end;
+	}
+
+	build_frame(FLAG_WIDE | FLAG_CONTROL | FLAG_MULTIPART);
+	if (!windbag_read_packet(&packet, &config, &io)
+		|| packet.multipart_index != 100000
+		|| packet.multipart_final != 0xFFFFFFFF)
+	{
+		fprintf(stderr, "wide control fragment was not read\n");
+		goto end;
+	}
+
+	/* and reassembly must not wrap around if one gets there anyway */
+	packet.control = 0;
+	if (reassembly_add(r, &packet, &complete) != 0
+		|| r->stats.rejected != 1 || r->n_slots != 0)
+	{
+		fprintf(stderr, "wide fragment was not rejected\n");
+		goto end;
+	}
+
+	rc = 0;
+
+end:
+	reassembly_free(r);
+	windbag_packet_cleanup(&packet);
+	windbag_packet_cleanup(&complete);
+	return rc;
+}